@@ -20,20 +20,16 @@
 
 #include <algorithm>
 #include <chrono>
-#include <fstream>
 #include <iostream>
 #include <opencv2/core/core.hpp>
-#include <sysexits.h>
 #include <boost/filesystem.hpp>
 
+#include "ImageSource.h"
 #include "System.h"
 
 namespace fs = ::boost::filesystem;
 using namespace std;
 
-void LoadImages(const string &strImagePath, const string &strPathTimes,
-                vector<string> &vstrImages, vector<double> &vTimeStamps);
-
 string FindFile(const string& baseFileName, const string& pathHint);
 
 int main(int argc, char **argv) {
@@ -46,14 +42,14 @@ int main(int argc, char **argv) {
   }
 
   // Retrieve paths to images
-  vector<string> vstrImageFilenames;
-  vector<double> vTimestamps;
+  ORB_SLAM2::ImageSequence sequence;
   std::cout << "Loading images..." << std::endl;
   string timeStampsFile = string(DEFAULT_MONO_SETTINGS_DIR) + string("EuRoC_TimeStamps/") + string(argv[3]);
-  LoadImages(string(argv[2]), timeStampsFile, vstrImageFilenames, vTimestamps);
-  std::cout << "Loaded " << vstrImageFilenames.size() << " images." << std::endl;
+  sequence.LoadEuRoC(string(argv[2]), string(), timeStampsFile);
+  std::cout << "Loaded " << sequence.size() << " images." << std::endl;
+  const vector<double> &vTimestamps = sequence.mvTimestamps;
 
-  int nImages = vstrImageFilenames.size();
+  int nImages = sequence.size();
 
   if (nImages <= 0) {
     cerr << "ERROR: Failed to load images" << endl;
@@ -87,15 +83,17 @@ int main(int argc, char **argv) {
   int main_error = 0;
   std::thread runthread([&]() { // Start in new thread
     // Main loop
-    cv::Mat im;
-    for (int ni = 0; ni < nImages; ni++) {
-      // Read image from file
-      im = cv::imread(vstrImageFilenames[ni], cv::IMREAD_UNCHANGED);
-      double tframe = vTimestamps[ni];
-
-      if (im.empty()) {
+    // Images are decoded ahead of the tracker on background threads
+    ORB_SLAM2::ImageSource source(sequence);
+    source.Start();
+    ORB_SLAM2::ImageFrame frame;
+    for (int ni = 0; ni < nImages && source.Next(frame); ni++) {
+      const cv::Mat &im = frame.im0;
+      double tframe = frame.timestamp;
+
+      if (!frame.valid) {
         cerr << endl
-             << "Failed to load image at: " << vstrImageFilenames[ni] << endl;
+             << "Failed to load image at: " << sequence.mvImage0[ni] << endl;
         main_error = 1;
         break;
       }
@@ -155,33 +153,6 @@ int main(int argc, char **argv) {
   return 0;
 }
 
-void LoadImages(const string &strImagePath, const string &strPathTimes,
-                vector<string> &vstrImages, vector<double> &vTimeStamps) {
-  // Check the file exists
-  if (fs::exists(strPathTimes) == false) {
-    cerr << "FATAL: Could not find the EuRoC Timestamp file file " << strPathTimes << endl;
-    exit(EX_DATAERR);
-  }
-
-  ifstream fTimes;
-  fTimes.open(strPathTimes.c_str());
-  vTimeStamps.reserve(5000);
-  vstrImages.reserve(5000);
-  while (!fTimes.eof()) {
-    string s;
-    getline(fTimes, s);
-    if (!s.empty()) {
-      stringstream ss;
-      ss << s;
-      vstrImages.push_back(strImagePath + "/" + ss.str() + ".png");
-      double t;
-      ss >> t;
-      vTimeStamps.push_back(t / 1e9);
-    }
-  }
-}
-
-
 string FindFile(const string& baseFileName, const string& pathHint)
 {
   fs::path baseFilePath(baseFileName);
@@ -19,21 +19,16 @@
  */
 
 #include <algorithm>
-#include <boost/filesystem.hpp>
 #include <chrono>
-#include <fstream>
-#include <iomanip>
 #include <iostream>
 
 #include <opencv2/core/core.hpp>
 
+#include "ImageSource.h"
 #include "System.h"
 
 using namespace std;
 
-void LoadImages(const string &strSequence, vector<string> &vstrImageFilenames,
-                vector<double> &vTimestamps);
-
 int main(int argc, char **argv) {
   if (argc != 3) {
     cerr << endl
@@ -42,11 +37,14 @@ int main(int argc, char **argv) {
   }
 
   // Retrieve paths to images
-  vector<string> vstrImageFilenames;
-  vector<double> vTimestamps;
-  LoadImages(string(argv[2]), vstrImageFilenames, vTimestamps);
+  ORB_SLAM2::ImageSequence sequence;
+  if (!sequence.LoadKITTI(string(argv[2]), false)) {
+    cerr << "ERROR: No images in provided path." << endl;
+    return 1;
+  }
+  const vector<double> &vTimestamps = sequence.mvTimestamps;
 
-  int nImages = vstrImageFilenames.size();
+  int nImages = sequence.size();
 
   // Settings
   string settingsFile =
@@ -74,16 +72,19 @@ int main(int argc, char **argv) {
   int main_error = 0;
   std::thread runthread([&]() { // Start in new thread
     // Main loop
-    cv::Mat im;
-    for (int ni = 0; ni < nImages; ni++) {
-      // Read image from file
-      im = cv::imread(vstrImageFilenames[ni], cv::IMREAD_UNCHANGED);
-      double tframe = vTimestamps[ni];
-
-      if (im.empty()) {
+    // Images are decoded ahead of the tracker on background threads
+    ORB_SLAM2::ImageSource source(sequence);
+    source.Start();
+    ORB_SLAM2::ImageFrame frame;
+    for (int ni = 0; ni < nImages && source.Next(frame); ni++) {
+      const cv::Mat &im = frame.im0;
+      double tframe = frame.timestamp;
+
+      if (!frame.valid) {
         cerr << endl
-             << "Failed to load image at: " << vstrImageFilenames[ni] << endl;
-        return 1;
+             << "Failed to load image at: " << sequence.mvImage0[ni] << endl;
+        main_error = 1;
+        break;
       }
 
       if (SLAM.isFinished() == true) {
@@ -140,33 +141,3 @@ int main(int argc, char **argv) {
 
   return 0;
 }
-
-void LoadImages(const string &strPathToSequence,
-                vector<string> &vstrImageFilenames,
-                vector<double> &vTimestamps) {
-  ifstream fTimes;
-  string strPathTimeFile = strPathToSequence + "/times.txt";
-  fTimes.open(strPathTimeFile.c_str());
-  while (!fTimes.eof()) {
-    string s;
-    getline(fTimes, s);
-    if (!s.empty()) {
-      stringstream ss;
-      ss << s;
-      double t;
-      ss >> t;
-      vTimestamps.push_back(t);
-    }
-  }
-
-  string strPrefixLeft = strPathToSequence + "/image_0/";
-
-  const int nTimes = vTimestamps.size();
-  vstrImageFilenames.resize(nTimes);
-
-  for (int i = 0; i < nTimes; i++) {
-    stringstream ss;
-    ss << setfill('0') << setw(6) << i;
-    vstrImageFilenames[i] = strPrefixLeft + ss.str() + ".png";
-  }
-}
@@ -19,21 +19,16 @@
  */
 
 #include <algorithm>
-#include <boost/filesystem.hpp>
 #include <chrono>
-#include <fstream>
 #include <iostream>
 
 #include <opencv2/core/core.hpp>
 
+#include "ImageSource.h"
 #include "System.h"
 
-namespace fs = ::boost::filesystem;
 using namespace ::std;
 
-void LoadImages(const string &strFile, vector<string> &vstrImageFilenames,
-                vector<double> &vTimestamps);
-
 int main(int argc, char **argv) {
   if (argc != 4) {
     cerr << endl
@@ -43,12 +38,14 @@ int main(int argc, char **argv) {
   }
 
   // Retrieve paths to images
-  vector<string> vstrImageFilenames;
-  vector<double> vTimestamps;
-  string strFile = string(argv[2]) + "/rgb.txt";
-  LoadImages(strFile, vstrImageFilenames, vTimestamps);
+  ORB_SLAM2::ImageSequence sequence;
+  if (!sequence.LoadTUM(string(argv[2]))) {
+    cerr << "ERROR: No images in provided path." << endl;
+    return 1;
+  }
+  const vector<double> &vTimestamps = sequence.mvTimestamps;
 
-  int nImages = vstrImageFilenames.size();
+  int nImages = sequence.size();
   //int nImages = 20;
 
   // Create SLAM system. It initializes all system threads and gets ready to
@@ -78,17 +75,17 @@ int main(int argc, char **argv) {
   // Main loop
   int main_error = 0;
   std::thread runthread([&]() { // Start in new thread
-    cv::Mat im;
-    for (int ni = 0; ni < nImages; ni++) {
-      // Read image from file
-      im = cv::imread(string(argv[2]) + "/" + vstrImageFilenames[ni],
-                      cv::IMREAD_UNCHANGED);
-      double tframe = vTimestamps[ni];
-
-      if (im.empty()) {
+    // Images are decoded ahead of the tracker on background threads
+    ORB_SLAM2::ImageSource source(sequence);
+    source.Start();
+    ORB_SLAM2::ImageFrame frame;
+    for (int ni = 0; ni < nImages && source.Next(frame); ni++) {
+      const cv::Mat &im = frame.im0;
+      double tframe = frame.timestamp;
+
+      if (!frame.valid) {
         cerr << endl
-             << "Failed to load image at: " << string(argv[2]) << "/"
-             << vstrImageFilenames[ni] << endl;
+             << "Failed to load image at: " << sequence.mvImage0[ni] << endl;
         main_error = 1;
         break;
       }
@@ -156,40 +153,3 @@ int main(int argc, char **argv) {
 
   return 0;
 }
-
-void LoadImages(const string &strFile, vector<string> &vstrImageFilenames,
-                vector<double> &vTimestamps) {
-  // Check the file exists
-  if (fs::exists(strFile) == false) {
-    cerr << "FATAL: Could not find the timestamp file " << strFile << endl;
-    exit(0);
-  }
-
-  ifstream f;
-  f.open(strFile.c_str());
-
-  // skip first three lines
-  string s0;
-  getline(f, s0);
-  getline(f, s0);
-  getline(f, s0);
-  if (f.good() == false) {
-    cerr << "FATAL: Error reading the header from " << strFile << endl;
-    exit(0);
-  }
-
-  while (!f.eof()) {
-    string s;
-    getline(f, s);
-    if (!s.empty()) {
-      stringstream ss;
-      ss << s;
-      double t;
-      string sRGB;
-      ss >> t;
-      vTimestamps.push_back(t);
-      ss >> sRGB;
-      vstrImageFilenames.push_back(sRGB);
-    }
-  }
-}
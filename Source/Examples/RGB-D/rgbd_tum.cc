@@ -19,23 +19,16 @@
  */
 
 #include <algorithm>
-#include <boost/filesystem.hpp>
 #include <chrono>
-#include <fstream>
 #include <iostream>
 
 #include <opencv2/core/core.hpp>
 
+#include <ImageSource.h>
 #include <System.h>
 
-namespace fs = ::boost::filesystem;
 using namespace ::std;
 
-void LoadImages(const string &strAssociationFilename,
-                vector<string> &vstrImageFilenamesRGB,
-                vector<string> &vstrImageFilenamesD,
-                vector<double> &vTimestamps);
-
 int main(int argc, char **argv) {
   if (argc != 4) {
     cerr << endl
@@ -46,23 +39,17 @@ int main(int argc, char **argv) {
   }
 
   // Retrieve paths to images
-  vector<string> vstrImageFilenamesRGB;
-  vector<string> vstrImageFilenamesD;
-  vector<double> vTimestamps;
   string settingsFile = string(DEFAULT_RGBD_SETTINGS_DIR) + string("/") + string(argv[1]);
   string strAssociationFilename = string(DEFAULT_RGBD_SETTINGS_DIR) + "/associations/" + string(argv[3]);
 
-  LoadImages(strAssociationFilename, vstrImageFilenamesRGB, vstrImageFilenamesD, vTimestamps);
-
-  // Check consistency in the number of images and depthmaps
-  int nImages = vstrImageFilenamesRGB.size();
-  if (vstrImageFilenamesRGB.empty()) {
+  ORB_SLAM2::ImageSequence sequence;
+  if (!sequence.LoadTUM(string(argv[2]), strAssociationFilename)) {
     cerr << endl << "No images found in provided path." << endl;
     return 1;
-  } else if (vstrImageFilenamesD.size() != vstrImageFilenamesRGB.size()) {
-    cerr << endl << "Different number of images for rgb and depth." << endl;
-    return 1;
   }
+  const vector<double> &vTimestamps = sequence.mvTimestamps;
+
+  int nImages = sequence.size();
 
   // Create SLAM system. It initializes all system threads and gets ready to process frames.
 
@@ -86,18 +73,18 @@ int main(int argc, char **argv) {
   // Main loop
   int main_error = 0;
   std::thread runthread([&]() { // Start in new thread
-    cv::Mat imRGB, imD;
-    for (int ni = 0; ni < nImages; ni++) {
-
-      // Read image and depthmap from file
-      imRGB = cv::imread(string(argv[2]) + "/" + vstrImageFilenamesRGB[ni], cv::IMREAD_UNCHANGED);
-      imD = cv::imread(string(argv[2]) + "/" + vstrImageFilenamesD[ni], cv::IMREAD_UNCHANGED);
-      double tframe = vTimestamps[ni];
-
-      if (imRGB.empty()) {
+    // Image and depthmap are decoded ahead of the tracker on background threads
+    ORB_SLAM2::ImageSource source(sequence);
+    source.Start();
+    ORB_SLAM2::ImageFrame frame;
+    for (int ni = 0; ni < nImages && source.Next(frame); ni++) {
+      const cv::Mat &imRGB = frame.im0;
+      const cv::Mat &imD = frame.im1;
+      double tframe = frame.timestamp;
+
+      if (!frame.valid) {
         cerr << endl
-             << "Failed to load image at: " << string(argv[2]) << "/"
-             << vstrImageFilenamesRGB[ni] << endl;
+             << "Failed to load image at: " << sequence.mvImage0[ni] << endl;
         main_error = 1;
         break;
       }
@@ -159,33 +146,3 @@ int main(int argc, char **argv) {
 
   return 0;
 }
-
-void LoadImages(const string &strAssociationFilename, vector<string> &vstrImageFilenamesRGB, vector<string> &vstrImageFilenamesD, vector<double> &vTimestamps) {
-
-  // Check the file exists
-  if (fs::exists(strAssociationFilename) == false) {
-    cerr << "FATAL: Could not find the associations file "
-         << strAssociationFilename << endl;
-    exit(0);
-  }
-
-  ifstream fAssociation;
-  fAssociation.open(strAssociationFilename.c_str());
-  while (!fAssociation.eof()) {
-    string s;
-    getline(fAssociation, s);
-    if (!s.empty()) {
-      stringstream ss;
-      ss << s;
-      double t;
-      string sRGB, sD;
-      ss >> t;
-      vTimestamps.push_back(t);
-      ss >> sRGB;
-      vstrImageFilenamesRGB.push_back(sRGB);
-      ss >> t;
-      ss >> sD;
-      vstrImageFilenamesD.push_back(sD);
-    }
-  }
-}
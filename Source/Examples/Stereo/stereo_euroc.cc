@@ -19,23 +19,16 @@
  */
 
 #include <algorithm>
-#include <boost/filesystem.hpp>
 #include <chrono>
-#include <fstream>
-#include <iomanip>
 #include <iostream>
 
 #include <opencv2/core/core.hpp>
 
+#include <ImageSource.h>
 #include <System.h>
 
-namespace fs = ::boost::filesystem;
 using namespace ::std;
 
-void LoadImages(const string &strPathLeft, const string &strPathRight,
-                const string &strPathTimes, vector<string> &vstrImageLeft,
-                vector<string> &vstrImageRight, vector<double> &vTimeStamps);
-
 int main(int argc, char **argv) {
   if (argc != 5) {
     cerr << endl
@@ -46,67 +39,26 @@ int main(int argc, char **argv) {
   }
 
   // Retrieve paths to images
-  vector<string> vstrImageLeft;
-  vector<string> vstrImageRight;
-  vector<double> vTimeStamp;
-  LoadImages(string(argv[2]), string(argv[3]), string(argv[4]), vstrImageLeft,
-             vstrImageRight, vTimeStamp);
-
-  if (vstrImageLeft.empty() || vstrImageRight.empty()) {
+  ORB_SLAM2::ImageSequence sequence;
+  if (!sequence.LoadEuRoC(string(argv[2]), string(argv[3]), string(argv[4]))) {
     cerr << "ERROR: No images in provided path." << endl;
     return 1;
   }
-
-  if (vstrImageLeft.size() != vstrImageRight.size()) {
-    cerr << "ERROR: Different number of left and right images." << endl;
-    return 1;
-  }
-
-  // Read rectification parameters
+  const vector<double> &vTimeStamp = sequence.mvTimestamps;
 
   // Settings
   string settingsFile =
       string(DEFAULT_STEREO_SETTINGS_DIR) + string("/") + string(argv[1]);
 
-  cv::FileStorage fsSettings(settingsFile, cv::FileStorage::READ);
-  if (!fsSettings.isOpened()) {
-    cerr << "ERROR: Wrong path to settings" << endl;
-    return -1;
-  }
-
-  cv::Mat K_l, K_r, P_l, P_r, R_l, R_r, D_l, D_r;
-  fsSettings["LEFT.K"] >> K_l;
-  fsSettings["RIGHT.K"] >> K_r;
-
-  fsSettings["LEFT.P"] >> P_l;
-  fsSettings["RIGHT.P"] >> P_r;
-
-  fsSettings["LEFT.R"] >> R_l;
-  fsSettings["RIGHT.R"] >> R_r;
-
-  fsSettings["LEFT.D"] >> D_l;
-  fsSettings["RIGHT.D"] >> D_r;
-
-  int rows_l = fsSettings["LEFT.height"];
-  int cols_l = fsSettings["LEFT.width"];
-  int rows_r = fsSettings["RIGHT.height"];
-  int cols_r = fsSettings["RIGHT.width"];
-
-  if (K_l.empty() || K_r.empty() || P_l.empty() || P_r.empty() || R_l.empty() ||
-      R_r.empty() || D_l.empty() || D_r.empty() || rows_l == 0 || rows_r == 0 ||
-      cols_l == 0 || cols_r == 0) {
+  // Read rectification parameters, the maps are applied on the decoder threads
+  ORB_SLAM2::ImageSource source(sequence);
+  if (!source.SetRectification(settingsFile)) {
     cerr << "ERROR: Calibration parameters to rectify stereo are missing!"
          << endl;
     return -1;
   }
 
-  cv::Mat M1l, M2l, M1r, M2r;
-  cv::initUndistortRectifyMap(K_l, D_l, R_l, P_l.rowRange(0, 3).colRange(0, 3),
-                              cv::Size(cols_l, rows_l), CV_32F, M1l, M2l);
-  cv::initUndistortRectifyMap(K_r, D_r, R_r, P_r.rowRange(0, 3).colRange(0, 3),
-                              cv::Size(cols_r, rows_r), CV_32F, M1r, M2r);
-
-  const int nImages = vstrImageLeft.size();
+  const int nImages = sequence.size();
 
   // Load both ORB and GCN vocabulary file whether or not "USE_ORB" is detected
   //const int Ntype = 1;
@@ -130,24 +82,13 @@ int main(int argc, char **argv) {
   // Main loop
   int main_error = 0;
   std::thread runthread([&]() { // Start in new thread
-    cv::Mat imLeft, imRight, imLeftRect, imRightRect;
-    for (int ni = 0; ni < nImages; ni++) {
-      // Read left and right images from file
-      imLeft = cv::imread(vstrImageLeft[ni], cv::IMREAD_UNCHANGED);
-      imRight = cv::imread(vstrImageRight[ni], cv::IMREAD_UNCHANGED);
-
-      if (imLeft.empty()) {
+    source.Start();
+    ORB_SLAM2::ImageFrame frame;
+    for (int ni = 0; ni < nImages && source.Next(frame); ni++) {
+      if (!frame.valid) {
         cerr << endl
-             << "Failed to load image at: " << string(vstrImageLeft[ni])
-             << endl;
-        main_error = 1;
-        break;
-      }
-
-      if (imRight.empty()) {
-        cerr << endl
-             << "Failed to load image at: " << string(vstrImageRight[ni])
-             << endl;
+             << "Failed to load image at: " << sequence.mvImage0[ni] << " or "
+             << sequence.mvImage1[ni] << endl;
         main_error = 1;
         break;
       }
@@ -156,9 +97,8 @@ int main(int argc, char **argv) {
         break;
       }
 
-      cv::remap(imLeft, imLeftRect, M1l, M2l, cv::INTER_LINEAR);
-      cv::remap(imRight, imRightRect, M1r, M2r, cv::INTER_LINEAR);
-
+      const cv::Mat &imLeftRect = frame.im0;
+      const cv::Mat &imRightRect = frame.im1;
       double tframe = vTimeStamp[ni];
 
       std::chrono::steady_clock::time_point t1 =
@@ -217,33 +157,3 @@ int main(int argc, char **argv) {
 
   return 0;
 }
-
-void LoadImages(const string &strPathLeft, const string &strPathRight,
-                const string &strPathTimes, vector<string> &vstrImageLeft,
-                vector<string> &vstrImageRight, vector<double> &vTimeStamps) {
-
-  // Check the file exists
-  if (fs::exists(strPathTimes) == false) {
-    cerr << "FATAL: Could not find the timestamp file " << strPathTimes << endl;
-    exit(0);
-  }
-
-  ifstream fTimes;
-  fTimes.open(strPathTimes.c_str());
-  vTimeStamps.reserve(5000);
-  vstrImageLeft.reserve(5000);
-  vstrImageRight.reserve(5000);
-  while (!fTimes.eof()) {
-    string s;
-    getline(fTimes, s);
-    if (!s.empty()) {
-      stringstream ss;
-      ss << s;
-      vstrImageLeft.push_back(strPathLeft + "/" + ss.str() + ".png");
-      vstrImageRight.push_back(strPathRight + "/" + ss.str() + ".png");
-      double t;
-      ss >> t;
-      vTimeStamps.push_back(t / 1e9);
-    }
-  }
-}
@@ -19,22 +19,16 @@
  */
 
 #include <algorithm>
-#include <boost/filesystem.hpp>
 #include <chrono>
-#include <fstream>
-#include <iomanip>
 #include <iostream>
 
 #include <opencv2/core/core.hpp>
 
+#include <ImageSource.h>
 #include <System.h>
 
-namespace fs = ::boost::filesystem;
 using namespace ::std;
 
-void LoadImages(const string &strPathToSequence, vector<string> &vstrImageLeft,
-                vector<string> &vstrImageRight, vector<double> &vTimestamps);
-
 int main(int argc, char **argv) {
   if (argc != 3) {
     cerr << endl
@@ -43,12 +37,14 @@ int main(int argc, char **argv) {
   }
 
   // Retrieve paths to images
-  vector<string> vstrImageLeft;
-  vector<string> vstrImageRight;
-  vector<double> vTimestamps;
-  LoadImages(string(argv[2]), vstrImageLeft, vstrImageRight, vTimestamps);
+  ORB_SLAM2::ImageSequence sequence;
+  if (!sequence.LoadKITTI(string(argv[2]), true)) {
+    cerr << "ERROR: No images in provided path." << endl;
+    return 1;
+  }
+  const vector<double> &vTimestamps = sequence.mvTimestamps;
 
-  const int nImages = vstrImageLeft.size();
+  const int nImages = sequence.size();
 
   // Settings
   string settingsFile =
@@ -76,18 +72,20 @@ int main(int argc, char **argv) {
   // Main loop
   int main_error = 0;
   std::thread runthread([&]() {
-    cv::Mat imLeft, imRight;
-    for (int ni = 0; ni < nImages; ni++) {
-      // Read left and right images from file
-      imLeft = cv::imread(vstrImageLeft[ni], cv::IMREAD_UNCHANGED);
-      imRight = cv::imread(vstrImageRight[ni], cv::IMREAD_UNCHANGED);
-      double tframe = vTimestamps[ni];
-
-      if (imLeft.empty()) {
+    // Images are decoded ahead of the tracker on background threads
+    ORB_SLAM2::ImageSource source(sequence);
+    source.Start();
+    ORB_SLAM2::ImageFrame frame;
+    for (int ni = 0; ni < nImages && source.Next(frame); ni++) {
+      const cv::Mat &imLeft = frame.im0;
+      const cv::Mat &imRight = frame.im1;
+      double tframe = frame.timestamp;
+
+      if (!frame.valid) {
         cerr << endl
-             << "Failed to load image at: " << string(vstrImageLeft[ni])
-             << endl;
-        return 1;
+             << "Failed to load image at: " << sequence.mvImage0[ni] << endl;
+        main_error = 1;
+        break;
       }
 
       if (SLAM.isFinished() == true) {
@@ -151,43 +149,3 @@ int main(int argc, char **argv) {
 
   return 0;
 }
-
-void LoadImages(const string &strPathToSequence, vector<string> &vstrImageLeft,
-                vector<string> &vstrImageRight, vector<double> &vTimestamps) {
-  ifstream fTimes;
-  string strPathTimeFile = strPathToSequence + "/times.txt";
-
-  // Check the file exists
-  if (fs::exists(strPathTimeFile) == false) {
-    cerr << "FATAL: Could not find the timestamp file " << strPathTimeFile
-         << endl;
-    exit(0);
-  }
-
-  fTimes.open(strPathTimeFile.c_str());
-  while (!fTimes.eof()) {
-    string s;
-    getline(fTimes, s);
-    if (!s.empty()) {
-      stringstream ss;
-      ss << s;
-      double t;
-      ss >> t;
-      vTimestamps.push_back(t);
-    }
-  }
-
-  string strPrefixLeft = strPathToSequence + "/image_0/";
-  string strPrefixRight = strPathToSequence + "/image_1/";
-
-  const int nTimes = vTimestamps.size();
-  vstrImageLeft.resize(nTimes);
-  vstrImageRight.resize(nTimes);
-
-  for (int i = 0; i < nTimes; i++) {
-    stringstream ss;
-    ss << setfill('0') << setw(6) << i;
-    vstrImageLeft[i] = strPrefixLeft + ss.str() + ".png";
-    vstrImageRight[i] = strPrefixRight + ss.str() + ".png";
-  }
-}
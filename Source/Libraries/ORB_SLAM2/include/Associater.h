@@ -13,6 +13,20 @@ namespace ORB_SLAM2 {
 
 class Associater {
 public:
+  // Projections and states of the local map points, read once per search
+  struct ProjectionQuery {
+    int Ftype = -1;
+    MapPointState state;
+    float x, y, xr, radius;
+    int level;
+  };
+
+  struct ProjectionSnapshot {
+    std::vector<ProjectionQuery> vQueries;
+    // Keypoints matched to a MapPoint with observations before the search
+    std::vector<std::vector<bool>> vvbTaken;
+  };
+
   Associater(float nnratio = 0.6, bool checkOri = true);
 
   // Computes the Hamming distance between two ORB descriptors
@@ -22,13 +36,17 @@ public:
   int SearchByProjection(Frame &CurrentFrame, const Frame &LastFrame, const float th, const bool bMono, const int Ftype);
 
   // Search matches between Frame keypoints and projected MapPoints. Returns number of matches Used to track the local map (Tracking)
-  int SearchByProjection(Frame &F, const std::vector<MapPoint*> &vpMapPoints, const float th);
+  // The points are matched in parallel on pPool. The result does not depend on the number of threads.
+  int SearchByProjection(Frame &F, const std::vector<MapPoint*> &vpMapPoints, const float th, ThreadPool *pPool = nullptr);
 
   // Project MapPoints using a Similarity Transformation and search matches. Used in loop detection (Loop Closing)
   int SearchByProjection(KeyFrame *pKF, cv::Mat Scw, const std::vector<MapPoint *> &vpPoints, std::vector<MapPoint *> &vpMatched, int th, const int Ftype);
 
   // Project MapPoints seen in KeyFrame into the Frame and search matches. Used in relocalisation (Tracking)
   int SearchByProjection(Frame &CurrentFrame, KeyFrame *pKF, const std::set<MapPoint *> &sAlreadyFound, const float th, const int ORBdist, const int Ftype);
+  // Same search with the pose and matches of a hypothesis on the keypoints of F
+  int SearchByProjection(const Frame &F, PoseHypothesis &hypothesis, KeyFrame *pKF, const std::set<MapPoint *> &sAlreadyFound,
+                         const float th, const int ORBdist, const int Ftype);
 
   int SearchByBoW(KeyFrame *pKF, Frame &F, std::vector<MapPoint *> &vpMapPointMatches, const int Ftype);
 
@@ -67,6 +85,13 @@ protected:
 
   float RadiusByViewingCos(const float &viewCos);
 
+  // The local map search in two steps. SnapshotProjection reads the MapPoints, serially, so the parallel matching
+  // only reads the snapshot and the frame.
+  void SnapshotProjection(const Frame &F, const std::vector<MapPoint*> &vpMapPoints, const float th,
+                          ProjectionSnapshot &snapshot);
+  int SearchByProjection(Frame &F, const std::vector<MapPoint*> &vpMapPoints, ProjectionSnapshot &snapshot,
+                         ThreadPool *pPool);
+
   bool CheckDistEpipolarLine(const cv::KeyPoint &kp1, const cv::KeyPoint &kp2, const cv::Mat &F12, const KeyFrame *pKF);
 
 };
@@ -0,0 +1,55 @@
+#ifndef ATLAS_H
+#define ATLAS_H
+
+#include <mutex>
+#include <vector>
+
+namespace ORB_SLAM2 {
+
+class Map;
+
+// Maps built during the session. The active map is the one Tracking,
+// LocalMapping, LoopClosing and the drawers work on; it stays the same object
+// for the whole session. Starting a new map moves the content of the active
+// map into an archived one, merging moves it back. KeyFrames of every map stay
+// in the KeyFrameDatabase, so loop detection finds matches in archived maps.
+class Atlas {
+public:
+  Atlas(Map *pActiveMap);
+  ~Atlas();
+
+  Map *GetActiveMap();
+
+  // Move the content of the active map into a new archived map, the active
+  // map is left empty. Requires the map update mutex of the active map.
+  Map *ArchiveActiveMap();
+
+  // Move the content of the active map into a discarded map, too small to be
+  // merged back. Its KeyFrames and MapPoints are never used again but stay
+  // allocated until clear, the trajectory still refers to them. Requires the
+  // map update mutex of the active map.
+  Map *DiscardActiveMap();
+
+  // Move the content of an archived map into the active map and delete it.
+  // Requires the map update mutex of the active map.
+  void MergeIntoActiveMap(Map *pMap);
+
+  std::vector<Map *> GetArchivedMaps();
+
+  // Number of maps, the active one included
+  size_t CountMaps();
+
+  // Delete the archived and discarded maps with their KeyFrames and MapPoints
+  void clear();
+
+protected:
+  Map *mpActiveMap;
+  std::vector<Map *> mvpArchivedMaps;
+  std::vector<Map *> mvpDiscardedMaps;
+
+  std::mutex mMutexAtlas;
+};
+
+} // namespace ORB_SLAM2
+
+#endif // ATLAS_H
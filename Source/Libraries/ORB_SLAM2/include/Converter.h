@@ -27,6 +27,8 @@
 #include "g2o/types/sim3/types_seven_dof_expmap.h"
 #include <Eigen/Dense>
 
+#include "SE3.h"
+
 namespace ORB_SLAM2 {
 
 class Converter {
@@ -35,6 +37,10 @@ public:
 
   static g2o::SE3Quat toSE3Quat(const cv::Mat &cvT);
   static g2o::SE3Quat toSE3Quat(const g2o::Sim3 &gSim3);
+  static g2o::SE3Quat toSE3Quat(const SE3f &T);
+
+  static SE3f toSE3f(const cv::Mat &cvT);
+  static cv::Mat toCvMat(const SE3f &T);
 
   static cv::Mat toCvMat(const g2o::SE3Quat &SE3);
   static cv::Mat toCvMat(const g2o::Sim3 &Sim3);
@@ -47,6 +53,7 @@ public:
   static Eigen::Matrix<double, 3, 1> toVector3d(const cv::Mat &cvVector);
   static Eigen::Matrix<double, 3, 1> toVector3d(const cv::Point3f &cvPoint);
   static Eigen::Matrix<double, 3, 3> toMatrix3d(const cv::Mat &cvMat3);
+  static Eigen::Vector3f toVector3f(const cv::Mat &cvVector);
 
   static std::vector<float> toQuaternion(const cv::Mat &M);
 };
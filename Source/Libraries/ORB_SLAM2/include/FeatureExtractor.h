@@ -6,6 +6,8 @@
 #include <opencv2/opencv.hpp>
 #include <vector>
 
+#include "ThreadPool.h"
+
 namespace ORB_SLAM2 {
 class FeatureExtractor {
 public:
@@ -43,9 +45,14 @@ public:
     return mvInvLevelSigma2;
   }
 
+  // Executor used for intra-image parallelism (null keeps it serial)
+  void SetThreadPool(ThreadPool *pPool) { mpThreadPool = pPool; }
+
   std::vector<cv::Mat> mvImagePyramid;
 
 protected:
+  ThreadPool *mpThreadPool = nullptr;
+
   int nfeatures;
   double scaleFactor;
   int nlevels;
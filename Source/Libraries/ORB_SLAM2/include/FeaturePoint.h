@@ -1,10 +1,15 @@
 #ifndef FEATUREPOINT_H
 #define FEATUREPOINT_H
 
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <memory>
 #include <vector>
 
 #include "DBoW2/BowVector.h"
 #include "DBoW2/FeatureVector.h"
+#include "HammingDistance.h"
 
 #include <opencv2/opencv.hpp>
 
@@ -12,36 +17,161 @@ namespace ORB_SLAM2 {
 
 class MapPoint;
 
-class FeaturePoint
+// Closest and second closest descriptor found by FeatureStore::SearchArea.
+// Distances are normalised to the 32B ORB scale.
+struct AreaMatch {
+  int bestIdx = -1;
+  int bestDist = INT_MAX;
+  int bestLevel = -1;
+  int secondDist = INT_MAX;
+  int secondLevel = -1;
+};
+
+// Keypoints, descriptors and grid of one channel. Built once with the Frame
+// and immutable afterwards, so copies of the Frame and the KeyFrame created
+// from it share one store instead of copying it.
+class FeatureStore
 {
 public:
-  
-  // Feature type
-  int type;
 
-  // Number of Keypoints
-  int N;
-
-  // Parms
+  // Keypoints as extracted and undistorted
   std::vector<cv::KeyPoint> mvKeys;
-  std::vector<cv::KeyPoint> mvKeysRight;
   std::vector<cv::KeyPoint> mvKeysUn;
 
+  // Undistorted keypoints as structure of arrays, scanned by the grid queries
+  std::vector<float> mvX;
+  std::vector<float> mvY;
+  std::vector<float> mvAngle;
+  std::vector<int> mvOctave;
+
+  // Right coordinate and depth, negative for monocular keypoints
   std::vector<float> mvuRight;
   std::vector<float> mvDepth;
-  
-  cv::Mat mDescriptors; 
+
+  // One descriptor per row
+  cv::Mat mDescriptors;
+
+  // Right image features, stereo only
+  std::vector<cv::KeyPoint> mvKeysRight;
   cv::Mat mDescriptorsRight;
 
+  // Flat grid over the undistorted image: the keypoints of cell (ix, iy) are
+  // mvGridIndices[mvGridStart[c] .. mvGridStart[c + 1]) with c = ix * mnGridRows + iy
+  int mnGridCols = 0;
+  int mnGridRows = 0;
+  float mfGridMinX = 0;
+  float mfGridMinY = 0;
+  float mfGridElementWidthInv = 0;
+  float mfGridElementHeightInv = 0;
+  std::vector<uint32_t> mvGridStart;
+  std::vector<uint32_t> mvGridIndices;
+
+  // Fill the structure of arrays from mvKeysUn
+  void BuildArrays();
+
+  // Bucket mvKeysUn into a nCols x nRows grid. Keypoints outside the grid are dropped.
+  void BuildGrid(int nCols, int nRows, float minX, float minY, float widthInv, float heightInv);
+
+  // Inclusive cell range covering the square of radius r around (x, y), false if it misses the grid
+  bool GetCellRange(float x, float y, float r, int &minCellX, int &maxCellX, int &minCellY, int &maxCellY) const;
+
+  // Keypoints inside the square of radius r around (x, y), optionally restricted to [minLevel, maxLevel]
+  std::vector<size_t> GetFeaturesInArea(float x, float y, float r, int minLevel = -1, int maxLevel = -1) const;
+
+  // Fused area query and descriptor scan of the projection searches: the
+  // keypoints of GetFeaturesInArea for which accept(idx) holds are scored
+  // against query in batches, without building the index list.
+  template <class Accept>
+  AreaMatch SearchArea(const cv::Mat &query, float x, float y, float r, int minLevel, int maxLevel,
+                       Accept accept) const;
+
+  // Store shared by all channels without features
+  static const std::shared_ptr<const FeatureStore> &Empty();
+};
+
+class FeaturePoint
+{
+public:
+
+  FeaturePoint();
+
+  // Feature type
+  int type;
+
+  // Number of Keypoints
+  int N;
+
+  // Immutable feature data
+  std::shared_ptr<const FeatureStore> mpFeatures;
+
   std::vector<MapPoint *> mvpMapPoints;
   std::vector<bool> mvbOutlier;
 
-  std::vector<std::vector<std::vector<std::size_t>>> mGrid;
-
   // Bag of Words std::vector structures.
   DBoW2::BowVector mBowVec;
   DBoW2::FeatureVector mFeatVec;
 };
-    
+
+template <class Accept>
+AreaMatch FeatureStore::SearchArea(const cv::Mat &query, float x, float y, float r, int minLevel, int maxLevel,
+                                   Accept accept) const {
+  AreaMatch match;
+
+  int nMinCellX, nMaxCellX, nMinCellY, nMaxCellY;
+  if (!GetCellRange(x, y, r, nMinCellX, nMaxCellX, nMinCellY, nMaxCellY))
+    return match;
+
+  const int maxOctave = maxLevel >= 0 ? maxLevel : INT_MAX;
+  const int nbytes = query.cols;
+  const uint8_t *pQuery = query.ptr<uint8_t>();
+
+  // Candidates are collected on the stack and scored by the SIMD kernel in batches
+  const size_t kBatch = 64;
+  size_t vBatch[kBatch];
+  int vDist[kBatch];
+  size_t n = 0;
+
+  auto score = [&]() {
+    HammingDistance::DistanceOneToMany(pQuery, mDescriptors.ptr<uint8_t>(), mDescriptors.step[0], nbytes, vBatch, n,
+                                       vDist);
+    for (size_t k = 0; k < n; k++) {
+      const int dist = HammingDistance::Normalise(vDist[k], nbytes);
+      if (dist < match.bestDist) {
+        match.secondDist = match.bestDist;
+        match.secondLevel = match.bestLevel;
+        match.bestDist = dist;
+        match.bestLevel = mvOctave[vBatch[k]];
+        match.bestIdx = vBatch[k];
+      } else if (dist < match.secondDist) {
+        match.secondDist = dist;
+        match.secondLevel = mvOctave[vBatch[k]];
+      }
+    }
+    n = 0;
+  };
+
+  for (int ix = nMinCellX; ix <= nMaxCellX; ix++) {
+    const uint32_t begin = mvGridStart[ix * mnGridRows + nMinCellY];
+    const uint32_t end = mvGridStart[ix * mnGridRows + nMaxCellY + 1];
+    for (uint32_t j = begin; j < end; j++) {
+      const uint32_t idx = mvGridIndices[j];
+      if (mvOctave[idx] < minLevel || mvOctave[idx] > maxOctave)
+        continue;
+      if (std::fabs(mvX[idx] - x) >= r || std::fabs(mvY[idx] - y) >= r)
+        continue;
+      if (!accept(idx))
+        continue;
+
+      vBatch[n++] = idx;
+      if (n == kBatch)
+        score();
+    }
+  }
+  if (n > 0)
+    score();
+
+  return match;
+}
+
 }
-#endif
\ No newline at end of file
+#endif
@@ -21,6 +21,7 @@
 #ifndef FRAME_H
 #define FRAME_H
 
+#include <memory>
 #include <vector>
 
 #include "DBoW2/BowVector.h"
@@ -30,6 +31,8 @@
 #include "KeyFrame.h"
 #include "MapPoint.h"
 #include "ORBVocabulary.h"
+#include "SE3.h"
+#include "ThreadPool.h"
 
 #include <opencv2/opencv.hpp>
 
@@ -43,6 +46,14 @@ namespace ORB_SLAM2 {
 class MapPoint;
 class KeyFrame;
 
+// Pose and matches of one channel solved apart from its frame. Relocalization
+// scores each RANSAC hypothesis on one of these instead of a copy of the frame.
+struct PoseHypothesis {
+  cv::Mat Tcw;
+  std::vector<MapPoint *> vpMapPoints;
+  std::vector<bool> vbOutlier;
+};
+
 class Frame {
 public:
 
@@ -70,7 +81,7 @@ public:
         const float &thDepth, int Ntype);
 
   // Extract features, Ftype: ORB(0), GCN(1), imageFlag: left image (0), right image (1).
-  void ExtractFeatures(const int Ftype, int imageFlag, const cv::Mat &im);
+  void ExtractFeatures(FeatureStore &features, const int Ftype, int imageFlag, const cv::Mat &im);
 
   // Compute Bag of Words representation.
   void ComputeBoW(const int Ftype);
@@ -81,8 +92,13 @@ public:
   // Computes rotation, translation and camera center matrices from the camera pose.
   void UpdatePoseMatrices();
 
+  // Returns the camera pose. The hot path reads the fixed-size copy.
+  inline const cv::Mat &GetPose() const { return mTcw; }
+  inline const SE3f &GetPosef() const { return mTcwf; }
+
   // Returns the camera center.
   inline cv::Mat GetCameraCenter() { return mOw.clone(); }
+  inline const Eigen::Vector3f &GetCameraCenterf() const { return mOwf; }
 
   // Returns inverse of rotation
   inline cv::Mat GetRotationInverse() { return mRwc.clone(); }
@@ -98,10 +114,10 @@ public:
 
   // Search a match for each keypoint in the left image to a keypoint in the right image. If there is a match, depth is computed and the right
   // coordinate associated to the left keypoint is stored.
-  void ComputeStereoMatches(const int Ftype);
+  void ComputeStereoMatches(FeatureStore &features, const int Ftype);
 
   // Associate a "right" coordinate to a keypoint if there is valid depth in the depthmap.
-  void ComputeStereoFromRGBD(const cv::Mat &imDepth, const int Ftype);
+  void ComputeStereoFromRGBD(const cv::Mat &imDepth, FeatureStore &features, const int Ftype);
   void ComputeStereoFromRGBD(const cv::Mat &imDepth, std::vector<float> &uRight, std::vector<float> &Depth, const int &refN, 
                              const std::vector<cv::KeyPoint> &Keys, const std::vector<cv::KeyPoint> &KeysUn);
 
@@ -141,16 +157,14 @@ public:
   // Threshold close/far points. Close points are inserted from 1 view. Far points are inserted as in the monocular case from 2 views.
   float mThDepth;
 
-  // Feature data used to store feature points
+  // Feature data used to store feature points. The keypoints, descriptors and
+  // grid of a channel are shared with copies of the frame and its keyframe.
   std::vector<FeaturePoint> Channels;
 
   // Keypoints are assigned to cells in a grid to reduce matching complexity when projecting MapPoints.
   static float mfGridElementWidthInv;
   static float mfGridElementHeightInv;
 
-  // Camera pose.
-  cv::Mat mTcw;
-
   // Current and Next Frame id.
   static long unsigned int nNextId;
   long unsigned int mnId;
@@ -175,28 +189,38 @@ public:
 
   static bool mbInitialComputations;
 
+  // Shared executor for per-channel feature computation (null runs serially).
+  static ThreadPool *mpThreadPool;
+
 private:
   // Undistort keypoints given OpenCV distortion parameters. Only for the RGB-D case. Stereo must be already rectified! (called in the constructor).
-  void UndistortKeyPoints(const int Ftype);
+  void UndistortKeyPoints(FeatureStore &features, const int Ftype);
   void UndistortKeyPoints(const std::vector<cv::KeyPoint> &Keys, std::vector<cv::KeyPoint> &KeysUn, const int &refN);
 
   // Computes image bounds for the undistorted image (called in the constructor).
   void ComputeImageBounds(const cv::Mat &imLeft);
 
   // Assign keypoints to the grid for speed up feature matching (called in the constructor).
-  void AssignFeaturesToGrid(const int Ftype);
-  void AssignFeaturesToGrid(const int &refN, const std::vector<cv::KeyPoint> &KeysUn, std::vector<std::vector<std::vector<std::size_t>>> &Grid);
+  void AssignFeaturesToGrid(FeatureStore &features, const int Ftype);
+
+  // Make the finished feature store the channel's and reset its matches
+  void PublishFeatures(const int Ftype, std::shared_ptr<const FeatureStore> pFeatures);
 
   // compute features and assign to grids
   void ComputeFeaturesRGBD(const int Ftype, const cv::Mat &imGray, const cv::Mat &imDepth);
   void ComputeFeaturesStereo(const int Ftype, const cv::Mat &imLeft, const cv::Mat &imRight);
   void ComputeFeaturesMono(const int Ftype, const cv::Mat &imGray); 
   
+  // Camera pose, only written by SetPose so that mTcwf stays in sync
+  cv::Mat mTcw;
+  SE3f mTcwf;
+
   // Rotation, translation and camera center
   cv::Mat mRcw;
   cv::Mat mtcw;
   cv::Mat mRwc;
   cv::Mat mOw; //==mtwc
+  Eigen::Vector3f mOwf;
 };
 
 } // namespace ORB_SLAM2
@@ -0,0 +1,45 @@
+#ifndef HAMMINGDISTANCE_H
+#define HAMMINGDISTANCE_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace ORB_SLAM2 {
+
+// Hamming distance kernels for binary descriptors.
+// The implementation is picked once at runtime from the best instruction set
+// the CPU supports (AVX-512 VPOPCNTDQ, AVX2, NEON), with a portable scalar
+// fallback. 32B rows (ORB) and 64B rows (padded AKAZE) have dedicated kernels,
+// any other width goes through the generic path.
+class HammingDistance {
+public:
+  enum Kernel { SCALAR = 0, AVX2, AVX512, NEON };
+
+  // Raw number of differing bits between two rows of nbytes
+  static int Distance(const uint8_t *a, const uint8_t *b, int nbytes);
+
+  // Distance from query to the rows vIdx[0..n) of a descriptor matrix whose
+  // rows are nbytes wide and stride bytes apart. Results are written to out.
+  static void DistanceOneToMany(const uint8_t *query, const uint8_t *data, size_t stride, int nbytes,
+                                const size_t *vIdx, size_t n, int *out);
+
+  // Distance from query to n contiguous rows of nbytes (e.g. the children of
+  // a vocabulary node). The query stays in registers across rows.
+  static void DistanceToRows(const uint8_t *query, const uint8_t *rows, int nbytes, size_t n, int *out);
+
+  // Scale a raw distance to the 32B ORB standard
+  static inline int Normalise(int dist, int nbytes) {
+    return nbytes == 32 ? dist : int(dist * 32.0f / nbytes + 0.5f);
+  }
+
+  // Kernel chosen at startup
+  static Kernel ActiveKernel();
+  static const char *KernelName();
+
+  // Force a given kernel (falls back to SCALAR if the CPU does not support it)
+  static void SetKernel(Kernel k);
+};
+
+} // namespace ORB_SLAM2
+
+#endif // HAMMINGDISTANCE_H
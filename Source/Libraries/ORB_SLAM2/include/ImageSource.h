@@ -0,0 +1,119 @@
+#ifndef IMAGESOURCE_H
+#define IMAGESOURCE_H
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+namespace ORB_SLAM2 {
+
+// Timestamps and image paths of a recorded sequence. Image 1 is the right
+// image (stereo) or the depth map (RGB-D), empty for monocular sequences.
+class ImageSequence {
+public:
+  // KITTI odometry: times.txt, image_0/ and image_1/
+  bool LoadKITTI(const std::string &strPath, bool bStereo);
+
+  // TUM RGB-D: rgb.txt for monocular, an association file for RGB-D.
+  // Image paths are relative to strPath.
+  bool LoadTUM(const std::string &strPath, const std::string &strAssociationFile = std::string());
+
+  // EuRoC MAV in the ASL layout, strPath is the mav0 folder
+  bool LoadEuRoC(const std::string &strPath, bool bStereo);
+
+  // EuRoC image folders with a separate timestamp list (one stamp in ns per
+  // line, as shipped in EuRoC_TimeStamps/). Empty strRightFolder for monocular.
+  bool LoadEuRoC(const std::string &strLeftFolder, const std::string &strRightFolder,
+                 const std::string &strTimesFile);
+
+  size_t size() const { return mvTimestamps.size(); }
+  bool empty() const { return mvTimestamps.empty(); }
+  bool HasSecondImage() const { return !mvImage1.empty(); }
+
+  // Keep only the first n frames
+  void Truncate(size_t n);
+
+  std::vector<double> mvTimestamps;
+  std::vector<std::string> mvImage0;
+  std::vector<std::string> mvImage1;
+};
+
+struct ImageFrame {
+  cv::Mat im0;
+  cv::Mat im1;
+  double timestamp = 0;
+  size_t index = 0;
+  // False if an image could not be decoded
+  bool valid = false;
+};
+
+// Decodes a sequence ahead of the consumer on a small pool of background
+// threads. Frames are handed out strictly in order through a bounded window,
+// so decode latency overlaps with tracking and memory stays capped at
+// nQueueDepth decoded frames. Colour conversion and stereo rectification,
+// when enabled, run on the decoder threads as well.
+class ImageSource {
+public:
+  ImageSource(const ImageSequence &seq, size_t nQueueDepth = 8, int nDecodeThreads = 2);
+
+  ~ImageSource();
+
+  ImageSource(const ImageSource &) = delete;
+  ImageSource &operator=(const ImageSource &) = delete;
+
+  // cv::ColorConversionCodes applied to image 0 after decoding, -1 to keep
+  // the image as stored. Must be set before Start.
+  void SetColorConversion(int code);
+
+  // Stereo rectification maps from LEFT.* / RIGHT.* in the settings file.
+  // Returns false if the calibration is missing. Must be called before Start.
+  bool SetRectification(const std::string &strSettingsFile);
+  bool IsRectifying() const { return mbRectify; }
+
+  // Start decoding frames [0, nFrames), the whole sequence if nFrames is 0
+  void Start(size_t nFrames = 0);
+
+  // Next frame in sequence order, blocks until it is decoded. Returns false
+  // once every frame was delivered or after Stop.
+  bool Next(ImageFrame &frame);
+
+  // Abort decoding and join the threads
+  void Stop();
+
+  size_t size() const { return mnFrames; }
+
+  // Decode frame i on the calling thread
+  ImageFrame Load(size_t i) const;
+
+protected:
+  void DecodeLoop();
+
+  const ImageSequence &mSeq;
+  const size_t mnDepth;
+  const int mnThreads;
+
+  int mnColorConversion;
+  bool mbRectify;
+  cv::Mat mM1l, mM2l, mM1r, mM2r;
+
+  size_t mnFrames;
+  // Next index a decoder claims and next index handed to the consumer
+  size_t mnNextDecode;
+  size_t mnNextOut;
+  std::map<size_t, ImageFrame> mmReady;
+
+  std::mutex mMutex;
+  std::condition_variable mCondReady;
+  std::condition_variable mCondSpace;
+  bool mbStop;
+  std::vector<std::thread> mvThreads;
+};
+
+} // namespace ORB_SLAM2
+
+#endif // IMAGESOURCE_H
@@ -29,7 +29,10 @@
 #include "ORBVocabulary.h"
 #include "ORBextractor.h"
 
+#include <atomic>
+#include <cstdint>
 #include <mutex>
+#include <unordered_map>
 
 namespace ORB_SLAM2 {
 
@@ -37,6 +40,7 @@ class Map;
 class MapPoint;
 class Frame;
 class KeyFrameDatabase;
+class MapStore;
 
 class KeyFrame {
 public:
@@ -51,6 +55,10 @@ public:
   cv::Mat GetRotation();
   cv::Mat GetTranslation();
 
+  // Fixed-size copies of the pose, read without allocating
+  SE3f GetPosef();
+  Eigen::Vector3f GetCameraCenterf();
+
   // Bag of Words Representation
   void ComputeBoW(const int Ftype);
 
@@ -58,6 +66,7 @@ public:
   void AddConnection(KeyFrame *pKF, const int &weight);
   void EraseConnection(KeyFrame *pKF);
   void UpdateConnectionsMultiChannels();
+  // Marks the ordered view stale, it is re-sorted on its next read
   void UpdateBestCovisibles();
   std::set<KeyFrame *> GetConnectedKeyFrames();
   std::vector<KeyFrame *> GetVectorCovisibleKeyFrames();
@@ -65,6 +74,10 @@ public:
   std::vector<KeyFrame *> GetCovisiblesByWeight(const int &w);
   int GetWeight(KeyFrame *pKF);
 
+  // Adds n to the number of MapPoints shared with pKF. Called by MapPoint as
+  // observations are added and erased, so the counts are always current.
+  void ChangeCovisibility(KeyFrame *pKF, int n);
+
   // Spanning tree functions
   void AddChild(KeyFrame *pKF);
   void EraseChild(KeyFrame *pKF);
@@ -111,6 +124,17 @@ public:
   void SetBadFlag();
   bool isBad();
 
+  // Map the keyframe belongs to, changed when maps are archived or merged
+  void SetMap(Map *pMap);
+  Map *GetMap();
+
+  // False once the MapStore evicted the features of the keyframe. Evicted
+  // features are read back by EnsureResident, the caller holds a MapStore
+  // read guard. It returns false if they could not be read back: the
+  // keyframe is dropped from the databases and must not be matched.
+  bool IsResident() const;
+  bool EnsureResident() const;
+
   // Compute Scene Depth (q=2 median). Used in monocular.
   float ComputeSceneMedianDepth(const int q, const int Ftype);
   float ComputeSceneMedianDepth(const int q);
@@ -130,6 +154,10 @@ public:
   long unsigned int mnId;
   const long unsigned int mnFrameId;
 
+  // First keyframe of its map: root of the spanning tree, never culled and
+  // fixed in bundle adjustment
+  bool mbOrigin;
+
   const double mTimeStamp;
 
   // Grid (to speed up feature matching)
@@ -146,14 +174,6 @@ public:
   long unsigned int mnBALocalForKF;
   long unsigned int mnBAFixedForKF;
 
-  // Variables used by the keyframe database
-  std::vector<long unsigned int> mnLoopQuery;
-  std::vector<int> mnLoopWords;
-  std::vector<float> mLoopScore;
-  std::vector<long unsigned int> mnRelocQuery;
-  std::vector<int> mnRelocWords;
-  std::vector<float> mRelocScore;
-
   // Variables used by loop closing
   cv::Mat mTcwGBA;
   cv::Mat mTcwBefGBA;
@@ -164,6 +184,12 @@ public:
 
   std::vector<FeaturePoint> Channels;
 
+  // Variables used by the MapStore
+  MapStore *mpMapStore;
+  std::atomic<bool> mbResident;
+  int64_t mnPageOffset;
+  uint64_t mnPageSize;
+
   // Pose relative to parent (this is computed when bad flag is activated)
   cv::Mat mTcp;
 
@@ -188,6 +214,8 @@ protected:
   cv::Mat Tcw;
   cv::Mat Twc;
   cv::Mat Ow;
+  SE3f Tcwf;
+  Eigen::Vector3f Owf;
 
   cv::Mat Cw; // Stereo middel point. Only for visualization
 
@@ -196,9 +224,13 @@ protected:
   std::vector<ORBVocabulary *> mpVocabulary;
 
   // Connected keyframe variables
-  std::map<KeyFrame *, int> mConnectedKeyFrameWeights;
+  std::unordered_map<KeyFrame *, int> mConnectedKeyFrameWeights;
   std::vector<KeyFrame *> mvpOrderedConnectedKeyFrames;
   std::vector<int> mvOrderedWeights;
+  bool mbOrderedDirty;
+
+  // MapPoints shared with every other keyframe, protected by mMutexCovisibility
+  std::unordered_map<KeyFrame *, int> mCovisibilityCounts;
 
   // Spanning Tree and Loop Edges
   bool mbFirstConnection;
@@ -218,6 +250,17 @@ protected:
   std::mutex mMutexPose;
   std::mutex mMutexConnections;
   std::mutex mMutexFeatures;
+  // Leaf lock: nothing else is locked while it is held
+  std::mutex mMutexCovisibility;
+  // Serializes reading back the evicted features
+  mutable std::mutex mMutexResidency;
+  // Set once reading them back failed, under mMutexResidency
+  mutable bool mbFeaturesLost;
+
+  // Rebuilds the ordered view if stale, the caller holds mMutexConnections
+  void SortConnections();
+
+  friend class MapSerializer;
 };
 
 } // namespace ORB_SLAM2
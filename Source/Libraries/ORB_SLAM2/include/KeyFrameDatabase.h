@@ -21,15 +21,16 @@
 #ifndef KEYFRAMEDATABASE_H
 #define KEYFRAMEDATABASE_H
 
-#include <list>
+#include <cstdint>
 #include <set>
+#include <unordered_map>
 #include <vector>
 
 #include "Frame.h"
 #include "KeyFrame.h"
 #include "ORBVocabulary.h"
 
-#include <mutex>
+#include <shared_mutex>
 
 namespace ORB_SLAM2 {
 
@@ -44,23 +45,69 @@ public:
 
   void erase(KeyFrame *pKF, const int Ftype);
 
+  // Erase a keyframe whose BoW vectors are lost with its evicted features,
+  // its postings are found by scanning the whole inverted file
+  void eraseLost(KeyFrame *pKF);
+
   void clear();
 
-  // Loop Detection
-  std::vector<KeyFrame *> DetectLoopCandidates(KeyFrame *pKF, float minScore, const int Ftype);
+  // Loop Detection. pvScores receives the similarity score of each candidate.
+  std::vector<KeyFrame *> DetectLoopCandidates(KeyFrame *pKF, float minScore, const int Ftype,
+                                               std::vector<float> *pvScores = NULL);
 
   // Relocalization
   std::vector<KeyFrame *> DetectRelocalizationCandidates(Frame *F, const int Ftype);
 
 protected:
+  // Keyframes containing a word with the weight of the word in each of them.
+  // Keyframes are referred to by their slot in mvpKeyFrames.
+  struct Postings {
+    std::vector<uint32_t> mvSlots;
+    std::vector<float> mvWeights;
+  };
+
+  // Query-local accumulators, indexed by slot: words in common with the query
+  // and similarity score. mvSlots lists the slots sharing a word in the order
+  // they were first reached and mvpKeyFrames their keyframes.
+  struct QueryScores {
+    std::vector<uint32_t> mvSlots;
+    std::vector<KeyFrame *> mvpKeyFrames;
+    std::vector<int> mvnWords;
+    std::vector<float> mvScores;
+  };
+
+  // Walk the postings of the words of BowVec under the shared lock
+  void Accumulate(const DBoW2::BowVector &BowVec, QueryScores &query) const;
+
+  // Slot of pKF, assigned on first use from the free slots. Requires the exclusive lock.
+  uint32_t GetSlot(KeyFrame *pKF);
+
+  // Drop every posting of slot from postings. Requires the exclusive lock.
+  static void ErasePostings(Postings &postings, const uint32_t slot);
+
+  // Return the slot of an erased keyframe to the free slots. Requires the exclusive lock.
+  void ReleaseSlot(std::unordered_map<KeyFrame *, uint32_t>::iterator sit);
+
   // Associated vocabulary
   const ORBVocabulary *mpVoc;
 
+  // The similarity score is accumulated from the postings (L1 scoring only)
+  bool mbScoreFromPostings;
+
   // Inverted file
-  std::vector<std::list<KeyFrame *>> mvInvertedFile;
+  std::vector<Postings> mvInvertedFile;
+
+  // Keyframe of every slot and slot of every keyframe. Erased keyframes leave
+  // a null slot in mvFreeSlots, reused by the next keyframe added, so the
+  // query accumulators stay sized to the keyframes alive.
+  std::vector<KeyFrame *> mvpKeyFrames;
+  std::unordered_map<KeyFrame *, uint32_t> mmSlots;
+  std::vector<uint32_t> mvFreeSlots;
+
+  // Queries share the lock, add and erase hold it exclusively
+  mutable std::shared_mutex mMutex;
 
-  // Mutex
-  std::mutex mMutex;
+  friend class MapSerializer;
 };
 
 } // namespace ORB_SLAM2
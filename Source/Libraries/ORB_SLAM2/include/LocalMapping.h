@@ -25,9 +25,13 @@
 #include "KeyFrameDatabase.h"
 #include "LoopClosing.h"
 #include "Map.h"
+#include "MapStore.h"
+#include "ThreadPool.h"
 #include "Tracking.h"
 
+#include <list>
 #include <mutex>
+#include <shared_mutex>
 
 namespace ORB_SLAM2 {
 
@@ -46,6 +50,10 @@ public:
 
   void SetTracker(Tracking *pTracker);
 
+  void SetThreadPool(ThreadPool *pThreadPool);
+
+  void SetMapStore(MapStore *pMapStore);
+
   // Main function
   void Run();
 
@@ -76,8 +84,21 @@ protected:
 
   void ProcessNewKeyFrameMultiChannels();
   void KeyFrameCullingMultiChannels();
-
-  void CreateNewMapPoints(const int Ftype);
+  // Valid MapPoints of a channel and how many of them are seen in at least 3
+  // other keyframes at the same or a finer scale
+  void CountRedundantObservations(KeyFrame *pKF, const int Ftype, int &nMPs, int &nRedundant);
+
+  // Point triangulated from keypoint idx1 of the current keyframe and idx2 of a neighbor
+  struct TriangulatedPoint {
+    cv::Mat x3D;
+    std::size_t idx1;
+    std::size_t idx2;
+  };
+
+  // Triangulates every channel with every neighbor in parallel, then inserts
+  // the new MapPoints serially
+  void CreateNewMapPoints();
+  void TriangulateWithNeighbor(KeyFrame *pKF2, const int Ftype, std::vector<TriangulatedPoint> &vCandidates);
   void SearchInNeighbors(const int Ftype);
 
 
@@ -105,6 +126,10 @@ protected:
   LoopClosing *mpLoopCloser;
   Tracking *mpTracker;
 
+  ThreadPool *mpThreadPool;
+
+  MapStore *mpMapStore;
+
   std::list<KeyFrame *> mlNewKeyFrames;
 
   KeyFrame *mpCurrentKeyFrame;
@@ -21,16 +21,21 @@
 #ifndef LOOPCLOSING_H
 #define LOOPCLOSING_H
 
+#include "Atlas.h"
 #include "KeyFrame.h"
 #include "LocalMapping.h"
 #include "Map.h"
+#include "MapStore.h"
 #include "ORBVocabulary.h"
 #include "Tracking.h"
 
 #include "KeyFrameDatabase.h"
+#include "ThreadPool.h"
 
 #include "g2o/types/sim3/types_seven_dof_expmap.h"
+#include <list>
 #include <mutex>
+#include <shared_mutex>
 #include <thread>
 
 namespace ORB_SLAM2 {
@@ -55,6 +60,12 @@ public:
 
   void SetLocalMapper(LocalMapping *pLocalMapper);
 
+  void SetThreadPool(ThreadPool *pThreadPool);
+
+  void SetAtlas(Atlas *pAtlas);
+
+  void SetMapStore(MapStore *pMapStore);
+
   // Main function
   void Run();
 
@@ -62,6 +73,12 @@ public:
 
   void RequestReset();
 
+  // Tracking is lost for good: archive the active map, or discard it when it
+  // is too small to be merged back, between two loop corrections. Tracking
+  // starts the new map once isNewMapRequested returns false.
+  void RequestNewMap(const bool bDiscard);
+  bool isNewMapRequested();
+
   // This function will run in a separate thread
   void RunGlobalBundleAdjustmentMultiChannels(unsigned long nLoopKF);
 
@@ -74,6 +91,9 @@ public:
     return mbFinishedGBA;
   }
 
+  // Stop a running Global Bundle Adjustment, its result is discarded
+  void AbortGlobalBundleAdjustment();
+
   void RequestFinish();
 
   bool isFinished();
@@ -83,16 +103,32 @@ public:
 protected:
   bool CheckNewKeyFrames();
 
-  bool DetectLoop(const int Ftype);
-  bool ComputeSim3(const int Ftype);
-  void CorrectLoop(const int Ftype);
-
+  // Query the databases of all channels and fuse their candidates
+  bool DetectLoop();
+  // Sim3 RANSAC over the matches of all channels
+  bool ComputeSim3();
+  void CorrectLoop();
+
+  // The loop keyframe belongs to an archived map: move it into the frame of the
+  // active map with the loop Sim3. Only this thread touches archived maps, so
+  // the transform runs without the map update mutex.
+  void TransformMap(Map *pLoopMap);
+  // Splice the transformed map into the active map. Requires the map update mutex.
+  void MergeMap(Map *pLoopMap);
+
+  // Fuses the loop MapPoints of one channel. Requires the map update mutex,
+  // held by CorrectLoop for all the channels.
   void SearchAndFuse(const KeyFrameAndPose &CorrectedPosesMap, const int Ftype);
 
   void ResetIfRequested();
   bool mbResetRequested;
   std::mutex mMutexReset;
 
+  void NewMapIfRequested();
+  bool mbNewMapRequested;
+  bool mbDiscardMap;
+  std::mutex mMutexNewMap;
+
   bool CheckFinish();
   void SetFinish();
   bool mbFinishRequested;
@@ -100,6 +136,8 @@ protected:
   std::mutex mMutexFinish;
 
   Map *mpMap;
+  Atlas *mpAtlas;
+  MapStore *mpMapStore;
   Tracking *mpTracker;
 
   std::vector<KeyFrameDatabase *> mpKeyFrameDB;
@@ -107,6 +145,8 @@ protected:
 
   LocalMapping *mpLocalMapper;
 
+  ThreadPool *mpThreadPool;
+
   std::list<KeyFrame *> mlpLoopKeyFrameQueue;
 
   std::mutex mMutexLoopQueue;
@@ -120,8 +160,9 @@ protected:
   std::vector<ConsistentGroup> mvConsistentGroups;
   std::vector<KeyFrame *> mvpEnoughConsistentCandidates;
   std::vector<KeyFrame *> mvpCurrentConnectedKFs;
-  std::vector<MapPoint *> mvpCurrentMatchedPoints;
-  std::vector<MapPoint *> mvpLoopMapPoints;
+  // One vector per channel
+  std::vector<std::vector<MapPoint *>> mvpCurrentMatchedPoints;
+  std::vector<std::vector<MapPoint *>> mvpLoopMapPoints;
   cv::Mat mScw;
   g2o::Sim3 mg2oScw;
 
@@ -60,6 +60,10 @@ public:
 
   void clear();
 
+  // Move every KeyFrame, MapPoint and origin into pDst, this map is left
+  // empty. The reference MapPoints move only if pDst has none.
+  void MoveTo(Map *pDst);
+
   std::vector<KeyFrame *> mvpKeyFrameOrigins;
 
   std::mutex mMutexMapUpdate;
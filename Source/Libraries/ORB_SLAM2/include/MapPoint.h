@@ -24,8 +24,12 @@
 #include "Frame.h"
 #include "KeyFrame.h"
 #include "Map.h"
+#include "ObservationSet.h"
 
+#include <atomic>
+#include <cstdint>
 #include <mutex>
+#include <Eigen/Core>
 #include <opencv2/core/core.hpp>
 
 namespace ORB_SLAM2 {
@@ -34,6 +38,38 @@ class KeyFrame;
 class Map;
 class Frame;
 
+// Copy of the MapPoint state read by Tracking and the matchers. Filled by
+// MapPoint::GetState without locks or allocations, the Mat accessors are
+// headers over this object and must not outlive it.
+struct MapPointState {
+  static const int kMaxDescriptorBytes = 128;
+
+  // Kept together in the first word so isBad() and Observations() read it atomically
+  int32_t nObs;
+  int32_t bBad;
+
+  float mWorldPos[3];
+  float mNormal[3];
+  float mfMinDistance;
+  float mfMaxDistance;
+  int32_t mnDescriptorBytes;
+  uint64_t mnVersion;
+  uint8_t mDescriptor[kMaxDescriptorBytes];
+
+  cv::Mat WorldPos() const { return cv::Mat(3, 1, CV_32F, const_cast<float *>(mWorldPos)); }
+  cv::Mat Normal() const { return cv::Mat(3, 1, CV_32F, const_cast<float *>(mNormal)); }
+  cv::Mat Descriptor() const { return cv::Mat(1, mnDescriptorBytes, CV_8U, const_cast<uint8_t *>(mDescriptor)); }
+
+  Eigen::Vector3f WorldPosf() const { return Eigen::Vector3f(mWorldPos[0], mWorldPos[1], mWorldPos[2]); }
+  Eigen::Vector3f Normalf() const { return Eigen::Vector3f(mNormal[0], mNormal[1], mNormal[2]); }
+
+  float MinDistanceInvariance() const { return 0.8f * mfMinDistance; }
+  float MaxDistanceInvariance() const { return 1.2f * mfMaxDistance; }
+
+  int PredictScale(const float &currentDist, const KeyFrame *pKF) const;
+  int PredictScale(const float &currentDist, const Frame *pF) const;
+};
+
 class MapPoint {
 public:
   MapPoint(const cv::Mat &Pos, KeyFrame *pRefKF, Map *pMap, const int Ftype);
@@ -41,13 +77,19 @@ public:
 
   void SetWorldPos(const cv::Mat &Pos);
   cv::Mat GetWorldPos();
+  Eigen::Vector3f GetWorldPosf();
 
   cv::Mat GetNormal();
   KeyFrame *GetReferenceKeyFrame();
 
-  std::map<KeyFrame *, std::size_t> GetObservations();
+  // Copy of the observations, for callers that lock other objects while iterating
+  ObservationSet GetObservations();
   int Observations();
 
+  // Calls f(pKF, idx) for every observation without copying. Runs under the
+  // MapPoint lock, so f must not call back into this MapPoint.
+  template <class F> void ForEachObservation(F f);
+
   void AddObservation(KeyFrame *pKF, std::size_t idx);
   void EraseObservation(KeyFrame *pKF);
 
@@ -60,6 +102,10 @@ public:
   void Replace(MapPoint *pMP);
   MapPoint *GetReplaced();
 
+  // Map the point belongs to, changed when maps are archived or merged
+  void SetMap(Map *pMap);
+  Map *GetMap();
+
   void IncreaseVisible(int n = 1);
   void IncreaseFound(int n = 1);
   float GetFoundRatio();
@@ -79,6 +125,9 @@ public:
 
   int GetFeatureType();
 
+  // Latest published state, read without locking (seqlock)
+  void GetState(MapPointState &state) const;
+
 public:
   long unsigned int mnId;
   static long unsigned int nNextId;
@@ -117,7 +166,7 @@ protected:
   cv::Mat mWorldPos;
 
   // Keyframes observing the point and associated index in keyframe
-  std::map<KeyFrame *, std::size_t> mObservations;
+  ObservationSet mObservations;
 
   // Mean viewing direction
   cv::Mat mNormalVector;
@@ -144,8 +193,29 @@ protected:
 
   std::mutex mMutexPos;
   std::mutex mMutexFeatures;
+
+  // Publish the members above as a new MapPointState version. The caller
+  // holds mMutexFeatures and mMutexPos, which serialises the writers.
+  void PublishState();
+
+  // Add n to the covisibility counts between pKF and the other observers in
+  // obs, or between every pair of observers in obs
+  static void UpdateCovisibility(const ObservationSet &obs, KeyFrame *pKF, int n);
+  static void UpdateCovisibility(const ObservationSet &obs, int n);
+
+  static const size_t kStateWords = (sizeof(MapPointState) + 7) / 8;
+  std::atomic<uint64_t> mnStateSeq;
+  std::atomic<uint64_t> mvStateWords[kStateWords];
+
+  friend class MapSerializer;
 };
 
+template <class F> void MapPoint::ForEachObservation(F f) {
+  std::unique_lock<std::mutex> lock(mMutexFeatures);
+  for (const ObservationSet::value_type &obs : mObservations)
+    f(obs.first, obs.second);
+}
+
 } // namespace ORB_SLAM2
 
 #endif // MAPPOINT_H
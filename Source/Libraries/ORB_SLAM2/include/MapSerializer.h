@@ -0,0 +1,46 @@
+#ifndef MAPSERIALIZER_H
+#define MAPSERIALIZER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace ORB_SLAM2 {
+
+class FeaturePoint;
+class Map;
+class MapStore;
+class KeyFrameDatabase;
+class ORBVocabulary;
+class ThreadPool;
+
+// Binary map file: every KeyFrame with all its channels, the MapPoints, the
+// covisibility graph, spanning tree, loop edges and the per-channel
+// KeyFrameDatabase inverted files. Pointers are stored as ids and remapped on
+// load. Records are encoded and decoded on the thread pool, the reader
+// decodes each record while the next one is read from disk.
+//
+// The file only stores the word ids of the vocabularies, so it has to be
+// loaded with the vocabularies it was built with.
+class MapSerializer {
+public:
+  // Map and databases must not be modified meanwhile (LocalMapping and
+  // LoopClosing stopped or finished). The tracker may keep running, the map
+  // lock is only held to snapshot the keyframes and map points.
+  static bool Save(const std::string &filename, Map *pMap, const std::vector<KeyFrameDatabase *> &vpKeyFrameDB,
+                   MapStore *pMapStore, ThreadPool *pPool);
+
+  // Map and databases must be empty. Advances the KeyFrame, MapPoint and
+  // Frame id counters past the loaded ids.
+  static bool Load(const std::string &filename, Map *pMap, const std::vector<KeyFrameDatabase *> &vpKeyFrameDB,
+                   const std::vector<ORBVocabulary *> &vpVocabulary, ThreadPool *pPool);
+
+  // Features of the channels without their MapPoints, the records of the
+  // MapStore page file
+  static std::vector<uint8_t> EncodeChannels(const std::vector<FeaturePoint> &vChannels);
+  static bool DecodeChannels(const std::vector<uint8_t> &data, int Ntype, std::vector<FeaturePoint> &vChannels);
+};
+
+} // namespace ORB_SLAM2
+
+#endif // MAPSERIALIZER_H
@@ -0,0 +1,168 @@
+#ifndef MAPSTORE_H
+#define MAPSTORE_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <shared_mutex>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+namespace ORB_SLAM2 {
+
+class Atlas;
+class FeaturePoint;
+class FeatureStore;
+class KeyFrame;
+class Map;
+
+// Bounds the memory held by keyframe features. Keyframes are bucketed in
+// square tiles of the x-z plane of their camera center, when they are
+// inserted in the map and again when a loop correction, global BA or map
+// merge moves them. Local optimizations only move keyframes slightly and
+// are checked at eviction instead. Once the resident
+// features exceed the budget, the tiles farthest from the camera (archived
+// maps first) are evicted: descriptors, distorted keypoints, grid and BoW
+// vectors are written to an append-only page file, and the keyframe keeps
+// its pose, graph, MapPoint associations and the undistorted keypoints,
+// right coordinates, depths and octaves the optimizations read. Evicted
+// features are read back by KeyFrame::EnsureResident when matching needs
+// them.
+//
+// Threads reading keyframe features hold a ReadGuard while they work;
+// eviction only runs when no guard is held, so it never pulls features from
+// under a reader. Reading back happens under a guard, one keyframe at a time,
+// and publishes a new store; the store it replaces is released by the next
+// eviction, since readers of the resident members may still hold it.
+// Background threads take their guard per unit of work and let a waiting
+// eviction through first, so overlapping readers cannot starve it.
+//
+// Tiles are measured in map units: meters with stereo and RGB-D. A monocular
+// map has no metric scale, its unit is the median scene depth of the
+// initialization, so the tile size is set relative to that depth.
+class MapStore {
+public:
+  struct Stats {
+    size_t nKeyFrames = 0;
+    size_t nResidentKeyFrames = 0;
+    size_t nResidentBytes = 0;
+    size_t nTiles = 0;
+    size_t nResidentTiles = 0;
+    uint64_t nEvictions = 0;
+    uint64_t nPageIns = 0;
+    uint64_t nLostKeyFrames = 0;
+    uint64_t nPageFileBytes = 0;
+  };
+
+  // nBudgetBytes == 0 disables eviction
+  MapStore(Atlas *pAtlas, const std::string &strPageFile, size_t nBudgetBytes, float fTileSize);
+  ~MapStore();
+
+  bool IsEnabled() const { return mnBudgetBytes > 0; }
+
+  // Bucket a keyframe inserted in the map, by LocalMapping and on map load
+  void AddKeyFrame(KeyFrame *pKF);
+
+  // Move keyframes whose poses were corrected to their current tiles
+  void UpdateKeyFrames(const std::vector<KeyFrame *> &vpKFs);
+
+  // With bYield the guard is taken after a waiting eviction ran, for at most
+  // a bounded wait since only the tracker retries it. Not for threads that
+  // hold the map update mutex, the tracker may be waiting on it.
+  std::shared_lock<std::shared_mutex> ReadGuard(const bool bYield = false);
+
+  // Evict the tiles farthest from the camera center Ow until the resident
+  // features fit the budget. Returns false, without waiting, if a reader holds
+  // a guard; yielding readers then hold off until the next attempt. Only the
+  // tiles are walked, within the budget it returns at once.
+  bool Evict(const cv::Mat &Ow);
+
+  // Read the features of an evicted keyframe back, called by
+  // KeyFrame::EnsureResident with the residency mutex of pKF held. Returns
+  // false if the page cannot be read back, the keyframe stays evicted.
+  bool PageIn(KeyFrame *pKF);
+
+  // Decode the paged channels of pKF without making it resident
+  bool ReadChannels(KeyFrame *pKF, std::vector<FeaturePoint> &vChannels);
+
+  // Bytes held by the features an eviction releases and PageIn restores
+  static size_t PagedBytes(KeyFrame *pKF);
+
+  // Forget the tiles and truncate the page file once the keyframes are
+  // deleted, on reset
+  void clear();
+
+  Stats GetStats();
+  void PrintStats(std::ostream &os);
+
+protected:
+  // Map and cell of a tile
+  typedef std::tuple<Map *, int64_t, int64_t> TileKey;
+
+  struct Tile {
+    std::vector<KeyFrame *> vpKFs;
+    size_t nResidentBytes = 0;
+  };
+
+  // Tile of a keyframe and the bytes it holds while resident
+  struct TileEntry {
+    TileKey key;
+    size_t nResidentBytes = 0;
+  };
+
+  TileKey GetTileKey(KeyFrame *pKF);
+
+  // Tile distance from the camera cell, archived maps are farther than any
+  // tile of the active map
+  static int64_t TileDistance(const TileKey &key, Map *pActiveMap, int64_t cx, int64_t cz);
+
+  // Write the features of pKF to the page file and release them, the caller
+  // holds the reader mutex exclusively
+  bool PageOut(KeyFrame *pKF);
+
+  bool ReadPage(KeyFrame *pKF, std::vector<uint8_t> &vData);
+
+  Atlas *mpAtlas;
+  std::string mStrPageFile;
+  size_t mnBudgetBytes;
+  float mfTileSize;
+
+  std::shared_mutex mMutexReaders;
+
+  // Set while an eviction failed to get the readers out
+  bool mbEvictionWaiting;
+  std::mutex mMutexWaiting;
+  std::condition_variable mcvWaiting;
+
+  // Tiles and residency, kept up to date by AddKeyFrame, UpdateKeyFrames,
+  // PageIn and Evict
+  std::map<TileKey, Tile> mTiles;
+  std::unordered_map<KeyFrame *, TileEntry> mmTileEntries;
+  size_t mnResidentKeyFrames;
+  size_t mnResidentBytes;
+  std::mutex mMutexTiles;
+
+  // Stores replaced by PageIn, released when no reader holds a guard
+  std::vector<std::shared_ptr<const FeatureStore>> mvpRetired;
+  std::mutex mMutexRetired;
+
+  // Page file, appended by PageOut and read by PageIn
+  std::fstream mPageFile;
+  uint64_t mnPageFileEnd;
+  std::mutex mMutexPageFile;
+
+  Stats mStats;
+  std::mutex mMutexStats;
+};
+
+} // namespace ORB_SLAM2
+
+#endif // MAPSTORE_H
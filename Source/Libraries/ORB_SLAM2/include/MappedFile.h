@@ -0,0 +1,40 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace ORB_SLAM2 {
+
+// Read-only view of a whole file. Uses mmap on POSIX systems so pages are
+// loaded lazily and shared between processes, and falls back to reading the
+// file into memory elsewhere.
+class MappedFile {
+public:
+  MappedFile() : mpData(nullptr), mnSize(0), mbMapped(false) {}
+  ~MappedFile() { Close(); }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  bool Open(const std::string &filename);
+  void Close();
+
+  bool IsOpen() const { return mpData != nullptr; }
+  const uint8_t *Data() const { return mpData; }
+  size_t Size() const { return mnSize; }
+  const std::string &Filename() const { return mFilename; }
+
+private:
+  const uint8_t *mpData;
+  size_t mnSize;
+  bool mbMapped;
+  std::vector<uint8_t> mvBuffer;
+  std::string mFilename;
+};
+
+} // namespace ORB_SLAM2
+
+#endif // MAPPEDFILE_H
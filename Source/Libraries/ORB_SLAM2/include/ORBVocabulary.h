@@ -28,6 +28,13 @@
 #include "DBoW2/DBoW2.h"
 #include "DBoW2/FORB.h"
 
+#include "MappedFile.h"
+#include "ThreadPool.h"
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
 namespace ORB_SLAM2 {
 
 class ORBVocabulary : public ::OrbVocabulary {
@@ -53,6 +60,111 @@ public:
    */
   void saveToBinaryFile(const std::string &filename) const;
 
+  /**
+   * Maps a vocabulary in the flat format (see ORBVocabulary.cc). Nothing is
+   * parsed or copied: the tree is used in place from the mapped file. The
+   * header and the child/id arrays are always validated, the descriptors and
+   * weights are left untouched unless asked for.
+   * @param filename
+   * @param bVerifyPayload also checksum the descriptors and weights, which
+   *   reads the whole file
+   */
+  bool loadFromFlatFile(const std::string &filename, bool bVerifyPayload = false);
+
+  /**
+   * Saves the loaded vocabulary (any source format) in the flat format
+   * @param filename
+   */
+  bool saveToFlatFile(const std::string &filename) const;
+
+  // True if the file starts with the flat format magic
+  static bool isFlatFile(const std::string &filename);
+
+  // Pool used to transform the descriptors of a frame in batches (null runs serially)
+  void SetThreadPool(ThreadPool *pThreadPool);
+
+  using ::OrbVocabulary::transform;
+  using ::OrbVocabulary::save;
+  using ::OrbVocabulary::load;
+
+  // Same output as DBoW2, served from the flat tree when one is loaded
+  virtual void transform(const std::vector<cv::Mat> &features, DBoW2::BowVector &v) const override;
+
+  virtual void transform(const std::vector<cv::Mat> &features, DBoW2::BowVector &v,
+                         DBoW2::FeatureVector &fv, int levelsup) const override;
+
+  virtual unsigned int size() const override;
+
+  virtual bool empty() const override;
+
+  virtual DBoW2::NodeId getParentNode(DBoW2::WordId wid, int levelsup) const override;
+
+  virtual cv::Mat getWord(DBoW2::WordId wid) const override;
+
+  virtual DBoW2::WordValue getWordWeight(DBoW2::WordId wid) const override;
+
+  // The flat tree is read only and has no FileStorage form
+  virtual void save(cv::FileStorage &fs, const std::string &name = "vocabulary") const override;
+
+  virtual void load(const cv::FileStorage &fs, const std::string &name = "vocabulary") override;
+
+  virtual int stopWords(double minWeight) override;
+
+protected:
+  // Tree with nodes in breadth first order, so the k children of a node are
+  // contiguous and their descriptors sit next to each other. Arrays are
+  // indexed by flat node index; the root is 0. Every loader builds or maps
+  // one, so transform never walks m_nodes.
+  struct FlatTree {
+    uint32_t nNodes = 0;
+    uint32_t nWords = 0;
+    uint32_t descBytes = 0;
+    const uint8_t *descriptors = nullptr; // nNodes x descBytes
+    const uint32_t *childBegin = nullptr; // flat index of the first child
+    const uint32_t *childCount = nullptr; // 0 for words
+    const uint32_t *nodeId = nullptr;     // DBoW2 NodeId
+    const uint32_t *wordId = nullptr;     // DBoW2 WordId of leaves
+    const double *weight = nullptr;
+  };
+
+  // Serialises m_nodes as a complete flat file image
+  bool buildFlatImage(std::vector<uint8_t> &vImage) const;
+
+  // Points mFlat into a validated flat file image
+  void attachFlat(const uint8_t *pImage);
+
+  // Builds the flat image from m_nodes, attaches it and releases m_nodes.
+  // m_nodes is kept when the tree cannot be flattened.
+  void flattenTree();
+
+  void transformFlat(const cv::Mat &feature, DBoW2::WordId &word_id, DBoW2::WordValue &weight,
+                     DBoW2::NodeId *nid, int levelsup) const;
+
+  virtual void transform(const cv::Mat &feature, DBoW2::WordId &id, DBoW2::WordValue &weight,
+                         DBoW2::NodeId *nid = NULL, int levelsup = 0) const override;
+
+  // Reverse links of the flat tree, built on first use by the calls that
+  // walk it upwards or by word (none of them is on the tracking path)
+  struct FlatIndex {
+    std::vector<uint32_t> vParent;   // flat index of the parent, by flat index
+    std::vector<uint32_t> vWordNode; // flat index, by word id
+    std::vector<uint32_t> vById;     // flat index, by DBoW2 NodeId
+  };
+  const FlatIndex &flatIndex() const;
+
+  // Descriptor of a flat node, viewing the flat tree storage
+  cv::Mat flatDescriptor(uint32_t i) const;
+
+  FlatTree mFlat;
+  // Backing storage of mFlat: the mapped file, or an image built at load time
+  std::shared_ptr<MappedFile> mpMappedFile;
+  std::vector<uint8_t> mvFlatImage;
+
+  mutable std::mutex mMutexFlatIndex;
+  mutable std::unique_ptr<FlatIndex> mpFlatIndex;
+
+  ThreadPool *mpThreadPool;
+
 private:
   using F = DBoW2::FORB;
 };
@@ -26,17 +26,19 @@
 
 namespace ORB_SLAM2 {
 
-class ExtractorNode {
-public:
-  ExtractorNode() : bNoMore(false) {}
-
-  void DivideNode(ExtractorNode &n1, ExtractorNode &n2, ExtractorNode &n3,
-                  ExtractorNode &n4);
-
-  std::vector<cv::KeyPoint> vKeys;
+// Node of the octree that distributes the keypoints of a level. The
+// keypoints of a node are the index range [begin, end) of the level buffers,
+// children partition the range of their parent. Nodes are linked in a list
+// through their indices in the node buffer.
+struct ExtractorNode {
   cv::Point2i UL, UR, BL, BR;
-  std::list<ExtractorNode>::iterator lit;
-  bool bNoMore;
+  int begin = 0;
+  int end = 0;
+  int prev = -1;
+  int next = -1;
+  bool bNoMore = false;
+
+  int size() const { return end - begin; }
 };
 
 class ORBextractor : public FeatureExtractor {
@@ -60,16 +62,51 @@ public:
 
 protected:
   void ComputePyramid(cv::Mat image);
+  void AllocatePyramid(const cv::Size &imageSize, const int type);
   void
   ComputeKeyPointsOctTree(std::vector<std::vector<cv::KeyPoint>> &allKeypoints);
-  std::vector<cv::KeyPoint>
-  DistributeOctTree(const std::vector<cv::KeyPoint> &vToDistributeKeys,
-                    const int &minX, const int &maxX, const int &minY,
-                    const int &maxY, const int &nFeatures, const int &level);
+  void ComputeKeyPointsLevel(const int level, std::vector<cv::KeyPoint> &keypoints);
+
+  // Scratch of one pyramid level, kept across frames so the extraction stops
+  // allocating once the capacities have grown
+  struct LevelBuffers {
+    std::vector<std::vector<cv::KeyPoint>> vRowKeys;
+    std::vector<std::vector<cv::KeyPoint>> vCellKeys;
+    std::vector<cv::KeyPoint> vToDistributeKeys;
+    std::vector<ExtractorNode> vNodes;
+    std::vector<int> vIndices;
+    std::vector<int> vPartition;
+    std::vector<std::pair<int, int>> vSizeAndNode;
+    std::vector<std::pair<int, int>> vPrevSizeAndNode;
+  };
+
+  void DistributeOctTree(LevelBuffers &buffers,
+                         const std::vector<cv::KeyPoint> &vToDistributeKeys,
+                         const int &minX, const int &maxX, const int &minY,
+                         const int &maxY, const int &nFeatures,
+                         std::vector<cv::KeyPoint> &vResultKeys);
 
   void
   ComputeKeyPointsOld(std::vector<std::vector<cv::KeyPoint>> &allKeypoints);
   std::vector<cv::Point> pattern;
+
+  // Process pyramid levels (and FAST cell rows) as thread pool tasks.
+  // Output is identical to the serial path.
+  bool mbParallelLevels = true;
+
+  // Persistent pyramid storage: mvImagePyramid and mvBlurredPyramid are views
+  // into two arenas allocated once for the input resolution
+  cv::Mat mPyramidArena;
+  cv::Mat mBlurArena;
+  std::vector<cv::Mat> mvPyramidBordered;
+  std::vector<cv::Mat> mvBlurredPyramid;
+  cv::Size mPyramidSize;
+  int mPyramidType = -1;
+
+  // Per frame results and scratch, sized with the pyramid
+  std::vector<LevelBuffers> mvLevelBuffers;
+  std::vector<std::vector<cv::KeyPoint>> mvLevelKeypoints;
+  std::vector<int> mvDescriptorOffsets;
 };
 
 } // namespace ORB_SLAM2
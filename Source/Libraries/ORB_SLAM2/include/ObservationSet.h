@@ -0,0 +1,94 @@
+#ifndef OBSERVATIONSET_H
+#define OBSERVATIONSET_H
+
+#include <algorithm>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace ORB_SLAM2 {
+
+class KeyFrame;
+
+// KeyFrames observing a MapPoint and the keypoint index in each, in insertion
+// order. Most points have only a few observations, so the first kInline are
+// stored in place and lookups are linear scans. Once more are added all
+// entries move to the heap.
+class ObservationSet {
+public:
+  typedef std::pair<KeyFrame *, std::size_t> value_type;
+  typedef const value_type *const_iterator;
+
+  static const std::size_t kInline = 8;
+
+  ObservationSet() : mnInline(0) {}
+
+  std::size_t size() const { return mvHeap.empty() ? mnInline : mvHeap.size(); }
+  bool empty() const { return size() == 0; }
+
+  const_iterator begin() const { return data(); }
+  const_iterator end() const { return data() + size(); }
+
+  const_iterator find(KeyFrame *pKF) const {
+    const_iterator it = begin();
+    const_iterator last = end();
+    while (it != last && it->first != pKF)
+      ++it;
+    return it;
+  }
+
+  std::size_t count(KeyFrame *pKF) const { return find(pKF) != end() ? 1 : 0; }
+
+  // Keypoint index in pKF, -1 if pKF does not observe the point
+  int index(KeyFrame *pKF) const {
+    const_iterator it = find(pKF);
+    return it != end() ? (int)it->second : -1;
+  }
+
+  // False if pKF was already an observer
+  bool insert(KeyFrame *pKF, std::size_t idx) {
+    if (count(pKF))
+      return false;
+    if (mvHeap.empty() && mnInline < kInline) {
+      mvInline[mnInline++] = value_type(pKF, idx);
+      return true;
+    }
+    if (mvHeap.empty()) {
+      mvHeap.reserve(2 * kInline);
+      mvHeap.assign(mvInline, mvInline + mnInline);
+      mnInline = 0;
+    }
+    mvHeap.push_back(value_type(pKF, idx));
+    return true;
+  }
+
+  // Keeps the order of the remaining observations. False if pKF was not an observer.
+  bool erase(KeyFrame *pKF) {
+    value_type *it = const_cast<value_type *>(find(pKF));
+    value_type *last = const_cast<value_type *>(end());
+    if (it == last)
+      return false;
+    std::copy(it + 1, last, it);
+    if (mvHeap.empty())
+      mnInline--;
+    else
+      mvHeap.pop_back();
+    return true;
+  }
+
+  void clear() {
+    mnInline = 0;
+    mvHeap.clear();
+  }
+
+private:
+  const value_type *data() const { return mvHeap.empty() ? mvInline : mvHeap.data(); }
+
+  value_type mvInline[kInline];
+  std::size_t mnInline;
+  std::vector<value_type> mvHeap;
+};
+
+} // namespace ORB_SLAM2
+
+#endif // OBSERVATIONSET_H
@@ -32,6 +32,7 @@
 namespace ORB_SLAM2 {
 
 class LoopClosing;
+class MapStore;
 
 class Optimizer {
 public:
@@ -40,16 +41,21 @@ public:
 public:
   void static SetNtype(int n);
 
+  // With pMapStore the keyframe features are read under guards taken per
+  // batch of MapPoints, otherwise the caller holds one
   void static BundleAdjustment(const std::vector<KeyFrame *> &vpKF, const std::vector<MapPoint *> &vpMP, int nIterations = 5, bool *pbStopFlag = NULL,
-                                            const unsigned long nLoopKF = 0, const bool bRobust = true);
+                                            const unsigned long nLoopKF = 0, const bool bRobust = true, MapStore *pMapStore = NULL);
                                        
-  void static GlobalBundleAdjustemnt(Map *pMap, int nIterations = 5, bool *pbStopFlag = NULL, const unsigned long nLoopKF = 0, const bool bRobust = true);
+  void static GlobalBundleAdjustemnt(Map *pMap, int nIterations = 5, bool *pbStopFlag = NULL, const unsigned long nLoopKF = 0, const bool bRobust = true,
+                                     MapStore *pMapStore = NULL);
 
   void static LocalBundleAdjustment(KeyFrame *pKF, bool *pbStopFlag, Map *pMap);
   
   int static PoseOptimizationMultiChannels(Frame *pFrame);
 
   int static PoseOptimization(Frame *pFrame, const int Ftype);
+  // Optimizes the pose of the hypothesis against the keypoints of F, which is not modified
+  int static PoseOptimization(const Frame &F, PoseHypothesis &hypothesis, const int Ftype);
 
   // if bFixScale is true, 6DoF optimization (stereo,rgbd), 7DoF otherwise (mono)
   void static OptimizeEssentialGraph(Map *pMap, KeyFrame *pLoopKF, KeyFrame *pCurKF, const LoopClosing::KeyFrameAndPose &NonCorrectedSim3,
@@ -59,6 +65,10 @@ public:
   // if bFixScale is true, optimize SE3 (stereo,rgbd), Sim3 otherwise (mono)
   static int OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, std::vector<MapPoint *> &vpMatches1, g2o::Sim3 &g2oS12, const float th2, const bool bFixScale, const int Ftype);
 
+  // Matches of every channel in one optimization, vvpMatches1[Ftype] indexed by the keypoints of pKF1 in channel Ftype
+  static int OptimizeSim3MultiChannels(KeyFrame *pKF1, KeyFrame *pKF2, std::vector<std::vector<MapPoint *>> &vvpMatches1, g2o::Sim3 &g2oS12,
+                                       const float th2, const bool bFixScale);
+
 };
 
 } // namespace ORB_SLAM2
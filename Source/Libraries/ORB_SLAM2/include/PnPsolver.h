@@ -62,8 +62,12 @@ namespace ORB_SLAM2 {
 
 class PnPsolver {
 public:
+  PnPsolver();
   PnPsolver(const Frame &F, const std::vector<MapPoint *> &vpMapPointMatches, const int Ftype);
 
+  // Starts a new problem, reusing the buffers of the previous one. Resets the RANSAC parameters.
+  void Setup(const Frame &F, const std::vector<MapPoint *> &vpMapPointMatches, const int Ftype);
+
   ~PnPsolver();
 
   void SetRansacParameters(double probability = 0.99, int minInliers = 8,
@@ -0,0 +1,74 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+namespace ORB_SLAM2 {
+
+// Per-stage latency recorder. Every thread appends completed scopes to its
+// own fixed size ring buffer (single writer, no locks on the hot path), the
+// oldest events are overwritten once a buffer is full. At Shutdown the
+// buffers are exported as a Chrome trace (chrome://tracing, Perfetto) and
+// summarised per stage.
+//
+// Instrumentation goes through the PROFILE_* macros, which expand to nothing
+// unless the library is built with ORB_SLAM2_PROFILING.
+class Profiler {
+public:
+  typedef std::chrono::steady_clock Clock;
+
+  // Nanoseconds since the first use of the profiler
+  static int64_t Now();
+
+  // Append a completed scope to the calling thread's buffer. arg < 0 means
+  // no argument (otherwise e.g. the channel index).
+  static void Record(const char *label, int arg, int64_t tStart, int64_t tEnd);
+
+  // Name shown for the calling thread in the trace
+  static void SetThreadName(const std::string &name);
+
+  // Export every recorded event. Call once the recording threads are idle.
+  static bool WriteChromeTrace(const std::string &filename);
+
+  // Count, mean, p50, p90, p99 and max per stage [ms]
+  static void PrintSummary(std::ostream &os);
+
+  static void Reset();
+};
+
+class ScopedTimer {
+public:
+  explicit ScopedTimer(const char *label, int arg = -1) : mLabel(label), mnArg(arg), mtStart(Profiler::Now()) {}
+
+  ~ScopedTimer() { Profiler::Record(mLabel, mnArg, mtStart, Profiler::Now()); }
+
+  ScopedTimer(const ScopedTimer &) = delete;
+  ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+private:
+  const char *mLabel;
+  int mnArg;
+  int64_t mtStart;
+};
+
+} // namespace ORB_SLAM2
+
+#ifdef ORB_SLAM2_PROFILING
+#define ORB_SLAM2_PROFILE_CAT2(a, b) a##b
+#define ORB_SLAM2_PROFILE_CAT(a, b) ORB_SLAM2_PROFILE_CAT2(a, b)
+// Time the enclosing scope; label must be a string literal
+#define PROFILE_SCOPE(label) ::ORB_SLAM2::ScopedTimer ORB_SLAM2_PROFILE_CAT(_profScope, __LINE__)(label)
+// Same, tagged with an integer (channel index)
+#define PROFILE_SCOPE_ARG(label, arg) \
+  ::ORB_SLAM2::ScopedTimer ORB_SLAM2_PROFILE_CAT(_profScope, __LINE__)(label, arg)
+#define PROFILE_THREAD_NAME(name) ::ORB_SLAM2::Profiler::SetThreadName(name)
+#else
+#define PROFILE_SCOPE(label) ((void)0)
+#define PROFILE_SCOPE_ARG(label, arg) ((void)(arg))
+#define PROFILE_THREAD_NAME(name) ((void)0)
+#endif
+
+#endif // PROFILER_H
@@ -0,0 +1,31 @@
+#ifndef SE3_H
+#define SE3_H
+
+#include <Eigen/Core>
+
+namespace ORB_SLAM2 {
+
+// Rigid transform held by value. Used for the poses on the tracking hot path,
+// where the cv::Mat poses would allocate on every access. The cv::Mat pose
+// stays the pose of record: Frame and KeyFrame derive their SE3f copy in
+// SetPose, and the copy is read only by the projection searches and the
+// optimizer setup.
+struct SE3f {
+  Eigen::Matrix3f R;
+  Eigen::Vector3f t;
+
+  SE3f() : R(Eigen::Matrix3f::Identity()), t(Eigen::Vector3f::Zero()) {}
+  SE3f(const Eigen::Matrix3f &R_, const Eigen::Vector3f &t_) : R(R_), t(t_) {}
+
+  Eigen::Vector3f operator*(const Eigen::Vector3f &p) const { return R * p + t; }
+  SE3f operator*(const SE3f &T) const { return SE3f(R * T.R, R * T.t + t); }
+
+  SE3f Inverse() const { return SE3f(R.transpose(), -R.transpose() * t); }
+
+  // Camera center when this is a world to camera transform
+  Eigen::Vector3f Center() const { return -R.transpose() * t; }
+};
+
+} // namespace ORB_SLAM2
+
+#endif // SE3_H
@@ -32,6 +32,11 @@ class Sim3Solver {
 public:
   Sim3Solver(const int Ftype, KeyFrame *pKF1, KeyFrame *pKF2, const std::vector<MapPoint *> &vpMatched12, const bool bFixScale = true);
 
+  // Matches of every channel pooled in one RANSAC. The inliers returned by
+  // iterate and find are indexed like the concatenation of vvpMatched12.
+  Sim3Solver(KeyFrame *pKF1, KeyFrame *pKF2, const std::vector<std::vector<MapPoint *>> &vvpMatched12,
+             const bool bFixScale = true);
+
   void SetRansacParameters(double probability = 0.99, int minInliers = 6, int maxIterations = 300);
 
   cv::Mat find(std::vector<bool> &vbInliers12, int &nInliers);
@@ -43,6 +48,9 @@ public:
   float GetEstimatedScale();
 
 protected:
+  // Append the correspondences of channel Ftype after the ones already added
+  void AddMatches(const int Ftype, const std::vector<MapPoint *> &vpMatched12);
+
   void ComputeCentroid(cv::Mat &P, cv::Mat &Pr, cv::Mat &C);
 
   void ComputeSim3(cv::Mat &P1, cv::Mat &P2);
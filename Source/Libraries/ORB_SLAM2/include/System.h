@@ -25,13 +25,16 @@
 #include <string>
 #include <thread>
 
+#include "Atlas.h"
 #include "FrameDrawer.h"
 #include "KeyFrameDatabase.h"
 #include "LocalMapping.h"
 #include "LoopClosing.h"
 #include "Map.h"
 #include "MapDrawer.h"
+#include "MapStore.h"
 #include "ORBVocabulary.h"
+#include "ThreadPool.h"
 #include "Tracking.h"
 #include "Viewer.h"
 
@@ -61,6 +64,9 @@ public:
   // Viewer threads.
   System(const std::string &strSettingsFile, const eSensor sensor, const bool bUseViewer = true);
 
+  // Shuts the system down if needed and joins the thread pool workers.
+  ~System();
+
   // Proccess the given stereo frame. Images must be synchronized and rectified.
   // Input images: RGB (CV_8UC3) or grayscale (CV_8U). RGB is converted to
   // grayscale. Returns the camera pose (empty if tracking fails).
@@ -118,9 +124,21 @@ public:
   // http://www.cvlibs.net/datasets/kitti/eval_odometry.php
   void SaveTrajectoryKITTI(const std::string &filename);
 
-  // TODO: Save/Load functions
-  // SaveMap(const string &filename);
-  // LoadMap(const string &filename);
+  // Camera pose (Twc, first keyframe at the origin) of every tracked frame,
+  // as saved by SaveTrajectoryTUM. Frames where tracking was lost are skipped.
+  // Call first Shutdown()
+  void GetCameraTrajectory(std::vector<double> &vTimestamps, std::vector<cv::Mat> &vTwc);
+
+  // Save the map (keyframes of every channel, map points, covisibility graph,
+  // spanning tree, loop edges and keyframe databases) in a binary file.
+  // Only the active map is saved, archived maps are not.
+  // Call first Shutdown() or ActivateLocalizationMode()
+  bool SaveMap(const std::string &filename);
+
+  // Load a map saved by SaveMap, built with the same vocabularies.
+  // Call before the first frame. Tracking starts lost and relocalizes in the
+  // loaded map; call ActivateLocalizationMode() to keep the map fixed.
+  bool LoadMap(const std::string &filename);
 
   // Information from most recent processed frame
   // You can call this right after TrackMonocular (or stereo or RGBD)
@@ -128,6 +146,14 @@ public:
   std::vector<MapPoint *> GetTrackedMapPoints();
   std::vector<cv::KeyPoint> GetTrackedKeyPointsUn();
 
+  // Map size, summed over the channels for the points
+  long unsigned int KeyFramesInMap();
+  long unsigned int MapPointsInMap();
+
+  // Block until LocalMapping has processed every queued keyframe. Used to make
+  // offline runs reproducible; returns at once if LocalMapping is stopped.
+  void WaitForLocalMapping();
+
   // Start the viewer
   void StartViewer();
 
@@ -153,6 +179,13 @@ private:
   // Map structure that stores the pointers to all KeyFrames and MapPoints.
   Map *mpMap;
 
+  // Maps archived when tracking was lost, merged back by loop closing.
+  Atlas *mpAtlas;
+
+  // Evicts the features of keyframes far from the camera to disk once they
+  // exceed the memory budget.
+  MapStore *mpMapStore;
+
   // Tracker. It receives a frame and computes the associated camera pose.
   // It also decides when to insert a new keyframe, create some new MapPoints
   // and performs relocalization if tracking fails.
@@ -180,6 +213,13 @@ private:
   std::thread *mptLoopClosing;
   std::thread *mptViewer;
 
+  // Work-stealing executor shared by Frame, the feature extractors and Local
+  // Mapping for short data-parallel tasks (replaces per-frame std::threads).
+  ThreadPool *mpThreadPool;
+
+  // Chrome trace written at Shutdown when built with ORB_SLAM2_PROFILING
+  std::string mStrTraceFile;
+
   // Reset flag
   std::mutex mMutexReset;
   bool mbReset;
@@ -0,0 +1,139 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace ORB_SLAM2 {
+
+class TaskGroup;
+
+// Long lived work-stealing executor shared by Frame, the feature extractors
+// and LocalMapping. Every worker owns a deque: it pushes and pops its own
+// tasks LIFO and steals FIFO from the others when it runs dry. A thread that
+// waits on a TaskGroup executes the queued tasks of that group and blocks
+// once none is left, so nested fork/join (channel -> left/right image ->
+// pyramid level) cannot deadlock. It never runs tasks of other groups, which
+// may take locks the waiting thread holds.
+class ThreadPool {
+public:
+  // nThreads <= 0 uses one worker per hardware thread. vCores optionally
+  // pins worker i to core vCores[i % vCores.size()] (Linux only).
+  ThreadPool(int nThreads, const std::vector<int> &vCores = std::vector<int>(), bool bTiming = false);
+
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  // Queue a task of pGroup (may be null). The label (a string literal) keys
+  // the timing statistics.
+  void Submit(std::function<void()> task, const char *label = nullptr, TaskGroup *pGroup = nullptr);
+
+  // Run one queued task of pGroup on the calling thread. Returns false if
+  // none was found.
+  bool RunPendingTask(const TaskGroup *pGroup);
+
+  int NumThreads() const { return static_cast<int>(mvThreads.size()); }
+
+  // Per-label timing (only collected when bTiming is set)
+  bool TimingEnabled() const { return mbTiming; }
+  void PrintTimings(std::ostream &os) const;
+  void ResetTimings();
+
+protected:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Task {
+    std::function<void()> func;
+    const char *label;
+    TaskGroup *pGroup;
+    Clock::time_point tSubmit;
+  };
+
+  struct WorkQueue {
+    std::mutex mMutex;
+    std::deque<Task> mdTasks;
+  };
+
+  struct TaskStats {
+    size_t nCalls = 0;
+    double totalRunMs = 0;
+    double maxRunMs = 0;
+    double totalQueueMs = 0;
+  };
+
+  void WorkerLoop(int idx);
+  bool PopTask(int idx, Task &task);
+  bool PopGroupTask(int idx, const TaskGroup *pGroup, Task &task);
+  void Execute(Task &task);
+  void PinThread(std::thread &t, int core);
+
+  std::vector<std::unique_ptr<WorkQueue>> mvQueues;
+  std::vector<std::thread> mvThreads;
+
+  std::atomic<int> mnQueued;
+  std::atomic<unsigned int> mnNextQueue;
+
+  std::mutex mMutexWake;
+  std::condition_variable mCondWake;
+  bool mbFinish;
+
+  bool mbTiming;
+  mutable std::mutex mMutexStats;
+  std::map<std::string, TaskStats> mStats;
+};
+
+// Fork/join scope on top of a ThreadPool. With a null pool every task runs
+// inline on the calling thread, which keeps the serial path available.
+class TaskGroup {
+public:
+  explicit TaskGroup(ThreadPool *pPool);
+
+  // Waits for the tasks. The exception of a task is rethrown unless the
+  // scope is already unwinding.
+  ~TaskGroup() noexcept(false);
+
+  TaskGroup(const TaskGroup &) = delete;
+  TaskGroup &operator=(const TaskGroup &) = delete;
+
+  void Run(std::function<void()> task, const char *label = nullptr);
+
+  // Block until every task of the group finished, running its queued tasks
+  // meanwhile. Rethrows the first exception thrown by a task.
+  void Wait();
+
+private:
+  friend class ThreadPool;
+
+  void Join();
+  void Finish(std::exception_ptr exception);
+
+  ThreadPool *mpPool;
+  const int mnUncaught;
+
+  // Tasks not finished, and the subset still in a queue of the pool (updated
+  // by the pool under the queue mutex)
+  std::atomic<int> mnPending;
+  std::atomic<int> mnQueued;
+
+  std::atomic<bool> mbWaiting;
+  std::mutex mMutex;
+  std::condition_variable mCond;
+  std::exception_ptr mException;
+};
+
+} // namespace ORB_SLAM2
+
+#endif // THREADPOOL_H
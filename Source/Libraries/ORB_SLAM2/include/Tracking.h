@@ -24,6 +24,7 @@
 #include <opencv2/core/core.hpp>
 #include <opencv2/features2d/features2d.hpp>
 
+#include "Atlas.h"
 #include "FeatureExtractor.h"
 #include "Frame.h"
 #include "FrameDrawer.h"
@@ -33,11 +34,17 @@
 #include "LoopClosing.h"
 #include "Map.h"
 #include "MapDrawer.h"
+#include "MapStore.h"
 #include "ORBVocabulary.h"
+#include "PnPsolver.h"
 #include "System.h"
 #include "Viewer.h"
 
+#include <atomic>
+#include <list>
+#include <memory>
 #include <mutex>
+#include <shared_mutex>
 
 namespace ORB_SLAM2 {
 
@@ -66,6 +73,9 @@ public:
   void SetLocalMapper(LocalMapping *pLocalMapper);
   void SetLoopClosing(LoopClosing *pLoopClosing);
   void SetViewer(Viewer *pViewer);
+  void SetThreadPool(ThreadPool *pThreadPool);
+  void SetAtlas(Atlas *pAtlas);
+  void SetMapStore(MapStore *pMapStore);
 
   // Load new settings
   // The focal lenght should be similar or scale prediction will fail when projecting points
@@ -75,6 +85,9 @@ public:
   // Use this function if you have deactivated local mapping and you only want to localize the camera.
   void InformOnlyTracking(const bool &flag);
 
+  // A map was loaded into the empty map, start lost so the next frame relocalizes
+  void InformMapLoaded();
+
 public:
   // Tracking states
   enum eTrackingState {
@@ -121,6 +134,9 @@ protected:
   // Main tracking function. It is independent of the input sensor.
   void Track();
 
+  // Initialize a new map from the next frames, once Loop Closing emptied the active map
+  void StartNewMap();
+
   void StereoInitialization(const int Ftype);
   void MonocularInitialization(const int Ftype);
   void CreateInitialMapMonocular(const int Ftype);
@@ -135,7 +151,12 @@ protected:
 
   bool TrackWithMotionModelMultiChannels();
   bool TrackReferenceKeyFrameMultiChannels();
-  bool Relocalization(const int Ftype);
+  // Tries the relocalization candidates of all channels in parallel
+  bool Relocalization();
+  // PnP RANSAC and pose optimization against one candidate, solved in
+  // hypothesis without touching the current frame. Gives up early once bStop is set.
+  bool RelocalizeWithCandidate(KeyFrame *pKF, const int Ftype, PnPsolver &solver, const std::atomic<bool> &bStop,
+                               PoseHypothesis &hypothesis);
 
   void UpdateLocalMapMultiChannels();
   void UpdateLocalKeyFramesMultiChannels();
@@ -194,6 +215,12 @@ protected:
   // System
   System *mpSystem;
 
+  // Executor of the local map search and relocalization
+  ThreadPool *mpThreadPool;
+
+  // PnP solvers reused across relocalizations, one per candidate
+  std::vector<std::unique_ptr<PnPsolver>> mvpPnPsolvers;
+
   // Drawers
   Viewer *mpViewer;
   std::vector<FrameDrawer *> mpFrameDrawer;
@@ -201,6 +228,17 @@ protected:
 
   // Map
   Map *mpMap;
+  Atlas *mpAtlas;
+
+  // Consecutive lost frames, a new map is started after mnLostFramesForNewMap
+  int mnLostFrames;
+  int mnLostFramesForNewMap;
+  // Loop Closing is archiving or discarding the active map, frames are dropped meanwhile
+  bool mbNewMapRequested;
+
+  // Keyframe features are evicted once a keyframe was added
+  MapStore *mpMapStore;
+  bool mbEvictionPending;
 
   // Calibration matrix
   cv::Mat mK;
@@ -1,8 +1,13 @@
 #include "Associater.h"
 
+#include <algorithm>
 #include <limits.h>
 
+#include "Converter.h"
 #include "DBoW2/FeatureVector.h"
+#include "HammingDistance.h"
+#include "Profiler.h"
+#include "ThreadPool.h"
 
 #include <stdint.h>
 
@@ -14,6 +19,19 @@ const int Associater::TH_HIGH = 100;
 const int Associater::TH_LOW = 50;
 const int Associater::HISTO_LENGTH = 30;
 
+// Local map points per task and conflict resolution rounds of the parallel SearchByProjection
+static const size_t kProjectionChunk = 256;
+static const int kProjectionRounds = 2;
+
+// Rigid part of a similarity [sR t], both blocks divided by the scale
+static SE3f RigidFromSim3(const cv::Mat &S) {
+  SE3f T = Converter::toSE3f(S);
+  const float s = T.R.row(0).norm();
+  T.R /= s;
+  T.t /= s;
+  return T;
+}
+
 Associater::Associater(float nnratio, bool checkOri)
     : mfNNratio(nnratio), mbCheckOrientation(checkOri) {}
 
@@ -30,22 +48,17 @@ int Associater::SearchByProjection(Frame &CurrentFrame, const Frame &LastFrame,
 
   // step 2 calcualte translation of current frame and last frame 
   // pose of current frame
-  const cv::Mat Rcw = CurrentFrame.mTcw.rowRange(0, 3).colRange(0, 3);
-  const cv::Mat tcw = CurrentFrame.mTcw.rowRange(0, 3).col(3);
-
-  // translation from current frame to world coordinate
-  const cv::Mat twc = -Rcw.t() * tcw;
-
-  // pose of last frame 
-  const cv::Mat Rlw = LastFrame.mTcw.rowRange(0, 3).colRange(0, 3);
-  const cv::Mat tlw = LastFrame.mTcw.rowRange(0, 3).col(3);
+  const SE3f &Tcw = CurrentFrame.GetPosef();
 
   // translation from current frame to last frame
-  const cv::Mat tlc = Rlw * twc + tlw;
+  const Eigen::Vector3f tlc = LastFrame.GetPosef() * Tcw.Center();
 
   // judge forward or backward
-  const bool bForward = tlc.at<float>(2) > CurrentFrame.mb && !bMono;
-  const bool bBackward = -tlc.at<float>(2) > CurrentFrame.mb && !bMono;
+  const bool bForward = tlc(2) > CurrentFrame.mb && !bMono;
+  const bool bBackward = -tlc(2) > CurrentFrame.mb && !bMono;
+
+  const FeatureStore &features = *CurrentFrame.Channels[Ftype].mpFeatures;
+  const vector<MapPoint *> &vpCurrentMPs = CurrentFrame.Channels[Ftype].mvpMapPoints;
 
   // step 3 project the mappoints created by last frame to current frame, calcualte its  u and v in pixel
   for (int i = 0; i < LastFrame.Channels[Ftype].N; i++) {
@@ -53,13 +66,15 @@ int Associater::SearchByProjection(Frame &CurrentFrame, const Frame &LastFrame,
   
     if (pMP) {
       if (!LastFrame.Channels[Ftype].mvbOutlier[i]) {
+        MapPointState state;
+        pMP->GetState(state);
+
         // Project
-        cv::Mat x3Dw = pMP->GetWorldPos();
-        cv::Mat x3Dc = Rcw * x3Dw + tcw;
+        const Eigen::Vector3f x3Dc = Tcw * state.WorldPosf();
 
-        const float xc = x3Dc.at<float>(0);
-        const float yc = x3Dc.at<float>(1);
-        const float invzc = 1.0 / x3Dc.at<float>(2);
+        const float xc = x3Dc(0);
+        const float yc = x3Dc(1);
+        const float invzc = 1.0 / x3Dc(2);
 
         if (invzc < 0)
           continue;
@@ -72,58 +87,39 @@ int Associater::SearchByProjection(Frame &CurrentFrame, const Frame &LastFrame,
         if (v < CurrentFrame.mnMinY || v > CurrentFrame.mnMaxY)
           continue;
 
-        int nLastOctave = LastFrame.Channels[Ftype].mvKeys[i].octave;
+        int nLastOctave = LastFrame.Channels[Ftype].mpFeatures->mvKeys[i].octave;
 
         // Search in a window. Size depends on scale
         float radius = th * CurrentFrame.mvScaleFactors[nLastOctave];
 
-        vector<size_t> vIndices2;
-
-        if (bForward)
-          vIndices2 = CurrentFrame.GetFeaturesInArea(Ftype, u, v, radius, nLastOctave);
-        else if (bBackward)
-          vIndices2 =
-              CurrentFrame.GetFeaturesInArea(Ftype ,u, v, radius, 0, nLastOctave);
-        else
-          vIndices2 = CurrentFrame.GetFeaturesInArea(Ftype, u, v, radius, nLastOctave - 1, nLastOctave + 1);
-
-        if (vIndices2.empty())
-          continue;
-
-        const cv::Mat dMP = pMP->GetDescriptor();
-
-        int bestDist = 256;
-        int bestIdx2 = -1;
-
-        for (vector<size_t>::const_iterator vit = vIndices2.begin(), vend = vIndices2.end(); vit != vend; vit++) {
-          const size_t i2 = *vit;
-          if (CurrentFrame.Channels[Ftype].mvpMapPoints[i2])
-            if (CurrentFrame.Channels[Ftype].mvpMapPoints[i2]->Observations() > 0)
-              continue;
-
-          if (CurrentFrame.Channels[Ftype].mvuRight[i2] > 0) {
-            const float ur = u - CurrentFrame.mbf * invzc;
-            const float er = fabs(ur - CurrentFrame.Channels[Ftype].mvuRight[i2]);
-            if (er > radius)
-              continue;
-          }
-
-          const cv::Mat &d = CurrentFrame.Channels[Ftype].mDescriptors.row(i2);
+        int minLevel = nLastOctave - 1;
+        int maxLevel = nLastOctave + 1;
+        if (bForward) {
+          minLevel = nLastOctave;
+          maxLevel = -1;
+        } else if (bBackward) {
+          minLevel = 0;
+          maxLevel = nLastOctave;
+        }
 
-          const int dist = DescriptorDistance(dMP, d);
+        const float ur = u - CurrentFrame.mbf * invzc;
 
-          if (dist < bestDist) {
-            bestDist = dist;
-            bestIdx2 = i2;
-          }
-        }
+        // Skip keypoints already matched to a MapPoint with observations and
+        // stereo keypoints off the predicted right coordinate
+        const AreaMatch match = features.SearchArea(state.Descriptor(), u, v, radius, minLevel, maxLevel,
+                                                    [&](size_t i2) {
+          if (vpCurrentMPs[i2] && vpCurrentMPs[i2]->Observations() > 0)
+            return false;
+          return features.mvuRight[i2] <= 0 || fabs(ur - features.mvuRight[i2]) <= radius;
+        });
 
-        if (bestDist <= TH_HIGH) {
+        const int bestIdx2 = match.bestIdx;
+        if (match.bestDist <= TH_HIGH) {
           CurrentFrame.Channels[Ftype].mvpMapPoints[bestIdx2] = pMP;
           nmatches++;
 
           if (mbCheckOrientation) {
-            float rot = LastFrame.Channels[Ftype].mvKeysUn[i].angle - CurrentFrame.Channels[Ftype].mvKeysUn[bestIdx2].angle;
+            float rot = LastFrame.Channels[Ftype].mpFeatures->mvKeysUn[i].angle - CurrentFrame.Channels[Ftype].mpFeatures->mvKeysUn[bestIdx2].angle;
             if (rot < 0.0)
               rot += 360.0f;
             int bin = round(rot * factor);
@@ -159,94 +155,158 @@ int Associater::SearchByProjection(Frame &CurrentFrame, const Frame &LastFrame,
 }
 
 // used in trackwithlocalmap
-int Associater::SearchByProjection(Frame &F, const vector<MapPoint*> &vpMapPoints, const float th) {
-  int nmatches = 0;
+int Associater::SearchByProjection(Frame &F, const vector<MapPoint*> &vpMapPoints, const float th, ThreadPool *pPool) {
+  ProjectionSnapshot snapshot;
+  SnapshotProjection(F, vpMapPoints, th, snapshot);
+  return SearchByProjection(F, vpMapPoints, snapshot, pPool);
+}
 
+void Associater::SnapshotProjection(const Frame &F, const vector<MapPoint*> &vpMapPoints, const float th,
+                                    ProjectionSnapshot &snapshot) {
+  PROFILE_SCOPE("Associater::SnapshotProjection");
   const bool bFactor = th != 1.0;
+  const size_t nPoints = vpMapPoints.size();
+  const int nChannels = F.Channels.size();
 
-  for (size_t iMP = 0; iMP < vpMapPoints.size(); iMP++) {
+  vector<ProjectionQuery> &vQueries = snapshot.vQueries;
+  vQueries.assign(nPoints, ProjectionQuery());
+  for (size_t iMP = 0; iMP < nPoints; iMP++) {
     MapPoint *pMP = vpMapPoints[iMP];
     if (!pMP->mbTrackInView)
       continue;
 
-    if (pMP->isBad())
-      continue;
-
-    int Ftype = pMP->GetFeatureType();
-    if (Ftype == -1)
+    ProjectionQuery &q = vQueries[iMP];
+    pMP->GetState(q.state);
+    const int Ftype = pMP->GetFeatureType();
+    if (q.state.bBad || Ftype == -1)
       continue;
 
-    const int &nPredictedLevel = pMP->mnTrackScaleLevel;
-
     // The size of the window will depend on the viewing direction
     float r = RadiusByViewingCos(pMP->mTrackViewCos);
-
     if (bFactor)
       r *= th;
 
-    const vector<size_t> vIndices = F.GetFeaturesInArea(Ftype, pMP->mTrackProjX, pMP->mTrackProjY, r * F.mvScaleFactors[nPredictedLevel],
-                                                        nPredictedLevel - 1, nPredictedLevel);
-
-    if (vIndices.empty())
-      continue;
-
-    const cv::Mat MPdescriptor = pMP->GetDescriptor();
+    q.x = pMP->mTrackProjX;
+    q.y = pMP->mTrackProjY;
+    q.xr = pMP->mTrackProjXR;
+    q.level = pMP->mnTrackScaleLevel;
+    q.radius = r * F.mvScaleFactors[q.level];
+    q.Ftype = Ftype;
+  }
 
-    int bestDist = 256;
-    int bestLevel = -1;
-    int bestDist2 = 256;
-    int bestLevel2 = -1;
-    int bestIdx = -1;
+  vector<vector<bool>> &vvbTaken = snapshot.vvbTaken;
+  vvbTaken.resize(nChannels);
+  for (int Ftype = 0; Ftype < nChannels; Ftype++) {
+    const vector<MapPoint *> &vpFrameMPs = F.Channels[Ftype].mvpMapPoints;
+    vvbTaken[Ftype].resize(vpFrameMPs.size());
+    for (size_t i = 0; i < vpFrameMPs.size(); i++)
+      vvbTaken[Ftype][i] = vpFrameMPs[i] && vpFrameMPs[i]->Observations() > 0;
+  }
+}
 
-    // Get best and second matches with near keypoints
-    for (vector<size_t>::const_iterator vit = vIndices.begin(), vend = vIndices.end(); vit != vend; vit++) {
-      const size_t idx = *vit;
+int Associater::SearchByProjection(Frame &F, const vector<MapPoint*> &vpMapPoints, ProjectionSnapshot &snapshot,
+                                   ThreadPool *pPool) {
+  PROFILE_SCOPE("Associater::SearchByProjection");
+  const size_t nPoints = vpMapPoints.size();
+  const int nChannels = F.Channels.size();
+  const vector<ProjectionQuery> &vQueries = snapshot.vQueries;
+  vector<vector<bool>> &vvbTaken = snapshot.vvbTaken;
+
+  // Every point proposes its best keypoint independently. When several points
+  // claim the same keypoint the lowest distance wins (ties go to the earlier
+  // point), so the result does not depend on the partitioning. The losers
+  // search again without the keypoints assigned so far.
+  vector<int> vBestIdx(nPoints, -1);
+  vector<int> vBestDist(nPoints, INT_MAX);
+  vector<size_t> vPending;
+  for (size_t iMP = 0; iMP < nPoints; iMP++)
+    if (vQueries[iMP].Ftype >= 0)
+      vPending.push_back(iMP);
 
-      if (F.Channels[Ftype].mvpMapPoints[idx])
-        if (F.Channels[Ftype].mvpMapPoints[idx]->Observations() > 0)
-          continue;
+  int nmatches = 0;
+  for (int round = 0; round < kProjectionRounds && !vPending.empty(); round++) {
+    const size_t nPending = vPending.size();
+    {
+      TaskGroup propose(pPool);
+      for (size_t begin = 0; begin < nPending; begin += kProjectionChunk) {
+        propose.Run([&, begin]() {
+          const size_t end = min(nPending, begin + kProjectionChunk);
+          for (size_t k = begin; k < end; k++) {
+            const size_t iMP = vPending[k];
+            const ProjectionQuery &q = vQueries[iMP];
+            const FeatureStore &features = *F.Channels[q.Ftype].mpFeatures;
+            const vector<bool> &vbTaken = vvbTaken[q.Ftype];
+
+            // Get best and second matches with near keypoints
+            const AreaMatch match = features.SearchArea(q.state.Descriptor(), q.x, q.y, q.radius, q.level - 1, q.level,
+                                                        [&](size_t idx) {
+              if (vbTaken[idx])
+                return false;
+              return features.mvuRight[idx] <= 0 || fabs(q.xr - features.mvuRight[idx]) <= q.radius;
+            });
+
+            vBestIdx[iMP] = -1;
+
+            // Apply ratio to second match (only if best and second are in the same
+            // scale level)
+            if (match.bestDist > TH_HIGH)
+              continue;
+            if (match.bestLevel == match.secondLevel && match.bestDist > mfNNratio * match.secondDist)
+              continue;
 
-      if (F.Channels[Ftype].mvuRight[idx] > 0) {
-        const float er = fabs(pMP->mTrackProjXR - F.Channels[Ftype].mvuRight[idx]);
-        if (er > r * F.mvScaleFactors[nPredictedLevel])
-          continue;
+            vBestIdx[iMP] = match.bestIdx;
+            vBestDist[iMP] = match.bestDist;
+          }
+        }, "SearchByProjection::Propose");
       }
+    }
 
-      const cv::Mat &d = F.Channels[Ftype].mDescriptors.row(idx);
-
-      const int dist = DescriptorDistance(MPdescriptor, d);
+    // Resolve conflicts, one task per channel
+    vector<vector<size_t>> vvLosers(nChannels);
+    vector<int> vnMatches(nChannels, 0);
+    {
+      TaskGroup resolve(pPool);
+      for (int Ftype = 0; Ftype < nChannels; Ftype++) {
+        resolve.Run([&, Ftype]() {
+          vector<int> vOwner(F.Channels[Ftype].N, -1);
+          for (const size_t iMP : vPending) {
+            if (vQueries[iMP].Ftype != Ftype || vBestIdx[iMP] < 0)
+              continue;
+            int &owner = vOwner[vBestIdx[iMP]];
+            if (owner < 0 || vBestDist[iMP] < vBestDist[owner]) {
+              if (owner >= 0)
+                vvLosers[Ftype].push_back(owner);
+              owner = iMP;
+            } else {
+              vvLosers[Ftype].push_back(iMP);
+            }
+          }
 
-      if (dist < bestDist) {
-        bestDist2 = bestDist;
-        bestDist = dist;
-        bestLevel2 = bestLevel;
-        bestLevel = F.Channels[Ftype].mvKeysUn[idx].octave;
-        bestIdx = idx;
-      } else if (dist < bestDist2) {
-        bestLevel2 = F.Channels[Ftype].mvKeysUn[idx].octave;
-        bestDist2 = dist;
+          for (size_t idx = 0; idx < vOwner.size(); idx++) {
+            if (vOwner[idx] < 0)
+              continue;
+            F.Channels[Ftype].mvpMapPoints[idx] = vpMapPoints[vOwner[idx]];
+            vvbTaken[Ftype][idx] = true;
+            vnMatches[Ftype]++;
+          }
+        }, "SearchByProjection::Resolve");
       }
     }
 
-    // Apply ratio to second match (only if best and second are in the same
-    // scale level)
-    if (bestDist <= TH_HIGH) {
-      if (bestLevel == bestLevel2 && bestDist > mfNNratio * bestDist2)
-        continue;
-
-      F.Channels[Ftype].mvpMapPoints[bestIdx] = pMP;
-      nmatches++;
+    vPending.clear();
+    for (int Ftype = 0; Ftype < nChannels; Ftype++) {
+      nmatches += vnMatches[Ftype];
+      vPending.insert(vPending.end(), vvLosers[Ftype].begin(), vvLosers[Ftype].end());
     }
+    sort(vPending.begin(), vPending.end());
   }
 
-  // std::cout << "Points in local map: " << vpMapPoints.size() << endl;
-  // std::cout << "Matched points in local map: " << nmatches << endl;
-
   return nmatches;
-
 }
 
 int Associater::SearchByProjection(KeyFrame *pKF, cv::Mat Scw, const vector<MapPoint *> &vpPoints, vector<MapPoint *> &vpMatched, int th, const int Ftype) { 
+  if (!pKF->EnsureResident())
+    return 0;
   // Get Calibration Parameters for later projection
   const float &fx = pKF->fx;
   const float &fy = pKF->fy;
@@ -254,11 +314,10 @@ int Associater::SearchByProjection(KeyFrame *pKF, cv::Mat Scw, const vector<MapP
   const float &cy = pKF->cy;
 
   // Decompose Scw 
-  cv::Mat sRcw = Scw.rowRange(0, 3).colRange(0, 3);
-  const float scw = sqrt(sRcw.row(0).dot(sRcw.row(0)));
-  cv::Mat Rcw = sRcw / scw;
-  cv::Mat tcw = Scw.rowRange(0, 3).col(3) / scw;
-  cv::Mat Ow = -Rcw.t() * tcw;
+  const SE3f Tcw = RigidFromSim3(Scw);
+  const Eigen::Matrix3f &Rcw = Tcw.R;
+  const Eigen::Vector3f &tcw = Tcw.t;
+  const Eigen::Vector3f Ow = Tcw.Center();
 
   // Set of MapPoints already found in the KeyFrame
   set<MapPoint *> spAlreadyFound(vpMatched.begin(), vpMatched.end());
@@ -274,20 +333,23 @@ int Associater::SearchByProjection(KeyFrame *pKF, cv::Mat Scw, const vector<MapP
     if (pMP->isBad() || spAlreadyFound.count(pMP))
       continue;
 
+    MapPointState state;
+    pMP->GetState(state);
+
     // Get 3D Coords.
-    cv::Mat p3Dw = pMP->GetWorldPos();
+    const Eigen::Vector3f p3Dw = state.WorldPosf();
 
     // Transform into Camera Coords.
-    cv::Mat p3Dc = Rcw * p3Dw + tcw;
+    const Eigen::Vector3f p3Dc = Rcw * p3Dw + tcw;
 
     // Depth must be positive
-    if (p3Dc.at<float>(2) < 0.0)
+    if (p3Dc(2) < 0.0)
       continue;
 
     // Project into Image
-    const float invz = 1 / p3Dc.at<float>(2);
-    const float x = p3Dc.at<float>(0) * invz;
-    const float y = p3Dc.at<float>(1) * invz;
+    const float invz = 1 / p3Dc(2);
+    const float x = p3Dc(0) * invz;
+    const float y = p3Dc(1) * invz;
 
     const float u = fx * x + cx;
     const float v = fy * y + cy;
@@ -297,57 +359,32 @@ int Associater::SearchByProjection(KeyFrame *pKF, cv::Mat Scw, const vector<MapP
       continue;
 
     // Depth must be inside the scale invariance region of the point
-    const float maxDistance = pMP->GetMaxDistanceInvariance();
-    const float minDistance = pMP->GetMinDistanceInvariance();
-    cv::Mat PO = p3Dw - Ow;
-    const float dist = cv::norm(PO);
+    const float maxDistance = state.MaxDistanceInvariance();
+    const float minDistance = state.MinDistanceInvariance();
+    const Eigen::Vector3f PO = p3Dw - Ow;
+    const float dist = PO.norm();
 
     if (dist < minDistance || dist > maxDistance)
       continue;
 
     // Viewing angle must be less than 60 deg
-    cv::Mat Pn = pMP->GetNormal();
+    const Eigen::Vector3f Pn = state.Normalf();
 
     if (PO.dot(Pn) < 0.5 * dist)
       continue;
 
-    int nPredictedLevel = pMP->PredictScale(dist, pKF);
+    int nPredictedLevel = state.PredictScale(dist, pKF);
 
     // Search in a radius
     const float radius = th * pKF->mvScaleFactors[nPredictedLevel];
 
-    const vector<size_t> vIndices = pKF->GetFeaturesInArea(u, v, radius, Ftype);
-
-    if (vIndices.empty())
-      continue;
-
-    // Match to the most similar keypoint in the radius
-    const cv::Mat dMP = pMP->GetDescriptor();
-
-    int bestDist = 256;
-    int bestIdx = -1;
-    for (vector<size_t>::const_iterator vit = vIndices.begin(), vend = vIndices.end(); vit != vend; vit++) {
-      const size_t idx = *vit;
-      if (vpMatched[idx])
-        continue;
-
-      const int &kpLevel = pKF->Channels[Ftype].mvKeysUn[idx].octave;
+    // Match to the most similar unmatched keypoint in the radius
+    const AreaMatch match = pKF->Channels[Ftype].mpFeatures->SearchArea(
+        state.Descriptor(), u, v, radius, nPredictedLevel - 1, nPredictedLevel,
+        [&](size_t idx) { return !vpMatched[idx]; });
 
-      if (kpLevel < nPredictedLevel - 1 || kpLevel > nPredictedLevel)
-        continue;
-
-      const cv::Mat &dKF = pKF->Channels[Ftype].mDescriptors.row(idx);
-
-      const int dist = DescriptorDistance(dMP, dKF);
-
-      if (dist < bestDist) {
-        bestDist = dist;
-        bestIdx = idx;
-      }
-    }
-
-    if (bestDist <= TH_LOW) {
-      vpMatched[bestIdx] = pMP;
+    if (match.bestDist <= TH_LOW) {
+      vpMatched[match.bestIdx] = pMP;
       nmatches++;
     }
   }
@@ -357,11 +394,25 @@ int Associater::SearchByProjection(KeyFrame *pKF, cv::Mat Scw, const vector<MapP
 
 int Associater::SearchByProjection(Frame &CurrentFrame, KeyFrame *pKF, const set<MapPoint *> &sAlreadyFound, 
                                    const float th, const int ORBdist, const int Ftype) {
+  PoseHypothesis hypothesis;
+  hypothesis.Tcw = CurrentFrame.GetPose();
+  hypothesis.vpMapPoints.swap(CurrentFrame.Channels[Ftype].mvpMapPoints);
+  const int nmatches = SearchByProjection(CurrentFrame, hypothesis, pKF, sAlreadyFound, th, ORBdist, Ftype);
+  CurrentFrame.Channels[Ftype].mvpMapPoints.swap(hypothesis.vpMapPoints);
+  return nmatches;
+}
+
+int Associater::SearchByProjection(const Frame &F, PoseHypothesis &hypothesis, KeyFrame *pKF,
+                                   const set<MapPoint *> &sAlreadyFound, const float th, const int ORBdist,
+                                   const int Ftype) {
+  if (!pKF->EnsureResident())
+    return 0;
   int nmatches = 0;
 
-  const cv::Mat Rcw = CurrentFrame.mTcw.rowRange(0, 3).colRange(0, 3);
-  const cv::Mat tcw = CurrentFrame.mTcw.rowRange(0, 3).col(3);
-  const cv::Mat Ow = -Rcw.t() * tcw;
+  const SE3f Tcw = Converter::toSE3f(hypothesis.Tcw);
+  const Eigen::Matrix3f &Rcw = Tcw.R;
+  const Eigen::Vector3f &tcw = Tcw.t;
+  const Eigen::Vector3f Ow = Tcw.Center();
 
   // Rotation Histogram (to check rotation consistency)
   vector<int> rotHist[HISTO_LENGTH];
@@ -376,70 +427,54 @@ int Associater::SearchByProjection(Frame &CurrentFrame, KeyFrame *pKF, const set
 
     if (pMP) {
       if (!pMP->isBad() && !sAlreadyFound.count(pMP)) {
+        MapPointState state;
+        pMP->GetState(state);
+
         // Project
-        cv::Mat x3Dw = pMP->GetWorldPos();
-        cv::Mat x3Dc = Rcw * x3Dw + tcw;
+        const Eigen::Vector3f x3Dw = state.WorldPosf();
+        const Eigen::Vector3f x3Dc = Rcw * x3Dw + tcw;
 
-        const float xc = x3Dc.at<float>(0);
-        const float yc = x3Dc.at<float>(1);
-        const float invzc = 1.0 / x3Dc.at<float>(2);
+        const float xc = x3Dc(0);
+        const float yc = x3Dc(1);
+        const float invzc = 1.0 / x3Dc(2);
 
-        const float u = CurrentFrame.fx * xc * invzc + CurrentFrame.cx;
-        const float v = CurrentFrame.fy * yc * invzc + CurrentFrame.cy;
+        const float u = F.fx * xc * invzc + F.cx;
+        const float v = F.fy * yc * invzc + F.cy;
 
-        if (u < CurrentFrame.mnMinX || u > CurrentFrame.mnMaxX)
+        if (u < F.mnMinX || u > F.mnMaxX)
           continue;
-        if (v < CurrentFrame.mnMinY || v > CurrentFrame.mnMaxY)
+        if (v < F.mnMinY || v > F.mnMaxY)
           continue;
 
         // Compute predicted scale level
-        cv::Mat PO = x3Dw - Ow;
-        float dist3D = cv::norm(PO);
+        const Eigen::Vector3f PO = x3Dw - Ow;
+        float dist3D = PO.norm();
 
-        const float maxDistance = pMP->GetMaxDistanceInvariance();
-        const float minDistance = pMP->GetMinDistanceInvariance();
+        const float maxDistance = state.MaxDistanceInvariance();
+        const float minDistance = state.MinDistanceInvariance();
 
         // Depth must be inside the scale pyramid of the image
         if (dist3D < minDistance || dist3D > maxDistance)
           continue;
 
-        int nPredictedLevel = pMP->PredictScale(dist3D, &CurrentFrame);
+        int nPredictedLevel = state.PredictScale(dist3D, &F);
 
         // Search in a window
-        const float radius = th * CurrentFrame.mvScaleFactors[nPredictedLevel];
-
-        const vector<size_t> vIndices2 = CurrentFrame.GetFeaturesInArea(Ftype, u, v, radius, nPredictedLevel - 1, nPredictedLevel + 1);
-
-        if (vIndices2.empty())
-          continue;
-
-        const cv::Mat dMP = pMP->GetDescriptor();
-
-        int bestDist = 256;
-        int bestIdx2 = -1;
-
-        for (vector<size_t>::const_iterator vit = vIndices2.begin(); vit != vIndices2.end(); vit++) {
-          const size_t i2 = *vit;
-          if (CurrentFrame.Channels[Ftype].mvpMapPoints[i2])
-            continue;
+        const float radius = th * F.mvScaleFactors[nPredictedLevel];
 
-          const cv::Mat &d = CurrentFrame.Channels[Ftype].mDescriptors.row(i2);
+        const vector<MapPoint *> &vpCurrentMPs = hypothesis.vpMapPoints;
+        const AreaMatch match = F.Channels[Ftype].mpFeatures->SearchArea(
+            state.Descriptor(), u, v, radius, nPredictedLevel - 1, nPredictedLevel + 1,
+            [&](size_t i2) { return !vpCurrentMPs[i2]; });
 
-          const int dist = DescriptorDistance(dMP, d);
-
-          if (dist < bestDist) {
-            bestDist = dist;
-            bestIdx2 = i2;
-          }
-        }
-
-        if (bestDist <= ORBdist) {
-          CurrentFrame.Channels[Ftype].mvpMapPoints[bestIdx2] = pMP;
+        const int bestIdx2 = match.bestIdx;
+        if (match.bestDist <= ORBdist) {
+          hypothesis.vpMapPoints[bestIdx2] = pMP;
           nmatches++;
 
           if (mbCheckOrientation) {
             float rot =
-                pKF->Channels[Ftype].mvKeysUn[i].angle - CurrentFrame.Channels[Ftype].mvKeysUn[bestIdx2].angle;
+                pKF->Channels[Ftype].mpFeatures->mvKeysUn[i].angle - F.Channels[Ftype].mpFeatures->mvKeysUn[bestIdx2].angle;
             if (rot < 0.0)
               rot += 360.0f;
             int bin = round(rot * factor);
@@ -463,7 +498,7 @@ int Associater::SearchByProjection(Frame &CurrentFrame, KeyFrame *pKF, const set
     for (int i = 0; i < HISTO_LENGTH; i++) {
       if (i != ind1 && i != ind2 && i != ind3) {
         for (size_t j = 0, jend = rotHist[i].size(); j < jend; j++) {
-          CurrentFrame.Channels[Ftype].mvpMapPoints[rotHist[i][j]] = NULL;
+          hypothesis.vpMapPoints[rotHist[i][j]] = NULL;
           nmatches--;
         }
       }
@@ -475,9 +510,11 @@ int Associater::SearchByProjection(Frame &CurrentFrame, KeyFrame *pKF, const set
 
 // used in trackwithkeyframe
 int Associater::SearchByBoW(KeyFrame *pKF, Frame &F, vector<MapPoint *> &vpMapPointMatches, const int Ftype) {
-  const vector<MapPoint *> vpMapPointsKF = pKF->GetMapPointMatches(Ftype);
-
   vpMapPointMatches = vector<MapPoint *>(F.Channels[Ftype].N, static_cast<MapPoint *>(NULL));
+  if (!pKF->EnsureResident())
+    return 0;
+
+  const vector<MapPoint *> vpMapPointsKF = pKF->GetMapPointMatches(Ftype);
 
   // suppose the featvec equals the featvec in frame.featdata, mybe it was not updated
   const DBoW2::FeatureVector &vFeatVecKF = pKF->Channels[Ftype].mFeatVec;
@@ -510,7 +547,7 @@ int Associater::SearchByBoW(KeyFrame *pKF, Frame &F, vector<MapPoint *> &vpMapPo
         if (pMP->isBad())
           continue;
 
-        const cv::Mat &dKF = pKF->Channels[Ftype].mDescriptors.row(realIdxKF);
+        const cv::Mat &dKF = pKF->Channels[Ftype].mpFeatures->mDescriptors.row(realIdxKF);
 
         int bestDist1 = 256;
         int bestIdxF = -1;
@@ -522,7 +559,7 @@ int Associater::SearchByBoW(KeyFrame *pKF, Frame &F, vector<MapPoint *> &vpMapPo
           if (vpMapPointMatches[realIdxF])
             continue;
 
-          const cv::Mat &dF = F.Channels[Ftype].mDescriptors.row(realIdxF);
+          const cv::Mat &dF = F.Channels[Ftype].mpFeatures->mDescriptors.row(realIdxF);
 
           const int dist = DescriptorDistance(dKF, dF);
 
@@ -540,10 +577,10 @@ int Associater::SearchByBoW(KeyFrame *pKF, Frame &F, vector<MapPoint *> &vpMapPo
               mfNNratio * static_cast<float>(bestDist2)) {
             vpMapPointMatches[bestIdxF] = pMP;
 
-            const cv::KeyPoint &kp = pKF->Channels[Ftype].mvKeysUn[realIdxKF];
+            const cv::KeyPoint &kp = pKF->Channels[Ftype].mpFeatures->mvKeysUn[realIdxKF];
 
             if (mbCheckOrientation) {
-              float rot = kp.angle - F.Channels[Ftype].mvKeys[bestIdxF].angle;
+              float rot = kp.angle - F.Channels[Ftype].mpFeatures->mvKeys[bestIdxF].angle;
               if (rot < 0.0)
                 rot += 360.0f;
               int bin = round(rot * factor);
@@ -588,17 +625,21 @@ int Associater::SearchByBoW(KeyFrame *pKF, Frame &F, vector<MapPoint *> &vpMapPo
 
 // used in the loopclosing 
 int Associater::SearchByBoW(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &vpMatches12, const int Ftype) {
+  if (!pKF1->EnsureResident() || !pKF2->EnsureResident()) {
+    vpMatches12 = vector<MapPoint *>(pKF1->GetMapPointMatches(Ftype).size(), static_cast<MapPoint *>(NULL));
+    return 0;
+  }
   
   // step 1 : get key points of two channels
-  const vector<cv::KeyPoint> &vKeysUn1 = pKF1->Channels[Ftype].mvKeysUn;
+  const vector<cv::KeyPoint> &vKeysUn1 = pKF1->Channels[Ftype].mpFeatures->mvKeysUn;
   const DBoW2::FeatureVector &vFeatVec1 = pKF1->Channels[Ftype].mFeatVec;
   const vector<MapPoint *> vpMapPoints1 = pKF1->GetMapPointMatches(Ftype);
-  const cv::Mat &Descriptors1 = pKF1->Channels[Ftype].mDescriptors;
+  const cv::Mat &Descriptors1 = pKF1->Channels[Ftype].mpFeatures->mDescriptors;
 
-  const vector<cv::KeyPoint> &vKeysUn2 = pKF2->Channels[Ftype].mvKeysUn;
+  const vector<cv::KeyPoint> &vKeysUn2 = pKF2->Channels[Ftype].mpFeatures->mvKeysUn;
   const DBoW2::FeatureVector &vFeatVec2 = pKF2->Channels[Ftype].mFeatVec;
   const vector<MapPoint *> vpMapPoints2 = pKF2->GetMapPointMatches(Ftype);
-  const cv::Mat &Descriptors2 = pKF2->Channels[Ftype].mDescriptors;
+  const cv::Mat &Descriptors2 = pKF2->Channels[Ftype].mpFeatures->mDescriptors;
 
   vpMatches12 = vector<MapPoint *>(vpMapPoints1.size(), static_cast<MapPoint *>(NULL));
   vector<bool> vbMatched2(vpMapPoints2.size(), false);
@@ -711,7 +752,7 @@ int Associater::SearchByNN(Frame &CurrentFrame, const Frame &LastFrame, const in
   
   std::vector<cv::DMatch> matches;
   cv::BFMatcher desc_matcher(cv::NORM_HAMMING, true);
-  desc_matcher.match(LastFrame.Channels[Ftype].mDescriptors, CurrentFrame.Channels[Ftype].mDescriptors, matches, cv::Mat());
+  desc_matcher.match(LastFrame.Channels[Ftype].mpFeatures->mDescriptors, CurrentFrame.Channels[Ftype].mpFeatures->mDescriptors, matches, cv::Mat());
 
   int nmatches = 0;
   for (int i = 0; i < static_cast<int>(matches.size()); ++i) {
@@ -740,6 +781,10 @@ int Associater::SearchByNN(Frame &CurrentFrame, const Frame &LastFrame, const in
 
 // vpMapPointMatches should be the mappoints of frame, we want to match the points on frame to the keyframe
 int Associater::SearchByNN(KeyFrame *pKF, Frame &F, std::vector<MapPoint *> &vpMapPointMatches, const int FType) {
+  if (!pKF->EnsureResident()) {
+    vpMapPointMatches = vector<MapPoint *>(F.Channels[FType].N, static_cast<MapPoint *>(NULL));
+    return 0;
+  }
 
   // std::cout << "Matching KeyFrame" << std::endl;
   // std::cout << pKF->mDescriptors.rows << std::endl;
@@ -750,7 +795,7 @@ int Associater::SearchByNN(KeyFrame *pKF, Frame &F, std::vector<MapPoint *> &vpM
 
   std::vector<cv::DMatch> matches;
   cv::BFMatcher desc_matcher(cv::NORM_HAMMING, true);
-  desc_matcher.match(pKF->Channels[FType].mDescriptors, F.Channels[FType].mDescriptors, matches, cv::Mat());
+  desc_matcher.match(pKF->Channels[FType].mpFeatures->mDescriptors, F.Channels[FType].mpFeatures->mDescriptors, matches, cv::Mat());
 
   int nmatches = 0;
   for (int i = 0; i < static_cast<int>(matches.size()); ++i) {
@@ -779,7 +824,7 @@ int Associater::SearchByNN(KeyFrame *pKF, Frame &F, std::vector<MapPoint *> &vpM
 int Associater::SearchByNN(Frame &F, const vector<MapPoint *> &vpMapPoints) {
   // std::cout << "Matching Localmap" << std::endl;
   // std::cout << vpMapPoints.size() << std::endl;
-  // std::cout << F.Channels[0].mDescriptors.rows << std::endl;
+  // std::cout << F.Channels[0].mpFeatures->mDescriptors.rows << std::endl;
 
   vector<vector<cv::Mat>> MPdescriptorAll;
   vector<vector<int>> select_indice;
@@ -824,7 +869,7 @@ int Associater::SearchByNN(Frame &F, const vector<MapPoint *> &vpMapPoints) {
   matches.resize(F.Ntype);
   cv::BFMatcher desc_matcher(cv::NORM_HAMMING, true);
   for (int Ftype = 0; Ftype < F.Ntype; Ftype++) {
-    desc_matcher.match(MPdescriptors[Ftype], F.Channels[Ftype].mDescriptors, matches[Ftype], cv::Mat());
+    desc_matcher.match(MPdescriptors[Ftype], F.Channels[Ftype].mpFeatures->mDescriptors, matches[Ftype], cv::Mat());
   }
   
   int nmatches = 0;
@@ -855,6 +900,8 @@ int Associater::SearchByNN(Frame &F, const vector<MapPoint *> &vpMapPoints) {
 
 int Associater::SearchForTriangulation(KeyFrame *pKF1, KeyFrame *pKF2, cv::Mat F12, std::vector<std::pair<size_t, size_t>> &vMatchedPairs, 
                                        const bool bOnlyStereo, const int Ftype) {
+  if (!pKF1->EnsureResident() || !pKF2->EnsureResident())
+    return 0;
 
   const DBoW2::FeatureVector &vFeatVec1 = pKF1->Channels[Ftype].mFeatVec;
   const DBoW2::FeatureVector &vFeatVec2 = pKF2->Channels[Ftype].mFeatVec;
@@ -896,15 +943,15 @@ int Associater::SearchForTriangulation(KeyFrame *pKF1, KeyFrame *pKF2, cv::Mat F
         if (pMP1)
           continue;
 
-        const bool bStereo1 = pKF1->Channels[Ftype].mvuRight[idx1] >= 0;
+        const bool bStereo1 = pKF1->Channels[Ftype].mpFeatures->mvuRight[idx1] >= 0;
 
         if (bOnlyStereo)
           if (!bStereo1)
             continue;
 
-        const cv::KeyPoint &kp1 = pKF1->Channels[Ftype].mvKeysUn[idx1];
+        const cv::KeyPoint &kp1 = pKF1->Channels[Ftype].mpFeatures->mvKeysUn[idx1];
 
-        const cv::Mat &d1 = pKF1->Channels[Ftype].mDescriptors.row(idx1);
+        const cv::Mat &d1 = pKF1->Channels[Ftype].mpFeatures->mDescriptors.row(idx1);
 
         int bestDist = TH_LOW;
         int bestIdx2 = -1;
@@ -918,20 +965,20 @@ int Associater::SearchForTriangulation(KeyFrame *pKF1, KeyFrame *pKF2, cv::Mat F
           if (vbMatched2[idx2] || pMP2)
             continue;
 
-          const bool bStereo2 = pKF2->Channels[Ftype].mvuRight[idx2] >= 0;
+          const bool bStereo2 = pKF2->Channels[Ftype].mpFeatures->mvuRight[idx2] >= 0;
 
           if (bOnlyStereo)
             if (!bStereo2)
               continue;
 
-          const cv::Mat &d2 = pKF2->Channels[Ftype].mDescriptors.row(idx2);
+          const cv::Mat &d2 = pKF2->Channels[Ftype].mpFeatures->mDescriptors.row(idx2);
 
           const int dist = DescriptorDistance(d1, d2);
 
           if (dist > TH_LOW || dist > bestDist)
             continue;
 
-          const cv::KeyPoint &kp2 = pKF2->Channels[Ftype].mvKeysUn[idx2];
+          const cv::KeyPoint &kp2 = pKF2->Channels[Ftype].mpFeatures->mvKeysUn[idx2];
 
           if (!bStereo1 && !bStereo2) {
             const float distex = ex - kp2.pt.x;
@@ -947,7 +994,7 @@ int Associater::SearchForTriangulation(KeyFrame *pKF1, KeyFrame *pKF2, cv::Mat F
         }
 
         if (bestIdx2 >= 0) {
-          const cv::KeyPoint &kp2 = pKF2->Channels[Ftype].mvKeysUn[bestIdx2];
+          const cv::KeyPoint &kp2 = pKF2->Channels[Ftype].mpFeatures->mvKeysUn[bestIdx2];
           vMatches12[idx1] = bestIdx2;
           nmatches++;
 
@@ -1004,23 +1051,28 @@ int Associater::SearchForTriangulation(KeyFrame *pKF1, KeyFrame *pKF2, cv::Mat F
 
 int Associater::SearchBySim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &vpMatches12, const float &s12,
                              const cv::Mat &R12, const cv::Mat &t12, const float th, const int Ftype) {
+  if (!pKF1->EnsureResident() || !pKF2->EnsureResident())
+    return 0;
   const float &fx = pKF1->fx;
   const float &fy = pKF1->fy;
   const float &cx = pKF1->cx;
   const float &cy = pKF1->cy;
 
   // Camera 1 from world
-  cv::Mat R1w = pKF1->GetRotation();
-  cv::Mat t1w = pKF1->GetTranslation();
+  const SE3f T1w = pKF1->GetPosef();
+  const Eigen::Matrix3f &R1w = T1w.R;
+  const Eigen::Vector3f &t1w = T1w.t;
 
   // Camera 2 from world
-  cv::Mat R2w = pKF2->GetRotation();
-  cv::Mat t2w = pKF2->GetTranslation();
+  const SE3f T2w = pKF2->GetPosef();
+  const Eigen::Matrix3f &R2w = T2w.R;
+  const Eigen::Vector3f &t2w = T2w.t;
 
   // Transformation between cameras
-  cv::Mat sR12 = s12 * R12;
-  cv::Mat sR21 = (1.0 / s12) * R12.t();
-  cv::Mat t21 = -sR21 * t12;
+  const Eigen::Matrix3f sR12 = s12 * Converter::toMatrix3d(R12).cast<float>();
+  const Eigen::Vector3f t12f = Converter::toVector3f(t12);
+  const Eigen::Matrix3f sR21 = sR12.transpose() / (s12 * s12);
+  const Eigen::Vector3f t21 = -sR21 * t12f;
 
   const vector<MapPoint *> vpMapPoints1 = pKF1->GetMapPointMatches(Ftype);
   const int N1 = vpMapPoints1.size();
@@ -1054,17 +1106,20 @@ int Associater::SearchBySim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *>
     if (pMP->isBad())
       continue;
 
-    cv::Mat p3Dw = pMP->GetWorldPos();
-    cv::Mat p3Dc1 = R1w * p3Dw + t1w;
-    cv::Mat p3Dc2 = sR21 * p3Dc1 + t21;
+    MapPointState state;
+    pMP->GetState(state);
+
+    const Eigen::Vector3f p3Dw = state.WorldPosf();
+    const Eigen::Vector3f p3Dc1 = R1w * p3Dw + t1w;
+    const Eigen::Vector3f p3Dc2 = sR21 * p3Dc1 + t21;
 
     // Depth must be positive
-    if (p3Dc2.at<float>(2) < 0.0)
+    if (p3Dc2(2) < 0.0)
       continue;
 
-    const float invz = 1.0 / p3Dc2.at<float>(2);
-    const float x = p3Dc2.at<float>(0) * invz;
-    const float y = p3Dc2.at<float>(1) * invz;
+    const float invz = 1.0 / p3Dc2(2);
+    const float x = p3Dc2(0) * invz;
+    const float y = p3Dc2(1) * invz;
 
     const float u = fx * x + cx;
     const float v = fy * y + cy;
@@ -1073,50 +1128,26 @@ int Associater::SearchBySim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *>
     if (!pKF2->IsInImage(u, v))
       continue;
 
-    const float maxDistance = pMP->GetMaxDistanceInvariance();
-    const float minDistance = pMP->GetMinDistanceInvariance();
-    const float dist3D = cv::norm(p3Dc2);
+    const float maxDistance = state.MaxDistanceInvariance();
+    const float minDistance = state.MinDistanceInvariance();
+    const float dist3D = p3Dc2.norm();
 
     // Depth must be inside the scale invariance region
     if (dist3D < minDistance || dist3D > maxDistance)
       continue;
 
     // Compute predicted octave
-    const int nPredictedLevel = pMP->PredictScale(dist3D, pKF2);
+    const int nPredictedLevel = state.PredictScale(dist3D, pKF2);
 
     // Search in a radius
     const float radius = th * pKF2->mvScaleFactors[nPredictedLevel];
 
-    const vector<size_t> vIndices = pKF2->GetFeaturesInArea(u, v, radius, Ftype);
-
-    if (vIndices.empty())
-      continue;
-
     // Match to the most similar keypoint in the radius
-    const cv::Mat dMP = pMP->GetDescriptor();
-
-    int bestDist = INT_MAX;
-    int bestIdx = -1;
-    for (vector<size_t>::const_iterator vit = vIndices.begin(), vend = vIndices.end(); vit != vend; vit++) {
-      const size_t idx = *vit;
-
-      const cv::KeyPoint &kp = pKF2->Channels[Ftype].mvKeysUn[idx];
-
-      if (kp.octave < nPredictedLevel - 1 || kp.octave > nPredictedLevel)
-        continue;
-
-      const cv::Mat &dKF = pKF2->Channels[Ftype].mDescriptors.row(idx);
+    const AreaMatch match = pKF2->Channels[Ftype].mpFeatures->SearchArea(
+        state.Descriptor(), u, v, radius, nPredictedLevel - 1, nPredictedLevel, [](size_t) { return true; });
 
-      const int dist = DescriptorDistance(dMP, dKF);
-
-      if (dist < bestDist) {
-        bestDist = dist;
-        bestIdx = idx;
-      }
-    }
-
-    if (bestDist <= TH_HIGH) {
-      vnMatch1[i1] = bestIdx;
+    if (match.bestDist <= TH_HIGH) {
+      vnMatch1[i1] = match.bestIdx;
     }
   }
 
@@ -1130,17 +1161,20 @@ int Associater::SearchBySim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *>
     if (pMP->isBad())
       continue;
 
-    cv::Mat p3Dw = pMP->GetWorldPos();
-    cv::Mat p3Dc2 = R2w * p3Dw + t2w;
-    cv::Mat p3Dc1 = sR12 * p3Dc2 + t12;
+    MapPointState state;
+    pMP->GetState(state);
+
+    const Eigen::Vector3f p3Dw = state.WorldPosf();
+    const Eigen::Vector3f p3Dc2 = R2w * p3Dw + t2w;
+    const Eigen::Vector3f p3Dc1 = sR12 * p3Dc2 + t12f;
 
     // Depth must be positive
-    if (p3Dc1.at<float>(2) < 0.0)
+    if (p3Dc1(2) < 0.0)
       continue;
 
-    const float invz = 1.0 / p3Dc1.at<float>(2);
-    const float x = p3Dc1.at<float>(0) * invz;
-    const float y = p3Dc1.at<float>(1) * invz;
+    const float invz = 1.0 / p3Dc1(2);
+    const float x = p3Dc1(0) * invz;
+    const float y = p3Dc1(1) * invz;
 
     const float u = fx * x + cx;
     const float v = fy * y + cy;
@@ -1149,50 +1183,26 @@ int Associater::SearchBySim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *>
     if (!pKF1->IsInImage(u, v))
       continue;
 
-    const float maxDistance = pMP->GetMaxDistanceInvariance();
-    const float minDistance = pMP->GetMinDistanceInvariance();
-    const float dist3D = cv::norm(p3Dc1);
+    const float maxDistance = state.MaxDistanceInvariance();
+    const float minDistance = state.MinDistanceInvariance();
+    const float dist3D = p3Dc1.norm();
 
     // Depth must be inside the scale pyramid of the image
     if (dist3D < minDistance || dist3D > maxDistance)
       continue;
 
     // Compute predicted octave
-    const int nPredictedLevel = pMP->PredictScale(dist3D, pKF1);
+    const int nPredictedLevel = state.PredictScale(dist3D, pKF1);
 
     // Search in a radius of 2.5*sigma(ScaleLevel)
     const float radius = th * pKF1->mvScaleFactors[nPredictedLevel];
 
-    const vector<size_t> vIndices = pKF1->GetFeaturesInArea(u, v, radius, Ftype);
-
-    if (vIndices.empty())
-      continue;
-
     // Match to the most similar keypoint in the radius
-    const cv::Mat dMP = pMP->GetDescriptor();
-
-    int bestDist = INT_MAX;
-    int bestIdx = -1;
-    for (vector<size_t>::const_iterator vit = vIndices.begin(), vend = vIndices.end(); vit != vend; vit++) {
-      const size_t idx = *vit;
+    const AreaMatch match = pKF1->Channels[Ftype].mpFeatures->SearchArea(
+        state.Descriptor(), u, v, radius, nPredictedLevel - 1, nPredictedLevel, [](size_t) { return true; });
 
-      const cv::KeyPoint &kp = pKF1->Channels[Ftype].mvKeysUn[idx];
-
-      if (kp.octave < nPredictedLevel - 1 || kp.octave > nPredictedLevel)
-        continue;
-
-      const cv::Mat &dKF = pKF1->Channels[Ftype].mDescriptors.row(idx);
-
-      const int dist = DescriptorDistance(dMP, dKF);
-
-      if (dist < bestDist) {
-        bestDist = dist;
-        bestIdx = idx;
-      }
-    }
-
-    if (bestDist <= TH_HIGH) {
-      vnMatch2[i2] = bestIdx;
+    if (match.bestDist <= TH_HIGH) {
+      vnMatch2[i2] = match.bestIdx;
     }
   }
 
@@ -1216,18 +1226,18 @@ int Associater::SearchBySim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *>
 
 int Associater::SearchForInitialization(const int Ftype, Frame &F1, Frame &F2, vector<cv::Point2f> &vbPrevMatched, vector<int> &vnMatches12, int windowSize) {
   int nmatches = 0;
-  vnMatches12 = vector<int>(F1.Channels[Ftype].mvKeysUn.size(), -1);
+  vnMatches12 = vector<int>(F1.Channels[Ftype].mpFeatures->mvKeysUn.size(), -1);
 
   vector<int> rotHist[HISTO_LENGTH];
   for (int i = 0; i < HISTO_LENGTH; i++)
     rotHist[i].reserve(500);
   const float factor = 1.0f / HISTO_LENGTH;
 
-  vector<int> vMatchedDistance(F2.Channels[Ftype].mvKeysUn.size(), INT_MAX);
-  vector<int> vnMatches21(F2.Channels[Ftype].mvKeysUn.size(), -1);
+  vector<int> vMatchedDistance(F2.Channels[Ftype].mpFeatures->mvKeysUn.size(), INT_MAX);
+  vector<int> vnMatches21(F2.Channels[Ftype].mpFeatures->mvKeysUn.size(), -1);
 
-  for (size_t i1 = 0, iend1 = F1.Channels[Ftype].mvKeysUn.size(); i1 < iend1; i1++) {
-    cv::KeyPoint kp1 = F1.Channels[Ftype].mvKeysUn[i1];
+  for (size_t i1 = 0, iend1 = F1.Channels[Ftype].mpFeatures->mvKeysUn.size(); i1 < iend1; i1++) {
+    cv::KeyPoint kp1 = F1.Channels[Ftype].mpFeatures->mvKeysUn[i1];
     int level1 = kp1.octave;
     if (level1 > 0)
       continue;
@@ -1237,7 +1247,7 @@ int Associater::SearchForInitialization(const int Ftype, Frame &F1, Frame &F2, v
     if (vIndices2.empty())
       continue;
 
-    cv::Mat d1 = F1.Channels[Ftype].mDescriptors.row(i1);
+    cv::Mat d1 = F1.Channels[Ftype].mpFeatures->mDescriptors.row(i1);
 
     int bestDist = INT_MAX;
     int bestDist2 = INT_MAX;
@@ -1246,7 +1256,7 @@ int Associater::SearchForInitialization(const int Ftype, Frame &F1, Frame &F2, v
     for (vector<size_t>::iterator vit = vIndices2.begin(); vit != vIndices2.end(); vit++) {
       size_t i2 = *vit;
 
-      cv::Mat d2 = F2.Channels[Ftype].mDescriptors.row(i2);
+      cv::Mat d2 = F2.Channels[Ftype].mpFeatures->mDescriptors.row(i2);
 
       int dist = DescriptorDistance(d1, d2);
 
@@ -1274,7 +1284,7 @@ int Associater::SearchForInitialization(const int Ftype, Frame &F1, Frame &F2, v
         nmatches++;
 
         if (mbCheckOrientation) {
-          float rot = F1.Channels[Ftype].mvKeysUn[i1].angle - F2.Channels[Ftype].mvKeysUn[bestIdx2].angle;
+          float rot = F1.Channels[Ftype].mpFeatures->mvKeysUn[i1].angle - F2.Channels[Ftype].mpFeatures->mvKeysUn[bestIdx2].angle;
           if (rot < 0.0)
             rot += 360.0f;
           int bin = round(rot * factor);
@@ -1310,14 +1320,17 @@ int Associater::SearchForInitialization(const int Ftype, Frame &F1, Frame &F2, v
   // Update prev matched
   for (size_t i1 = 0, iend1 = vnMatches12.size(); i1 < iend1; i1++)
     if (vnMatches12[i1] >= 0)
-      vbPrevMatched[i1] = F2.Channels[Ftype].mvKeysUn[vnMatches12[i1]].pt;
+      vbPrevMatched[i1] = F2.Channels[Ftype].mpFeatures->mvKeysUn[vnMatches12[i1]].pt;
 
   return nmatches;
 }
 
 int Associater::Fuse(const int Ftype, KeyFrame *pKF, const vector<MapPoint *> &vpMapPoints, const float th) {
-  cv::Mat Rcw = pKF->GetRotation();
-  cv::Mat tcw = pKF->GetTranslation();
+  if (!pKF->EnsureResident())
+    return 0;
+  const SE3f Tcw = pKF->GetPosef();
+  const Eigen::Matrix3f &Rcw = Tcw.R;
+  const Eigen::Vector3f &tcw = Tcw.t;
 
   const float &fx = pKF->fx;
   const float &fy = pKF->fy;
@@ -1325,7 +1338,7 @@ int Associater::Fuse(const int Ftype, KeyFrame *pKF, const vector<MapPoint *> &v
   const float &cy = pKF->cy;
   const float &bf = pKF->mbf;
 
-  cv::Mat Ow = pKF->GetCameraCenter();
+  const Eigen::Vector3f Ow = Tcw.Center();
 
   int nFused = 0;
 
@@ -1340,16 +1353,19 @@ int Associater::Fuse(const int Ftype, KeyFrame *pKF, const vector<MapPoint *> &v
     if (pMP->isBad() || pMP->IsInKeyFrame(pKF))
       continue;
 
-    cv::Mat p3Dw = pMP->GetWorldPos();
-    cv::Mat p3Dc = Rcw * p3Dw + tcw;
+    MapPointState state;
+    pMP->GetState(state);
+
+    const Eigen::Vector3f p3Dw = state.WorldPosf();
+    const Eigen::Vector3f p3Dc = Rcw * p3Dw + tcw;
 
     // Depth must be positive
-    if (p3Dc.at<float>(2) < 0.0f)
+    if (p3Dc(2) < 0.0f)
       continue;
 
-    const float invz = 1 / p3Dc.at<float>(2);
-    const float x = p3Dc.at<float>(0) * invz;
-    const float y = p3Dc.at<float>(1) * invz;
+    const float invz = 1 / p3Dc(2);
+    const float x = p3Dc(0) * invz;
+    const float y = p3Dc(1) * invz;
 
     const float u = fx * x + cx;
     const float v = fy * y + cy;
@@ -1360,82 +1376,46 @@ int Associater::Fuse(const int Ftype, KeyFrame *pKF, const vector<MapPoint *> &v
 
     const float ur = u - bf * invz;
 
-    const float maxDistance = pMP->GetMaxDistanceInvariance();
-    const float minDistance = pMP->GetMinDistanceInvariance();
-    cv::Mat PO = p3Dw - Ow;
-    const float dist3D = cv::norm(PO);
+    const float maxDistance = state.MaxDistanceInvariance();
+    const float minDistance = state.MinDistanceInvariance();
+    const Eigen::Vector3f PO = p3Dw - Ow;
+    const float dist3D = PO.norm();
 
     // Depth must be inside the scale pyramid of the image
     if (dist3D < minDistance || dist3D > maxDistance)
       continue;
 
     // Viewing angle must be less than 60 deg
-    cv::Mat Pn = pMP->GetNormal();
+    const Eigen::Vector3f Pn = state.Normalf();
 
     if (PO.dot(Pn) < 0.5 * dist3D)
       continue;
 
-    int nPredictedLevel = pMP->PredictScale(dist3D, pKF);
+    int nPredictedLevel = state.PredictScale(dist3D, pKF);
 
     // Search in a radius
     const float radius = th * pKF->mvScaleFactors[nPredictedLevel];
 
-    const vector<size_t> vIndices = pKF->GetFeaturesInArea(u, v, radius, Ftype);
+    // Match to the most similar keypoint in the radius with a small reprojection error
+    const FeatureStore &features = *pKF->Channels[Ftype].mpFeatures;
+    const AreaMatch match = features.SearchArea(state.Descriptor(), u, v, radius, nPredictedLevel - 1,
+                                                nPredictedLevel, [&](size_t idx) {
+      const float ex = u - features.mvX[idx];
+      const float ey = v - features.mvY[idx];
+      const float invSigma2 = pKF->mvInvLevelSigma2[features.mvOctave[idx]];
 
-    if (vIndices.empty())
-      continue;
-
-    // Match to the most similar keypoint in the radius
-
-    const cv::Mat dMP = pMP->GetDescriptor();
-
-    int bestDist = 256;
-    int bestIdx = -1;
-    for (vector<size_t>::const_iterator vit = vIndices.begin(), vend = vIndices.end(); vit != vend; vit++) {
-      const size_t idx = *vit;
-
-      const cv::KeyPoint &kp = pKF->Channels[Ftype].mvKeysUn[idx];
-
-      const int &kpLevel = kp.octave;
-
-      if (kpLevel < nPredictedLevel - 1 || kpLevel > nPredictedLevel)
-        continue;
-
-      if (pKF->Channels[Ftype].mvuRight[idx] >= 0) {
+      if (features.mvuRight[idx] >= 0) {
         // Check reprojection error in stereo
-        const float &kpx = kp.pt.x;
-        const float &kpy = kp.pt.y;
-        const float &kpr = pKF->Channels[Ftype].mvuRight[idx];
-        const float ex = u - kpx;
-        const float ey = v - kpy;
-        const float er = ur - kpr;
-        const float e2 = ex * ex + ey * ey + er * er;
-
-        if (e2 * pKF->mvInvLevelSigma2[kpLevel] > 7.8)
-          continue;
-      } else {
-        const float &kpx = kp.pt.x;
-        const float &kpy = kp.pt.y;
-        const float ex = u - kpx;
-        const float ey = v - kpy;
-        const float e2 = ex * ex + ey * ey;
-
-        if (e2 * pKF->mvInvLevelSigma2[kpLevel] > 5.99)
-          continue;
+        const float er = ur - features.mvuRight[idx];
+        return (ex * ex + ey * ey + er * er) * invSigma2 <= 7.8;
       }
+      return (ex * ex + ey * ey) * invSigma2 <= 5.99;
+    });
 
-      const cv::Mat &dKF = pKF->Channels[Ftype].mDescriptors.row(idx);
-
-      const int dist = DescriptorDistance(dMP, dKF);
-
-      if (dist < bestDist) {
-        bestDist = dist;
-        bestIdx = idx;
-      }
-    }
+    const int bestIdx = match.bestIdx;
 
     // If there is already a MapPoint replace otherwise add new measurement
-    if (bestDist <= TH_LOW) {
+    if (match.bestDist <= TH_LOW) {
       MapPoint *pMPinKF = pKF->GetMapPoint(bestIdx, Ftype);
       if (pMPinKF) {
         if (!pMPinKF->isBad()) {
@@ -1456,6 +1436,8 @@ int Associater::Fuse(const int Ftype, KeyFrame *pKF, const vector<MapPoint *> &v
 }
 
 int Associater::Fuse(const int Ftype, KeyFrame *pKF, cv::Mat Scw, const vector<MapPoint *> &vpPoints, float th, vector<MapPoint *> &vpReplacePoint) {
+  if (!pKF->EnsureResident())
+    return 0;
   // Get Calibration Parameters for later projection
   const float &fx = pKF->fx;
   const float &fy = pKF->fy;
@@ -1463,11 +1445,10 @@ int Associater::Fuse(const int Ftype, KeyFrame *pKF, cv::Mat Scw, const vector<M
   const float &cy = pKF->cy;
 
   // Decompose Scw
-  cv::Mat sRcw = Scw.rowRange(0, 3).colRange(0, 3);
-  const float scw = sqrt(sRcw.row(0).dot(sRcw.row(0)));
-  cv::Mat Rcw = sRcw / scw;
-  cv::Mat tcw = Scw.rowRange(0, 3).col(3) / scw;
-  cv::Mat Ow = -Rcw.t() * tcw;
+  const SE3f Tcw = RigidFromSim3(Scw);
+  const Eigen::Matrix3f &Rcw = Tcw.R;
+  const Eigen::Vector3f &tcw = Tcw.t;
+  const Eigen::Vector3f Ow = Tcw.Center();
 
   // Set of MapPoints already found in the KeyFrame
   const set<MapPoint *> spAlreadyFound = pKF->GetMapPoints(Ftype);
@@ -1484,20 +1465,23 @@ int Associater::Fuse(const int Ftype, KeyFrame *pKF, cv::Mat Scw, const vector<M
     if (pMP->isBad() || spAlreadyFound.count(pMP))
       continue;
 
+    MapPointState state;
+    pMP->GetState(state);
+
     // Get 3D Coords.
-    cv::Mat p3Dw = pMP->GetWorldPos();
+    const Eigen::Vector3f p3Dw = state.WorldPosf();
 
     // Transform into Camera Coords.
-    cv::Mat p3Dc = Rcw * p3Dw + tcw;
+    const Eigen::Vector3f p3Dc = Rcw * p3Dw + tcw;
 
     // Depth must be positive
-    if (p3Dc.at<float>(2) < 0.0f)
+    if (p3Dc(2) < 0.0f)
       continue;
 
     // Project into Image
-    const float invz = 1.0 / p3Dc.at<float>(2);
-    const float x = p3Dc.at<float>(0) * invz;
-    const float y = p3Dc.at<float>(1) * invz;
+    const float invz = 1.0 / p3Dc(2);
+    const float x = p3Dc(0) * invz;
+    const float y = p3Dc(1) * invz;
 
     const float u = fx * x + cx;
     const float v = fy * y + cy;
@@ -1507,56 +1491,34 @@ int Associater::Fuse(const int Ftype, KeyFrame *pKF, cv::Mat Scw, const vector<M
       continue;
 
     // Depth must be inside the scale pyramid of the image
-    const float maxDistance = pMP->GetMaxDistanceInvariance();
-    const float minDistance = pMP->GetMinDistanceInvariance();
-    cv::Mat PO = p3Dw - Ow;
-    const float dist3D = cv::norm(PO);
+    const float maxDistance = state.MaxDistanceInvariance();
+    const float minDistance = state.MinDistanceInvariance();
+    const Eigen::Vector3f PO = p3Dw - Ow;
+    const float dist3D = PO.norm();
 
     if (dist3D < minDistance || dist3D > maxDistance)
       continue;
 
     // Viewing angle must be less than 60 deg
-    cv::Mat Pn = pMP->GetNormal();
+    const Eigen::Vector3f Pn = state.Normalf();
 
     if (PO.dot(Pn) < 0.5 * dist3D)
       continue;
 
     // Compute predicted scale level
-    const int nPredictedLevel = pMP->PredictScale(dist3D, pKF);
+    const int nPredictedLevel = state.PredictScale(dist3D, pKF);
 
     // Search in a radius
     const float radius = th * pKF->mvScaleFactors[nPredictedLevel];
 
-    const vector<size_t> vIndices = pKF->GetFeaturesInArea(u, v, radius, Ftype);
-
-    if (vIndices.empty())
-      continue;
-
     // Match to the most similar keypoint in the radius
+    const AreaMatch match = pKF->Channels[Ftype].mpFeatures->SearchArea(
+        state.Descriptor(), u, v, radius, nPredictedLevel - 1, nPredictedLevel, [](size_t) { return true; });
 
-    const cv::Mat dMP = pMP->GetDescriptor();
-
-    int bestDist = INT_MAX;
-    int bestIdx = -1;
-    for (vector<size_t>::const_iterator vit = vIndices.begin(); vit != vIndices.end(); vit++) {
-      const size_t idx = *vit;
-      const int &kpLevel = pKF->Channels[Ftype].mvKeysUn[idx].octave;
-
-      if (kpLevel < nPredictedLevel - 1 || kpLevel > nPredictedLevel)
-        continue;
-
-      const cv::Mat &dKF = pKF->Channels[Ftype].mDescriptors.row(idx);
-
-      int dist = DescriptorDistance(dMP, dKF);
-
-      if (dist < bestDist) {
-        bestDist = dist;
-        bestIdx = idx;
-      }
-    }
+    const int bestIdx = match.bestIdx;
 
     // If there is already a MapPoint replace otherwise add new measurement
-    if (bestDist <= TH_LOW) {
+    if (match.bestDist <= TH_LOW) {
       MapPoint *pMPinKF = pKF->GetMapPoint(bestIdx, Ftype);
       if (pMPinKF) {
         if (!pMPinKF->isBad())
@@ -1607,32 +1569,9 @@ void Associater::ComputeThreeMaxima(vector<int> *histo, const int L, int &ind1,
 }
 
 int Associater::DescriptorDistance(const cv::Mat &a, const cv::Mat &b) {
-
-  const uchar* pa = a.ptr<uchar>();
-  const uchar* pb = b.ptr<uchar>();
-
-  int dist = 0;
-  for (int i = 0; i < a.cols; ++i, ++pa, ++pb)
-    dist += __builtin_popcount(*pa ^ *pb);
-
-
-  dist = int(dist * 32.0f / a.cols + 0.5f); // Normalise to 32B standard
-
-  /*
-  const int *pa = a.ptr<int32_t>();
-  const int *pb = b.ptr<int32_t>();
-
-  int dist = 0;
-
-  for (int i = 0; i < 8; i++, pa++, pb++) {
-    unsigned int v = *pa ^ *pb;
-    v = v - ((v >> 1) & 0x55555555);
-    v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
-    dist += (((v + (v >> 4)) & 0xF0F0F0F) * 0x1010101) >> 24;
-  }
-  */
-
-  return dist;
+  // Normalise to 32B standard so that TH_LOW/TH_HIGH hold for wider descriptors
+  const int dist = HammingDistance::Distance(a.ptr<uchar>(), b.ptr<uchar>(), a.cols);
+  return HammingDistance::Normalise(dist, a.cols);
 }
 
 float Associater::RadiusByViewingCos(const float &viewCos) {
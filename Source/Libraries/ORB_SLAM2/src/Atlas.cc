@@ -0,0 +1,73 @@
+#include "Atlas.h"
+#include "Map.h"
+
+#include <algorithm>
+
+using namespace ::std;
+
+namespace ORB_SLAM2 {
+
+Atlas::Atlas(Map *pActiveMap) : mpActiveMap(pActiveMap) {}
+
+Atlas::~Atlas() {
+  for (Map *pMap : mvpArchivedMaps)
+    delete pMap;
+  for (Map *pMap : mvpDiscardedMaps)
+    delete pMap;
+}
+
+Map *Atlas::GetActiveMap() { return mpActiveMap; }
+
+Map *Atlas::ArchiveActiveMap() {
+  Map *pMap = new Map(mpActiveMap->Ntype);
+  mpActiveMap->MoveTo(pMap);
+
+  unique_lock<mutex> lock(mMutexAtlas);
+  mvpArchivedMaps.push_back(pMap);
+  return pMap;
+}
+
+Map *Atlas::DiscardActiveMap() {
+  Map *pMap = new Map(mpActiveMap->Ntype);
+  mpActiveMap->MoveTo(pMap);
+
+  unique_lock<mutex> lock(mMutexAtlas);
+  mvpDiscardedMaps.push_back(pMap);
+  return pMap;
+}
+
+void Atlas::MergeIntoActiveMap(Map *pMap) {
+  pMap->MoveTo(mpActiveMap);
+
+  {
+    unique_lock<mutex> lock(mMutexAtlas);
+    mvpArchivedMaps.erase(remove(mvpArchivedMaps.begin(), mvpArchivedMaps.end(), pMap), mvpArchivedMaps.end());
+  }
+  delete pMap;
+}
+
+vector<Map *> Atlas::GetArchivedMaps() {
+  unique_lock<mutex> lock(mMutexAtlas);
+  return mvpArchivedMaps;
+}
+
+size_t Atlas::CountMaps() {
+  unique_lock<mutex> lock(mMutexAtlas);
+  return mvpArchivedMaps.size() + 1;
+}
+
+void Atlas::clear() {
+  unique_lock<mutex> lock(mMutexAtlas);
+  for (Map *pMap : mvpArchivedMaps) {
+    pMap->clear();
+    delete pMap;
+  }
+  mvpArchivedMaps.clear();
+  for (Map *pMap : mvpDiscardedMaps) {
+    pMap->clear();
+    delete pMap;
+  }
+  mvpDiscardedMaps.clear();
+}
+
+} // namespace ORB_SLAM2
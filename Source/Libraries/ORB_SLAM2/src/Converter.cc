@@ -45,6 +45,32 @@ g2o::SE3Quat Converter::toSE3Quat(const cv::Mat &cvT) {
   return g2o::SE3Quat(R, t);
 }
 
+g2o::SE3Quat Converter::toSE3Quat(const SE3f &T) {
+  return g2o::SE3Quat(T.R.cast<double>(), T.t.cast<double>());
+}
+
+SE3f Converter::toSE3f(const cv::Mat &cvT) {
+  SE3f T;
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++)
+      T.R(i, j) = cvT.at<float>(i, j);
+    T.t(i) = cvT.at<float>(i, 3);
+  }
+
+  return T;
+}
+
+cv::Mat Converter::toCvMat(const SE3f &T) {
+  cv::Mat cvMat = cv::Mat::eye(4, 4, CV_32F);
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++)
+      cvMat.at<float>(i, j) = T.R(i, j);
+    cvMat.at<float>(i, 3) = T.t(i);
+  }
+
+  return cvMat;
+}
+
 cv::Mat Converter::toCvMat(const g2o::SE3Quat &SE3) {
   Eigen::Matrix<double, 4, 4> eigMat = SE3.to_homogeneous_matrix();
   return toCvMat(eigMat);
@@ -122,6 +148,10 @@ Eigen::Matrix<double, 3, 3> Converter::toMatrix3d(const cv::Mat &cvMat3) {
   return M;
 }
 
+Eigen::Vector3f Converter::toVector3f(const cv::Mat &cvVector) {
+  return Eigen::Vector3f(cvVector.at<float>(0), cvVector.at<float>(1), cvVector.at<float>(2));
+}
+
 std::vector<float> Converter::toQuaternion(const cv::Mat &M) {
   Eigen::Matrix<double, 3, 3> eigMat = toMatrix3d(M);
   Eigen::Quaterniond q(eigMat);
@@ -1,7 +1,115 @@
 #include <FeaturePoint.h>
 
+#include <cmath>
+
 using namespace ::std;
 
 namespace ORB_SLAM2 {
 
-}
\ No newline at end of file
+void FeatureStore::BuildArrays() {
+  const size_t N = mvKeysUn.size();
+  mvX.resize(N);
+  mvY.resize(N);
+  mvAngle.resize(N);
+  mvOctave.resize(N);
+  for (size_t i = 0; i < N; i++) {
+    const cv::KeyPoint &kp = mvKeysUn[i];
+    mvX[i] = kp.pt.x;
+    mvY[i] = kp.pt.y;
+    mvAngle[i] = kp.angle;
+    mvOctave[i] = kp.octave;
+  }
+}
+
+void FeatureStore::BuildGrid(int nCols, int nRows, float minX, float minY, float widthInv, float heightInv) {
+  mnGridCols = nCols;
+  mnGridRows = nRows;
+  mfGridMinX = minX;
+  mfGridMinY = minY;
+  mfGridElementWidthInv = widthInv;
+  mfGridElementHeightInv = heightInv;
+
+  // Counting sort: cell of every keypoint, cell sizes, prefix sum, scatter
+  const size_t N = mvKeysUn.size();
+  const int nCells = nCols * nRows;
+  vector<int> vCell(N, -1);
+  mvGridStart.assign(nCells + 1, 0);
+  for (size_t i = 0; i < N; i++) {
+    const int posX = round((mvKeysUn[i].pt.x - minX) * widthInv);
+    const int posY = round((mvKeysUn[i].pt.y - minY) * heightInv);
+
+    // Keypoint's coordinates are undistorted, which could cause to go out of the image
+    if (posX < 0 || posX >= nCols || posY < 0 || posY >= nRows)
+      continue;
+    vCell[i] = posX * nRows + posY;
+    mvGridStart[vCell[i] + 1]++;
+  }
+
+  for (int c = 0; c < nCells; c++)
+    mvGridStart[c + 1] += mvGridStart[c];
+
+  // Keypoints keep their index order inside a cell
+  mvGridIndices.resize(mvGridStart[nCells]);
+  vector<uint32_t> vNext(mvGridStart.begin(), mvGridStart.end() - 1);
+  for (size_t i = 0; i < N; i++)
+    if (vCell[i] >= 0)
+      mvGridIndices[vNext[vCell[i]]++] = i;
+}
+
+bool FeatureStore::GetCellRange(float x, float y, float r, int &minCellX, int &maxCellX, int &minCellY,
+                                int &maxCellY) const {
+  minCellX = max(0, (int)floor((x - mfGridMinX - r) * mfGridElementWidthInv));
+  if (minCellX >= mnGridCols)
+    return false;
+
+  maxCellX = min(mnGridCols - 1, (int)ceil((x - mfGridMinX + r) * mfGridElementWidthInv));
+  if (maxCellX < 0)
+    return false;
+
+  minCellY = max(0, (int)floor((y - mfGridMinY - r) * mfGridElementHeightInv));
+  if (minCellY >= mnGridRows)
+    return false;
+
+  maxCellY = min(mnGridRows - 1, (int)ceil((y - mfGridMinY + r) * mfGridElementHeightInv));
+  if (maxCellY < 0)
+    return false;
+
+  return true;
+}
+
+vector<size_t> FeatureStore::GetFeaturesInArea(float x, float y, float r, int minLevel, int maxLevel) const {
+  vector<size_t> vIndices;
+
+  int nMinCellX, nMaxCellX, nMinCellY, nMaxCellY;
+  if (!GetCellRange(x, y, r, nMinCellX, nMaxCellX, nMinCellY, nMaxCellY))
+    return vIndices;
+
+  // Octaves are never negative, so minLevel <= 0 does not filter
+  const bool bCheckLevels = (minLevel > 0) || (maxLevel >= 0);
+  const int maxOctave = maxLevel >= 0 ? maxLevel : INT_MAX;
+
+  for (int ix = nMinCellX; ix <= nMaxCellX; ix++) {
+    // Cells of a column are contiguous, scan the whole row range at once
+    const uint32_t begin = mvGridStart[ix * mnGridRows + nMinCellY];
+    const uint32_t end = mvGridStart[ix * mnGridRows + nMaxCellY + 1];
+    for (uint32_t j = begin; j < end; j++) {
+      const uint32_t idx = mvGridIndices[j];
+      if (bCheckLevels && (mvOctave[idx] < minLevel || mvOctave[idx] > maxOctave))
+        continue;
+
+      if (fabs(mvX[idx] - x) < r && fabs(mvY[idx] - y) < r)
+        vIndices.push_back(idx);
+    }
+  }
+
+  return vIndices;
+}
+
+const shared_ptr<const FeatureStore> &FeatureStore::Empty() {
+  static const shared_ptr<const FeatureStore> pEmpty = make_shared<FeatureStore>();
+  return pEmpty;
+}
+
+FeaturePoint::FeaturePoint() : type(0), N(0), mpFeatures(FeatureStore::Empty()) {}
+
+}
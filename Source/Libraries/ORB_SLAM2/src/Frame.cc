@@ -21,7 +21,7 @@
 #include "Frame.h"
 #include "Converter.h"
 #include "Associater.h"
-#include <thread>
+#include "Profiler.h"
 
 using namespace ::std;
 
@@ -32,6 +32,7 @@ bool Frame::mbInitialComputations = true;
 float Frame::cx, Frame::cy, Frame::fx, Frame::fy, Frame::invfx, Frame::invfy;
 float Frame::mnMinX, Frame::mnMinY, Frame::mnMaxX, Frame::mnMaxY;
 float Frame::mfGridElementWidthInv, Frame::mfGridElementHeightInv;
+ThreadPool *Frame::mpThreadPool = nullptr;
 
 Frame::Frame(int Ntype) {
   Channels.resize(Ntype);
@@ -88,6 +89,7 @@ Frame::Frame(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timeSt
       mpFeatureExtractorLeft(extractorLeft),
       mpFeatureExtractorRight(extractorRight),
       Ntype(Ntype) {
+  PROFILE_SCOPE("Frame::Frame");
   Channels.resize(Ntype);
 
   // Frame ID
@@ -121,16 +123,10 @@ Frame::Frame(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timeSt
 
   mb = mbf / fx;
 
-  thread CompFeaturesThread[Ntype];
-
-  for (int Ftype = 0; Ftype < Ntype; Ftype++)
-    CompFeaturesThread[Ftype] = thread(&Frame::ComputeFeaturesStereo, this, Ftype, imLeft, imRight);
-    
+  TaskGroup channels(mpThreadPool);
   for (int Ftype = 0; Ftype < Ntype; Ftype++)
-    CompFeaturesThread[Ftype].join();
-
-  // for (int Ftype = 0; Ftype < Ntype; Ftype++)
-  //   ComputeFeaturesStereo(Ftype, imLeft, imRight);
+    channels.Run([this, Ftype, &imLeft, &imRight] { ComputeFeaturesStereo(Ftype, imLeft, imRight); }, "Frame::ComputeFeaturesStereo");
+  channels.Wait();
 }
 
 // RGB-D
@@ -147,6 +143,7 @@ Frame::Frame(const cv::Mat &imGray, const cv::Mat &imDepth,
       mThDepth(thDepth),
       mpFeatureExtractorLeft(extractor),
       Ntype(Ntype) {
+  PROFILE_SCOPE("Frame::Frame");
   // Resize the vectors
   Channels.resize(Ntype);
   mpFeatureExtractorRight.resize(Ntype);
@@ -188,14 +185,10 @@ Frame::Frame(const cv::Mat &imGray, const cv::Mat &imDepth,
 
   mb = mbf / fx;
 
-  thread CompFeaturesThread[Ntype];
-
+  TaskGroup channels(mpThreadPool);
   for (int Ftype = 0; Ftype < Ntype; Ftype++)
-    CompFeaturesThread[Ftype] = thread(&Frame::ComputeFeaturesRGBD, this, Ftype, imGray, imDepth);
-    
-  for (int Ftype = 0; Ftype < Ntype; Ftype++)
-    CompFeaturesThread[Ftype].join();
-
+    channels.Run([this, Ftype, &imGray, &imDepth] { ComputeFeaturesRGBD(Ftype, imGray, imDepth); }, "Frame::ComputeFeaturesRGBD");
+  channels.Wait();
 }
 
 // Mono
@@ -211,6 +204,7 @@ Frame::Frame(const cv::Mat &imGray, const double &timeStamp,
       mThDepth(thDepth),
       mpFeatureExtractorLeft(extractor),
       Ntype(Ntype) {
+  PROFILE_SCOPE("Frame::Frame");
   // Resize the vectors
   Channels.resize(Ntype);
   mpFeatureExtractorRight.resize(Ntype);
@@ -252,60 +246,24 @@ Frame::Frame(const cv::Mat &imGray, const double &timeStamp,
 
   mb = mbf / fx;
 
-  thread CompFeaturesThread[Ntype];
-  
-  for (int Ftype = 0; Ftype < Ntype; Ftype++)
-    CompFeaturesThread[Ftype] = thread(&Frame::ComputeFeaturesMono, this, Ftype, imGray);
-
+  TaskGroup channels(mpThreadPool);
   for (int Ftype = 0; Ftype < Ntype; Ftype++)
-    CompFeaturesThread[Ftype].join();
+    channels.Run([this, Ftype, &imGray] { ComputeFeaturesMono(Ftype, imGray); }, "Frame::ComputeFeaturesMono");
+  channels.Wait();
 }
 
-void Frame::AssignFeaturesToGrid(const int Ftype) {
-  int nReserve = 0.5f * Channels[Ftype].N / (FRAME_GRID_COLS * FRAME_GRID_ROWS);
-  Channels[Ftype].mGrid.resize(FRAME_GRID_COLS);
-  for (unsigned int i = 0; i < FRAME_GRID_COLS; i++) {
-    Channels[Ftype].mGrid[i].resize(FRAME_GRID_ROWS);
-    for (unsigned int j = 0; j < FRAME_GRID_ROWS; j++) {
-      Channels[Ftype].mGrid[i][j].reserve(nReserve);
-    }
-  }
- 
-  for (int i = 0; i < Channels[Ftype].N; i++) {
-    const cv::KeyPoint &kp = Channels[Ftype].mvKeysUn[i];
-
-    int nGridPosX, nGridPosY;
-    if (PosInGrid(kp, nGridPosX, nGridPosY))
-      Channels[Ftype].mGrid[nGridPosX][nGridPosY].push_back(i);
-  }
-}
-
-//rewrite AssignFeaturesToGrid()
-void Frame::AssignFeaturesToGrid(const int &refN, const vector<cv::KeyPoint> &KeysUn,vector<vector<vector<size_t>>> &Grid) {
-  int nReserve = 0.5f * refN / (FRAME_GRID_COLS * FRAME_GRID_ROWS);
-  Grid.resize(FRAME_GRID_COLS);
-  for (unsigned int i = 0; i < FRAME_GRID_COLS; i++) {
-    Grid[i].resize(FRAME_GRID_ROWS);
-    for (unsigned int j = 0; j < FRAME_GRID_ROWS; j++) {
-      Grid[i][j].reserve(nReserve);
-    }
-  }
-
-  for (int i = 0; i < refN; i++) {
-    const cv::KeyPoint &kp = KeysUn[i];
-
-    int nGridPosX, nGridPosY;
-    if (PosInGrid(kp, nGridPosX, nGridPosY))
-      Grid[nGridPosX][nGridPosY].push_back(i);
-  }
+void Frame::AssignFeaturesToGrid(FeatureStore &features, const int Ftype) {
+  PROFILE_SCOPE_ARG("Frame::AssignFeaturesToGrid", Ftype);
+  features.BuildGrid(FRAME_GRID_COLS, FRAME_GRID_ROWS, mnMinX, mnMinY, mfGridElementWidthInv, mfGridElementHeightInv);
 }
 
-void Frame::ExtractFeatures(const int Ftype, int imageFlag, const cv::Mat &im) {
+void Frame::ExtractFeatures(FeatureStore &features, const int Ftype, int imageFlag, const cv::Mat &im) {
+  PROFILE_SCOPE_ARG("Frame::ExtractFeatures", Ftype);
   if (imageFlag == 0) {
-    (*mpFeatureExtractorLeft[Ftype])(im, cv::Mat(), Channels[Ftype].mvKeys, Channels[Ftype].mDescriptors);
+    (*mpFeatureExtractorLeft[Ftype])(im, cv::Mat(), features.mvKeys, features.mDescriptors);
   }
   else {
-    (*mpFeatureExtractorRight[Ftype])(im, cv::Mat(), Channels[Ftype].mvKeysRight, Channels[Ftype].mDescriptorsRight);
+    (*mpFeatureExtractorRight[Ftype])(im, cv::Mat(), features.mvKeysRight, features.mDescriptorsRight);
   }
 }
 
@@ -319,19 +277,25 @@ void Frame::UpdatePoseMatrices() {
   mRwc = mRcw.t();
   mtcw = mTcw.rowRange(0, 3).col(3);
   mOw = -mRcw.t() * mtcw;
+
+  mTcwf = Converter::toSE3f(mTcw);
+  mOwf = mTcwf.Center();
 }
 
 bool Frame::isInFrustum(MapPoint *pMP, float viewingCosLimit) {
   pMP->mbTrackInView = false;
 
+  MapPointState state;
+  pMP->GetState(state);
+
   // 3D in absolute coordinates
-  cv::Mat P = pMP->GetWorldPos();
+  const Eigen::Vector3f P = state.WorldPosf();
 
   // 3D in camera coordinates
-  const cv::Mat Pc = mRcw * P + mtcw;
-  const float &PcX = Pc.at<float>(0);
-  const float &PcY = Pc.at<float>(1);
-  const float &PcZ = Pc.at<float>(2);
+  const Eigen::Vector3f Pc = mTcwf * P;
+  const float PcX = Pc(0);
+  const float PcY = Pc(1);
+  const float PcZ = Pc(2);
 
   // Check positive depth
   if (PcZ < 0.0f)
@@ -348,24 +312,22 @@ bool Frame::isInFrustum(MapPoint *pMP, float viewingCosLimit) {
     return false;
 
   // Check distance is in the scale invariance region of the MapPoint
-  const float maxDistance = pMP->GetMaxDistanceInvariance();
-  const float minDistance = pMP->GetMinDistanceInvariance();
-  const cv::Mat PO = P - mOw;
-  const float dist = cv::norm(PO);
+  const float maxDistance = state.MaxDistanceInvariance();
+  const float minDistance = state.MinDistanceInvariance();
+  const Eigen::Vector3f PO = P - mOwf;
+  const float dist = PO.norm();
 
   if (dist < minDistance || dist > maxDistance)
     return false;
 
   // Check viewing angle
-  cv::Mat Pn = pMP->GetNormal();
-
-  const float viewCos = PO.dot(Pn) / dist;
+  const float viewCos = PO.dot(state.Normalf()) / dist;
 
   if (viewCos < viewingCosLimit)
     return false;
 
   // Predict scale in the image
-  const int nPredictedLevel = pMP->PredictScale(dist, this);
+  const int nPredictedLevel = state.PredictScale(dist, this);
 
   // Data used by the tracking
   pMP->mbTrackInView = true;
@@ -378,55 +340,8 @@ bool Frame::isInFrustum(MapPoint *pMP, float viewingCosLimit) {
   return true;
 }
 
-// Rewrite GetFeaturesInArea()
 vector<size_t> Frame::GetFeaturesInArea(const int Ftype, const float &x, const float &y, const float &r, const int minLevel, const int maxLevel) const {
-  vector<size_t> vIndices;
-  vIndices.reserve(Channels[Ftype].N);
-
-  const int nMinCellX = max(0, (int)floor((x - mnMinX - r) * mfGridElementWidthInv));
-  if (nMinCellX >= FRAME_GRID_COLS)
-    return vIndices;
-
-  const int nMaxCellX = min((int)FRAME_GRID_COLS - 1, (int)ceil((x - mnMinX + r) * mfGridElementWidthInv));
-  if (nMaxCellX < 0)
-    return vIndices;
-
-  const int nMinCellY = max(0, (int)floor((y - mnMinY - r) * mfGridElementHeightInv));
-  if (nMinCellY >= FRAME_GRID_ROWS)
-    return vIndices;
-
-  const int nMaxCellY = min((int)FRAME_GRID_ROWS - 1, (int)ceil((y - mnMinY + r) * mfGridElementHeightInv));
-  if (nMaxCellY < 0)
-    return vIndices;
-
-  const bool bCheckLevels = (minLevel > 0) || (maxLevel >= 0);
-
-  for (int ix = nMinCellX; ix <= nMaxCellX; ix++) {
-    for (int iy = nMinCellY; iy <= nMaxCellY; iy++) {
-      const vector<size_t> vCell = Channels[Ftype].mGrid[ix][iy];
-      if (vCell.empty())
-        continue;
-
-      for (size_t j = 0, jend = vCell.size(); j < jend; j++) {
-        const cv::KeyPoint &kpUn = Channels[Ftype].mvKeysUn[vCell[j]];
-        if (bCheckLevels) {
-          if (kpUn.octave < minLevel)
-            continue;
-          if (maxLevel >= 0)
-            if (kpUn.octave > maxLevel)
-              continue;
-        }
-
-        const float distx = kpUn.pt.x - x;
-        const float disty = kpUn.pt.y - y;
-
-        if (fabs(distx) < r && fabs(disty) < r)
-          vIndices.push_back(vCell[j]);
-      }
-    }
-  }
-
-  return vIndices;
+  return Channels[Ftype].mpFeatures->GetFeaturesInArea(x, y, r, minLevel, maxLevel);
 }
 
 bool Frame::PosInGrid(const cv::KeyPoint &kp, int &posX, int &posY) {
@@ -441,23 +356,27 @@ bool Frame::PosInGrid(const cv::KeyPoint &kp, int &posX, int &posY) {
 }
 
 void Frame::ComputeBoW(const int Ftype) {
+  PROFILE_SCOPE_ARG("Frame::ComputeBoW", Ftype);
   if (Channels[Ftype].mBowVec.empty()) {
-    vector<cv::Mat> vCurrentDesc = Converter::toDescriptorVector(Channels[Ftype].mDescriptors);
+    vector<cv::Mat> vCurrentDesc = Converter::toDescriptorVector(Channels[Ftype].mpFeatures->mDescriptors);
     mpVocabulary[Ftype]->transform(vCurrentDesc, Channels[Ftype].mBowVec, Channels[Ftype].mFeatVec, 4);
   }
 }
 
-void Frame::UndistortKeyPoints(const int Ftype) {
-  if (mDistCoef.at<float>(0) == 0.0) {
-    Channels[Ftype].mvKeysUn = Channels[Ftype].mvKeys;
+void Frame::UndistortKeyPoints(FeatureStore &features, const int Ftype) {
+  PROFILE_SCOPE_ARG("Frame::UndistortKeyPoints", Ftype);
+  const int N = features.mvKeys.size();
+  if (mDistCoef.at<float>(0) == 0.0 || N == 0) {
+    features.mvKeysUn = features.mvKeys;
+    features.BuildArrays();
     return;
   }
 
   // Fill matrix with points
-  cv::Mat mat(Channels[Ftype].N, 2, CV_32F);
-  for (int i = 0; i < Channels[Ftype].N; i++) {
-    mat.at<float>(i, 0) = Channels[Ftype].mvKeys[i].pt.x;
-    mat.at<float>(i, 1) = Channels[Ftype].mvKeys[i].pt.y;
+  cv::Mat mat(N, 2, CV_32F);
+  for (int i = 0; i < N; i++) {
+    mat.at<float>(i, 0) = features.mvKeys[i].pt.x;
+    mat.at<float>(i, 1) = features.mvKeys[i].pt.y;
   }
 
   // Undistort points
@@ -466,13 +385,14 @@ void Frame::UndistortKeyPoints(const int Ftype) {
   mat = mat.reshape(1);
 
   // Fill undistorted keypoint vector
-  Channels[Ftype].mvKeysUn.resize(Channels[Ftype].N);
-  for (int i = 0; i < Channels[Ftype].N; i++) {
-    cv::KeyPoint kp = Channels[Ftype].mvKeys[i];
+  features.mvKeysUn.resize(N);
+  for (int i = 0; i < N; i++) {
+    cv::KeyPoint kp = features.mvKeys[i];
     kp.pt.x = mat.at<float>(i, 0);
     kp.pt.y = mat.at<float>(i, 1);
-    Channels[Ftype].mvKeysUn[i] = kp;
+    features.mvKeysUn[i] = kp;
   }
+  features.BuildArrays();
 }
 
 void Frame::ComputeImageBounds(const cv::Mat &imLeft) {
@@ -505,9 +425,11 @@ void Frame::ComputeImageBounds(const cv::Mat &imLeft) {
   }
 }
 
-void Frame::ComputeStereoMatches(const int Ftype) {
-  Channels[Ftype].mvuRight = vector<float>(Channels[Ftype].N, -1.0f);
-  Channels[Ftype].mvDepth = vector<float>(Channels[Ftype].N, -1.0f);
+void Frame::ComputeStereoMatches(FeatureStore &features, const int Ftype) {
+  PROFILE_SCOPE_ARG("Frame::ComputeStereoMatches", Ftype);
+  const int N = features.mvKeys.size();
+  features.mvuRight = vector<float>(N, -1.0f);
+  features.mvDepth = vector<float>(N, -1.0f);
 
   const int thOrbDist = (Associater::TH_HIGH + Associater::TH_LOW) / 2;
 
@@ -518,12 +440,12 @@ void Frame::ComputeStereoMatches(const int Ftype) {
   for (int i = 0; i < nRows; i++)
     vRowIndices[i].reserve(200);
 
-  const int Nr =  Channels[Ftype].mvKeysRight.size();
+  const int Nr =  features.mvKeysRight.size();
 
   for (int iR = 0; iR < Nr; iR++) {
-    const cv::KeyPoint &kp = Channels[Ftype].mvKeysRight[iR];
+    const cv::KeyPoint &kp = features.mvKeysRight[iR];
     const float &kpY = kp.pt.y;
-    const float r = 2.0f * mvScaleFactors[Channels[Ftype].mvKeysRight[iR].octave];
+    const float r = 2.0f * mvScaleFactors[features.mvKeysRight[iR].octave];
     const int maxr = ceil(kpY + r);
     const int minr = floor(kpY - r);
 
@@ -538,10 +460,10 @@ void Frame::ComputeStereoMatches(const int Ftype) {
 
   // For each left keypoint search a match in the right image
   vector<pair<int, int>> vDistIdx;
-  vDistIdx.reserve(Channels[Ftype].N);
+  vDistIdx.reserve(N);
 
-  for (int iL = 0; iL < Channels[Ftype].N; iL++) {
-    const cv::KeyPoint &kpL = Channels[Ftype].mvKeys[iL];
+  for (int iL = 0; iL < N; iL++) {
+    const cv::KeyPoint &kpL = features.mvKeys[iL];
     const int &levelL = kpL.octave;
     const float &vL = kpL.pt.y;
     const float &uL = kpL.pt.x;
@@ -560,12 +482,12 @@ void Frame::ComputeStereoMatches(const int Ftype) {
     int bestDist = Associater::TH_HIGH;
     size_t bestIdxR = 0;
 
-    const cv::Mat &dL = Channels[Ftype].mDescriptors.row(iL);
+    const cv::Mat &dL = features.mDescriptors.row(iL);
 
     // Compare descriptor to right keypoints
     for (size_t iC = 0; iC < vCandidates.size(); iC++) {
       const size_t iR = vCandidates[iC];
-      const cv::KeyPoint &kpR = Channels[Ftype].mvKeysRight[iR];
+      const cv::KeyPoint &kpR = features.mvKeysRight[iR];
 
       if (kpR.octave < levelL - 1 || kpR.octave > levelL + 1)
         continue;
@@ -573,7 +495,7 @@ void Frame::ComputeStereoMatches(const int Ftype) {
       const float &uR = kpR.pt.x;
 
       if (uR >= minU && uR <= maxU) {
-        const cv::Mat &dR = Channels[Ftype].mDescriptorsRight.row(iR);
+        const cv::Mat &dR = features.mDescriptorsRight.row(iR);
         const int dist = Associater::DescriptorDistance(dL, dR);
 
         if (dist < bestDist) {
@@ -586,7 +508,7 @@ void Frame::ComputeStereoMatches(const int Ftype) {
     // Subpixel match by correlation
     if (bestDist < thOrbDist) {
       // coordinates in image pyramid at keypoint scale
-      const float uR0 = Channels[Ftype].mvKeysRight[bestIdxR].pt.x;
+      const float uR0 = features.mvKeysRight[bestIdxR].pt.x;
       const float scaleFactor = mvInvScaleFactors[kpL.octave];
       const float scaleduL = round(kpL.pt.x * scaleFactor);
       const float scaledvL = round(kpL.pt.y * scaleFactor);
@@ -646,8 +568,8 @@ void Frame::ComputeStereoMatches(const int Ftype) {
           disparity = 0.01;
           bestuR = uL - 0.01;
         }
-        Channels[Ftype].mvDepth[iL] = mbf / disparity;
-        Channels[Ftype].mvuRight[iL] = bestuR;
+        features.mvDepth[iL] = mbf / disparity;
+        features.mvuRight[iL] = bestuR;
         vDistIdx.push_back(pair<int, int>(bestDist, iL));
       }
     }
@@ -661,19 +583,21 @@ void Frame::ComputeStereoMatches(const int Ftype) {
     if (vDistIdx[i].first < thDist)
       break;
     else {
-      Channels[Ftype].mvuRight[vDistIdx[i].second] = -1;
-      Channels[Ftype].mvDepth[vDistIdx[i].second] = -1;
+      features.mvuRight[vDistIdx[i].second] = -1;
+      features.mvDepth[vDistIdx[i].second] = -1;
     }
   }
 }
 
-void Frame::ComputeStereoFromRGBD(const cv::Mat &imDepth, const int Ftype) {
-  Channels[Ftype].mvuRight = vector<float>(Channels[Ftype].N, -1);
-  Channels[Ftype].mvDepth = vector<float>(Channels[Ftype].N, -1);
+void Frame::ComputeStereoFromRGBD(const cv::Mat &imDepth, FeatureStore &features, const int Ftype) {
+  PROFILE_SCOPE_ARG("Frame::ComputeStereoFromRGBD", Ftype);
+  const int N = features.mvKeys.size();
+  features.mvuRight = vector<float>(N, -1);
+  features.mvDepth = vector<float>(N, -1);
 
-  for (int i = 0; i < Channels[Ftype].N; i++) {
-    const cv::KeyPoint &kp = Channels[Ftype].mvKeys[i];
-    const cv::KeyPoint &kpU = Channels[Ftype].mvKeysUn[i];
+  for (int i = 0; i < N; i++) {
+    const cv::KeyPoint &kp = features.mvKeys[i];
+    const cv::KeyPoint &kpU = features.mvKeysUn[i];
 
     const float &v = kp.pt.y;
     const float &u = kp.pt.x;
@@ -682,17 +606,18 @@ void Frame::ComputeStereoFromRGBD(const cv::Mat &imDepth, const int Ftype) {
 
     // if(d>0)
     if (d > 0.1f && d < 20.f) {
-      Channels[Ftype].mvDepth[i] = d;
-      Channels[Ftype].mvuRight[i] = kpU.pt.x - mbf / d;
+      features.mvDepth[i] = d;
+      features.mvuRight[i] = kpU.pt.x - mbf / d;
     }
   }
 }
 
 cv::Mat Frame::UnprojectStereo(const int &i, const int Ftype) {
-  const float z = Channels[Ftype].mvDepth[i];
+  const FeatureStore &features = *Channels[Ftype].mpFeatures;
+  const float z = features.mvDepth[i];
   if (z > 0) {
-    const float u = Channels[Ftype].mvKeysUn[i].pt.x;
-    const float v = Channels[Ftype].mvKeysUn[i].pt.y;
+    const float u = features.mvX[i];
+    const float v = features.mvY[i];
     const float x = (u - cx) * z * invfx;
     const float y = (v - cy) * z * invfy;
     cv::Mat x3Dc = (cv::Mat_<float>(3, 1) << x, y, z);
@@ -702,95 +627,68 @@ cv::Mat Frame::UnprojectStereo(const int &i, const int Ftype) {
 }
 
 void Frame::ComputeFeaturesRGBD(const int Ftype, const cv::Mat &imGray, const cv::Mat &imDepth) {
-  // Feature extraction
-  
-  // cout << "ExtractFeatures (before)" << Ftype << endl;
+  shared_ptr<FeatureStore> pFeatures = make_shared<FeatureStore>();
 
-  ExtractFeatures(Ftype, 0, imGray);
-
-  // cout << "ExtractFeatures (after)" << Ftype << endl;
-
-
-  Channels[Ftype].N = Channels[Ftype].mvKeys.size();
-  
-  if (Channels[Ftype].mvKeys.empty())
-    return;
+  // Feature extraction
+  ExtractFeatures(*pFeatures, Ftype, 0, imGray);
 
-  
   // mvKeysUn, Left image
-  UndistortKeyPoints(Ftype);
-  // UndistortKeyPoints(Channels[Ftype].mvKeys, Channels[Ftype].mvKeysUn, Channels[Ftype].N);
+  UndistortKeyPoints(*pFeatures, Ftype);
 
-  // cout << "UndistortKeyPoints" << Ftype << endl;
-  
   // compute mvuRight and mvDepth
-  ComputeStereoFromRGBD(imDepth, Ftype);
-  // ComputeStereoFromRGBD(imDepth, Channels[Ftype].mvuRight, Channels[Ftype].mvDepth, Channels[Ftype].N, Channels[Ftype].mvKeys, Channels[Ftype].mvKeysUn);  
-
-  // cout << "ComputeStereoFromRGBD" << Ftype << endl;
-
-  // map points
-  Channels[Ftype].mvpMapPoints = vector<MapPoint *>(Channels[Ftype].N, static_cast<MapPoint *>(NULL));
-
-  // outliers
-  Channels[Ftype].mvbOutlier = vector<bool>(Channels[Ftype].N, false);
+  ComputeStereoFromRGBD(imDepth, *pFeatures, Ftype);
 
-  
-  AssignFeaturesToGrid(Ftype);
-  //AssignFeaturesToGrid(Channels[Ftype].N, Channels[Ftype].mvKeysUn, Channels[Ftype].mGrid);
-  // cout << "AssignFeaturesToGrid" << Ftype << endl;
+  AssignFeaturesToGrid(*pFeatures, Ftype);
+  PublishFeatures(Ftype, pFeatures);
 }
 
 void Frame::ComputeFeaturesStereo(const int Ftype, const cv::Mat &imLeft, const cv::Mat &imRight) {
+  shared_ptr<FeatureStore> pFeatures = make_shared<FeatureStore>();
+
   // Feature extraction
-  thread threadLeft(&Frame::ExtractFeatures, this, Ftype, 0, imLeft);
-  thread threadRight(&Frame::ExtractFeatures, this, Ftype, 1, imRight);
-  threadLeft.join();
-  threadRight.join();
-
-  Channels[Ftype].N = Channels[Ftype].mvKeys.size();
-  
-  if (Channels[Ftype].mvKeys.empty())
-    return;
+  TaskGroup images(mpThreadPool);
+  images.Run([this, Ftype, &pFeatures, &imLeft] { ExtractFeatures(*pFeatures, Ftype, 0, imLeft); }, "Frame::ExtractFeaturesLeft");
+  images.Run([this, Ftype, &pFeatures, &imRight] { ExtractFeatures(*pFeatures, Ftype, 1, imRight); }, "Frame::ExtractFeaturesRight");
+  images.Wait();
 
   // mvKeysUn, Left image
-  UndistortKeyPoints(Ftype);
+  UndistortKeyPoints(*pFeatures, Ftype);
 
   // compute mvuRight and mvDepth
-  ComputeStereoMatches(Ftype);
-  
-  // map points
-  Channels[Ftype].mvpMapPoints = vector<MapPoint *>(Channels[Ftype].N, static_cast<MapPoint *>(NULL));
-
-  // outliers
-  Channels[Ftype].mvbOutlier = vector<bool>(Channels[Ftype].N, false);
+  if (!pFeatures->mvKeys.empty())
+    ComputeStereoMatches(*pFeatures, Ftype);
 
-  AssignFeaturesToGrid(Ftype);
+  AssignFeaturesToGrid(*pFeatures, Ftype);
+  PublishFeatures(Ftype, pFeatures);
 }
 
 void Frame::ComputeFeaturesMono(const int Ftype, const cv::Mat &imGray) {
-  // Feature extraction
-  ExtractFeatures(Ftype, 0, imGray);
+  shared_ptr<FeatureStore> pFeatures = make_shared<FeatureStore>();
 
-  Channels[Ftype].N = Channels[Ftype].mvKeys.size();
-  
-  if (Channels[Ftype].mvKeys.empty())
-    return;
+  // Feature extraction
+  ExtractFeatures(*pFeatures, Ftype, 0, imGray);
 
   // mvKeysUn, Left image
-  UndistortKeyPoints(Ftype);
+  UndistortKeyPoints(*pFeatures, Ftype);
 
   // Set no stereo information
-  Channels[Ftype].mvuRight = vector<float>(Channels[Ftype].N, -1);
-  Channels[Ftype].mvDepth = vector<float>(Channels[Ftype].N, -1);
+  pFeatures->mvuRight = vector<float>(pFeatures->mvKeys.size(), -1);
+  pFeatures->mvDepth = vector<float>(pFeatures->mvKeys.size(), -1);
+
+  AssignFeaturesToGrid(*pFeatures, Ftype);
+  PublishFeatures(Ftype, pFeatures);
+}
+
+void Frame::PublishFeatures(const int Ftype, shared_ptr<const FeatureStore> pFeatures) {
+  FeaturePoint &channel = Channels[Ftype];
+  channel.N = pFeatures->mvKeys.size();
+  channel.mpFeatures = move(pFeatures);
 
   // map points
-  Channels[Ftype].mvpMapPoints = vector<MapPoint *>(Channels[Ftype].N, static_cast<MapPoint *>(NULL));
+  channel.mvpMapPoints = vector<MapPoint *>(channel.N, static_cast<MapPoint *>(NULL));
 
   // outliers
-  Channels[Ftype].mvbOutlier = vector<bool>(Channels[Ftype].N, false);
-
-  AssignFeaturesToGrid(Ftype);
+  channel.mvbOutlier = vector<bool>(channel.N, false);
 }
 
 // Rewrite UndistortKeyPoints
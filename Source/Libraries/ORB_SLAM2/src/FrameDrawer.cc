@@ -142,14 +142,14 @@ void FrameDrawer::DrawTextInfo(cv::Mat &im, int nState, cv::Mat &imText) {
 void FrameDrawer::Update(Tracking *pTracker) {
   unique_lock<mutex> lock(mMutex);
   pTracker->mImGray.copyTo(mIm);
-  mvCurrentKeys = pTracker->mCurrentFrame.Channels[mFtype].mvKeys;
+  mvCurrentKeys = pTracker->mCurrentFrame.Channels[mFtype].mpFeatures->mvKeys;
   N = mvCurrentKeys.size();
   mvbVO = std::vector<bool>(N, false);
   mvbMap = std::vector<bool>(N, false);
   mbOnlyTracking = pTracker->mbOnlyTracking;
 
   if (pTracker->mLastProcessedState == Tracking::NOT_INITIALIZED) {
-    mvIniKeys = pTracker->mInitialFrame.Channels[mFtype].mvKeys;
+    mvIniKeys = pTracker->mInitialFrame.Channels[mFtype].mpFeatures->mvKeys;
     mvIniMatches = pTracker->mvIniMatches[mFtype];
   } else if (pTracker->mLastProcessedState == Tracking::OK) {
     for (int i = 0; i < N; i++) {
@@ -0,0 +1,282 @@
+#include "HammingDistance.h"
+
+#include <atomic>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAMMING_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) || defined(__ARM_NEON)
+#define HAMMING_NEON 1
+#include <arm_neon.h>
+#endif
+
+using namespace ::std;
+
+namespace ORB_SLAM2 {
+
+namespace {
+
+typedef int (*RowFunc)(const uint8_t *, const uint8_t *);
+typedef void (*RowsFunc)(const uint8_t *, const uint8_t *, size_t, int *);
+
+struct KernelTable {
+  HammingDistance::Kernel kernel;
+  const char *name;
+  RowFunc d32;
+  RowFunc d64;
+  RowsFunc rows32;
+};
+
+// Scalar kernels
+
+inline uint64_t Load64(const uint8_t *p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline int ScalarN(const uint8_t *a, const uint8_t *b, int nbytes) {
+  int dist = 0;
+  int i = 0;
+  for (; i + 8 <= nbytes; i += 8)
+    dist += __builtin_popcountll(Load64(a + i) ^ Load64(b + i));
+  for (; i < nbytes; i++)
+    dist += __builtin_popcount(a[i] ^ b[i]);
+  return dist;
+}
+
+int Scalar32(const uint8_t *a, const uint8_t *b) {
+  return __builtin_popcountll(Load64(a) ^ Load64(b)) + __builtin_popcountll(Load64(a + 8) ^ Load64(b + 8)) +
+         __builtin_popcountll(Load64(a + 16) ^ Load64(b + 16)) + __builtin_popcountll(Load64(a + 24) ^ Load64(b + 24));
+}
+
+int Scalar64(const uint8_t *a, const uint8_t *b) {
+  return Scalar32(a, b) + Scalar32(a + 32, b + 32);
+}
+
+void ScalarRows32(const uint8_t *q, const uint8_t *rows, size_t n, int *out) {
+  const uint64_t q0 = Load64(q), q1 = Load64(q + 8), q2 = Load64(q + 16), q3 = Load64(q + 24);
+  for (size_t i = 0; i < n; i++, rows += 32)
+    out[i] = __builtin_popcountll(q0 ^ Load64(rows)) + __builtin_popcountll(q1 ^ Load64(rows + 8)) +
+             __builtin_popcountll(q2 ^ Load64(rows + 16)) + __builtin_popcountll(q3 ^ Load64(rows + 24));
+}
+
+const KernelTable kScalar = {HammingDistance::SCALAR, "scalar", Scalar32, Scalar64, ScalarRows32};
+
+#ifdef HAMMING_X86
+
+// AVX2: nibble lookup popcount (Mula), bytes summed with vpsadbw
+
+__attribute__((target("avx2"))) inline __m256i Popcount256(__m256i v) {
+  const __m256i lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                       0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i low = _mm256_set1_epi8(0x0f);
+  const __m256i lo = _mm256_shuffle_epi8(lut, _mm256_and_si256(v, low));
+  const __m256i hi = _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(v, 4), low));
+  return _mm256_sad_epu8(_mm256_add_epi8(lo, hi), _mm256_setzero_si256());
+}
+
+// The lane sums fit their low 32 bits, the 64 bit extracts do not exist on
+// 32-bit x86
+__attribute__((target("avx2"))) inline int Sum256(__m256i v) {
+  const __m128i s = _mm_add_epi64(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+  return _mm_cvtsi128_si32(s) + _mm_extract_epi32(s, 2);
+}
+
+__attribute__((target("avx2"))) int Avx2_32(const uint8_t *a, const uint8_t *b) {
+  const __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a));
+  const __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b));
+  return Sum256(Popcount256(_mm256_xor_si256(va, vb)));
+}
+
+__attribute__((target("avx2"))) int Avx2_64(const uint8_t *a, const uint8_t *b) {
+  const __m256i x0 = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(a)),
+                                      _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b)));
+  const __m256i x1 = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + 32)),
+                                      _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + 32)));
+  return Sum256(_mm256_add_epi64(Popcount256(x0), Popcount256(x1)));
+}
+
+__attribute__((target("avx2"))) void Avx2Rows32(const uint8_t *q, const uint8_t *rows, size_t n, int *out) {
+  const __m256i vq = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(q));
+  for (size_t i = 0; i < n; i++, rows += 32)
+    out[i] = Sum256(Popcount256(_mm256_xor_si256(vq, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(rows)))));
+}
+
+const KernelTable kAvx2 = {HammingDistance::AVX2, "avx2", Avx2_32, Avx2_64, Avx2Rows32};
+
+// AVX-512 VPOPCNTDQ: native 64 bit lane popcount. Kept on 256 bit registers
+// (AVX512VL) so the wide units do not drop the core frequency.
+
+__attribute__((target("avx2,avx512f,avx512vl,avx512vpopcntdq"))) inline __m256i Xcnt256(const uint8_t *a, const uint8_t *b) {
+  const __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a));
+  const __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b));
+  return _mm256_popcnt_epi64(_mm256_xor_si256(va, vb));
+}
+
+__attribute__((target("avx2,avx512f,avx512vl,avx512vpopcntdq"))) int Avx512_32(const uint8_t *a, const uint8_t *b) {
+  return Sum256(Xcnt256(a, b));
+}
+
+__attribute__((target("avx2,avx512f,avx512vl,avx512vpopcntdq"))) int Avx512_64(const uint8_t *a, const uint8_t *b) {
+  return Sum256(_mm256_add_epi64(Xcnt256(a, b), Xcnt256(a + 32, b + 32)));
+}
+
+__attribute__((target("avx2,avx512f,avx512vl,avx512vpopcntdq"))) void Avx512Rows32(const uint8_t *q, const uint8_t *rows,
+                                                                                   size_t n, int *out) {
+  const __m256i vq = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(q));
+  for (size_t i = 0; i < n; i++, rows += 32)
+    out[i] = Sum256(_mm256_popcnt_epi64(_mm256_xor_si256(vq, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(rows)))));
+}
+
+const KernelTable kAvx512 = {HammingDistance::AVX512, "avx512-vpopcntdq", Avx512_32, Avx512_64, Avx512Rows32};
+
+#endif // HAMMING_X86
+
+#ifdef HAMMING_NEON
+
+// NEON: per byte vcnt, widened horizontal add
+
+inline uint8x16_t Xcnt(const uint8_t *a, const uint8_t *b) {
+  return vcntq_u8(veorq_u8(vld1q_u8(a), vld1q_u8(b)));
+}
+
+// Horizontal sum of the byte counts, vaddlvq_u8 only exists on AArch64
+inline int SumBytes(uint8x16_t c) {
+#ifdef __aarch64__
+  return int(vaddlvq_u8(c));
+#else
+  const uint64x2_t s = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(c)));
+  return int(vgetq_lane_u64(s, 0) + vgetq_lane_u64(s, 1));
+#endif
+}
+
+int Neon32(const uint8_t *a, const uint8_t *b) {
+  const uint8x16_t c = vaddq_u8(Xcnt(a, b), Xcnt(a + 16, b + 16));
+  return SumBytes(c);
+}
+
+int Neon64(const uint8_t *a, const uint8_t *b) {
+  const uint8x16_t c0 = vaddq_u8(Xcnt(a, b), Xcnt(a + 16, b + 16));
+  const uint8x16_t c1 = vaddq_u8(Xcnt(a + 32, b + 32), Xcnt(a + 48, b + 48));
+  return SumBytes(c0) + SumBytes(c1);
+}
+
+void NeonRows32(const uint8_t *q, const uint8_t *rows, size_t n, int *out) {
+  const uint8x16_t q0 = vld1q_u8(q), q1 = vld1q_u8(q + 16);
+  for (size_t i = 0; i < n; i++, rows += 32) {
+    const uint8x16_t c = vaddq_u8(vcntq_u8(veorq_u8(q0, vld1q_u8(rows))), vcntq_u8(veorq_u8(q1, vld1q_u8(rows + 16))));
+    out[i] = SumBytes(c);
+  }
+}
+
+const KernelTable kNeon = {HammingDistance::NEON, "neon", Neon32, Neon64, NeonRows32};
+
+#endif // HAMMING_NEON
+
+bool Supported(HammingDistance::Kernel k) {
+  switch (k) {
+  case HammingDistance::SCALAR:
+    return true;
+#ifdef HAMMING_X86
+  case HammingDistance::AVX2:
+    return __builtin_cpu_supports("avx2");
+  case HammingDistance::AVX512:
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("avx512vl") &&
+           __builtin_cpu_supports("avx512vpopcntdq");
+#endif
+#ifdef HAMMING_NEON
+  case HammingDistance::NEON:
+    return true;
+#endif
+  default:
+    return false;
+  }
+}
+
+const KernelTable *Table(HammingDistance::Kernel k) {
+  switch (k) {
+#ifdef HAMMING_X86
+  case HammingDistance::AVX2:
+    return &kAvx2;
+  case HammingDistance::AVX512:
+    return &kAvx512;
+#endif
+#ifdef HAMMING_NEON
+  case HammingDistance::NEON:
+    return &kNeon;
+#endif
+  default:
+    return &kScalar;
+  }
+}
+
+const KernelTable *SelectBest() {
+#ifdef HAMMING_X86
+  __builtin_cpu_init();
+#endif
+  const HammingDistance::Kernel order[] = {HammingDistance::AVX512, HammingDistance::AVX2, HammingDistance::NEON};
+  for (HammingDistance::Kernel k : order)
+    if (Supported(k))
+      return Table(k);
+  return &kScalar;
+}
+
+atomic<const KernelTable *> &Active() {
+  static atomic<const KernelTable *> table(SelectBest());
+  return table;
+}
+
+} // namespace
+
+int HammingDistance::Distance(const uint8_t *a, const uint8_t *b, int nbytes) {
+  const KernelTable *t = Active().load(memory_order_relaxed);
+  if (nbytes == 32)
+    return t->d32(a, b);
+  if (nbytes == 64)
+    return t->d64(a, b);
+  return ScalarN(a, b, nbytes);
+}
+
+void HammingDistance::DistanceOneToMany(const uint8_t *query, const uint8_t *data, size_t stride, int nbytes,
+                                        const size_t *vIdx, size_t n, int *out) {
+  const KernelTable *t = Active().load(memory_order_relaxed);
+  RowFunc f = nbytes == 32 ? t->d32 : (nbytes == 64 ? t->d64 : nullptr);
+  if (f) {
+    for (size_t i = 0; i < n; i++) {
+      // Candidates are usually clustered in a few grid cells, warm the next row
+      if (i + 1 < n)
+        __builtin_prefetch(data + vIdx[i + 1] * stride);
+      out[i] = f(query, data + vIdx[i] * stride);
+    }
+  } else {
+    for (size_t i = 0; i < n; i++)
+      out[i] = ScalarN(query, data + vIdx[i] * stride, nbytes);
+  }
+}
+
+void HammingDistance::DistanceToRows(const uint8_t *query, const uint8_t *rows, int nbytes, size_t n, int *out) {
+  if (nbytes == 32) {
+    Active().load(memory_order_relaxed)->rows32(query, rows, n, out);
+    return;
+  }
+  for (size_t i = 0; i < n; i++)
+    out[i] = Distance(query, rows + i * nbytes, nbytes);
+}
+
+HammingDistance::Kernel HammingDistance::ActiveKernel() {
+  return Active().load()->kernel;
+}
+
+const char *HammingDistance::KernelName() {
+  return Active().load()->name;
+}
+
+void HammingDistance::SetKernel(Kernel k) {
+  Active().store(Supported(k) ? Table(k) : &kScalar);
+}
+
+} // namespace ORB_SLAM2
@@ -0,0 +1,254 @@
+#include "ImageSource.h"
+#include "Profiler.h"
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include <opencv2/calib3d.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+using namespace ::std;
+
+namespace ORB_SLAM2 {
+
+bool ImageSequence::LoadKITTI(const string &strPath, bool bStereo) {
+  ifstream f(strPath + "/times.txt");
+  if (!f.is_open()) {
+    cerr << "Could not find the timestamp file " << strPath << "/times.txt" << endl;
+    return false;
+  }
+
+  string line;
+  while (getline(f, line)) {
+    if (line.empty())
+      continue;
+    stringstream ss;
+    ss << setfill('0') << setw(6) << mvTimestamps.size();
+    mvTimestamps.push_back(stod(line));
+    mvImage0.push_back(strPath + "/image_0/" + ss.str() + ".png");
+    if (bStereo)
+      mvImage1.push_back(strPath + "/image_1/" + ss.str() + ".png");
+  }
+  return !empty();
+}
+
+bool ImageSequence::LoadTUM(const string &strPath, const string &strAssociationFile) {
+  const bool bRGBD = !strAssociationFile.empty();
+  const string strFile = bRGBD ? strAssociationFile : strPath + "/rgb.txt";
+  ifstream f(strFile);
+  if (!f.is_open()) {
+    cerr << "Could not find the " << (bRGBD ? "associations" : "image list") << " file " << strFile << endl;
+    return false;
+  }
+
+  string line;
+  while (getline(f, line)) {
+    // rgb.txt starts with a commented header
+    if (line.empty() || line[0] == '#')
+      continue;
+    stringstream ss(line);
+    double t, tD;
+    string strRGB, strD;
+    ss >> t >> strRGB;
+    if (bRGBD) {
+      ss >> tD >> strD;
+      mvImage1.push_back(strPath + "/" + strD);
+    }
+    mvTimestamps.push_back(t);
+    mvImage0.push_back(strPath + "/" + strRGB);
+  }
+  return !empty();
+}
+
+bool ImageSequence::LoadEuRoC(const string &strPath, bool bStereo) {
+  ifstream f(strPath + "/cam0/data.csv");
+  if (!f.is_open()) {
+    cerr << "Could not find the image list " << strPath << "/cam0/data.csv" << endl;
+    return false;
+  }
+
+  string line;
+  while (getline(f, line)) {
+    if (line.empty() || line[0] == '#')
+      continue;
+    const string strStamp = line.substr(0, line.find(','));
+    mvTimestamps.push_back(stod(strStamp) / 1e9);
+    mvImage0.push_back(strPath + "/cam0/data/" + strStamp + ".png");
+    if (bStereo)
+      mvImage1.push_back(strPath + "/cam1/data/" + strStamp + ".png");
+  }
+  return !empty();
+}
+
+bool ImageSequence::LoadEuRoC(const string &strLeftFolder, const string &strRightFolder, const string &strTimesFile) {
+  ifstream f(strTimesFile);
+  if (!f.is_open()) {
+    cerr << "Could not find the timestamp file " << strTimesFile << endl;
+    return false;
+  }
+
+  string line;
+  while (getline(f, line)) {
+    stringstream ss(line);
+    string strStamp;
+    ss >> strStamp;
+    if (strStamp.empty())
+      continue;
+    mvTimestamps.push_back(stod(strStamp) / 1e9);
+    mvImage0.push_back(strLeftFolder + "/" + strStamp + ".png");
+    if (!strRightFolder.empty())
+      mvImage1.push_back(strRightFolder + "/" + strStamp + ".png");
+  }
+  return !empty();
+}
+
+void ImageSequence::Truncate(size_t n) {
+  if (n >= size())
+    return;
+  mvTimestamps.resize(n);
+  mvImage0.resize(n);
+  if (!mvImage1.empty())
+    mvImage1.resize(n);
+}
+
+ImageSource::ImageSource(const ImageSequence &seq, size_t nQueueDepth, int nDecodeThreads)
+    : mSeq(seq), mnDepth(max<size_t>(1, nQueueDepth)), mnThreads(max(1, nDecodeThreads)), mnColorConversion(-1),
+      mbRectify(false), mnFrames(0), mnNextDecode(0), mnNextOut(0), mbStop(false) {}
+
+ImageSource::~ImageSource() { Stop(); }
+
+void ImageSource::SetColorConversion(int code) { mnColorConversion = code; }
+
+bool ImageSource::SetRectification(const string &strSettingsFile) {
+  cv::FileStorage fSettings(strSettingsFile, cv::FileStorage::READ);
+  if (!fSettings.isOpened()) {
+    cerr << "Failed to open settings file at: " << strSettingsFile << endl;
+    return false;
+  }
+
+  cv::Mat K_l, K_r, P_l, P_r, R_l, R_r, D_l, D_r;
+  fSettings["LEFT.K"] >> K_l;
+  fSettings["RIGHT.K"] >> K_r;
+  fSettings["LEFT.P"] >> P_l;
+  fSettings["RIGHT.P"] >> P_r;
+  fSettings["LEFT.R"] >> R_l;
+  fSettings["RIGHT.R"] >> R_r;
+  fSettings["LEFT.D"] >> D_l;
+  fSettings["RIGHT.D"] >> D_r;
+  const int rows_l = fSettings["LEFT.height"];
+  const int cols_l = fSettings["LEFT.width"];
+  const int rows_r = fSettings["RIGHT.height"];
+  const int cols_r = fSettings["RIGHT.width"];
+
+  if (K_l.empty() || K_r.empty() || P_l.empty() || P_r.empty() || R_l.empty() || R_r.empty() || D_l.empty() ||
+      D_r.empty() || rows_l == 0 || rows_r == 0 || cols_l == 0 || cols_r == 0)
+    return false;
+
+  cv::initUndistortRectifyMap(K_l, D_l, R_l, P_l.rowRange(0, 3).colRange(0, 3), cv::Size(cols_l, rows_l), CV_32F,
+                              mM1l, mM2l);
+  cv::initUndistortRectifyMap(K_r, D_r, R_r, P_r.rowRange(0, 3).colRange(0, 3), cv::Size(cols_r, rows_r), CV_32F,
+                              mM1r, mM2r);
+  mbRectify = true;
+  return true;
+}
+
+void ImageSource::Start(size_t nFrames) {
+  Stop();
+
+  mnFrames = nFrames == 0 ? mSeq.size() : min(nFrames, mSeq.size());
+  mnNextDecode = 0;
+  mnNextOut = 0;
+  mmReady.clear();
+  mbStop = false;
+
+  mvThreads.reserve(mnThreads);
+  for (int i = 0; i < mnThreads; i++)
+    mvThreads.emplace_back(&ImageSource::DecodeLoop, this);
+}
+
+bool ImageSource::Next(ImageFrame &frame) {
+  {
+    unique_lock<mutex> lock(mMutex);
+    if (mnNextOut >= mnFrames)
+      return false;
+    mCondReady.wait(lock, [this] { return mbStop || mmReady.count(mnNextOut); });
+    if (mbStop)
+      return false;
+
+    map<size_t, ImageFrame>::iterator it = mmReady.find(mnNextOut);
+    frame = move(it->second);
+    mmReady.erase(it);
+    mnNextOut++;
+  }
+  mCondSpace.notify_all();
+  return true;
+}
+
+void ImageSource::Stop() {
+  {
+    unique_lock<mutex> lock(mMutex);
+    mbStop = true;
+  }
+  mCondSpace.notify_all();
+  mCondReady.notify_all();
+
+  for (thread &t : mvThreads)
+    t.join();
+  mvThreads.clear();
+}
+
+ImageFrame ImageSource::Load(size_t i) const {
+  PROFILE_SCOPE("ImageSource::Load");
+  ImageFrame frame;
+  frame.index = i;
+  frame.timestamp = mSeq.mvTimestamps[i];
+  frame.im0 = cv::imread(mSeq.mvImage0[i], cv::IMREAD_UNCHANGED);
+  if (mSeq.HasSecondImage())
+    frame.im1 = cv::imread(mSeq.mvImage1[i], cv::IMREAD_UNCHANGED);
+
+  frame.valid = !frame.im0.empty() && (!mSeq.HasSecondImage() || !frame.im1.empty());
+  if (!frame.valid)
+    return frame;
+
+  if (mnColorConversion >= 0)
+    cv::cvtColor(frame.im0, frame.im0, mnColorConversion);
+
+  if (mbRectify) {
+    cv::Mat imLeftRect, imRightRect;
+    cv::remap(frame.im0, imLeftRect, mM1l, mM2l, cv::INTER_LINEAR);
+    frame.im0 = imLeftRect;
+    if (!frame.im1.empty()) {
+      cv::remap(frame.im1, imRightRect, mM1r, mM2r, cv::INTER_LINEAR);
+      frame.im1 = imRightRect;
+    }
+  }
+  return frame;
+}
+
+void ImageSource::DecodeLoop() {
+  PROFILE_THREAD_NAME("ImageDecoder");
+  while (true) {
+    size_t i;
+    {
+      unique_lock<mutex> lock(mMutex);
+      // Never run more than mnDepth frames ahead of the consumer
+      mCondSpace.wait(lock, [this] { return mbStop || mnNextDecode >= mnFrames || mnNextDecode < mnNextOut + mnDepth; });
+      if (mbStop || mnNextDecode >= mnFrames)
+        return;
+      i = mnNextDecode++;
+    }
+
+    ImageFrame frame = Load(i);
+
+    {
+      unique_lock<mutex> lock(mMutex);
+      mmReady.emplace(i, move(frame));
+    }
+    mCondReady.notify_all();
+  }
+}
+
+} // namespace ORB_SLAM2
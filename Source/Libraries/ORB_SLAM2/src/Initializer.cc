@@ -41,7 +41,7 @@ Initializer::Initializer(const Frame &ReferenceFrame, int Ntype, float sigma, in
   mK = ReferenceFrame.mK.clone();
 
   for (int Ftype = 0; Ftype < Ntype; Ftype++)
-    mvKeys1[Ftype] = ReferenceFrame.Channels[Ftype].mvKeysUn;
+    mvKeys1[Ftype] = ReferenceFrame.Channels[Ftype].mpFeatures->mvKeysUn;
 
   mSigma = sigma;
   mSigma2 = sigma * sigma;
@@ -54,7 +54,7 @@ bool Initializer::Initialize(const Frame &CurrentFrame, const std::vector<std::v
   // Fill structures with current keypoints and matches with reference frame
   // Reference Frame: 1, Current Frame: 2
   for (int Ftype = 0; Ftype < Ntype; Ftype++)
-    mvKeys2[Ftype] = CurrentFrame.Channels[Ftype].mvKeysUn;
+    mvKeys2[Ftype] = CurrentFrame.Channels[Ftype].mpFeatures->mvKeysUn;
 
   for (int Ftype = 0; Ftype < Ntype; Ftype++) {
     mvMatches12[Ftype].clear();
@@ -220,7 +220,7 @@ bool Initializer::Initialize2(const Frame &CurrentFrame, const std::vector<std::
   std::vector<bool> vbMatched1all;
 
   for (int Ftype = 0; Ftype < Ntype; Ftype++)
-    mvKeys2[Ftype] = CurrentFrame.Channels[Ftype].mvKeysUn;
+    mvKeys2[Ftype] = CurrentFrame.Channels[Ftype].mpFeatures->mvKeysUn;
   
   int nKeys1 = 0, nKeys2 = 0;
   for (int Ftype = 0; Ftype < Ntype; Ftype++) {
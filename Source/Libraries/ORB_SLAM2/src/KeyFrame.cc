@@ -21,6 +21,10 @@
 #include "KeyFrame.h"
 #include "Converter.h"
 #include "Associater.h"
+#include "MapStore.h"
+#include "Profiler.h"
+#include <algorithm>
+#include <functional>
 #include <mutex>
 
 using namespace ::std;
@@ -31,6 +35,7 @@ long unsigned int KeyFrame::nNextId = 0;
 
 KeyFrame::KeyFrame(Frame &F, Map *pMap, vector<KeyFrameDatabase *> pKFDB, int Ntype)
     : mnFrameId(F.mnId), 
+      mbOrigin(false),
       mTimeStamp(F.mTimeStamp), 
       mnGridCols(FRAME_GRID_COLS),
       mnGridRows(FRAME_GRID_ROWS),
@@ -51,6 +56,10 @@ KeyFrame::KeyFrame(Frame &F, Map *pMap, vector<KeyFrameDatabase *> pKFDB, int Nt
       mb(F.mb),
       mThDepth(F.mThDepth),
       Channels(F.Channels), 
+      mpMapStore(NULL),
+      mbResident(true),
+      mnPageOffset(-1),
+      mnPageSize(0),
       mnScaleLevels(F.mnScaleLevels),
       mfScaleFactor(F.mfScaleFactor), 
       mfLogScaleFactor(F.mfLogScaleFactor),
@@ -64,6 +73,7 @@ KeyFrame::KeyFrame(Frame &F, Map *pMap, vector<KeyFrameDatabase *> pKFDB, int Nt
       mK(F.mK),
       mpKeyFrameDB(pKFDB),
       mpVocabulary(F.mpVocabulary), 
+      mbOrderedDirty(false),
       mbFirstConnection(true),
       mpParent(NULL), 
       mbNotErase(false), 
@@ -71,31 +81,21 @@ KeyFrame::KeyFrame(Frame &F, Map *pMap, vector<KeyFrameDatabase *> pKFDB, int Nt
       mbBad(false),
       mHalfBaseline(F.mb / 2), 
       mpMap(pMap),
+      mbFeaturesLost(false),
       Ntype(Ntype) {
   mnId = nNextId++;
   // Resize for vectors
-  mnLoopQuery.resize(Ntype);
-  mnLoopWords.resize(Ntype);
-  mLoopScore.resize(Ntype);
-  mnRelocQuery.resize(Ntype);
-  mnRelocWords.resize(Ntype);
-  mRelocScore.resize(Ntype);
   Channels.resize(Ntype);
 
-  // Initlizer for Reloc
-  for (int Ftype = 0; Ftype < Ntype; Ftype++) {
-    mnRelocQuery[Ftype] = 0;
-    mnRelocWords[Ftype] = 0;
-    mnLoopQuery[Ftype] = 0; 
-    mnLoopWords[Ftype] = 0; 
-  } 
-
-  SetPose(F.mTcw);
+  SetPose(F.GetPose());
 }
 
 void KeyFrame::ComputeBoW(const int Ftype) {
+  PROFILE_SCOPE_ARG("KeyFrame::ComputeBoW", Ftype);
+  if (!EnsureResident())
+    return;
   if (Channels[Ftype].mBowVec.empty() || Channels[Ftype].mFeatVec.empty()) {
-    std::vector<cv::Mat> vCurrentDesc = Converter::toDescriptorVector(Channels[Ftype].mDescriptors);
+    std::vector<cv::Mat> vCurrentDesc = Converter::toDescriptorVector(Channels[Ftype].mpFeatures->mDescriptors);
     mpVocabulary[Ftype]->transform(vCurrentDesc, Channels[Ftype].mBowVec, Channels[Ftype].mFeatVec, 4);
   }
 }
@@ -113,6 +113,9 @@ void KeyFrame::SetPose(const cv::Mat &Tcw_) {
   Ow.copyTo(Twc.rowRange(0, 3).col(3));
   cv::Mat center = (cv::Mat_<float>(4, 1) << mHalfBaseline, 0, 0, 1);
   Cw = Twc * center;
+
+  Tcwf = Converter::toSE3f(Tcw);
+  Owf = Tcwf.Center();
 }
 
 cv::Mat KeyFrame::GetPose() {
@@ -130,6 +133,16 @@ cv::Mat KeyFrame::GetCameraCenter() {
   return Ow.clone();
 }
 
+SE3f KeyFrame::GetPosef() {
+  unique_lock<mutex> lock(mMutexPose);
+  return Tcwf;
+}
+
+Eigen::Vector3f KeyFrame::GetCameraCenterf() {
+  unique_lock<mutex> lock(mMutexPose);
+  return Owf;
+}
+
 cv::Mat KeyFrame::GetStereoCenter() {
   unique_lock<mutex> lock(mMutexPose);
   return Cw.clone();
@@ -147,54 +160,56 @@ cv::Mat KeyFrame::GetTranslation() {
 
 // TO-DO multi channels ?
 void KeyFrame::AddConnection(KeyFrame *pKF, const int &weight) {
-  {
-    unique_lock<mutex> lock(mMutexConnections);
-    if (!mConnectedKeyFrameWeights.count(pKF))
-      mConnectedKeyFrameWeights[pKF] = weight;
-    else if (mConnectedKeyFrameWeights[pKF] != weight)
-      mConnectedKeyFrameWeights[pKF] = weight;
-    else
-      return;
+  unique_lock<mutex> lock(mMutexConnections);
+  pair<unordered_map<KeyFrame *, int>::iterator, bool> res = mConnectedKeyFrameWeights.insert(make_pair(pKF, weight));
+  if (res.second || res.first->second != weight) {
+    res.first->second = weight;
+    mbOrderedDirty = true;
   }
-
-  UpdateBestCovisibles();
 }
 
 // TO-DO multi channels ?
 void KeyFrame::UpdateBestCovisibles() {
   unique_lock<mutex> lock(mMutexConnections);
+  mbOrderedDirty = true;
+}
+
+void KeyFrame::SortConnections() {
+  if (!mbOrderedDirty)
+    return;
+
   std::vector<pair<int, KeyFrame *>> vPairs;
   vPairs.reserve(mConnectedKeyFrameWeights.size());
-  for (map<KeyFrame *, int>::iterator mit = mConnectedKeyFrameWeights.begin(), mend = mConnectedKeyFrameWeights.end(); mit != mend; mit++)
+  for (unordered_map<KeyFrame *, int>::iterator mit = mConnectedKeyFrameWeights.begin(), mend = mConnectedKeyFrameWeights.end(); mit != mend; mit++)
     vPairs.push_back(make_pair(mit->second, mit->first));
 
-  sort(vPairs.begin(), vPairs.end());
-  std::list<KeyFrame *> lKFs;
-  std::list<int> lWs;
+  sort(vPairs.begin(), vPairs.end(), greater<pair<int, KeyFrame *>>());
+  mvpOrderedConnectedKeyFrames.resize(vPairs.size());
+  mvOrderedWeights.resize(vPairs.size());
   for (std::size_t i = 0, iend = vPairs.size(); i < iend; i++) {
-    lKFs.push_front(vPairs[i].second);
-    lWs.push_front(vPairs[i].first);
+    mvpOrderedConnectedKeyFrames[i] = vPairs[i].second;
+    mvOrderedWeights[i] = vPairs[i].first;
   }
-
-  mvpOrderedConnectedKeyFrames = std::vector<KeyFrame *>(lKFs.begin(), lKFs.end());
-  mvOrderedWeights = std::vector<int>(lWs.begin(), lWs.end());
+  mbOrderedDirty = false;
 }
 
 set<KeyFrame *> KeyFrame::GetConnectedKeyFrames() {
   unique_lock<mutex> lock(mMutexConnections);
   set<KeyFrame *> s;
-  for (map<KeyFrame *, int>::iterator mit = mConnectedKeyFrameWeights.begin(); mit != mConnectedKeyFrameWeights.end(); mit++)
+  for (unordered_map<KeyFrame *, int>::iterator mit = mConnectedKeyFrameWeights.begin(); mit != mConnectedKeyFrameWeights.end(); mit++)
     s.insert(mit->first);
   return s;
 }
 
 std::vector<KeyFrame *> KeyFrame::GetVectorCovisibleKeyFrames() {
   unique_lock<mutex> lock(mMutexConnections);
+  SortConnections();
   return mvpOrderedConnectedKeyFrames;
 }
 
 std::vector<KeyFrame *> KeyFrame::GetBestCovisibilityKeyFrames(const int &N) {
   unique_lock<mutex> lock(mMutexConnections);
+  SortConnections();
   if ((int)mvpOrderedConnectedKeyFrames.size() < N)
     return mvpOrderedConnectedKeyFrames;
   else
@@ -203,6 +218,7 @@ std::vector<KeyFrame *> KeyFrame::GetBestCovisibilityKeyFrames(const int &N) {
 
 std::vector<KeyFrame *> KeyFrame::GetCovisiblesByWeight(const int &w) {
   unique_lock<mutex> lock(mMutexConnections);
+  SortConnections();
 
   if (mvpOrderedConnectedKeyFrames.empty())
     return std::vector<KeyFrame *>();
@@ -218,10 +234,16 @@ std::vector<KeyFrame *> KeyFrame::GetCovisiblesByWeight(const int &w) {
 
 int KeyFrame::GetWeight(KeyFrame *pKF) {
   unique_lock<mutex> lock(mMutexConnections);
-  if (mConnectedKeyFrameWeights.count(pKF))
-    return mConnectedKeyFrameWeights[pKF];
-  else
-    return 0;
+  unordered_map<KeyFrame *, int>::const_iterator mit = mConnectedKeyFrameWeights.find(pKF);
+  return mit != mConnectedKeyFrameWeights.end() ? mit->second : 0;
+}
+
+void KeyFrame::ChangeCovisibility(KeyFrame *pKF, int n) {
+  unique_lock<mutex> lock(mMutexCovisibility);
+  int &count = mCovisibilityCounts[pKF];
+  count += n;
+  if (count <= 0)
+    mCovisibilityCounts.erase(pKF);
 }
 
 void KeyFrame::AddMapPoint(MapPoint *pMP, const std::size_t &idx, const int Ftype) {
@@ -317,83 +339,48 @@ MapPoint *KeyFrame::GetMapPoint(const std::size_t &idx, const int Ftype) {
 
 // Multi Channels ??
 void KeyFrame::UpdateConnectionsMultiChannels() {
-  map<KeyFrame *, int> KFcounter;
-
-  std::vector<std::vector<MapPoint *>> vpMP;
-  vpMP.resize(Ntype);
-
+  // Shared MapPoints of all channels, counted as the observations change
+  std::vector<pair<int, KeyFrame *>> vCounts;
   {
-    unique_lock<mutex> lockMPs(mMutexFeatures);
-    for (int Ftype = 0; Ftype < Ntype; Ftype++) 
-      vpMP[Ftype] = Channels[Ftype].mvpMapPoints;
-  }
-
-  // For all map points in keyframe check in which other keyframes are they seen, increase counter for those keyframes
-  for (int Ftype = 0; Ftype < Ntype; Ftype++) {
-    for (std::vector<MapPoint *>::iterator vit = vpMP[Ftype].begin(), vend = vpMP[Ftype].end(); vit != vend; vit++) {
-      MapPoint *pMP = *vit;
-
-      if (!pMP)
-        continue;
-
-      if (pMP->isBad())
-        continue;
-
-      map<KeyFrame *, std::size_t> observations = pMP->GetObservations();
-
-      for (map<KeyFrame *, std::size_t>::iterator mit = observations.begin(), mend = observations.end(); mit != mend; mit++) {
-        if (mit->first->mnId == mnId)
-          continue;
-        KFcounter[mit->first]++;
-      }
-    }
+    unique_lock<mutex> lock(mMutexCovisibility);
+    vCounts.reserve(mCovisibilityCounts.size());
+    for (unordered_map<KeyFrame *, int>::iterator mit = mCovisibilityCounts.begin(), mend = mCovisibilityCounts.end(); mit != mend; mit++)
+      vCounts.push_back(make_pair(mit->second, mit->first));
   }
 
   // This should not happen
-  if (KFcounter.empty())
+  if (vCounts.empty())
     return;
 
   // If the counter is greater than threshold add connection, in case no keyframe counter is over threshold add the one with maximum counter
-  int nmax = 0;
-  KeyFrame *pKFmax = NULL;
-  int th = 15;
+  const int th = 15;
+  sort(vCounts.begin(), vCounts.end(), greater<pair<int, KeyFrame *>>());
 
-  std::vector<pair<int, KeyFrame *>> vPairs;
-  vPairs.reserve(KFcounter.size());
-  for (map<KeyFrame *, int>::iterator mit = KFcounter.begin(), mend = KFcounter.end(); mit != mend; mit++) {
-    if (mit->second > nmax) {
-      nmax = mit->second;
-      pKFmax = mit->first;
-    }
+  std::size_t nConnected = 0;
+  while (nConnected < vCounts.size() && vCounts[nConnected].first >= th)
+    nConnected++;
+  nConnected = max<std::size_t>(nConnected, 1);
 
-    if (mit->second >= th) {
-      vPairs.push_back(make_pair(mit->second, mit->first));
-      (mit->first)->AddConnection(this, mit->second);
-    }
-  }
-
-  if (vPairs.empty()) {
-    vPairs.push_back(make_pair(nmax, pKFmax));
-    pKFmax->AddConnection(this, nmax);
-  }
-
-  sort(vPairs.begin(), vPairs.end());
-  std::list<KeyFrame *> lKFs;
-  std::list<int> lWs;
-  for (std::size_t i = 0; i < vPairs.size(); i++) {
-    lKFs.push_front(vPairs[i].second);
-    lWs.push_front(vPairs[i].first);
-  }
+  for (std::size_t i = 0; i < nConnected; i++)
+    vCounts[i].second->AddConnection(this, vCounts[i].first);
 
   {
     unique_lock<mutex> lockCon(mMutexConnections);
 
-    // mspConnectedKeyFrames = spConnectedKeyFrames;
-    mConnectedKeyFrameWeights = KFcounter;
-    mvpOrderedConnectedKeyFrames = std::vector<KeyFrame *>(lKFs.begin(), lKFs.end());
-    mvOrderedWeights = std::vector<int>(lWs.begin(), lWs.end());
+    mConnectedKeyFrameWeights.clear();
+    mConnectedKeyFrameWeights.reserve(vCounts.size());
+    for (std::size_t i = 0; i < vCounts.size(); i++)
+      mConnectedKeyFrameWeights[vCounts[i].second] = vCounts[i].first;
+
+    mvpOrderedConnectedKeyFrames.resize(nConnected);
+    mvOrderedWeights.resize(nConnected);
+    for (std::size_t i = 0; i < nConnected; i++) {
+      mvpOrderedConnectedKeyFrames[i] = vCounts[i].second;
+      mvOrderedWeights[i] = vCounts[i].first;
+    }
+    mbOrderedDirty = false;
 
-    if (mbFirstConnection && mnId != 0) {
+    if (mbFirstConnection && !mbOrigin) {
       mpParent = mvpOrderedConnectedKeyFrames.front();
       mpParent->AddChild(this);
       mbFirstConnection = false;
@@ -414,6 +401,7 @@ void KeyFrame::EraseChild(KeyFrame *pKF) {
 void KeyFrame::ChangeParent(KeyFrame *pKF) {
   unique_lock<mutex> lockCon(mMutexConnections);
   mpParent = pKF;
+  mbFirstConnection = false;
   pKF->AddChild(this);
 }
 
@@ -464,7 +452,7 @@ void KeyFrame::SetErase() {
 void KeyFrame::SetBadFlag() {
   {
     unique_lock<mutex> lock(mMutexConnections);
-    if (mnId == 0)
+    if (mbOrigin)
       return;
     else if (mbNotErase) {
       mbToBeErased = true;
@@ -472,7 +460,7 @@ void KeyFrame::SetBadFlag() {
     }
   }
 
-  for (map<KeyFrame *, int>::iterator mit = mConnectedKeyFrameWeights.begin(), mend = mConnectedKeyFrameWeights.end(); mit != mend; mit++)
+  for (unordered_map<KeyFrame *, int>::iterator mit = mConnectedKeyFrameWeights.begin(), mend = mConnectedKeyFrameWeights.end(); mit != mend; mit++)
     mit->first->EraseConnection(this);
 
   // erase observation of every kind of map points (one keyframe, two kinds of mappoints)
@@ -488,6 +476,8 @@ void KeyFrame::SetBadFlag() {
 
     mConnectedKeyFrameWeights.clear();
     mvpOrderedConnectedKeyFrames.clear();
+    mvOrderedWeights.clear();
+    mbOrderedDirty = false;
 
     // Update Spanning Tree
     set<KeyFrame *> sParentCandidates;
@@ -542,9 +532,12 @@ void KeyFrame::SetBadFlag() {
     mbBad = true;
   }
 
-  mpMap->EraseKeyFrame(this);
-  for (int Ftype = 0; Ftype < Ntype; Ftype++)
-    mpKeyFrameDB[Ftype]->erase(this, Ftype);
+  GetMap()->EraseKeyFrame(this);
+  // The database finds the postings through the BoW vectors, keyframes whose
+  // features are lost were dropped already
+  if (EnsureResident())
+    for (int Ftype = 0; Ftype < Ntype; Ftype++)
+      mpKeyFrameDB[Ftype]->erase(this, Ftype);
 }
 
 bool KeyFrame::isBad() {
@@ -552,55 +545,50 @@ bool KeyFrame::isBad() {
   return mbBad;
 }
 
-void KeyFrame::EraseConnection(KeyFrame *pKF) {
-  bool bUpdate = false;
+void KeyFrame::SetMap(Map *pMap) {
+  unique_lock<mutex> lock(mMutexConnections);
+  mpMap = pMap;
+}
+
+Map *KeyFrame::GetMap() {
+  unique_lock<mutex> lock(mMutexConnections);
+  return mpMap;
+}
+
+bool KeyFrame::IsResident() const { return mbResident.load(memory_order_acquire); }
+
+bool KeyFrame::EnsureResident() const {
+  if (IsResident())
+    return true;
+
   {
-    unique_lock<mutex> lock(mMutexConnections);
-    if (mConnectedKeyFrameWeights.count(pKF)) {
-      mConnectedKeyFrameWeights.erase(pKF);
-      bUpdate = true;
-    }
+    unique_lock<mutex> lock(mMutexResidency);
+    if (IsResident())
+      return true;
+    if (mbFeaturesLost)
+      return false;
+    if (mpMapStore->PageIn(const_cast<KeyFrame *>(this)))
+      return true;
+    mbFeaturesLost = true;
   }
 
-  if (bUpdate)
-    UpdateBestCovisibles();
+  // Without its words the keyframe cannot be scored, the queries must not
+  // return it
+  for (KeyFrameDatabase *pKFDB : mpKeyFrameDB)
+    pKFDB->eraseLost(const_cast<KeyFrame *>(this));
+  return false;
 }
 
-std::vector<std::size_t> KeyFrame::GetFeaturesInArea(const float &x, const float &y, const float &r, const int Ftype) const {
-  std::vector<std::size_t> vIndices;
-  vIndices.reserve(Channels[Ftype].N);
-
-  const int nMinCellX = max(0, (int)floor((x - mnMinX - r) * mfGridElementWidthInv));
-  if (nMinCellX >= mnGridCols)
-    return vIndices;
-
-  const int nMaxCellX = min((int)mnGridCols - 1, (int)ceil((x - mnMinX + r) * mfGridElementWidthInv));
-  if (nMaxCellX < 0)
-    return vIndices;
-
-  const int nMinCellY = max(0, (int)floor((y - mnMinY - r) * mfGridElementHeightInv));
-  if (nMinCellY >= mnGridRows)
-    return vIndices;
-
-  const int nMaxCellY = min((int)mnGridRows - 1, (int)ceil((y - mnMinY + r) * mfGridElementHeightInv));
-  if (nMaxCellY < 0)
-    return vIndices;
-
-  for (int ix = nMinCellX; ix <= nMaxCellX; ix++) {
-    for (int iy = nMinCellY; iy <= nMaxCellY; iy++) {
-      const std::vector<std::size_t> vCell = Channels[Ftype].mGrid[ix][iy];
-      for (std::size_t j = 0, jend = vCell.size(); j < jend; j++) {
-        const cv::KeyPoint &kpUn = Channels[Ftype].mvKeysUn[vCell[j]];
-        const float distx = kpUn.pt.x - x;
-        const float disty = kpUn.pt.y - y;
-
-        if (fabs(distx) < r && fabs(disty) < r)
-          vIndices.push_back(vCell[j]);
-      }
-    }
-  }
+void KeyFrame::EraseConnection(KeyFrame *pKF) {
+  unique_lock<mutex> lock(mMutexConnections);
+  if (mConnectedKeyFrameWeights.erase(pKF))
+    mbOrderedDirty = true;
+}
 
-  return vIndices;
+std::vector<std::size_t> KeyFrame::GetFeaturesInArea(const float &x, const float &y, const float &r, const int Ftype) const {
+  if (!EnsureResident())
+    return std::vector<std::size_t>();
+  return Channels[Ftype].mpFeatures->GetFeaturesInArea(x, y, r);
 }
 
 bool KeyFrame::IsInImage(const float &x, const float &y) const {
@@ -608,10 +596,12 @@ bool KeyFrame::IsInImage(const float &x, const float &y) const {
 }
 
 cv::Mat KeyFrame::UnprojectStereo(int i, const int Ftype) {
-  const float z = Channels[Ftype].mvDepth[i];
+  if (!EnsureResident())
+    return cv::Mat();
+  const float z = Channels[Ftype].mpFeatures->mvDepth[i];
   if (z > 0) {
-    const float u = Channels[Ftype].mvKeys[i].pt.x;
-    const float v = Channels[Ftype].mvKeys[i].pt.y;
+    const float u = Channels[Ftype].mpFeatures->mvKeys[i].pt.x;
+    const float v = Channels[Ftype].mpFeatures->mvKeys[i].pt.y;
     const float x = (u - cx) * z * invfx;
     const float y = (v - cy) * z * invfy;
     cv::Mat x3Dc = (cv::Mat_<float>(3, 1) << x, y, z);
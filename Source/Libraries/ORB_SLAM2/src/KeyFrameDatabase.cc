@@ -23,113 +23,197 @@
 #include "DBoW2/BowVector.h"
 #include "KeyFrame.h"
 
+#include <algorithm>
 #include <mutex>
-
-using namespace std;
+#include <shared_mutex>
 
 using namespace ::std;
 
 namespace ORB_SLAM2 {
 
 KeyFrameDatabase::KeyFrameDatabase(const ORBVocabulary &voc) : mpVoc(&voc) {
+  mbScoreFromPostings = voc.getScoringType() == DBoW2::L1_NORM;
   mvInvertedFile.resize(voc.size());
 }
 
-//TO-DO add Ftype
+uint32_t KeyFrameDatabase::GetSlot(KeyFrame *pKF) {
+  unordered_map<KeyFrame *, uint32_t>::iterator sit = mmSlots.find(pKF);
+  if (sit != mmSlots.end())
+    return sit->second;
+
+  uint32_t slot;
+  if (!mvFreeSlots.empty()) {
+    slot = mvFreeSlots.back();
+    mvFreeSlots.pop_back();
+    mvpKeyFrames[slot] = pKF;
+  } else {
+    slot = mvpKeyFrames.size();
+    mvpKeyFrames.push_back(pKF);
+  }
+  mmSlots[pKF] = slot;
+  return slot;
+}
+
 void KeyFrameDatabase::add(KeyFrame *pKF, const int Ftype) {
-  unique_lock<mutex> lock(mMutex);
+  unique_lock<shared_mutex> lock(mMutex);
 
-  for (DBoW2::BowVector::const_iterator vit = pKF->Channels[Ftype].mBowVec.begin(), vend = pKF->Channels[Ftype].mBowVec.end(); vit != vend; vit++)
-    mvInvertedFile[vit->first].push_back(pKF);
+  const uint32_t slot = GetSlot(pKF);
+  for (DBoW2::BowVector::const_iterator vit = pKF->Channels[Ftype].mBowVec.begin(), vend = pKF->Channels[Ftype].mBowVec.end(); vit != vend; vit++) {
+    Postings &postings = mvInvertedFile[vit->first];
+    postings.mvSlots.push_back(slot);
+    postings.mvWeights.push_back(vit->second);
+  }
 }
 
-//TO-DO add Ftype
 void KeyFrameDatabase::erase(KeyFrame *pKF, const int Ftype) {
-  unique_lock<mutex> lock(mMutex);
+  unique_lock<shared_mutex> lock(mMutex);
+
+  unordered_map<KeyFrame *, uint32_t>::iterator sit = mmSlots.find(pKF);
+  if (sit == mmSlots.end())
+    return;
+  const uint32_t slot = sit->second;
 
   // Erase elements in the Inverse File for the entry
-  for (DBoW2::BowVector::const_iterator vit = pKF->Channels[Ftype].mBowVec.begin(), vend = pKF->Channels[Ftype].mBowVec.end(); vit != vend; vit++) {
-    // List of keyframes that share the word
-    std::list<KeyFrame *> &lKFs = mvInvertedFile[vit->first];
+  for (DBoW2::BowVector::const_iterator vit = pKF->Channels[Ftype].mBowVec.begin(), vend = pKF->Channels[Ftype].mBowVec.end(); vit != vend; vit++)
+    ErasePostings(mvInvertedFile[vit->first], slot);
 
-    for (std::list<KeyFrame *>::iterator lit = lKFs.begin(), lend = lKFs.end(); lit != lend; lit++) {
-      if (pKF == *lit) {
-        lKFs.erase(lit);
-        break;
-      }
-    }
+  ReleaseSlot(sit);
+}
+
+void KeyFrameDatabase::eraseLost(KeyFrame *pKF) {
+  unique_lock<shared_mutex> lock(mMutex);
+
+  unordered_map<KeyFrame *, uint32_t>::iterator sit = mmSlots.find(pKF);
+  if (sit == mmSlots.end())
+    return;
+
+  for (Postings &postings : mvInvertedFile)
+    ErasePostings(postings, sit->second);
+
+  ReleaseSlot(sit);
+}
+
+void KeyFrameDatabase::ErasePostings(Postings &postings, const uint32_t slot) {
+  // Every posting of the slot goes, a reused slot must not inherit any
+  size_t n = 0;
+  for (size_t j = 0; j < postings.mvSlots.size(); j++) {
+    if (postings.mvSlots[j] == slot)
+      continue;
+    postings.mvSlots[n] = postings.mvSlots[j];
+    postings.mvWeights[n] = postings.mvWeights[j];
+    n++;
   }
+  postings.mvSlots.resize(n);
+  postings.mvWeights.resize(n);
+}
+
+void KeyFrameDatabase::ReleaseSlot(unordered_map<KeyFrame *, uint32_t>::iterator sit) {
+  // No posting refers to the slot anymore, the next keyframe added takes it
+  const uint32_t slot = sit->second;
+  mvpKeyFrames[slot] = NULL;
+  mvFreeSlots.push_back(slot);
+  mmSlots.erase(sit);
 }
 
 void KeyFrameDatabase::clear() {
+  unique_lock<shared_mutex> lock(mMutex);
+
   mvInvertedFile.clear();
   mvInvertedFile.resize(mpVoc->size());
+  mvpKeyFrames.clear();
+  mmSlots.clear();
+  mvFreeSlots.clear();
 }
 
-std::vector<KeyFrame *> KeyFrameDatabase::DetectLoopCandidates(KeyFrame *pKF, float minScore, const int Ftype) {
-  set<KeyFrame *> spConnectedKeyFrames = pKF->GetConnectedKeyFrames();
-  std::list<KeyFrame *> lKFsSharingWords;
-
-  // Search all keyframes that share a word with current keyframes. Discard keyframes connected to the query keyframe
-  {
-    unique_lock<mutex> lock(mMutex);
-
-    for (DBoW2::BowVector::const_iterator vit = pKF->Channels[Ftype].mBowVec.begin(), vend = pKF->Channels[Ftype].mBowVec.end(); vit != vend; vit++) {
-      std::list<KeyFrame *> &lKFs = mvInvertedFile[vit->first];
-
-      for (std::list<KeyFrame *>::iterator lit = lKFs.begin(), lend = lKFs.end(); lit != lend; lit++) {
-        KeyFrame *pKFi = *lit;
-        if (pKFi->mnLoopQuery[Ftype] != pKF->mnId) {
-          pKFi->mnLoopWords[Ftype] = 0;
-          if (!spConnectedKeyFrames.count(pKFi)) {
-            pKFi->mnLoopQuery[Ftype] = pKF->mnId;
-            lKFsSharingWords.push_back(pKFi);
-          }
-        }
-        pKFi->mnLoopWords[Ftype]++;
-      }
+void KeyFrameDatabase::Accumulate(const DBoW2::BowVector &BowVec, QueryScores &query) const {
+  shared_lock<shared_mutex> lock(mMutex);
+
+  const size_t nSlots = mvpKeyFrames.size();
+  query.mvSlots.clear();
+  query.mvnWords.assign(nSlots, 0);
+  query.mvScores.assign(nSlots, 0.f);
+
+  int *pnWords = query.mvnWords.data();
+  float *pScores = query.mvScores.data();
+
+  for (DBoW2::BowVector::const_iterator vit = BowVec.begin(), vend = BowVec.end(); vit != vend; vit++) {
+    const Postings &postings = mvInvertedFile[vit->first];
+    const uint32_t *pSlots = postings.mvSlots.data();
+    const float *pWeights = postings.mvWeights.data();
+    const size_t n = postings.mvSlots.size();
+
+    for (size_t j = 0; j < n; j++)
+      if (pnWords[pSlots[j]]++ == 0)
+        query.mvSlots.push_back(pSlots[j]);
+
+    // L1 score of two normalised vectors: sum of min(v_i, w_i) over the words in common
+    if (mbScoreFromPostings) {
+      const float v = vit->second;
+      for (size_t j = 0; j < n; j++)
+        pScores[pSlots[j]] += min(v, pWeights[j]);
     }
   }
 
-  if (lKFsSharingWords.empty())
-    return std::vector<KeyFrame *>();
+  query.mvpKeyFrames.resize(query.mvSlots.size());
+  for (size_t i = 0; i < query.mvSlots.size(); i++)
+    query.mvpKeyFrames[i] = mvpKeyFrames[query.mvSlots[i]];
+}
 
-  std::list<pair<float, KeyFrame *>> lScoreAndMatch;
+std::vector<KeyFrame *> KeyFrameDatabase::DetectLoopCandidates(KeyFrame *pKF, float minScore, const int Ftype,
+                                                               std::vector<float> *pvScores) {
+  const set<KeyFrame *> spConnectedKeyFrames = pKF->GetConnectedKeyFrames();
+  const DBoW2::BowVector &BowVec = pKF->Channels[Ftype].mBowVec;
 
-  // Only compare against those keyframes that share enough words
+  // Search all keyframes that share a word with current keyframes
+  QueryScores query;
+  Accumulate(BowVec, query);
+
+  // Discard keyframes connected to the query keyframe. Only compare against those keyframes that share enough words
   int maxCommonWords = 0;
-  for (std::list<KeyFrame *>::iterator lit = lKFsSharingWords.begin(), lend = lKFsSharingWords.end(); lit != lend; lit++) {
-    if ((*lit)->mnLoopWords[Ftype] > maxCommonWords)
-      maxCommonWords = (*lit)->mnLoopWords[Ftype];
+  for (size_t i = 0; i < query.mvSlots.size(); i++) {
+    int &nWords = query.mvnWords[query.mvSlots[i]];
+    if (spConnectedKeyFrames.count(query.mvpKeyFrames[i]))
+      nWords = 0;
+    else if (nWords > maxCommonWords)
+      maxCommonWords = nWords;
   }
 
-  int minCommonWords = maxCommonWords * 0.8f;
+  if (maxCommonWords == 0)
+    return std::vector<KeyFrame *>();
 
-  int nscores = 0;
+  const int minCommonWords = maxCommonWords * 0.8f;
 
   // Compute similarity score. Retain the matches whose score is higher than minScore
-  for (std::list<KeyFrame *>::iterator lit = lKFsSharingWords.begin(), lend = lKFsSharingWords.end(); lit != lend; lit++) {
-    KeyFrame *pKFi = *lit;
-
-    if (pKFi->mnLoopWords[Ftype] > minCommonWords) {
-      nscores++;
-
-      float si = mpVoc->score(pKF->Channels[Ftype].mBowVec, pKFi->Channels[Ftype].mBowVec);
-
-      pKFi->mLoopScore[Ftype] = si;
-      if (si >= minScore)
-        lScoreAndMatch.push_back(make_pair(si, pKFi));
+  unordered_map<KeyFrame *, uint32_t> mScoredSlots;
+  std::vector<pair<float, KeyFrame *>> vScoreAndMatch;
+  for (size_t i = 0; i < query.mvSlots.size(); i++) {
+    const uint32_t slot = query.mvSlots[i];
+    if (query.mvnWords[slot] <= minCommonWords)
+      continue;
+
+    KeyFrame *pKFi = query.mvpKeyFrames[i];
+    if (!mbScoreFromPostings) {
+      if (!pKFi->EnsureResident())
+        continue;
+      query.mvScores[slot] = mpVoc->score(BowVec, pKFi->Channels[Ftype].mBowVec);
     }
+
+    mScoredSlots[pKFi] = slot;
+    if (query.mvScores[slot] >= minScore)
+      vScoreAndMatch.push_back(make_pair(query.mvScores[slot], pKFi));
   }
 
-  if (lScoreAndMatch.empty())
+  if (vScoreAndMatch.empty())
     return std::vector<KeyFrame *>();
 
-  std::list<pair<float, KeyFrame *>> lAccScoreAndMatch;
+  std::vector<pair<float, KeyFrame *>> vAccScoreAndMatch;
+  std::vector<float> vBestScores;
+  vAccScoreAndMatch.reserve(vScoreAndMatch.size());
+  vBestScores.reserve(vScoreAndMatch.size());
   float bestAccScore = minScore;
 
   // Lets now accumulate score by covisibility
-  for (std::list<pair<float, KeyFrame *>>::iterator it = lScoreAndMatch.begin(), itend = lScoreAndMatch.end(); it != itend; it++) {
+  for (std::vector<pair<float, KeyFrame *>>::iterator it = vScoreAndMatch.begin(), itend = vScoreAndMatch.end(); it != itend; it++) {
     KeyFrame *pKFi = it->second;
     std::vector<KeyFrame *> vpNeighs = pKFi->GetBestCovisibilityKeyFrames(10);
 
@@ -137,17 +221,20 @@ std::vector<KeyFrame *> KeyFrameDatabase::DetectLoopCandidates(KeyFrame *pKF, fl
     float accScore = it->first;
     KeyFrame *pBestKF = pKFi;
     for (std::vector<KeyFrame *>::iterator vit = vpNeighs.begin(), vend = vpNeighs.end(); vit != vend; vit++) {
-      KeyFrame *pKF2 = *vit;
-      if (pKF2->mnLoopQuery[Ftype] == pKF->mnId && pKF2->mnLoopWords[Ftype] > minCommonWords) {
-        accScore += pKF2->mLoopScore[Ftype];
-        if (pKF2->mLoopScore[Ftype] > bestScore) {
-          pBestKF = pKF2;
-          bestScore = pKF2->mLoopScore[Ftype];
-        }
+      unordered_map<KeyFrame *, uint32_t>::const_iterator sit = mScoredSlots.find(*vit);
+      if (sit == mScoredSlots.end())
+        continue;
+
+      const float score2 = query.mvScores[sit->second];
+      accScore += score2;
+      if (score2 > bestScore) {
+        pBestKF = *vit;
+        bestScore = score2;
       }
     }
 
-    lAccScoreAndMatch.push_back(make_pair(accScore, pBestKF));
+    vAccScoreAndMatch.push_back(make_pair(accScore, pBestKF));
+    vBestScores.push_back(bestScore);
     if (accScore > bestAccScore)
       bestAccScore = accScore;
   }
@@ -157,14 +244,18 @@ std::vector<KeyFrame *> KeyFrameDatabase::DetectLoopCandidates(KeyFrame *pKF, fl
 
   set<KeyFrame *> spAlreadyAddedKF;
   std::vector<KeyFrame *> vpLoopCandidates;
-  vpLoopCandidates.reserve(lAccScoreAndMatch.size());
+  vpLoopCandidates.reserve(vAccScoreAndMatch.size());
+  if (pvScores)
+    pvScores->clear();
 
-  for (std::list<pair<float, KeyFrame *>>::iterator it = lAccScoreAndMatch.begin(), itend = lAccScoreAndMatch.end(); it != itend; it++) {
-    if (it->first > minScoreToRetain) {
-      KeyFrame *pKFi = it->second;
+  for (size_t i = 0; i < vAccScoreAndMatch.size(); i++) {
+    if (vAccScoreAndMatch[i].first > minScoreToRetain) {
+      KeyFrame *pKFi = vAccScoreAndMatch[i].second;
       if (!spAlreadyAddedKF.count(pKFi)) {
         vpLoopCandidates.push_back(pKFi);
         spAlreadyAddedKF.insert(pKFi);
+        if (pvScores)
+          pvScores->push_back(vBestScores[i]);
       }
     }
   }
@@ -173,62 +264,50 @@ std::vector<KeyFrame *> KeyFrameDatabase::DetectLoopCandidates(KeyFrame *pKF, fl
 }
 
 std::vector<KeyFrame *> KeyFrameDatabase::DetectRelocalizationCandidates(Frame *F, const int Ftype) {
-  std::list<KeyFrame *> lKFsSharingWords;
+  const DBoW2::BowVector &BowVec = F->Channels[Ftype].mBowVec;
 
   // Search all keyframes that share a word with current frame
-  {
-    unique_lock<mutex> lock(mMutex);
-
-    for (DBoW2::BowVector::const_iterator vit = F->Channels[Ftype].mBowVec.begin(), vend = F->Channels[Ftype].mBowVec.end(); vit != vend; vit++) {
-      std::list<KeyFrame *> &lKFs = mvInvertedFile[vit->first];
-
-      for (std::list<KeyFrame *>::iterator lit = lKFs.begin(), lend = lKFs.end(); lit != lend; lit++) {
-        KeyFrame *pKFi = *lit;
-        if (pKFi->mnRelocQuery[Ftype] != F->mnId) {
-          pKFi->mnRelocWords[Ftype] = 0;
-          pKFi->mnRelocQuery[Ftype] = F->mnId;
-          lKFsSharingWords.push_back(pKFi);
-        }
-        pKFi->mnRelocWords[Ftype]++;
-      }
-    }
-  }
-  if (lKFsSharingWords.empty())
-    return std::vector<KeyFrame *>();
+  QueryScores query;
+  Accumulate(BowVec, query);
 
   // Only compare against those keyframes that share enough words
   int maxCommonWords = 0;
-  for (std::list<KeyFrame *>::iterator lit = lKFsSharingWords.begin(), lend = lKFsSharingWords.end(); lit != lend; lit++) {
-    if ((*lit)->mnRelocWords[Ftype] > maxCommonWords)
-      maxCommonWords = (*lit)->mnRelocWords[Ftype];
-  }
-
-  int minCommonWords = maxCommonWords * 0.8f;
+  for (size_t i = 0; i < query.mvSlots.size(); i++)
+    maxCommonWords = max(maxCommonWords, query.mvnWords[query.mvSlots[i]]);
 
-  std::list<pair<float, KeyFrame *>> lScoreAndMatch;
+  if (maxCommonWords == 0)
+    return std::vector<KeyFrame *>();
 
-  int nscores = 0;
+  const int minCommonWords = maxCommonWords * 0.8f;
 
   // Compute similarity score.
-  for (std::list<KeyFrame *>::iterator lit = lKFsSharingWords.begin(), lend = lKFsSharingWords.end(); lit != lend; lit++) {
-    KeyFrame *pKFi = *lit;
-
-    if (pKFi->mnRelocWords[Ftype] > minCommonWords) {
-      nscores++;
-      float si = mpVoc->score(F->Channels[Ftype].mBowVec, pKFi->Channels[Ftype].mBowVec);
-      pKFi->mRelocScore[Ftype] = si;
-      lScoreAndMatch.push_back(make_pair(si, pKFi));
+  unordered_map<KeyFrame *, uint32_t> mScoredSlots;
+  std::vector<pair<float, KeyFrame *>> vScoreAndMatch;
+  for (size_t i = 0; i < query.mvSlots.size(); i++) {
+    const uint32_t slot = query.mvSlots[i];
+    if (query.mvnWords[slot] <= minCommonWords)
+      continue;
+
+    KeyFrame *pKFi = query.mvpKeyFrames[i];
+    if (!mbScoreFromPostings) {
+      if (!pKFi->EnsureResident())
+        continue;
+      query.mvScores[slot] = mpVoc->score(BowVec, pKFi->Channels[Ftype].mBowVec);
     }
+
+    mScoredSlots[pKFi] = slot;
+    vScoreAndMatch.push_back(make_pair(query.mvScores[slot], pKFi));
   }
 
-  if (lScoreAndMatch.empty())
+  if (vScoreAndMatch.empty())
     return std::vector<KeyFrame *>();
 
-  std::list<pair<float, KeyFrame *>> lAccScoreAndMatch;
+  std::vector<pair<float, KeyFrame *>> vAccScoreAndMatch;
+  vAccScoreAndMatch.reserve(vScoreAndMatch.size());
   float bestAccScore = 0;
 
   // Lets now accumulate score by covisibility
-  for (std::list<pair<float, KeyFrame *>>::iterator it = lScoreAndMatch.begin(), itend = lScoreAndMatch.end(); it != itend; it++) {
+  for (std::vector<pair<float, KeyFrame *>>::iterator it = vScoreAndMatch.begin(), itend = vScoreAndMatch.end(); it != itend; it++) {
     KeyFrame *pKFi = it->second;
     std::vector<KeyFrame *> vpNeighs = pKFi->GetBestCovisibilityKeyFrames(10);
 
@@ -236,17 +315,18 @@ std::vector<KeyFrame *> KeyFrameDatabase::DetectRelocalizationCandidates(Frame *
     float accScore = bestScore;
     KeyFrame *pBestKF = pKFi;
     for (std::vector<KeyFrame *>::iterator vit = vpNeighs.begin(), vend = vpNeighs.end(); vit != vend; vit++) {
-      KeyFrame *pKF2 = *vit;
-      if (pKF2->mnRelocQuery[Ftype] != F->mnId)
+      unordered_map<KeyFrame *, uint32_t>::const_iterator sit = mScoredSlots.find(*vit);
+      if (sit == mScoredSlots.end())
         continue;
 
-      accScore += pKF2->mRelocScore[Ftype];
-      if (pKF2->mRelocScore[Ftype] > bestScore) {
-        pBestKF = pKF2;
-        bestScore = pKF2->mRelocScore[Ftype];
+      const float score2 = query.mvScores[sit->second];
+      accScore += score2;
+      if (score2 > bestScore) {
+        pBestKF = *vit;
+        bestScore = score2;
       }
     }
-    lAccScoreAndMatch.push_back(make_pair(accScore, pBestKF));
+    vAccScoreAndMatch.push_back(make_pair(accScore, pBestKF));
     if (accScore > bestAccScore)
       bestAccScore = accScore;
   }
@@ -255,8 +335,8 @@ std::vector<KeyFrame *> KeyFrameDatabase::DetectRelocalizationCandidates(Frame *
   float minScoreToRetain = 0.75f * bestAccScore;
   set<KeyFrame *> spAlreadyAddedKF;
   std::vector<KeyFrame *> vpRelocCandidates;
-  vpRelocCandidates.reserve(lAccScoreAndMatch.size());
-  for (std::list<pair<float, KeyFrame *>>::iterator it = lAccScoreAndMatch.begin(), itend = lAccScoreAndMatch.end(); it != itend; it++) {
+  vpRelocCandidates.reserve(vAccScoreAndMatch.size());
+  for (std::vector<pair<float, KeyFrame *>>::iterator it = vAccScoreAndMatch.begin(), itend = vAccScoreAndMatch.end(); it != itend; it++) {
     const float &si = it->first;
     if (si > minScoreToRetain) {
       KeyFrame *pKFi = it->second;
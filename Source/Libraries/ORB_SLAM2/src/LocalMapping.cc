@@ -21,20 +21,27 @@
 #include "LocalMapping.h"
 #include "LoopClosing.h"
 #include "Associater.h"
+#include "Profiler.h"
 #include "Optimizer.h"
 
+#include <algorithm>
 #include <mutex>
 
 using namespace ::std;
 
 namespace ORB_SLAM2 {
 
+// Recently added MapPoints tested per task in MapPointCulling
+static const std::size_t kCullingChunk = 512;
+
 LocalMapping::LocalMapping(Map *pMap, const float bMonocular, int Ntype)
     : mbMonocular(bMonocular), 
       mbResetRequested(false),
       mbFinishRequested(false),
       mbFinished(true), 
       mpMap(pMap), 
+      mpThreadPool(nullptr),
+      mpMapStore(NULL),
       mbAbortBA(false),
       mbStopped(false), 
       mbStopRequested(false),
@@ -48,7 +55,12 @@ void LocalMapping::SetLoopCloser(LoopClosing *pLoopCloser) {
 
 void LocalMapping::SetTracker(Tracking *pTracker) { mpTracker = pTracker; }
 
+void LocalMapping::SetThreadPool(ThreadPool *pThreadPool) { mpThreadPool = pThreadPool; }
+
+void LocalMapping::SetMapStore(MapStore *pMapStore) { mpMapStore = pMapStore; }
+
 void LocalMapping::Run() {
+  PROFILE_THREAD_NAME("LocalMapping");
 
   mbFinished = false;
 
@@ -59,6 +71,10 @@ void LocalMapping::Run() {
 
     // Check if there are keyframes in the queue
     if (CheckNewKeyFrames()) {
+      PROFILE_SCOPE("LocalMapping::KeyFrame");
+      // Keep the MapStore from evicting the features of the neighbors
+      shared_lock<shared_mutex> residency = mpMapStore->ReadGuard(true);
+
       // BoW conversion and insertion in Map
       ProcessNewKeyFrameMultiChannels();
 
@@ -66,8 +82,7 @@ void LocalMapping::Run() {
       MapPointCulling();
 
       // Triangulate new MapPoints
-      for (int Ftype = 0; Ftype < Ntype; Ftype++)
-        CreateNewMapPoints(Ftype);
+      CreateNewMapPoints();
 
       if (!CheckNewKeyFrames()) {
         // Find more matches in neighbor keyframes and fuse point duplications
@@ -124,8 +139,8 @@ bool LocalMapping::CheckNewKeyFrames() {
 }
 
 void LocalMapping::MapPointCulling() {
+  PROFILE_SCOPE("LocalMapping::MapPointCulling");
   // Check Recent Added MapPoints
-  std::list<MapPoint *>::iterator lit = mlpRecentAddedMapPoints.begin();
   const unsigned long int nCurrentKFid = mpCurrentKeyFrame->mnId;
 
   int nThObs;
@@ -135,20 +150,41 @@ void LocalMapping::MapPointCulling() {
     nThObs = 3;
   const int cnThObs = nThObs;
 
-  while (lit != mlpRecentAddedMapPoints.end()) {
-    MapPoint *pMP = *lit;
-    if (pMP->isBad()) {
-      lit = mlpRecentAddedMapPoints.erase(lit);
-    } else if (pMP->GetFoundRatio() < 0.25f) {
-      pMP->SetBadFlag();
-      lit = mlpRecentAddedMapPoints.erase(lit);
-    } else if (((int)nCurrentKFid - (int)pMP->mnFirstKFid) >= 2 && pMP->Observations() <= cnThObs) {
-      pMP->SetBadFlag();
-      lit = mlpRecentAddedMapPoints.erase(lit);
-    } else if (((int)nCurrentKFid - (int)pMP->mnFirstKFid) >= 3)
-      lit = mlpRecentAddedMapPoints.erase(lit);
-    else
-      lit++;
+  // The tests of a point do not depend on the others, run them in chunks and
+  // apply the results in order afterwards
+  enum { KEEP, DROP, CULL };
+  const std::vector<MapPoint *> vpRecent(mlpRecentAddedMapPoints.begin(), mlpRecentAddedMapPoints.end());
+  std::vector<char> vAction(vpRecent.size());
+  {
+    TaskGroup chunks(mpThreadPool);
+    for (std::size_t begin = 0; begin < vpRecent.size(); begin += kCullingChunk) {
+      const std::size_t end = min(begin + kCullingChunk, vpRecent.size());
+      chunks.Run(
+          [&, begin, end] {
+            for (std::size_t i = begin; i < end; i++) {
+              MapPoint *pMP = vpRecent[i];
+              if (pMP->isBad())
+                vAction[i] = DROP;
+              else if (pMP->GetFoundRatio() < 0.25f)
+                vAction[i] = CULL;
+              else if (((int)nCurrentKFid - (int)pMP->mnFirstKFid) >= 2 && pMP->Observations() <= cnThObs)
+                vAction[i] = CULL;
+              else if (((int)nCurrentKFid - (int)pMP->mnFirstKFid) >= 3)
+                vAction[i] = DROP;
+              else
+                vAction[i] = KEEP;
+            }
+          },
+          "LocalMapping::MapPointCulling");
+    }
+  }
+
+  mlpRecentAddedMapPoints.clear();
+  for (std::size_t i = 0; i < vpRecent.size(); i++) {
+    if (vAction[i] == CULL)
+      vpRecent[i]->SetBadFlag();
+    else if (vAction[i] == KEEP)
+      mlpRecentAddedMapPoints.push_back(vpRecent[i]);
   }
 }
 
@@ -287,15 +323,19 @@ bool LocalMapping::isFinished() {
 }
 
 void LocalMapping::ProcessNewKeyFrameMultiChannels() {
+  PROFILE_SCOPE("LocalMapping::ProcessNewKeyFrame");
   {
     unique_lock<mutex> lock(mMutexNewKFs);
     mpCurrentKeyFrame = mlNewKeyFrames.front();
     mlNewKeyFrames.pop_front();
   }
 
-  // Compute Bags of Words structures
-  for (int Ftype = 0; Ftype < Ntype; Ftype++)
-    mpCurrentKeyFrame->ComputeBoW(Ftype);
+  // Compute Bags of Words structures, channels are independent
+  {
+    TaskGroup channels(mpThreadPool);
+    for (int Ftype = 0; Ftype < Ntype; Ftype++)
+      channels.Run([this, Ftype] { mpCurrentKeyFrame->ComputeBoW(Ftype); }, "LocalMapping::ComputeBoW");
+  }
   
   for (int Ftype = 0; Ftype < Ntype; Ftype++) {
       
@@ -323,17 +363,71 @@ void LocalMapping::ProcessNewKeyFrameMultiChannels() {
 
   // Insert Keyframe in Map
   mpMap->AddKeyFrame(mpCurrentKeyFrame);
+  mpMapStore->AddKeyFrame(mpCurrentKeyFrame);
 }
 
-void LocalMapping::CreateNewMapPoints(const int Ftype) {
+void LocalMapping::CreateNewMapPoints() {
+  PROFILE_SCOPE("LocalMapping::CreateNewMapPoints");
   // Retrieve neighbor keyframes in covisibility graph
   int nn = 10;
   if (mbMonocular)
     nn = 20;
   const std::vector<KeyFrame *> vpNeighKFs = mpCurrentKeyFrame->GetBestCovisibilityKeyFrames(nn);
+  const int nNeighs = vpNeighKFs.size();
 
-  Associater assocaiter(0.6, false);
-  
+  // Search matches with epipolar restriction and triangulate, every channel
+  // and neighbor in its own task against the keyframes as they are now
+  std::vector<std::vector<TriangulatedPoint>> vvCandidates(Ntype * nNeighs);
+  std::vector<char> vbAborted(Ntype * nNeighs, false);
+  {
+    TaskGroup tasks(mpThreadPool);
+    for (int Ftype = 0; Ftype < Ntype; Ftype++) {
+      for (int i = 0; i < nNeighs; i++) {
+        tasks.Run(
+            [&, Ftype, i] {
+              if (i > 0 && CheckNewKeyFrames()) {
+                vbAborted[Ftype * nNeighs + i] = true;
+                return;
+              }
+              TriangulateWithNeighbor(vpNeighKFs[i], Ftype, vvCandidates[Ftype * nNeighs + i]);
+            },
+            "LocalMapping::TriangulateWithNeighbor");
+      }
+    }
+  }
+
+  // Insert in the order of the serial search. A keypoint triangulated with an
+  // earlier neighbor already has its MapPoint, later candidates for it are dropped.
+  for (int Ftype = 0; Ftype < Ntype; Ftype++) {
+    for (int i = 0; i < nNeighs; i++) {
+      if (vbAborted[Ftype * nNeighs + i])
+        break;
+
+      KeyFrame *pKF2 = vpNeighKFs[i];
+      for (const TriangulatedPoint &cand : vvCandidates[Ftype * nNeighs + i]) {
+        if (mpCurrentKeyFrame->GetMapPoint(cand.idx1, Ftype) || pKF2->GetMapPoint(cand.idx2, Ftype))
+          continue;
+
+        MapPoint *pMP = new MapPoint(cand.x3D, mpCurrentKeyFrame, mpMap, Ftype);
+
+        pMP->AddObservation(mpCurrentKeyFrame, cand.idx1);
+        pMP->AddObservation(pKF2, cand.idx2);
+
+        mpCurrentKeyFrame->AddMapPoint(pMP, cand.idx1, Ftype);
+        pKF2->AddMapPoint(pMP, cand.idx2, Ftype);
+
+        pMP->ComputeDistinctiveDescriptors(); // May delete Ftype laterly
+
+        pMP->UpdateNormalAndDepth();
+
+        mpMap->AddMapPoint(pMP);
+        mlpRecentAddedMapPoints.push_back(pMP);
+      }
+    }
+  }
+}
+
+void LocalMapping::TriangulateWithNeighbor(KeyFrame *pKF2, const int Ftype, std::vector<TriangulatedPoint> &vCandidates) {
   cv::Mat Rcw1 = mpCurrentKeyFrame->GetRotation();
   cv::Mat Rwc1 = Rcw1.t();
   cv::Mat tcw1 = mpCurrentKeyFrame->GetTranslation();
@@ -351,211 +445,188 @@ void LocalMapping::CreateNewMapPoints(const int Ftype) {
 
   const float ratioFactor = 1.5f * mpCurrentKeyFrame->mfScaleFactor;
 
-  int nnew = 0;
+  // Check first that baseline is not too short
+  cv::Mat Ow2 = pKF2->GetCameraCenter();
+  cv::Mat vBaseline = Ow2 - Ow1;
+  const float baseline = cv::norm(vBaseline);
 
-  // Search matches with epipolar restriction and triangulate
-  for (std::size_t i = 0; i < vpNeighKFs.size(); i++) {
-    if (i > 0 && CheckNewKeyFrames())
+  if (!mbMonocular) {
+    if (baseline < pKF2->mb)
       return;
+  } else {
+    
+    const float medianDepthKF2 = pKF2->ComputeSceneMedianDepth(2, Ftype);
+    const float ratioBaselineDepth = baseline / medianDepthKF2;
 
-    KeyFrame *pKF2 = vpNeighKFs[i];
-
-    // Check first that baseline is not too short
-    cv::Mat Ow2 = pKF2->GetCameraCenter();
-    cv::Mat vBaseline = Ow2 - Ow1;
-    const float baseline = cv::norm(vBaseline);
+    if (ratioBaselineDepth < 0.01)
+      return;
+  }
 
-    if (!mbMonocular) {
-      if (baseline < pKF2->mb)
+  // Compute Fundamental Matrix
+  cv::Mat F12 = ComputeF12(mpCurrentKeyFrame, pKF2);
+
+  // Search matches that fullfil epipolar constraint
+  Associater associater(0.6, false);
+  std::vector<pair<std::size_t, std::size_t>> vMatchedIndices;
+  associater.SearchForTriangulation(mpCurrentKeyFrame, pKF2, F12, vMatchedIndices, false, Ftype);
+
+  cv::Mat Rcw2 = pKF2->GetRotation();
+  cv::Mat Rwc2 = Rcw2.t();
+  cv::Mat tcw2 = pKF2->GetTranslation();
+  cv::Mat Tcw2(3, 4, CV_32F);
+  Rcw2.copyTo(Tcw2.colRange(0, 3));
+  tcw2.copyTo(Tcw2.col(3));
+
+  const float &fx2 = pKF2->fx;
+  const float &fy2 = pKF2->fy;
+  const float &cx2 = pKF2->cx;
+  const float &cy2 = pKF2->cy;
+  const float &invfx2 = pKF2->invfx;
+  const float &invfy2 = pKF2->invfy;
+
+  // Triangulate each match
+  const int nmatches = vMatchedIndices.size();
+  for (int ikp = 0; ikp < nmatches; ikp++) {
+    const int &idx1 = vMatchedIndices[ikp].first;
+    const int &idx2 = vMatchedIndices[ikp].second;
+
+    const cv::KeyPoint &kp1 = mpCurrentKeyFrame->Channels[Ftype].mpFeatures->mvKeysUn[idx1];
+    const float kp1_ur = mpCurrentKeyFrame->Channels[Ftype].mpFeatures->mvuRight[idx1];
+    bool bStereo1 = kp1_ur >= 0;
+
+    const cv::KeyPoint &kp2 = pKF2->Channels[Ftype].mpFeatures->mvKeysUn[idx2];
+    const float kp2_ur = pKF2->Channels[Ftype].mpFeatures->mvuRight[idx2];
+    bool bStereo2 = kp2_ur >= 0;
+
+    // Check parallax between rays
+    cv::Mat xn1 = (cv::Mat_<float>(3, 1) << (kp1.pt.x - cx1) * invfx1, (kp1.pt.y - cy1) * invfy1, 1.0);
+    cv::Mat xn2 = (cv::Mat_<float>(3, 1) << (kp2.pt.x - cx2) * invfx2, (kp2.pt.y - cy2) * invfy2, 1.0);
+
+    cv::Mat ray1 = Rwc1 * xn1;
+    cv::Mat ray2 = Rwc2 * xn2;
+    const float cosParallaxRays = ray1.dot(ray2) / (cv::norm(ray1) * cv::norm(ray2));
+
+    float cosParallaxStereo = cosParallaxRays + 1;
+    float cosParallaxStereo1 = cosParallaxStereo;
+    float cosParallaxStereo2 = cosParallaxStereo;
+
+    if (bStereo1)
+      cosParallaxStereo1 = cos(2 * atan2(mpCurrentKeyFrame->mb / 2, mpCurrentKeyFrame->Channels[Ftype].mpFeatures->mvDepth[idx1]));
+    else if (bStereo2)
+      cosParallaxStereo2 = cos(2 * atan2(pKF2->mb / 2, pKF2->Channels[Ftype].mpFeatures->mvDepth[idx2]));
+
+    cosParallaxStereo = min(cosParallaxStereo1, cosParallaxStereo2);
+
+    cv::Mat x3D;
+    if (cosParallaxRays < cosParallaxStereo && cosParallaxRays > 0 && (bStereo1 || bStereo2 || cosParallaxRays < 0.9998)) {
+      // Linear Triangulation Method
+      cv::Mat A(4, 4, CV_32F);
+      A.row(0) = xn1.at<float>(0) * Tcw1.row(2) - Tcw1.row(0);
+      A.row(1) = xn1.at<float>(1) * Tcw1.row(2) - Tcw1.row(1);
+      A.row(2) = xn2.at<float>(0) * Tcw2.row(2) - Tcw2.row(0);
+      A.row(3) = xn2.at<float>(1) * Tcw2.row(2) - Tcw2.row(1);
+
+      cv::Mat w, u, vt;
+      cv::SVD::compute(A, w, u, vt, cv::SVD::MODIFY_A | cv::SVD::FULL_UV);
+
+      x3D = vt.row(3).t();
+
+      if (x3D.at<float>(3) == 0)
         continue;
-    } else {
-      
-      const float medianDepthKF2 = pKF2->ComputeSceneMedianDepth(2, Ftype);
-      const float ratioBaselineDepth = baseline / medianDepthKF2;
 
-      if (ratioBaselineDepth < 0.01)
-        continue;
-    }
+      // Euclidean coordinates
+      x3D = x3D.rowRange(0, 3) / x3D.at<float>(3);
 
-    // Compute Fundamental Matrix
-    cv::Mat F12 = ComputeF12(mpCurrentKeyFrame, pKF2);
-
-    // Search matches that fullfil epipolar constraint
-    std::vector<pair<std::size_t, std::size_t>> vMatchedIndices;
-    assocaiter.SearchForTriangulation(mpCurrentKeyFrame, pKF2, F12, vMatchedIndices, false, Ftype);
-
-    cv::Mat Rcw2 = pKF2->GetRotation();
-    cv::Mat Rwc2 = Rcw2.t();
-    cv::Mat tcw2 = pKF2->GetTranslation();
-    cv::Mat Tcw2(3, 4, CV_32F);
-    Rcw2.copyTo(Tcw2.colRange(0, 3));
-    tcw2.copyTo(Tcw2.col(3));
-
-    const float &fx2 = pKF2->fx;
-    const float &fy2 = pKF2->fy;
-    const float &cx2 = pKF2->cx;
-    const float &cy2 = pKF2->cy;
-    const float &invfx2 = pKF2->invfx;
-    const float &invfy2 = pKF2->invfy;
-
-    // Triangulate each match
-    const int nmatches = vMatchedIndices.size();
-    for (int ikp = 0; ikp < nmatches; ikp++) {
-      const int &idx1 = vMatchedIndices[ikp].first;
-      const int &idx2 = vMatchedIndices[ikp].second;
-
-      const cv::KeyPoint &kp1 = mpCurrentKeyFrame->Channels[Ftype].mvKeysUn[idx1];
-      const float kp1_ur = mpCurrentKeyFrame->Channels[Ftype].mvuRight[idx1];
-      bool bStereo1 = kp1_ur >= 0;
-
-      const cv::KeyPoint &kp2 = pKF2->Channels[Ftype].mvKeysUn[idx2];
-      const float kp2_ur = pKF2->Channels[Ftype].mvuRight[idx2];
-      bool bStereo2 = kp2_ur >= 0;
-
-      // Check parallax between rays
-      cv::Mat xn1 = (cv::Mat_<float>(3, 1) << (kp1.pt.x - cx1) * invfx1, (kp1.pt.y - cy1) * invfy1, 1.0);
-      cv::Mat xn2 = (cv::Mat_<float>(3, 1) << (kp2.pt.x - cx2) * invfx2, (kp2.pt.y - cy2) * invfy2, 1.0);
-
-      cv::Mat ray1 = Rwc1 * xn1;
-      cv::Mat ray2 = Rwc2 * xn2;
-      const float cosParallaxRays = ray1.dot(ray2) / (cv::norm(ray1) * cv::norm(ray2));
-
-      float cosParallaxStereo = cosParallaxRays + 1;
-      float cosParallaxStereo1 = cosParallaxStereo;
-      float cosParallaxStereo2 = cosParallaxStereo;
-
-      if (bStereo1)
-        cosParallaxStereo1 = cos(2 * atan2(mpCurrentKeyFrame->mb / 2, mpCurrentKeyFrame->Channels[Ftype].mvDepth[idx1]));
-      else if (bStereo2)
-        cosParallaxStereo2 = cos(2 * atan2(pKF2->mb / 2, pKF2->Channels[Ftype].mvDepth[idx2]));
-
-      cosParallaxStereo = min(cosParallaxStereo1, cosParallaxStereo2);
-
-      cv::Mat x3D;
-      if (cosParallaxRays < cosParallaxStereo && cosParallaxRays > 0 && (bStereo1 || bStereo2 || cosParallaxRays < 0.9998)) {
-        // Linear Triangulation Method
-        cv::Mat A(4, 4, CV_32F);
-        A.row(0) = xn1.at<float>(0) * Tcw1.row(2) - Tcw1.row(0);
-        A.row(1) = xn1.at<float>(1) * Tcw1.row(2) - Tcw1.row(1);
-        A.row(2) = xn2.at<float>(0) * Tcw2.row(2) - Tcw2.row(0);
-        A.row(3) = xn2.at<float>(1) * Tcw2.row(2) - Tcw2.row(1);
-
-        cv::Mat w, u, vt;
-        cv::SVD::compute(A, w, u, vt, cv::SVD::MODIFY_A | cv::SVD::FULL_UV);
-
-        x3D = vt.row(3).t();
-
-        if (x3D.at<float>(3) == 0)
-          continue;
+    } else if (bStereo1 && cosParallaxStereo1 < cosParallaxStereo2) {
+      x3D = mpCurrentKeyFrame->UnprojectStereo(idx1, Ftype);
+    } else if (bStereo2 && cosParallaxStereo2 < cosParallaxStereo1) {
+      x3D = pKF2->UnprojectStereo(idx2, Ftype);
+    } else
+      continue; // No stereo and very low parallax
 
-        // Euclidean coordinates
-        x3D = x3D.rowRange(0, 3) / x3D.at<float>(3);
+    cv::Mat x3Dt = x3D.t();
 
-      } else if (bStereo1 && cosParallaxStereo1 < cosParallaxStereo2) {
-        x3D = mpCurrentKeyFrame->UnprojectStereo(idx1, Ftype);
-      } else if (bStereo2 && cosParallaxStereo2 < cosParallaxStereo1) {
-        x3D = pKF2->UnprojectStereo(idx2, Ftype);
-      } else
-        continue; // No stereo and very low parallax
+    // Check triangulation in front of cameras
+    float z1 = Rcw1.row(2).dot(x3Dt) + tcw1.at<float>(2);
+    if (z1 <= 0)
+      continue;
 
-      cv::Mat x3Dt = x3D.t();
+    float z2 = Rcw2.row(2).dot(x3Dt) + tcw2.at<float>(2);
+    if (z2 <= 0)
+      continue;
 
-      // Check triangulation in front of cameras
-      float z1 = Rcw1.row(2).dot(x3Dt) + tcw1.at<float>(2);
-      if (z1 <= 0)
+    // Check reprojection error in first keyframe
+    const float &sigmaSquare1 = mpCurrentKeyFrame->mvLevelSigma2[kp1.octave];
+    const float x1 = Rcw1.row(0).dot(x3Dt) + tcw1.at<float>(0);
+    const float y1 = Rcw1.row(1).dot(x3Dt) + tcw1.at<float>(1);
+    const float invz1 = 1.0 / z1;
+
+    if (!bStereo1) {
+      float u1 = fx1 * x1 * invz1 + cx1;
+      float v1 = fy1 * y1 * invz1 + cy1;
+      float errX1 = u1 - kp1.pt.x;
+      float errY1 = v1 - kp1.pt.y;
+      if ((errX1 * errX1 + errY1 * errY1) > 5.991 * sigmaSquare1)
         continue;
-
-      float z2 = Rcw2.row(2).dot(x3Dt) + tcw2.at<float>(2);
-      if (z2 <= 0)
+    } else {
+      float u1 = fx1 * x1 * invz1 + cx1;
+      float u1_r = u1 - mpCurrentKeyFrame->mbf * invz1;
+      float v1 = fy1 * y1 * invz1 + cy1;
+      float errX1 = u1 - kp1.pt.x;
+      float errY1 = v1 - kp1.pt.y;
+      float errX1_r = u1_r - kp1_ur;
+      if ((errX1 * errX1 + errY1 * errY1 + errX1_r * errX1_r) > 7.8 * sigmaSquare1)
         continue;
+    }
 
-      // Check reprojection error in first keyframe
-      const float &sigmaSquare1 = mpCurrentKeyFrame->mvLevelSigma2[kp1.octave];
-      const float x1 = Rcw1.row(0).dot(x3Dt) + tcw1.at<float>(0);
-      const float y1 = Rcw1.row(1).dot(x3Dt) + tcw1.at<float>(1);
-      const float invz1 = 1.0 / z1;
-
-      if (!bStereo1) {
-        float u1 = fx1 * x1 * invz1 + cx1;
-        float v1 = fy1 * y1 * invz1 + cy1;
-        float errX1 = u1 - kp1.pt.x;
-        float errY1 = v1 - kp1.pt.y;
-        if ((errX1 * errX1 + errY1 * errY1) > 5.991 * sigmaSquare1)
-          continue;
-      } else {
-        float u1 = fx1 * x1 * invz1 + cx1;
-        float u1_r = u1 - mpCurrentKeyFrame->mbf * invz1;
-        float v1 = fy1 * y1 * invz1 + cy1;
-        float errX1 = u1 - kp1.pt.x;
-        float errY1 = v1 - kp1.pt.y;
-        float errX1_r = u1_r - kp1_ur;
-        if ((errX1 * errX1 + errY1 * errY1 + errX1_r * errX1_r) > 7.8 * sigmaSquare1)
-          continue;
-      }
-
-      // Check reprojection error in second keyframe
-      const float sigmaSquare2 = pKF2->mvLevelSigma2[kp2.octave];
-      const float x2 = Rcw2.row(0).dot(x3Dt) + tcw2.at<float>(0);
-      const float y2 = Rcw2.row(1).dot(x3Dt) + tcw2.at<float>(1);
-      const float invz2 = 1.0 / z2;
-      if (!bStereo2) {
-        float u2 = fx2 * x2 * invz2 + cx2;
-        float v2 = fy2 * y2 * invz2 + cy2;
-        float errX2 = u2 - kp2.pt.x;
-        float errY2 = v2 - kp2.pt.y;
-        if ((errX2 * errX2 + errY2 * errY2) > 5.991 * sigmaSquare2)
-          continue;
-      } else {
-        float u2 = fx2 * x2 * invz2 + cx2;
-        float u2_r = u2 - mpCurrentKeyFrame->mbf * invz2;
-        float v2 = fy2 * y2 * invz2 + cy2;
-        float errX2 = u2 - kp2.pt.x;
-        float errY2 = v2 - kp2.pt.y;
-        float errX2_r = u2_r - kp2_ur;
-        if ((errX2 * errX2 + errY2 * errY2 + errX2_r * errX2_r) > 7.8 * sigmaSquare2)
-          continue;
-      }
-
-      // Check scale consistency
-      cv::Mat normal1 = x3D - Ow1;
-      float dist1 = cv::norm(normal1);
-
-      cv::Mat normal2 = x3D - Ow2;
-      float dist2 = cv::norm(normal2);
-
-      if (dist1 == 0 || dist2 == 0)
+    // Check reprojection error in second keyframe
+    const float sigmaSquare2 = pKF2->mvLevelSigma2[kp2.octave];
+    const float x2 = Rcw2.row(0).dot(x3Dt) + tcw2.at<float>(0);
+    const float y2 = Rcw2.row(1).dot(x3Dt) + tcw2.at<float>(1);
+    const float invz2 = 1.0 / z2;
+    if (!bStereo2) {
+      float u2 = fx2 * x2 * invz2 + cx2;
+      float v2 = fy2 * y2 * invz2 + cy2;
+      float errX2 = u2 - kp2.pt.x;
+      float errY2 = v2 - kp2.pt.y;
+      if ((errX2 * errX2 + errY2 * errY2) > 5.991 * sigmaSquare2)
         continue;
-
-      const float ratioDist = dist2 / dist1;
-      const float ratioOctave = mpCurrentKeyFrame->mvScaleFactors[kp1.octave] / pKF2->mvScaleFactors[kp2.octave];
-
-      /*if(fabs(ratioDist-ratioOctave)>ratioFactor)
-          continue;*/
-      if (ratioDist * ratioFactor < ratioOctave || ratioDist > ratioOctave * ratioFactor)
+    } else {
+      float u2 = fx2 * x2 * invz2 + cx2;
+      float u2_r = u2 - mpCurrentKeyFrame->mbf * invz2;
+      float v2 = fy2 * y2 * invz2 + cy2;
+      float errX2 = u2 - kp2.pt.x;
+      float errY2 = v2 - kp2.pt.y;
+      float errX2_r = u2_r - kp2_ur;
+      if ((errX2 * errX2 + errY2 * errY2 + errX2_r * errX2_r) > 7.8 * sigmaSquare2)
         continue;
+    }
 
-      // Triangulation is succesfull
-      MapPoint *pMP = new MapPoint(x3D, mpCurrentKeyFrame, mpMap, Ftype);
-
-      pMP->AddObservation(mpCurrentKeyFrame, idx1);
-      pMP->AddObservation(pKF2, idx2);
+    // Check scale consistency
+    cv::Mat normal1 = x3D - Ow1;
+    float dist1 = cv::norm(normal1);
 
-      mpCurrentKeyFrame->AddMapPoint(pMP, idx1, Ftype);
-      pKF2->AddMapPoint(pMP, idx2, Ftype);
+    cv::Mat normal2 = x3D - Ow2;
+    float dist2 = cv::norm(normal2);
 
-      pMP->ComputeDistinctiveDescriptors(); // May delete Ftype laterly
+    if (dist1 == 0 || dist2 == 0)
+      continue;
 
-      pMP->UpdateNormalAndDepth();
+    const float ratioDist = dist2 / dist1;
+    const float ratioOctave = mpCurrentKeyFrame->mvScaleFactors[kp1.octave] / pKF2->mvScaleFactors[kp2.octave];
 
-      mpMap->AddMapPoint(pMP);
-      mlpRecentAddedMapPoints.push_back(pMP);
+    /*if(fabs(ratioDist-ratioOctave)>ratioFactor)
+        continue;*/
+    if (ratioDist * ratioFactor < ratioOctave || ratioDist > ratioOctave * ratioFactor)
+      continue;
 
-      nnew++;
-    }
+    // Triangulation is succesfull
+    vCandidates.push_back(TriangulatedPoint{x3D, (std::size_t)idx1, (std::size_t)idx2});
   }
 }
 
 void LocalMapping::SearchInNeighbors(const int Ftype) {
+  PROFILE_SCOPE_ARG("LocalMapping::SearchInNeighbors", Ftype);
   // Retrieve neighbor keyframes
   int nn = 10;
   if (mbMonocular)
@@ -629,81 +700,94 @@ void LocalMapping::SearchInNeighbors(const int Ftype) {
 }
 
 void LocalMapping::KeyFrameCullingMultiChannels() {
+  PROFILE_SCOPE("LocalMapping::KeyFrameCulling");
   // Check redundant keyframes (only local keyframes)
   // A keyframe is considered redundant if the 90% of the MapPoints it sees, are
   // seen in at least other 3 keyframes (in the same or finer scale) We only
   // consider close stereo points
   std::vector<KeyFrame *> vpLocalKeyFrames = mpCurrentKeyFrame->GetVectorCovisibleKeyFrames();
+  const int nKFs = vpLocalKeyFrames.size();
 
-  for (std::vector<KeyFrame *>::iterator vit = vpLocalKeyFrames.begin(), vend = vpLocalKeyFrames.end(); vit != vend; vit++) {
-    KeyFrame *pKF = *vit;
-    if (pKF->mnId == 0)
-      continue;
-
-    int nObs = 3;
-    const int thObs = nObs;            // threshold
-
-    int nRedundantObservations[Ntype]; // Number of redundant map points
-    int nMPs[Ntype];                   // NUmber of valid map points
-    
-    for (int Ftype = 0; Ftype < Ntype; Ftype++) {
-      nRedundantObservations[Ftype] = 0;
-      nMPs[Ftype] = 0;
+  // Count every keyframe and channel in parallel against the current map
+  std::vector<int> vnMPs(nKFs * Ntype, 0);
+  std::vector<int> vnRedundant(nKFs * Ntype, 0);
+  {
+    TaskGroup tasks(mpThreadPool);
+    for (int k = 0; k < nKFs; k++) {
+      if (vpLocalKeyFrames[k]->mbOrigin)
+        continue;
+      for (int Ftype = 0; Ftype < Ntype; Ftype++)
+        tasks.Run(
+            [&, k, Ftype] {
+              CountRedundantObservations(vpLocalKeyFrames[k], Ftype, vnMPs[k * Ntype + Ftype],
+                                         vnRedundant[k * Ntype + Ftype]);
+            },
+            "LocalMapping::CountRedundantObservations");
     }
-    
-    for (int Ftype = 0; Ftype < Ntype; Ftype++) {
-      const std::vector<MapPoint *> vpMapPoints = pKF->GetMapPointMatches(Ftype);
-
-      for (std::size_t i = 0, iend = vpMapPoints.size(); i < iend; i++) {
-        MapPoint *pMP = vpMapPoints[i];
-
-        if (pMP) {
-          if (!pMP->isBad()) {
-            if (!mbMonocular) {
-              if (pKF->Channels[Ftype].mvDepth[i] > pKF->mThDepth || pKF->Channels[Ftype].mvDepth[i] < 0)
-                continue;
-            }
+  }
 
-            nMPs[Ftype]++;
-
-            if (pMP->Observations() > thObs) {
-              const int &scaleLevel = pKF->Channels[Ftype].mvKeysUn[i].octave;
-              const map<KeyFrame *, std::size_t> observations = pMP->GetObservations();
-              int nObs = 0;
-              for (map<KeyFrame *, std::size_t>::const_iterator mit = observations.begin(), mend = observations.end(); mit != mend; mit++) {
-                KeyFrame *pKFi = mit->first;
-                if (pKFi == pKF)
-                  continue;
-                const int &scaleLeveli = pKFi->Channels[Ftype].mvKeysUn[mit->second].octave;
-
-                if (scaleLeveli <= scaleLevel + 1) {
-                  nObs++;
-                  if (nObs >= thObs)
-                    break;
-                }
-              }
+  // Set the bad flags in order. Culling a keyframe removes observations the
+  // later candidates were counted with, so those are counted again.
+  bool bCulled = false;
+  for (int k = 0; k < nKFs; k++) {
+    KeyFrame *pKF = vpLocalKeyFrames[k];
+    if (pKF->mbOrigin)
+      continue;
 
-              if (nObs >= thObs) {
-                nRedundantObservations[Ftype]++;
-              }
-            }
-          }
-        }
-      }
+    if (bCulled) {
+      for (int Ftype = 0; Ftype < Ntype; Ftype++)
+        CountRedundantObservations(pKF, Ftype, vnMPs[k * Ntype + Ftype], vnRedundant[k * Ntype + Ftype]);
     }
 
-
     // All channels should satisfy the requirements
     bool KFBadFlag = true;
     for (int Ftype = 0; Ftype < Ntype; Ftype++) {
-      if (nRedundantObservations[Ftype] <= 0.9 * nMPs[Ftype]) {
+      if (vnRedundant[k * Ntype + Ftype] <= 0.9 * vnMPs[k * Ntype + Ftype]) {
         KFBadFlag = false;
         break;
-      } 
+      }
     }
 
-    if (KFBadFlag)
+    if (KFBadFlag) {
       pKF->SetBadFlag();
+      bCulled = bCulled || pKF->isBad();
+    }
+  }
+}
+
+void LocalMapping::CountRedundantObservations(KeyFrame *pKF, const int Ftype, int &nMPs, int &nRedundant) {
+  const int thObs = 3;
+  nMPs = 0;
+  nRedundant = 0;
+
+  const std::vector<MapPoint *> vpMapPoints = pKF->GetMapPointMatches(Ftype);
+  const FeatureStore &features = *pKF->Channels[Ftype].mpFeatures;
+
+  for (std::size_t i = 0, iend = vpMapPoints.size(); i < iend; i++) {
+    MapPoint *pMP = vpMapPoints[i];
+    if (!pMP || pMP->isBad())
+      continue;
+
+    if (!mbMonocular) {
+      if (features.mvDepth[i] > pKF->mThDepth || features.mvDepth[i] < 0)
+        continue;
+    }
+
+    nMPs++;
+
+    if (pMP->Observations() > thObs) {
+      const int scaleLevel = features.mvOctave[i];
+      int nObs = 0;
+      pMP->ForEachObservation([&](KeyFrame *pKFi, std::size_t idx) {
+        if (pKFi == pKF)
+          return;
+        if (pKFi->Channels[Ftype].mpFeatures->mvOctave[idx] <= scaleLevel + 1)
+          nObs++;
+      });
+
+      if (nObs >= thObs)
+        nRedundant++;
+    }
   }
 }
 
@@ -25,9 +25,11 @@
 #include "Converter.h"
 
 #include "Optimizer.h"
+#include "Profiler.h"
 
 #include "Associater.h"
 
+#include <algorithm>
 #include <mutex>
 #include <thread>
 
@@ -37,13 +39,16 @@ namespace ORB_SLAM2 {
 
 LoopClosing::LoopClosing(Map *pMap, std::vector<KeyFrameDatabase *> pDB, std::vector<ORBVocabulary *> pVoc,
                          const bool bFixScale, int Ntype)
-    : mbResetRequested(false), mbFinishRequested(false), mbFinished(true),
-      mpMap(pMap), mpMatchedKF(NULL),
+    : mbResetRequested(false), mbNewMapRequested(false), mbDiscardMap(false), mbFinishRequested(false), mbFinished(true),
+      mpMap(pMap), mpAtlas(NULL), mpMapStore(NULL), mpThreadPool(nullptr), mpMatchedKF(NULL),
       mLastLoopKFid(0), mbRunningGBA(false), mbFinishedGBA(true),
       mbStopGBA(false), mpThreadGBA(NULL), mbFixScale(bFixScale),
       mnFullBAIdx(0), mpKeyFrameDB(pDB), mpVocabulary(pVoc), Ntype(Ntype) {
   mnCovisibilityConsistencyTh = 3;
 
+  mvpCurrentMatchedPoints.resize(Ntype);
+  mvpLoopMapPoints.resize(Ntype);
+
   /*
   mpKeyFrameDB.resize(Ntype);
   mpVocabulary.resize(Ntype);
@@ -64,26 +69,39 @@ void LoopClosing::SetLocalMapper(LocalMapping *pLocalMapper) {
   mpLocalMapper = pLocalMapper;
 }
 
+void LoopClosing::SetThreadPool(ThreadPool *pThreadPool) { mpThreadPool = pThreadPool; }
+
+void LoopClosing::SetAtlas(Atlas *pAtlas) { mpAtlas = pAtlas; }
+
+void LoopClosing::SetMapStore(MapStore *pMapStore) { mpMapStore = pMapStore; }
+
 void LoopClosing::Run() {
+  PROFILE_THREAD_NAME("LoopClosing");
+
   mbFinished = false;
 
   while (1) {
     
     // Check if there are keyframes in the queue
     if (CheckNewKeyFrames()) {
+      // Loop detection and correction read keyframe features of the whole map
+      shared_lock<shared_mutex> residency = mpMapStore->ReadGuard(true);
+
       // Detect loop candidates and check covisibility consistency
-      if (DetectLoop(0)) {
+      if (DetectLoop()) {
         // Compute similarity transformation [sR|t]
         // In the stereo/RGBD case s=1
-        if (ComputeSim3(0)) {
+        if (ComputeSim3()) {
           // Perform loop fusion and pose graph optimization
-          CorrectLoop(0);
+          CorrectLoop();
         }
       }
     }
 
     ResetIfRequested();
 
+    NewMapIfRequested();
+
     if (CheckFinish())
       break;
 
@@ -96,7 +114,7 @@ void LoopClosing::Run() {
 
 void LoopClosing::InsertKeyFrame(KeyFrame *pKF) {
   unique_lock<mutex> lock(mMutexLoopQueue);
-  if (pKF->mnId != 0)
+  if (!pKF->mbOrigin)
     mlpLoopKeyFrameQueue.push_back(pKF);
 }
 
@@ -127,10 +145,78 @@ void LoopClosing::ResetIfRequested() {
   if (mbResetRequested) {
     mlpLoopKeyFrameQueue.clear();
     mLastLoopKFid = 0;
+    {
+      unique_lock<mutex> lockNewMap(mMutexNewMap);
+      mbNewMapRequested = false;
+    }
     mbResetRequested = false;
   }
 }
 
+void LoopClosing::RequestNewMap(const bool bDiscard) {
+  unique_lock<mutex> lock(mMutexNewMap);
+  mbNewMapRequested = true;
+  mbDiscardMap = bDiscard;
+}
+
+bool LoopClosing::isNewMapRequested() {
+  unique_lock<mutex> lock(mMutexNewMap);
+  return mbNewMapRequested;
+}
+
+void LoopClosing::NewMapIfRequested() {
+  bool bDiscard;
+  {
+    unique_lock<mutex> lock(mMutexNewMap);
+    if (!mbNewMapRequested)
+      return;
+    bDiscard = mbDiscardMap;
+  }
+
+  // A running Global BA would write its result into the new map
+  AbortGlobalBundleAdjustment();
+
+  // Local Mapping stops once its queue is empty, no keyframe of the old map is
+  // left behind. The stop is this thread's, as for a loop correction.
+  mpLocalMapper->RequestStop();
+  while (!mpLocalMapper->isStopped() && !mpLocalMapper->isFinished())
+    this_thread::sleep_for(chrono::microseconds(1000));
+
+  {
+    unique_lock<mutex> lock(mpMap->mMutexMapUpdate);
+    if (bDiscard) {
+      Map *pDiscarded = mpAtlas->DiscardActiveMap();
+      cout << "Discarded map with " << pDiscarded->KeyFramesInMap() << " keyframes" << endl;
+
+      // Loop detection must not match the discarded keyframes, erase needs
+      // their words. Keyframes whose features are lost were dropped already.
+      shared_lock<shared_mutex> residency = mpMapStore->ReadGuard();
+      for (KeyFrame *pKF : pDiscarded->GetAllKeyFrames()) {
+        if (!pKF->EnsureResident())
+          continue;
+        for (int Ftype = 0; Ftype < Ntype; Ftype++)
+          mpKeyFrameDB[Ftype]->erase(pKF, Ftype);
+      }
+    } else {
+      Map *pArchived = mpAtlas->ArchiveActiveMap();
+      cout << "Archived map with " << pArchived->KeyFramesInMap() << " keyframes, " << mpAtlas->CountMaps()
+           << " maps in the atlas" << endl;
+    }
+  }
+
+  // The queued keyframes and the consistency groups belong to the old map
+  {
+    unique_lock<mutex> lock(mMutexLoopQueue);
+    mlpLoopKeyFrameQueue.clear();
+  }
+  mvConsistentGroups.clear();
+
+  mpLocalMapper->Release();
+
+  unique_lock<mutex> lock(mMutexNewMap);
+  mbNewMapRequested = false;
+}
+
 void LoopClosing::RequestFinish() {
   unique_lock<mutex> lock(mMutexFinish);
   mbFinishRequested = true;
@@ -151,7 +237,8 @@ bool LoopClosing::isFinished() {
   return mbFinished;
 }
 
-bool LoopClosing::DetectLoop(const int Ftype) {
+bool LoopClosing::DetectLoop() {
+  PROFILE_SCOPE("LoopClosing::DetectLoop");
   
   // step 1 : get one keyframe from queue
   {
@@ -161,39 +248,84 @@ bool LoopClosing::DetectLoop(const int Ftype) {
     // Avoid that a keyframe can be erased while it is being process by this thread
     mpCurrentKF->SetNotErase();
   }
+  // The database and the scores read the BoW vectors. A keyframe whose
+  // features are lost is neither added nor used to detect a loop.
+  if (!mpCurrentKF->EnsureResident()) {
+    mpCurrentKF->SetErase();
+    return false;
+  }
 
-  // step 2 : If the map contains less than 10 KF or less than 10 KF have passed from last loop detection
-  if (mpCurrentKF->mnId < mLastLoopKFid + 10) {
+  // step 2 : If the map contains less than 10 KF or less than 10 KF have passed from last loop detection.
+  // Keyframes archived meanwhile with their map are only added to the database.
+  if (mpCurrentKF->mnId < mLastLoopKFid + 10 || mpCurrentKF->GetMap() != mpMap) {
     for (int i = 0; i < Ntype; i++)
-      mpKeyFrameDB[i]->add(mpCurrentKF, i); // TO-DO need add keyframe in multi channels
+      mpKeyFrameDB[i]->add(mpCurrentKF, i);
     mpCurrentKF->SetErase();
     return false;
   }
 
-  // step 3 : Compute reference BoW similarity score. This is the lowest score to a connected keyframe in the covisibility graph
-  // We will impose loop candidates to have a higher similarity than this
+  // step 3 : For every channel compute the reference BoW similarity score. This is the lowest score to a connected keyframe in the covisibility graph
+  // and the database of the channel is queried imposing loop candidates to have a higher similarity than this
   const std::vector<KeyFrame *> vpConnectedKeyFrames = mpCurrentKF->GetVectorCovisibleKeyFrames();
-  const DBoW2::BowVector &CurrentBowVec = mpCurrentKF->Channels[Ftype].mBowVec;
-  float minScore = 1;
-  for (std::size_t i = 0; i < vpConnectedKeyFrames.size(); i++) {
-    KeyFrame *pKF = vpConnectedKeyFrames[i];
-    if (pKF->isBad())
-      continue;
-    const DBoW2::BowVector &BowVec = pKF->Channels[Ftype].mBowVec;
+  std::vector<std::vector<KeyFrame *>> vvpChannelCandidateKFs(Ntype);
+  std::vector<std::vector<float>> vvChannelScores(Ntype);
+  {
+    TaskGroup channels(mpThreadPool);
+    for (int Ftype = 0; Ftype < Ntype; Ftype++)
+      channels.Run(
+          [this, Ftype, &vpConnectedKeyFrames, &vvpChannelCandidateKFs, &vvChannelScores] {
+            const DBoW2::BowVector &CurrentBowVec = mpCurrentKF->Channels[Ftype].mBowVec;
+            float minScore = 1;
+            for (std::size_t i = 0; i < vpConnectedKeyFrames.size(); i++) {
+              KeyFrame *pKF = vpConnectedKeyFrames[i];
+              if (pKF->isBad() || !pKF->EnsureResident())
+                continue;
+              const DBoW2::BowVector &BowVec = pKF->Channels[Ftype].mBowVec;
+
+              float score = mpVocabulary[Ftype]->score(CurrentBowVec, BowVec);
+
+              if (score < minScore)
+                minScore = score;
+            }
+
+            vvpChannelCandidateKFs[Ftype] =
+                mpKeyFrameDB[Ftype]->DetectLoopCandidates(mpCurrentKF, minScore, Ftype, &vvChannelScores[Ftype]);
+          },
+          "LoopClosing::DetectLoopCandidates");
+  }
+
+  // step 4 : Fuse the candidates of all channels. Scores of different vocabularies are not comparable, so each
+  // channel adds the score of a candidate relative to its best one and keyframes found by several channels come first
+  map<KeyFrame *, float> mFusedScores;
+  for (int Ftype = 0; Ftype < Ntype; Ftype++) {
+    const std::vector<KeyFrame *> &vpChannelKFs = vvpChannelCandidateKFs[Ftype];
+    const std::vector<float> &vScores = vvChannelScores[Ftype];
 
-    float score = mpVocabulary[Ftype]->score(CurrentBowVec, BowVec);
+    float bestScore = 0;
+    for (float score : vScores)
+      bestScore = max(bestScore, score);
 
-    if (score < minScore)
-      minScore = score;
+    for (std::size_t i = 0; i < vpChannelKFs.size(); i++)
+      mFusedScores[vpChannelKFs[i]] += bestScore > 0 ? vScores[i] / bestScore : 1.0f;
   }
 
-  // step 4 : Query the database imposing the minimum score
-  std::vector<KeyFrame *> vpCandidateKFs = mpKeyFrameDB[Ftype]->DetectLoopCandidates(mpCurrentKF, minScore, Ftype);
+  std::vector<pair<float, KeyFrame *>> vScoreAndCandidate(mFusedScores.size());
+  std::size_t nFused = 0;
+  for (map<KeyFrame *, float>::iterator mit = mFusedScores.begin(), mend = mFusedScores.end(); mit != mend; mit++)
+    vScoreAndCandidate[nFused++] = make_pair(mit->second, mit->first);
+  sort(vScoreAndCandidate.begin(), vScoreAndCandidate.end(),
+       [](const pair<float, KeyFrame *> &a, const pair<float, KeyFrame *> &b) {
+         return a.first > b.first || (a.first == b.first && a.second->mnId < b.second->mnId);
+       });
+
+  std::vector<KeyFrame *> vpCandidateKFs(vScoreAndCandidate.size());
+  for (std::size_t i = 0; i < vScoreAndCandidate.size(); i++)
+    vpCandidateKFs[i] = vScoreAndCandidate[i].second;
 
   // If there are no loop candidates, just add new keyframe and return false
   if (vpCandidateKFs.empty()) {
     for (int i = 0; i < Ntype; i++)
-      mpKeyFrameDB[i]->add(mpCurrentKF, i); //  TO-DO need add keyframes in multi channels
+      mpKeyFrameDB[i]->add(mpCurrentKF, i);
     mvConsistentGroups.clear();
     mpCurrentKF->SetErase();
     return false;
@@ -256,7 +388,7 @@ bool LoopClosing::DetectLoop(const int Ftype) {
 
   // Add Current Keyframe to database
   for (int i = 0; i < Ntype; i++)
-    mpKeyFrameDB[i]->add(mpCurrentKF, i); // TO-DO need add multi channels in the multi channels
+    mpKeyFrameDB[i]->add(mpCurrentKF, i);
 
   if (mvpEnoughConsistentCandidates.empty()) {
     mpCurrentKF->SetErase();
@@ -269,43 +401,67 @@ bool LoopClosing::DetectLoop(const int Ftype) {
   return false;
 }
 
-bool LoopClosing::ComputeSim3(const int Ftype) {
+bool LoopClosing::ComputeSim3() {
+  PROFILE_SCOPE("LoopClosing::ComputeSim3");
   // For each consistent loop candidate we try to compute a Sim3
 
   const int nInitialCandidates = mvpEnoughConsistentCandidates.size();
 
-  // We compute first ORB matches for each candidate. If enough matches are found, we setup a Sim3Solver
+  // We compute first matches in every channel for each candidate. If enough matches are found, we setup a Sim3Solver
+  // on the matches of all channels
   Associater associater(0.75, true);
 
   std::vector<Sim3Solver *> vpSim3Solvers;
   vpSim3Solvers.resize(nInitialCandidates);
 
-  std::vector<std::vector<MapPoint *>> vvpMapPointMatches;
-  vvpMapPointMatches.resize(nInitialCandidates);
+  std::vector<std::vector<std::vector<MapPoint *>>> vvvpMapPointMatches(nInitialCandidates, std::vector<std::vector<MapPoint *>>(Ntype));
+  std::vector<std::vector<int>> vvnMatches(nInitialCandidates, std::vector<int>(Ntype, 0));
 
   std::vector<bool> vbDiscarded;
   vbDiscarded.resize(nInitialCandidates);
 
-  int nCandidates = 0; // candidates with enough matches
-
   for (int i = 0; i < nInitialCandidates; i++) {
     KeyFrame *pKF = mvpEnoughConsistentCandidates[i];
 
     // avoid that local mapping erase it while it is being processed in this thread
     pKF->SetNotErase();
 
-    if (pKF->isBad()) {
+    if (pKF->isBad())
       vbDiscarded[i] = true;
-      continue;
+  }
+
+  {
+    TaskGroup tasks(mpThreadPool);
+    for (int i = 0; i < nInitialCandidates; i++) {
+      if (vbDiscarded[i])
+        continue;
+      for (int Ftype = 0; Ftype < Ntype; Ftype++)
+        tasks.Run(
+            [&, i, Ftype] {
+              vvnMatches[i][Ftype] = associater.SearchByBoW(mpCurrentKF, mvpEnoughConsistentCandidates[i],
+                                                            vvvpMapPointMatches[i][Ftype], Ftype);
+            },
+            "LoopClosing::SearchByBoW");
     }
+  }
+
+  int nCandidates = 0; // candidates with enough matches
 
-    int nmatches = associater.SearchByBoW(mpCurrentKF, pKF, vvpMapPointMatches[i], Ftype);
+  for (int i = 0; i < nInitialCandidates; i++) {
+    if (vbDiscarded[i])
+      continue;
+
+    KeyFrame *pKF = mvpEnoughConsistentCandidates[i];
+
+    int nmatches = 0;
+    for (int Ftype = 0; Ftype < Ntype; Ftype++)
+      nmatches += vvnMatches[i][Ftype];
 
     if (nmatches < 20) {
       vbDiscarded[i] = true;
       continue;
     } else {
-      Sim3Solver *pSolver = new Sim3Solver(Ftype, mpCurrentKF, pKF, vvpMapPointMatches[i], mbFixScale);
+      Sim3Solver *pSolver = new Sim3Solver(mpCurrentKF, pKF, vvvpMapPointMatches[i], mbFixScale);
       pSolver->SetRansacParameters(0.99, 20, 300);
       vpSim3Solvers[i] = pSolver;
     }
@@ -339,19 +495,34 @@ bool LoopClosing::ComputeSim3(const int Ftype) {
 
       // If RANSAC returns a Sim3, perform a guided matching and optimize with all correspondences
       if (!Scm.empty()) {
-        std::vector<MapPoint *> vpMapPointMatches(vvpMapPointMatches[i].size(), static_cast<MapPoint *>(NULL));
-        for (std::size_t j = 0, jend = vbInliers.size(); j < jend; j++) {
-          if (vbInliers[j])
-            vpMapPointMatches[j] = vvpMapPointMatches[i][j];
+        // Inliers are indexed like the matches of all channels one after the other
+        std::vector<std::vector<MapPoint *>> vvpMapPointMatches(Ntype);
+        std::size_t nOffset = 0;
+        for (int Ftype = 0; Ftype < Ntype; Ftype++) {
+          const std::vector<MapPoint *> &vpMatches = vvvpMapPointMatches[i][Ftype];
+          vvpMapPointMatches[Ftype].assign(vpMatches.size(), static_cast<MapPoint *>(NULL));
+          for (std::size_t j = 0, jend = vpMatches.size(); j < jend; j++) {
+            if (vbInliers[nOffset + j])
+              vvpMapPointMatches[Ftype][j] = vpMatches[j];
+          }
+          nOffset += vpMatches.size();
         }
 
         cv::Mat R = pSolver->GetEstimatedRotation();
         cv::Mat t = pSolver->GetEstimatedTranslation();
         const float s = pSolver->GetEstimatedScale();
-        associater.SearchBySim3(mpCurrentKF, pKF, vpMapPointMatches, s, R, t, 7.5, Ftype);
+        {
+          TaskGroup channels(mpThreadPool);
+          for (int Ftype = 0; Ftype < Ntype; Ftype++)
+            channels.Run(
+                [&, Ftype] {
+                  associater.SearchBySim3(mpCurrentKF, pKF, vvpMapPointMatches[Ftype], s, R, t, 7.5, Ftype);
+                },
+                "LoopClosing::SearchBySim3");
+        }
 
         g2o::Sim3 gScm(Converter::toMatrix3d(R), Converter::toVector3d(t), s);
-        const int nInliers = Optimizer::OptimizeSim3(mpCurrentKF, pKF, vpMapPointMatches, gScm, 10, mbFixScale, Ftype);
+        const int nInliers = Optimizer::OptimizeSim3MultiChannels(mpCurrentKF, pKF, vvpMapPointMatches, gScm, 10, mbFixScale);
 
         // If optimization is succesful stop ransacs and continue
         if (nInliers >= 20) {
@@ -361,13 +532,16 @@ bool LoopClosing::ComputeSim3(const int Ftype) {
           mg2oScw = gScm * gSmw;
           mScw = Converter::toCvMat(mg2oScw);
 
-          mvpCurrentMatchedPoints = vpMapPointMatches;
+          mvpCurrentMatchedPoints = vvpMapPointMatches;
           break;
         }
       }
     }
   }
 
+  for (int i = 0; i < nInitialCandidates; i++)
+    delete vpSim3Solvers[i];
+
   if (!bMatch) {
     for (int i = 0; i < nInitialCandidates; i++)
       mvpEnoughConsistentCandidates[i]->SetErase();
@@ -378,29 +552,41 @@ bool LoopClosing::ComputeSim3(const int Ftype) {
   // Retrieve MapPoints seen in Loop Keyframe and neighbors
   std::vector<KeyFrame *> vpLoopConnectedKFs = mpMatchedKF->GetVectorCovisibleKeyFrames();
   vpLoopConnectedKFs.push_back(mpMatchedKF);
-  mvpLoopMapPoints.clear();
-  for (std::vector<KeyFrame *>::iterator vit = vpLoopConnectedKFs.begin(); vit != vpLoopConnectedKFs.end(); vit++) {
-    KeyFrame *pKF = *vit;
-    std::vector<MapPoint *> vpMapPoints = pKF->GetMapPointMatches(Ftype);
-    for (std::size_t i = 0, iend = vpMapPoints.size(); i < iend; i++) {
-      MapPoint *pMP = vpMapPoints[i];
-      if (pMP) {
-        if (!pMP->isBad() && pMP->mnLoopPointForKF != mpCurrentKF->mnId) {
-          mvpLoopMapPoints.push_back(pMP);
-          pMP->mnLoopPointForKF = mpCurrentKF->mnId;
-        }
-      }
-    }
-  }
 
-  // Find more matches projecting with the computed Sim3
-  associater.SearchByProjection(mpCurrentKF, mScw, mvpLoopMapPoints, mvpCurrentMatchedPoints, 10, Ftype);
+  // Find more matches projecting with the computed Sim3, every channel on its own MapPoints
+  {
+    TaskGroup channels(mpThreadPool);
+    for (int Ftype = 0; Ftype < Ntype; Ftype++)
+      channels.Run(
+          [&, Ftype] {
+            std::vector<MapPoint *> &vpLoopMapPoints = mvpLoopMapPoints[Ftype];
+            vpLoopMapPoints.clear();
+            for (std::vector<KeyFrame *>::iterator vit = vpLoopConnectedKFs.begin(); vit != vpLoopConnectedKFs.end(); vit++) {
+              KeyFrame *pKF = *vit;
+              std::vector<MapPoint *> vpMapPoints = pKF->GetMapPointMatches(Ftype);
+              for (std::size_t i = 0, iend = vpMapPoints.size(); i < iend; i++) {
+                MapPoint *pMP = vpMapPoints[i];
+                if (pMP) {
+                  if (!pMP->isBad() && pMP->mnLoopPointForKF != mpCurrentKF->mnId) {
+                    vpLoopMapPoints.push_back(pMP);
+                    pMP->mnLoopPointForKF = mpCurrentKF->mnId;
+                  }
+                }
+              }
+            }
+
+            associater.SearchByProjection(mpCurrentKF, mScw, vpLoopMapPoints, mvpCurrentMatchedPoints[Ftype], 10, Ftype);
+          },
+          "LoopClosing::SearchByProjection");
+  }
 
   // If enough matches accept Loop
   int nTotalMatches = 0;
-  for (std::size_t i = 0; i < mvpCurrentMatchedPoints.size(); i++) {
-    if (mvpCurrentMatchedPoints[i])
-      nTotalMatches++;
+  for (int Ftype = 0; Ftype < Ntype; Ftype++) {
+    for (std::size_t i = 0; i < mvpCurrentMatchedPoints[Ftype].size(); i++) {
+      if (mvpCurrentMatchedPoints[Ftype][i])
+        nTotalMatches++;
+    }
   }
 
   if (nTotalMatches >= 40) {
@@ -416,24 +602,15 @@ bool LoopClosing::ComputeSim3(const int Ftype) {
   }
 }
 
-void LoopClosing::CorrectLoop(const int Ftype) {
+void LoopClosing::CorrectLoop() {
+  PROFILE_SCOPE("LoopClosing::CorrectLoop");
   cout << "Loop detected!" << endl;
 
   // Send a stop signal to Local Mapping. Avoid new keyframes are inserted while correcting the loop
   mpLocalMapper->RequestStop();
 
   // If a Global Bundle Adjustment is running, abort it
-  if (isRunningGBA()) {
-    unique_lock<mutex> lock(mMutexGBA);
-    mbStopGBA = true;
-
-    mnFullBAIdx++;
-
-    if (mpThreadGBA) {
-      mpThreadGBA->detach();
-      delete mpThreadGBA;
-    }
-  }
+  AbortGlobalBundleAdjustment();
 
   // Wait until Local Mapping has effectively stopped
   while (!mpLocalMapper->isStopped()) {
@@ -449,13 +626,24 @@ void LoopClosing::CorrectLoop(const int Ftype) {
   mvpCurrentConnectedKFs.push_back(mpCurrentKF);
 
   KeyFrameAndPose CorrectedSim3, NonCorrectedSim3;
-  CorrectedSim3[mpCurrentKF] = mg2oScw;
   cv::Mat Twc = mpCurrentKF->GetPoseInverse();
 
+  // The loop joins an archived map, bring it into the active world first.
+  // Maps are archived on this thread too, so the current keyframe is in the
+  // active map.
+  Map *pLoopMap = mpMatchedKF->GetMap();
+  if (pLoopMap != mpMap)
+    TransformMap(pLoopMap);
+
   {
     // Get Map Mutex
     unique_lock<mutex> lock(mpMap->mMutexMapUpdate);
 
+    if (pLoopMap != mpMap)
+      MergeMap(pLoopMap);
+
+    CorrectedSim3[mpCurrentKF] = mg2oScw;
+
     for (std::vector<KeyFrame *>::iterator vit = mvpCurrentConnectedKFs.begin(), vend = mvpCurrentConnectedKFs.end(); vit != vend; vit++) {
       KeyFrame *pKFi = *vit;
 
@@ -486,26 +674,28 @@ void LoopClosing::CorrectLoop(const int Ftype) {
 
       g2o::Sim3 g2oSiw = NonCorrectedSim3[pKFi];
 
-      std::vector<MapPoint *> vpMPsi = pKFi->GetMapPointMatches(Ftype); // Multi channels ??
-      for (std::size_t iMP = 0, endMPi = vpMPsi.size(); iMP < endMPi; iMP++) {
-        MapPoint *pMPi = vpMPsi[iMP];
-        if (!pMPi)
-          continue;
-        if (pMPi->isBad())
-          continue;
-        if (pMPi->mnCorrectedByKF == mpCurrentKF->mnId)
-          continue;
+      for (int Ftype = 0; Ftype < Ntype; Ftype++) {
+        std::vector<MapPoint *> vpMPsi = pKFi->GetMapPointMatches(Ftype);
+        for (std::size_t iMP = 0, endMPi = vpMPsi.size(); iMP < endMPi; iMP++) {
+          MapPoint *pMPi = vpMPsi[iMP];
+          if (!pMPi)
+            continue;
+          if (pMPi->isBad())
+            continue;
+          if (pMPi->mnCorrectedByKF == mpCurrentKF->mnId)
+            continue;
 
-        // Project with non-corrected pose and project back with corrected pose
-        cv::Mat P3Dw = pMPi->GetWorldPos();
-        Eigen::Matrix<double, 3, 1> eigP3Dw = Converter::toVector3d(P3Dw);
-        Eigen::Matrix<double, 3, 1> eigCorrectedP3Dw = g2oCorrectedSwi.map(g2oSiw.map(eigP3Dw));
+          // Project with non-corrected pose and project back with corrected pose
+          cv::Mat P3Dw = pMPi->GetWorldPos();
+          Eigen::Matrix<double, 3, 1> eigP3Dw = Converter::toVector3d(P3Dw);
+          Eigen::Matrix<double, 3, 1> eigCorrectedP3Dw = g2oCorrectedSwi.map(g2oSiw.map(eigP3Dw));
 
-        cv::Mat cvCorrectedP3Dw = Converter::toCvMat(eigCorrectedP3Dw);
-        pMPi->SetWorldPos(cvCorrectedP3Dw);
-        pMPi->mnCorrectedByKF = mpCurrentKF->mnId;
-        pMPi->mnCorrectedReference = pKFi->mnId;
-        pMPi->UpdateNormalAndDepth(); // Ftype will be deleted
+          cv::Mat cvCorrectedP3Dw = Converter::toCvMat(eigCorrectedP3Dw);
+          pMPi->SetWorldPos(cvCorrectedP3Dw);
+          pMPi->mnCorrectedByKF = mpCurrentKF->mnId;
+          pMPi->mnCorrectedReference = pKFi->mnId;
+          pMPi->UpdateNormalAndDepth();
+        }
       }
 
       // Update keyframe pose with corrected Sim3. First transform Sim3 to SE3 (scale translation)
@@ -524,25 +714,31 @@ void LoopClosing::CorrectLoop(const int Ftype) {
     }
 
     // Start Loop Fusion. Update matched map points and replace if duplicated
-    for (std::size_t i = 0; i < mvpCurrentMatchedPoints.size(); i++) {
-      if (mvpCurrentMatchedPoints[i]) {
-        MapPoint *pLoopMP = mvpCurrentMatchedPoints[i];
-        MapPoint *pCurMP = mpCurrentKF->GetMapPoint(i, Ftype);
-        if (pCurMP)
-          pCurMP->Replace(pLoopMP);
-        else {
-          mpCurrentKF->AddMapPoint(pLoopMP, i, Ftype);
-          pLoopMP->AddObservation(mpCurrentKF, i);
-          pLoopMP->ComputeDistinctiveDescriptors();
+    for (int Ftype = 0; Ftype < Ntype; Ftype++) {
+      for (std::size_t i = 0; i < mvpCurrentMatchedPoints[Ftype].size(); i++) {
+        if (mvpCurrentMatchedPoints[Ftype][i]) {
+          MapPoint *pLoopMP = mvpCurrentMatchedPoints[Ftype][i];
+          MapPoint *pCurMP = mpCurrentKF->GetMapPoint(i, Ftype);
+          if (pCurMP)
+            pCurMP->Replace(pLoopMP);
+          else {
+            mpCurrentKF->AddMapPoint(pLoopMP, i, Ftype);
+            pLoopMP->AddObservation(mpCurrentKF, i);
+            pLoopMP->ComputeDistinctiveDescriptors();
+          }
         }
       }
     }
-  }
 
-  // Project MapPoints observed in the neighborhood of the loop keyframe
-  // into the current keyframe and neighbors using corrected poses.
-  // Fuse duplications.
-  SearchAndFuse(CorrectedSim3, Ftype);
+    // Project MapPoints observed in the neighborhood of the loop keyframe
+    // into the current keyframe and neighbors using corrected poses.
+    // Fuse duplications. Channels have disjoint MapPoints and are fused in
+    // parallel under the map lock held here, the tasks never take it.
+    TaskGroup channels(mpThreadPool);
+    for (int Ftype = 0; Ftype < Ntype; Ftype++)
+      channels.Run([this, Ftype, &CorrectedSim3] { SearchAndFuse(CorrectedSim3, Ftype); }, "LoopClosing::SearchAndFuse");
+    channels.Wait();
+  }
 
   // After the MapPoint fusion, new links in the covisibility graph will appear. attaching both sides of the loop
   map<KeyFrame *, set<KeyFrame *>> LoopConnections;
@@ -566,6 +762,8 @@ void LoopClosing::CorrectLoop(const int Ftype) {
   Optimizer::OptimizeEssentialGraph(mpMap, mpMatchedKF, mpCurrentKF, NonCorrectedSim3, CorrectedSim3, LoopConnections, mbFixScale);
 
   mpMap->InformNewBigChange();
+  // The whole map moved, merged keyframes included
+  mpMapStore->UpdateKeyFrames(mpMap->GetAllKeyFrames());
 
   // Add loop edge
   mpMatchedKF->AddLoopEdge(mpCurrentKF);
@@ -583,7 +781,63 @@ void LoopClosing::CorrectLoop(const int Ftype) {
   mLastLoopKFid = mpCurrentKF->mnId;
 }
 
+void LoopClosing::TransformMap(Map *pLoopMap) {
+  PROFILE_SCOPE("LoopClosing::TransformMap");
+  cout << "Merging map with " << pLoopMap->KeyFramesInMap() << " keyframes" << endl;
+
+  // The loop Sim3 is the pose of the current keyframe in the world of the loop
+  // map, composed with the current pose it maps that world into the active one
+  cv::Mat Tcw = mpCurrentKF->GetPose();
+  g2o::Sim3 g2oScw(Converter::toMatrix3d(Tcw.rowRange(0, 3).colRange(0, 3)), Converter::toVector3d(Tcw.rowRange(0, 3).col(3)), 1.0);
+  const g2o::Sim3 g2oSwl = g2oScw.inverse() * mg2oScw;
+  const g2o::Sim3 g2oSlw = g2oSwl.inverse();
+
+  const std::vector<KeyFrame *> vpKFs = pLoopMap->GetAllKeyFrames();
+  for (KeyFrame *pKF : vpKFs) {
+    cv::Mat Til = pKF->GetPose();
+    g2o::Sim3 g2oSil(Converter::toMatrix3d(Til.rowRange(0, 3).colRange(0, 3)), Converter::toVector3d(Til.rowRange(0, 3).col(3)), 1.0);
+    g2o::Sim3 g2oSiw = g2oSil * g2oSlw;
+
+    // [R t/s;0 1]
+    Eigen::Vector3d eigt = g2oSiw.translation() / g2oSiw.scale();
+    pKF->SetPose(Converter::toCvSE3(g2oSiw.rotation().toRotationMatrix(), eigt));
+  }
+
+  const std::vector<MapPoint *> vpMPs = pLoopMap->GetAllMapPoints();
+  for (MapPoint *pMP : vpMPs) {
+    if (pMP->isBad())
+      continue;
+    Eigen::Matrix<double, 3, 1> eigP3Dw = g2oSwl.map(Converter::toVector3d(pMP->GetWorldPos()));
+    pMP->SetWorldPos(Converter::toCvMat(eigP3Dw));
+    pMP->UpdateNormalAndDepth();
+  }
+
+  // Both sides of the loop are now in the active world
+  mg2oScw = g2oScw;
+  mScw = Converter::toCvMat(mg2oScw);
+}
+
+void LoopClosing::MergeMap(Map *pLoopMap) {
+  // Hang the spanning tree of the loop map from the current keyframe: reverse
+  // the path from the matched keyframe up to the old origin
+  KeyFrame *pChild = mpMatchedKF;
+  KeyFrame *pParent = pChild->GetParent();
+  while (pParent) {
+    KeyFrame *pNext = pParent->GetParent();
+    pParent->EraseChild(pChild);
+    pParent->ChangeParent(pChild);
+    pChild = pParent;
+    pParent = pNext;
+  }
+  pChild->mbOrigin = false;
+  mpMatchedKF->ChangeParent(mpCurrentKF);
+  pLoopMap->mvpKeyFrameOrigins.clear();
+
+  mpAtlas->MergeIntoActiveMap(pLoopMap);
+}
+
 void LoopClosing::SearchAndFuse(const KeyFrameAndPose &CorrectedPosesMap, const int Ftype) {
+  PROFILE_SCOPE_ARG("LoopClosing::SearchAndFuse", Ftype);
   Associater associater(0.8);
 
   for (KeyFrameAndPose::const_iterator mit = CorrectedPosesMap.begin(), mend = CorrectedPosesMap.end(); mit != mend; mit++) {
@@ -592,27 +846,42 @@ void LoopClosing::SearchAndFuse(const KeyFrameAndPose &CorrectedPosesMap, const
     g2o::Sim3 g2oScw = mit->second;
     cv::Mat cvScw = Converter::toCvMat(g2oScw);
 
-    std::vector<MapPoint *> vpReplacePoints(mvpLoopMapPoints.size(), static_cast<MapPoint *>(NULL));
+    const std::vector<MapPoint *> &vpLoopMapPoints = mvpLoopMapPoints[Ftype];
+    std::vector<MapPoint *> vpReplacePoints(vpLoopMapPoints.size(), static_cast<MapPoint *>(NULL));
 
-    associater.Fuse(Ftype, pKF, cvScw, mvpLoopMapPoints, 4, vpReplacePoints);
+    associater.Fuse(Ftype, pKF, cvScw, vpLoopMapPoints, 4, vpReplacePoints);
 
-    // Get Map Mutex
-    unique_lock<mutex> lock(mpMap->mMutexMapUpdate);
-    const int nLP = mvpLoopMapPoints.size();
+    const int nLP = vpLoopMapPoints.size();
     for (int i = 0; i < nLP; i++) {
       MapPoint *pRep = vpReplacePoints[i];
       if (pRep) {
-        pRep->Replace(mvpLoopMapPoints[i]);
+        pRep->Replace(vpLoopMapPoints[i]);
       }
     }
   }
 }
 
+void LoopClosing::AbortGlobalBundleAdjustment() {
+  if (isRunningGBA()) {
+    unique_lock<mutex> lock(mMutexGBA);
+    mbStopGBA = true;
+
+    mnFullBAIdx++;
+
+    if (mpThreadGBA) {
+      mpThreadGBA->detach();
+      delete mpThreadGBA;
+      mpThreadGBA = NULL;
+    }
+  }
+}
+
 void LoopClosing::RunGlobalBundleAdjustmentMultiChannels(unsigned long nLoopKF) {
+  PROFILE_SCOPE("LoopClosing::RunGlobalBundleAdjustment");
   cout << "Starting Global Bundle Adjustment" << endl;
 
   int idx = mnFullBAIdx;
-  Optimizer::GlobalBundleAdjustemnt(mpMap, 10, &mbStopGBA, nLoopKF, false);
+  Optimizer::GlobalBundleAdjustemnt(mpMap, 10, &mbStopGBA, nLoopKF, false, mpMapStore);
 
   // Update all MapPoints and KeyFrames
   // Local Mapping was active during BA, that means that there might be new
@@ -694,6 +963,7 @@ void LoopClosing::RunGlobalBundleAdjustmentMultiChannels(unsigned long nLoopKF)
       }
 
       mpMap->InformNewBigChange();
+      mpMapStore->UpdateKeyFrames(mpMap->GetAllKeyFrames());
 
       mpLocalMapper->Release();
 
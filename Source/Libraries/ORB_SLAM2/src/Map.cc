@@ -20,6 +20,7 @@
 
 #include "Map.h"
 
+#include <algorithm>
 #include <mutex>
 
 using namespace ::std;
@@ -128,6 +129,34 @@ long unsigned int Map::GetMaxKFid() {
   return mnMaxKFid;
 }
 
+void Map::MoveTo(Map *pDst) {
+  scoped_lock lock(mMutexMap, pDst->mMutexMap);
+
+  for (KeyFrame *pKF : mspKeyFrames) {
+    pKF->SetMap(pDst);
+    pDst->mspKeyFrames.insert(pKF);
+  }
+  for (int Ftype = 0; Ftype < Ntype; Ftype++)
+    for (MapPoint *pMP : mspMapPoints[Ftype]) {
+      pMP->SetMap(pDst);
+      pDst->mspMapPoints[Ftype].insert(pMP);
+    }
+
+  pDst->mvpKeyFrameOrigins.insert(pDst->mvpKeyFrameOrigins.end(), mvpKeyFrameOrigins.begin(), mvpKeyFrameOrigins.end());
+  if (pDst->mvpReferenceMapPoints.empty())
+    pDst->mvpReferenceMapPoints.swap(mvpReferenceMapPoints);
+  pDst->mnMaxKFid = max(pDst->mnMaxKFid, mnMaxKFid);
+  pDst->mnBigChangeIdx++;
+
+  mspKeyFrames.clear();
+  for (int Ftype = 0; Ftype < Ntype; Ftype++)
+    mspMapPoints[Ftype].clear();
+  mvpReferenceMapPoints.clear();
+  mvpKeyFrameOrigins.clear();
+  mnMaxKFid = 0;
+  mnBigChangeIdx++;
+}
+
 void Map::clear() {
 
   for (int Ftype = 0; Ftype < Ntype; Ftype++)
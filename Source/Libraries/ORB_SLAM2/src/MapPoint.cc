@@ -20,8 +20,13 @@
 
 #include "MapPoint.h"
 #include "Associater.h"
+#include "Converter.h"
 
+#include <cstddef>
+#include <cstring>
 #include <mutex>
+#include <stdexcept>
+#include <string>
 
 using namespace ::std;
 
@@ -30,6 +35,8 @@ namespace ORB_SLAM2 {
 long unsigned int MapPoint::nNextId = 0;
 mutex MapPoint::mGlobalMutex;
 
+static_assert(offsetof(MapPointState, mWorldPos) == sizeof(uint64_t), "nObs and bBad must fill the first state word");
+
 MapPoint::MapPoint(const cv::Mat &Pos, KeyFrame *pRefKF, Map *pMap, const int Ftype)
     : mnFirstKFid(pRefKF->mnId), 
       mnFirstFrame(pRefKF->mnFrameId), 
@@ -50,10 +57,17 @@ MapPoint::MapPoint(const cv::Mat &Pos, KeyFrame *pRefKF, Map *pMap, const int Ft
       mfMinDistance(0),
       mfMaxDistance(0), 
       mpMap(pMap), 
-      mFtype(Ftype) {
+      mFtype(Ftype),
+      mnStateSeq(0) {
   Pos.copyTo(mWorldPos);
   mNormalVector = cv::Mat::zeros(3, 1, CV_32F);
 
+  {
+    unique_lock<mutex> lock1(mMutexFeatures);
+    unique_lock<mutex> lock2(mMutexPos);
+    PublishState();
+  }
+
   // MapPoints can be created from Tracking and Local Mapping. This mutex avoid conflicts with id.
   unique_lock<mutex> lock(mpMap->mMutexPointCreation);
   mnId = nNextId++;
@@ -77,7 +91,8 @@ MapPoint::MapPoint(const cv::Mat &Pos, Map *pMap, Frame *pFrame, const int &idxF
       mbBad(false), 
       mpReplaced(NULL), 
       mpMap(pMap), 
-      mFtype(Ftype) {
+      mFtype(Ftype),
+      mnStateSeq(0) {
   Pos.copyTo(mWorldPos);
   cv::Mat Ow = pFrame->GetCameraCenter();
   mNormalVector = mWorldPos - Ow;
@@ -85,14 +100,20 @@ MapPoint::MapPoint(const cv::Mat &Pos, Map *pMap, Frame *pFrame, const int &idxF
 
   cv::Mat PC = Pos - Ow;
   const float dist = cv::norm(PC);
-  const int level = pFrame->Channels[mFtype].mvKeysUn[idxF].octave;
+  const int level = pFrame->Channels[mFtype].mpFeatures->mvKeysUn[idxF].octave;
   const float levelScaleFactor = pFrame->mvScaleFactors[level];
   const int nLevels = pFrame->mnScaleLevels;
 
   mfMaxDistance = dist * levelScaleFactor;
   mfMinDistance = mfMaxDistance / pFrame->mvScaleFactors[nLevels - 1];
 
-  pFrame->Channels[mFtype].mDescriptors.row(idxF).copyTo(mDescriptor);
+  pFrame->Channels[mFtype].mpFeatures->mDescriptors.row(idxF).copyTo(mDescriptor);
+
+  {
+    unique_lock<mutex> lock1(mMutexFeatures);
+    unique_lock<mutex> lock2(mMutexPos);
+    PublishState();
+  }
 
   // MapPoints can be created from Tracking and Local Mapping. This mutex avoid conflicts with id.
   unique_lock<mutex> lock(mpMap->mMutexPointCreation);
@@ -101,8 +122,10 @@ MapPoint::MapPoint(const cv::Mat &Pos, Map *pMap, Frame *pFrame, const int &idxF
 
 void MapPoint::SetWorldPos(const cv::Mat &Pos) {
   unique_lock<mutex> lock2(mGlobalMutex);
+  unique_lock<mutex> lock1(mMutexFeatures);
   unique_lock<mutex> lock(mMutexPos);
   Pos.copyTo(mWorldPos);
+  PublishState();
 }
 
 cv::Mat MapPoint::GetWorldPos() {
@@ -110,6 +133,11 @@ cv::Mat MapPoint::GetWorldPos() {
   return mWorldPos.clone();
 }
 
+Eigen::Vector3f MapPoint::GetWorldPosf() {
+  unique_lock<mutex> lock(mMutexPos);
+  return Converter::toVector3f(mWorldPos);
+}
+
 cv::Mat MapPoint::GetNormal() {
   unique_lock<mutex> lock(mMutexPos);
   return mNormalVector.clone();
@@ -125,33 +153,44 @@ void MapPoint::AddObservation(KeyFrame *pKF, std::size_t idx) {
   unique_lock<mutex> lock(mMutexFeatures);
   if (mObservations.count(pKF))
     return;
-  mObservations[pKF] = idx;
+  // Bad points no longer count towards the covisibility graph
+  if (!mbBad)
+    UpdateCovisibility(mObservations, pKF, 1);
+  mObservations.insert(pKF, idx);
 
-  if (pKF->Channels[mFtype].mvuRight[idx] >= 0)
+  if (pKF->Channels[mFtype].mpFeatures->mvuRight[idx] >= 0)
     nObs += 2;
   else
     nObs++;
+
+  unique_lock<mutex> lock2(mMutexPos);
+  PublishState();
 }
 
 void MapPoint::EraseObservation(KeyFrame *pKF) {
   bool bBad = false;
   {
     unique_lock<mutex> lock(mMutexFeatures);
-    if (mObservations.count(pKF)) {
-      int idx = mObservations[pKF];
-      if (pKF->Channels[mFtype].mvuRight[idx] >= 0)
+    const int idx = mObservations.index(pKF);
+    if (idx >= 0) {
+      if (pKF->Channels[mFtype].mpFeatures->mvuRight[idx] >= 0)
         nObs -= 2;
       else
         nObs--;
 
       mObservations.erase(pKF);
+      if (!mbBad)
+        UpdateCovisibility(mObservations, pKF, -1);
 
-      if (mpRefKF == pKF)
+      if (mpRefKF == pKF && !mObservations.empty())
         mpRefKF = mObservations.begin()->first;
 
       // If only 2 observations or less, discard point
       if (nObs <= 2)
         bBad = true;
+
+      unique_lock<mutex> lock2(mMutexPos);
+      PublishState();
     }
   }
 
@@ -159,35 +198,56 @@ void MapPoint::EraseObservation(KeyFrame *pKF) {
     SetBadFlag();
 }
 
-map<KeyFrame *, std::size_t> MapPoint::GetObservations() {
+void MapPoint::UpdateCovisibility(const ObservationSet &obs, KeyFrame *pKF, int n) {
+  for (ObservationSet::const_iterator mit = obs.begin(), mend = obs.end(); mit != mend; mit++) {
+    if (mit->first == pKF)
+      continue;
+    mit->first->ChangeCovisibility(pKF, n);
+    pKF->ChangeCovisibility(mit->first, n);
+  }
+}
+
+void MapPoint::UpdateCovisibility(const ObservationSet &obs, int n) {
+  for (ObservationSet::const_iterator mit = obs.begin(), mend = obs.end(); mit != mend; mit++)
+    for (ObservationSet::const_iterator mit2 = obs.begin(); mit2 != mend; mit2++)
+      if (mit2 != mit)
+        mit->first->ChangeCovisibility(mit2->first, n);
+}
+
+ObservationSet MapPoint::GetObservations() {
   unique_lock<mutex> lock(mMutexFeatures);
   return mObservations;
 }
 
 int MapPoint::Observations() {
-  unique_lock<mutex> lock(mMutexFeatures);
-  return nObs;
+  const uint64_t word = mvStateWords[0].load(memory_order_acquire);
+  MapPointState state;
+  memcpy(&state, &word, sizeof(word));
+  return state.nObs;
 }
 
 void MapPoint::SetBadFlag() {
-  map<KeyFrame *, std::size_t> obs;
+  ObservationSet obs;
   int Ftype;
   
   {
     unique_lock<mutex> lock1(mMutexFeatures);
     unique_lock<mutex> lock2(mMutexPos);
+    if (!mbBad)
+      UpdateCovisibility(mObservations, -1);
     mbBad = true;
     obs = mObservations;
     mObservations.clear();
     Ftype = mFtype;
+    PublishState();
   }
 
-  for (map<KeyFrame *, std::size_t>::iterator mit = obs.begin(), mend = obs.end(); mit != mend; mit++) {
+  for (ObservationSet::const_iterator mit = obs.begin(), mend = obs.end(); mit != mend; mit++) {
     KeyFrame *pKF = mit->first;
     pKF->EraseMapPointMatch(mit->second, Ftype);
   }
 
-  mpMap->EraseMapPoint(this);
+  GetMap()->EraseMapPoint(this);
 }
 
 MapPoint *MapPoint::GetReplaced() {
@@ -202,10 +262,12 @@ void MapPoint::Replace(MapPoint *pMP) {
     return;
 
   int nvisible, nfound, Ftype;
-  map<KeyFrame *, std::size_t> obs;
+  ObservationSet obs;
   {
     unique_lock<mutex> lock1(mMutexFeatures);
     unique_lock<mutex> lock2(mMutexPos);
+    if (!mbBad)
+      UpdateCovisibility(mObservations, -1);
     obs = mObservations;
     mObservations.clear();
     mbBad = true;
@@ -213,9 +275,10 @@ void MapPoint::Replace(MapPoint *pMP) {
     nfound = mnFound;
     Ftype = mFtype; //Have problem ??
     mpReplaced = pMP;
+    PublishState();
   }
 
-  for (map<KeyFrame *, std::size_t>::iterator mit = obs.begin(), mend = obs.end(); mit != mend; mit++) {
+  for (ObservationSet::const_iterator mit = obs.begin(), mend = obs.end(); mit != mend; mit++) {
     // Replace measurement in keyframe
     KeyFrame *pKF = mit->first;
 
@@ -230,13 +293,24 @@ void MapPoint::Replace(MapPoint *pMP) {
   pMP->IncreaseVisible(nvisible);
   pMP->ComputeDistinctiveDescriptors();
 
-  mpMap->EraseMapPoint(this);
+  GetMap()->EraseMapPoint(this);
 }
 
-bool MapPoint::isBad() {
+void MapPoint::SetMap(Map *pMap) {
   unique_lock<mutex> lock(mMutexFeatures);
-  unique_lock<mutex> lock2(mMutexPos);
-  return mbBad;
+  mpMap = pMap;
+}
+
+Map *MapPoint::GetMap() {
+  unique_lock<mutex> lock(mMutexFeatures);
+  return mpMap;
+}
+
+bool MapPoint::isBad() {
+  const uint64_t word = mvStateWords[0].load(memory_order_acquire);
+  MapPointState state;
+  memcpy(&state, &word, sizeof(word));
+  return state.bBad != 0;
 }
 
 void MapPoint::IncreaseVisible(int n) {
@@ -258,7 +332,7 @@ void MapPoint::ComputeDistinctiveDescriptors() {
   // Retrieve all observed descriptors
   std::vector<cv::Mat> vDescriptors;
 
-  map<KeyFrame *, std::size_t> observations;
+  ObservationSet observations;
 
   {
     unique_lock<mutex> lock1(mMutexFeatures);
@@ -270,13 +344,26 @@ void MapPoint::ComputeDistinctiveDescriptors() {
   if (observations.empty())
     return;
 
-  vDescriptors.reserve(observations.size());
+  vDescriptors.reserve(observations.size() + 1);
 
-  for (map<KeyFrame *, std::size_t>::iterator mit = observations.begin(), mend = observations.end(); mit != mend; mit++) {
+  // Keyframes evicted by the MapStore are not read back for this, the current
+  // descriptor stands in for them
+  bool bEvicted = false;
+  for (ObservationSet::const_iterator mit = observations.begin(), mend = observations.end(); mit != mend; mit++) {
     KeyFrame *pKF = mit->first;
 
-    if (!pKF->isBad())
-      vDescriptors.push_back(pKF->Channels[mFtype].mDescriptors.row(mit->second));
+    if (pKF->isBad())
+      continue;
+    if (!pKF->IsResident())
+      bEvicted = true;
+    else
+      vDescriptors.push_back(pKF->Channels[mFtype].mpFeatures->mDescriptors.row(mit->second));
+  }
+
+  if (bEvicted) {
+    cv::Mat descriptor = GetDescriptor();
+    if (!descriptor.empty())
+      vDescriptors.push_back(descriptor);
   }
 
   if (vDescriptors.empty())
@@ -311,7 +398,9 @@ void MapPoint::ComputeDistinctiveDescriptors() {
 
   {
     unique_lock<mutex> lock(mMutexFeatures);
+    unique_lock<mutex> lock2(mMutexPos);
     mDescriptor = vDescriptors[BestIdx].clone();
+    PublishState();
   }
 }
 
@@ -322,10 +411,7 @@ cv::Mat MapPoint::GetDescriptor() {
 
 int MapPoint::GetIndexInKeyFrame(KeyFrame *pKF) {
   unique_lock<mutex> lock(mMutexFeatures);
-  if (mObservations.count(pKF))
-    return mObservations[pKF];
-  else
-    return -1;
+  return mObservations.index(pKF);
 }
 
 int MapPoint::GetFeatureType() {
@@ -338,7 +424,7 @@ bool MapPoint::IsInKeyFrame(KeyFrame *pKF) {
 }
 
 void MapPoint::UpdateNormalAndDepth() {
-  map<KeyFrame *, std::size_t> observations;
+  ObservationSet observations;
   KeyFrame *pRefKF;
   cv::Mat Pos;
   
@@ -357,7 +443,7 @@ void MapPoint::UpdateNormalAndDepth() {
 
   cv::Mat normal = cv::Mat::zeros(3, 1, CV_32F);
   int n = 0;
-  for (map<KeyFrame *, std::size_t>::iterator mit = observations.begin(), mend = observations.end(); mit != mend; mit++) {
+  for (ObservationSet::const_iterator mit = observations.begin(), mend = observations.end(); mit != mend; mit++) {
     KeyFrame *pKF = mit->first;
     cv::Mat Owi = pKF->GetCameraCenter();
     cv::Mat normali = mWorldPos - Owi;
@@ -367,15 +453,20 @@ void MapPoint::UpdateNormalAndDepth() {
 
   cv::Mat PC = Pos - pRefKF->GetCameraCenter();
   const float dist = cv::norm(PC);
-  const int level = pRefKF->Channels[mFtype].mvKeysUn[observations[pRefKF]].octave;
+  const int idxRef = observations.index(pRefKF);
+  if (idxRef < 0)
+    return;
+  const int level = pRefKF->Channels[mFtype].mpFeatures->mvKeysUn[idxRef].octave;
   const float levelScaleFactor = pRefKF->mvScaleFactors[level];
   const int nLevels = pRefKF->mnScaleLevels;
 
   {
+    unique_lock<mutex> lock4(mMutexFeatures);
     unique_lock<mutex> lock3(mMutexPos);
     mfMaxDistance = dist * levelScaleFactor;
     mfMinDistance = mfMaxDistance / pRefKF->mvScaleFactors[nLevels - 1];
     mNormalVector = normal / n;
+    PublishState();
   }
 }
 
@@ -389,36 +480,91 @@ float MapPoint::GetMaxDistanceInvariance() {
   return 1.2f * mfMaxDistance;
 }
 
-int MapPoint::PredictScale(const float &currentDist, KeyFrame *pKF) {
-  float ratio;
-  {
-    unique_lock<mutex> lock(mMutexPos);
-    ratio = mfMaxDistance / currentDist;
-  }
-
-  int nScale = ceil(log(ratio) / pKF->mfLogScaleFactor);
+static int PredictScaleLevel(float maxDistance, float currentDist, float logScaleFactor, int nLevels) {
+  int nScale = ceil(log(maxDistance / currentDist) / logScaleFactor);
   if (nScale < 0)
     nScale = 0;
-  else if (nScale >= pKF->mnScaleLevels)
-    nScale = pKF->mnScaleLevels - 1;
+  else if (nScale >= nLevels)
+    nScale = nLevels - 1;
 
   return nScale;
 }
 
+int MapPoint::PredictScale(const float &currentDist, KeyFrame *pKF) {
+  float maxDistance;
+  {
+    unique_lock<mutex> lock(mMutexPos);
+    maxDistance = mfMaxDistance;
+  }
+  return PredictScaleLevel(maxDistance, currentDist, pKF->mfLogScaleFactor, pKF->mnScaleLevels);
+}
+
 int MapPoint::PredictScale(const float &currentDist, Frame *pF) {
-  float ratio;
+  float maxDistance;
   {
     unique_lock<mutex> lock(mMutexPos);
-    ratio = mfMaxDistance / currentDist;
+    maxDistance = mfMaxDistance;
   }
+  return PredictScaleLevel(maxDistance, currentDist, pF->mfLogScaleFactor, pF->mnScaleLevels);
+}
 
-  int nScale = ceil(log(ratio) / pF->mfLogScaleFactor);
-  if (nScale < 0)
-    nScale = 0;
-  else if (nScale >= pF->mnScaleLevels)
-    nScale = pF->mnScaleLevels - 1;
+int MapPointState::PredictScale(const float &currentDist, const KeyFrame *pKF) const {
+  return PredictScaleLevel(mfMaxDistance, currentDist, pKF->mfLogScaleFactor, pKF->mnScaleLevels);
+}
 
-  return nScale;
+int MapPointState::PredictScale(const float &currentDist, const Frame *pF) const {
+  return PredictScaleLevel(mfMaxDistance, currentDist, pF->mfLogScaleFactor, pF->mnScaleLevels);
+}
+
+void MapPoint::PublishState() {
+  MapPointState state;
+  memset(&state, 0, sizeof(state));
+  state.nObs = nObs;
+  state.bBad = mbBad;
+  for (int i = 0; i < 3; i++) {
+    state.mWorldPos[i] = mWorldPos.at<float>(i);
+    state.mNormal[i] = mNormalVector.at<float>(i);
+  }
+  state.mfMinDistance = mfMinDistance;
+  state.mfMaxDistance = mfMaxDistance;
+  if (!mDescriptor.empty()) {
+    // The descriptor width comes from the registered extractor, a wider one
+    // cannot be published without truncating it
+    const size_t nBytes = mDescriptor.total() * mDescriptor.elemSize();
+    if (!mDescriptor.isContinuous() || nBytes > MapPointState::kMaxDescriptorBytes)
+      throw std::runtime_error("[MapPoint] Descriptor of " + to_string(nBytes) + " bytes exceeds " +
+                               to_string(MapPointState::kMaxDescriptorBytes) + " bytes");
+    state.mnDescriptorBytes = nBytes;
+    memcpy(state.mDescriptor, mDescriptor.data, state.mnDescriptorBytes);
+  }
+
+  const uint64_t seq = mnStateSeq.load(memory_order_relaxed);
+  state.mnVersion = seq / 2 + 1;
+
+  uint64_t vWords[kStateWords];
+  memcpy(vWords, &state, sizeof(state));
+
+  // Odd sequence while the words are rewritten
+  mnStateSeq.store(seq + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  for (size_t i = 0; i < kStateWords; i++)
+    mvStateWords[i].store(vWords[i], memory_order_release);
+  mnStateSeq.store(seq + 2, memory_order_release);
+}
+
+void MapPoint::GetState(MapPointState &state) const {
+  uint64_t vWords[kStateWords];
+  while (true) {
+    const uint64_t seq = mnStateSeq.load(memory_order_acquire);
+    if (seq & 1)
+      continue;
+    for (size_t i = 0; i < kStateWords; i++)
+      vWords[i] = mvStateWords[i].load(memory_order_relaxed);
+    atomic_thread_fence(memory_order_acquire);
+    if (mnStateSeq.load(memory_order_relaxed) == seq)
+      break;
+  }
+  memcpy(&state, vWords, sizeof(state));
 }
 
 } // namespace ORB_SLAM2
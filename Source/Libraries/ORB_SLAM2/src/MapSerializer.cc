@@ -0,0 +1,1017 @@
+#include "MapSerializer.h"
+#include "KeyFrame.h"
+#include "KeyFrameDatabase.h"
+#include "Map.h"
+#include "MapPoint.h"
+#include "MapStore.h"
+#include "ORBVocabulary.h"
+#include "Profiler.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <shared_mutex>
+#include <type_traits>
+#include <unordered_map>
+
+using namespace ::std;
+
+namespace ORB_SLAM2 {
+
+// File layout (native little endian):
+//
+//   MapFileHeader
+//   records: RecordHeader followed by size bytes of payload
+//     kRecordMap        vocabulary size per channel, origin keyframe ids
+//     kRecordKeyFrame   one per keyframe, ascending id
+//     kRecordMapPoint   one per map point, ascending id
+//     kRecordDatabase   inverted file of one channel
+//
+// Unknown record types are skipped, so records can be added without breaking
+// older readers.
+namespace {
+
+const char kMapMagic[8] = {'O', 'R', 'B', 'M', 'A', 'P', 'F', '\0'};
+const uint32_t kMapVersion = 2;
+const uint32_t kMapEndianTag = 0x01020304;
+
+enum RecordType : uint32_t { kRecordMap = 1, kRecordKeyFrame = 2, kRecordMapPoint = 3, kRecordDatabase = 4 };
+
+struct MapFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t endianTag;
+  int32_t Ntype;
+  uint32_t reserved0;
+  uint64_t nKeyFrames;
+  uint64_t nMapPoints;
+  uint64_t nNextKeyFrameId;
+  uint64_t nNextMapPointId;
+  uint64_t nNextFrameId;
+  uint64_t reserved1[3];
+};
+static_assert(sizeof(MapFileHeader) == 96, "MapFileHeader layout changed");
+
+struct RecordHeader {
+  uint32_t type;
+  uint32_t reserved;
+  uint64_t size;
+};
+
+// Covisibility edge and map point observation as stored in the file
+struct StoredEdge {
+  uint64_t id;
+  int32_t weight;
+  int32_t reserved;
+};
+
+struct StoredObservation {
+  uint64_t id;
+  uint64_t idx;
+};
+
+// Records are encoded with 64 bit sizes and ids whatever the platform types
+class RecordWriter {
+public:
+  template <typename T> void Put(const T &v) {
+    static_assert(is_trivially_copyable<T>::value, "Put needs a trivially copyable type");
+    PutBytes(&v, sizeof(T));
+  }
+
+  template <typename T> void PutVector(const vector<T> &v) {
+    static_assert(is_trivially_copyable<T>::value, "PutVector needs a trivially copyable type");
+    Put<uint64_t>(v.size());
+    PutBytes(v.data(), v.size() * sizeof(T));
+  }
+
+  void PutKeyPoints(const vector<cv::KeyPoint> &vKeys) {
+    Put<uint64_t>(vKeys.size());
+    for (const cv::KeyPoint &kp : vKeys) {
+      Put<float>(kp.pt.x);
+      Put<float>(kp.pt.y);
+      Put<float>(kp.size);
+      Put<float>(kp.angle);
+      Put<float>(kp.response);
+      Put<int32_t>(kp.octave);
+      Put<int32_t>(kp.class_id);
+    }
+  }
+
+  void PutMat(const cv::Mat &M) {
+    Put<int32_t>(M.rows);
+    Put<int32_t>(M.cols);
+    Put<int32_t>(M.type());
+    if (M.empty())
+      return;
+    const cv::Mat C = M.isContinuous() ? M : M.clone();
+    PutBytes(C.data, C.total() * C.elemSize());
+  }
+
+  void PutBytes(const void *p, size_t n) {
+    const uint8_t *b = static_cast<const uint8_t *>(p);
+    mvData.insert(mvData.end(), b, b + n);
+  }
+
+  vector<uint8_t> mvData;
+};
+
+// Bounds checked reader, every Get fails once the payload is exhausted
+class RecordReader {
+public:
+  RecordReader(const vector<uint8_t> &v) : mpData(v.data()), mnSize(v.size()), mnPos(0) {}
+
+  template <typename T> bool Get(T &v) { return GetBytes(&v, sizeof(T)); }
+
+  template <typename T> bool GetVector(vector<T> &v) {
+    static_assert(is_trivially_copyable<T>::value, "GetVector needs a trivially copyable type");
+    uint64_t n;
+    if (!Get(n) || n > (mnSize - mnPos) / max<size_t>(1, sizeof(T)))
+      return false;
+    v.resize(n);
+    return GetBytes(v.data(), n * sizeof(T));
+  }
+
+  bool GetKeyPoints(vector<cv::KeyPoint> &vKeys) {
+    const size_t kKeyPointSize = 5 * sizeof(float) + 2 * sizeof(int32_t);
+    uint64_t n;
+    if (!Get(n) || n > (mnSize - mnPos) / kKeyPointSize)
+      return false;
+    vKeys.resize(n);
+    for (cv::KeyPoint &kp : vKeys) {
+      int32_t octave, classId;
+      Get(kp.pt.x);
+      Get(kp.pt.y);
+      Get(kp.size);
+      Get(kp.angle);
+      Get(kp.response);
+      Get(octave);
+      Get(classId);
+      kp.octave = octave;
+      kp.class_id = classId;
+    }
+    return true;
+  }
+
+  bool GetMat(cv::Mat &M) {
+    int32_t rows, cols, type;
+    if (!Get(rows) || !Get(cols) || !Get(type) || rows < 0 || cols < 0)
+      return false;
+    if (rows == 0 || cols == 0) {
+      M.release();
+      return true;
+    }
+    const size_t elemSize = CV_ELEM_SIZE(type);
+    if ((uint64_t)rows * cols * elemSize > mnSize - mnPos)
+      return false;
+    M.create(rows, cols, type);
+    return GetBytes(M.data, M.total() * elemSize);
+  }
+
+  size_t Remaining() const { return mnSize - mnPos; }
+
+  bool GetBytes(void *p, size_t n) {
+    if (n > mnSize - mnPos)
+      return false;
+    memcpy(p, mpData + mnPos, n);
+    mnPos += n;
+    return true;
+  }
+
+private:
+  const uint8_t *mpData;
+  size_t mnSize;
+  size_t mnPos;
+};
+
+struct KeyFrameRecord {
+  uint64_t id = 0;
+  uint64_t frameId = 0;
+  double timestamp = 0;
+  float fx, fy, cx, cy, bf, b, thDepth;
+  cv::Mat K;
+  float gridWidthInv, gridHeightInv;
+  int32_t minX, minY, maxX, maxY;
+  int32_t nScaleLevels;
+  float scaleFactor;
+  vector<float> vScaleFactors, vLevelSigma2, vInvLevelSigma2;
+  cv::Mat Tcw;
+  uint8_t bNotErase = 0;
+
+  vector<FeaturePoint> vChannels;
+  vector<vector<int64_t>> vMapPointIds;
+
+  vector<StoredEdge> vConnections;
+  int64_t parent = -1;
+  vector<uint64_t> vChildren;
+  vector<uint64_t> vLoopEdges;
+};
+
+struct MapPointRecord {
+  uint64_t id = 0;
+  int32_t Ftype = 0;
+  int64_t firstKFid = -1;
+  int64_t firstFrame = 0;
+  cv::Mat pos, normal, descriptor;
+  int64_t refKF = -1;
+  int32_t nVisible = 1, nFound = 1;
+  float minDistance = 0, maxDistance = 0;
+  vector<StoredObservation> vObservations;
+};
+
+struct DatabaseRecord {
+  int32_t Ftype = -1;
+  vector<pair<uint32_t, vector<uint64_t>>> vPostings;
+};
+
+// Map helpers shared by the two directions
+
+void EncodeChannel(RecordWriter &w, const FeaturePoint &ch, const vector<MapPoint *> &vpMPs) {
+  w.Put<int32_t>(ch.type);
+  w.Put<int32_t>(ch.N);
+  const FeatureStore &features = *ch.mpFeatures;
+  w.PutKeyPoints(features.mvKeys);
+  w.PutKeyPoints(features.mvKeysUn);
+  w.PutVector(features.mvuRight);
+  w.PutVector(features.mvDepth);
+  w.PutMat(features.mDescriptors);
+
+  vector<int64_t> vIds(vpMPs.size(), -1);
+  for (size_t i = 0; i < vpMPs.size(); i++)
+    if (vpMPs[i] && !vpMPs[i]->isBad())
+      vIds[i] = vpMPs[i]->mnId;
+  w.PutVector(vIds);
+
+  w.Put<uint64_t>(ch.mBowVec.size());
+  for (const auto &word : ch.mBowVec) {
+    w.Put<uint32_t>(word.first);
+    w.Put<double>(word.second);
+  }
+
+  w.Put<uint64_t>(ch.mFeatVec.size());
+  for (const auto &node : ch.mFeatVec) {
+    w.Put<uint32_t>(node.first);
+    w.PutVector(vector<uint32_t>(node.second.begin(), node.second.end()));
+  }
+
+  w.Put<int32_t>(features.mnGridCols);
+  w.Put<int32_t>(features.mnGridRows);
+  w.Put<float>(features.mfGridMinX);
+  w.Put<float>(features.mfGridMinY);
+  w.Put<float>(features.mfGridElementWidthInv);
+  w.Put<float>(features.mfGridElementHeightInv);
+  w.PutVector(features.mvGridStart);
+  w.PutVector(features.mvGridIndices);
+}
+
+bool DecodeChannel(RecordReader &r, FeaturePoint &ch, vector<int64_t> &vMapPointIds) {
+  int32_t N;
+  if (!r.Get(ch.type) || !r.Get(N) || N < 0)
+    return false;
+  ch.N = N;
+  shared_ptr<FeatureStore> pFeatures = make_shared<FeatureStore>();
+  FeatureStore &features = *pFeatures;
+  if (!r.GetKeyPoints(features.mvKeys) || !r.GetKeyPoints(features.mvKeysUn) || !r.GetVector(features.mvuRight) ||
+      !r.GetVector(features.mvDepth) || !r.GetMat(features.mDescriptors) || !r.GetVector(vMapPointIds))
+    return false;
+  if (features.mvKeys.size() != (size_t)N || features.mvKeysUn.size() != (size_t)N ||
+      features.mvuRight.size() != (size_t)N || features.mvDepth.size() != (size_t)N ||
+      features.mDescriptors.rows != N || vMapPointIds.size() != (size_t)N)
+    return false;
+  features.BuildArrays();
+
+  uint64_t nWords;
+  if (!r.Get(nWords))
+    return false;
+  for (uint64_t i = 0; i < nWords; i++) {
+    uint32_t word;
+    double weight;
+    if (!r.Get(word) || !r.Get(weight))
+      return false;
+    ch.mBowVec.insert(ch.mBowVec.end(), make_pair(word, weight));
+  }
+
+  uint64_t nNodes;
+  if (!r.Get(nNodes))
+    return false;
+  vector<uint32_t> vIdx;
+  for (uint64_t i = 0; i < nNodes; i++) {
+    uint32_t node;
+    if (!r.Get(node) || !r.GetVector(vIdx))
+      return false;
+    for (uint32_t idx : vIdx)
+      if (idx >= (uint32_t)N)
+        return false;
+    ch.mFeatVec.insert(ch.mFeatVec.end(), make_pair(node, vector<unsigned int>(vIdx.begin(), vIdx.end())));
+  }
+
+  if (!r.Get(features.mnGridCols) || !r.Get(features.mnGridRows) || !r.Get(features.mfGridMinX) ||
+      !r.Get(features.mfGridMinY) || !r.Get(features.mfGridElementWidthInv) ||
+      !r.Get(features.mfGridElementHeightInv) || !r.GetVector(features.mvGridStart) ||
+      !r.GetVector(features.mvGridIndices))
+    return false;
+  // Channels without features may have no grid at all
+  if (features.mnGridCols < 0 || features.mnGridRows < 0)
+    return false;
+  if (features.mvGridStart.empty()) {
+    if (!features.mvGridIndices.empty() || features.mnGridCols * features.mnGridRows > 0)
+      return false;
+  } else if (features.mvGridStart.size() != (size_t)features.mnGridCols * features.mnGridRows + 1 ||
+             features.mvGridStart.front() != 0 || features.mvGridStart.back() != features.mvGridIndices.size() ||
+             !is_sorted(features.mvGridStart.begin(), features.mvGridStart.end())) {
+    return false;
+  }
+  for (uint32_t idx : features.mvGridIndices)
+    if (idx >= (uint32_t)N)
+      return false;
+
+  ch.mpFeatures = move(pFeatures);
+  return true;
+}
+
+bool DecodeKeyFrame(const vector<uint8_t> &payload, int Ntype, KeyFrameRecord &rec) {
+  RecordReader r(payload);
+  if (!r.Get(rec.id) || !r.Get(rec.frameId) || !r.Get(rec.timestamp))
+    return false;
+  if (!r.Get(rec.fx) || !r.Get(rec.fy) || !r.Get(rec.cx) || !r.Get(rec.cy) || !r.Get(rec.bf) || !r.Get(rec.b) ||
+      !r.Get(rec.thDepth) || !r.GetMat(rec.K))
+    return false;
+  if (!r.Get(rec.gridWidthInv) || !r.Get(rec.gridHeightInv) || !r.Get(rec.minX) || !r.Get(rec.minY) ||
+      !r.Get(rec.maxX) || !r.Get(rec.maxY))
+    return false;
+  if (!r.Get(rec.nScaleLevels) || !r.Get(rec.scaleFactor) || !r.GetVector(rec.vScaleFactors) ||
+      !r.GetVector(rec.vLevelSigma2) || !r.GetVector(rec.vInvLevelSigma2))
+    return false;
+  if (!r.GetMat(rec.Tcw) || rec.Tcw.rows != 4 || rec.Tcw.cols != 4 || rec.Tcw.type() != CV_32F ||
+      !r.Get(rec.bNotErase))
+    return false;
+
+  rec.vChannels.resize(Ntype);
+  rec.vMapPointIds.resize(Ntype);
+  for (int Ftype = 0; Ftype < Ntype; Ftype++)
+    if (!DecodeChannel(r, rec.vChannels[Ftype], rec.vMapPointIds[Ftype]))
+      return false;
+
+  return r.GetVector(rec.vConnections) && r.Get(rec.parent) && r.GetVector(rec.vChildren) &&
+         r.GetVector(rec.vLoopEdges);
+}
+
+bool DecodeMapPoint(const vector<uint8_t> &payload, int Ntype, MapPointRecord &rec) {
+  RecordReader r(payload);
+  if (!r.Get(rec.id) || !r.Get(rec.Ftype) || rec.Ftype < 0 || rec.Ftype >= Ntype)
+    return false;
+  if (!r.Get(rec.firstKFid) || !r.Get(rec.firstFrame) || !r.GetMat(rec.pos) || !r.GetMat(rec.normal) ||
+      !r.GetMat(rec.descriptor) || !r.Get(rec.refKF))
+    return false;
+  if (rec.pos.rows != 3 || rec.pos.cols != 1 || rec.pos.type() != CV_32F)
+    return false;
+  return r.Get(rec.nVisible) && r.Get(rec.nFound) && r.Get(rec.minDistance) && r.Get(rec.maxDistance) &&
+         r.GetVector(rec.vObservations);
+}
+
+bool DecodeDatabase(const vector<uint8_t> &payload, int Ntype, const vector<ORBVocabulary *> &vpVocabulary,
+                    DatabaseRecord &rec) {
+  RecordReader r(payload);
+  uint64_t nPostings;
+  if (!r.Get(rec.Ftype) || rec.Ftype < 0 || rec.Ftype >= Ntype || !r.Get(nPostings))
+    return false;
+  // Every posting holds at least its word and the size of its id list
+  if (nPostings > r.Remaining() / (sizeof(uint32_t) + sizeof(uint64_t)))
+    return false;
+  const uint32_t nWords = vpVocabulary[rec.Ftype]->size();
+  rec.vPostings.resize(nPostings);
+  for (auto &posting : rec.vPostings)
+    if (!r.Get(posting.first) || posting.first >= nWords || !r.GetVector(posting.second))
+      return false;
+  return true;
+}
+
+} // namespace
+
+// The serializer reads and restores the protected graph and observation state,
+// see the friend declarations in KeyFrame, MapPoint and KeyFrameDatabase.
+
+bool MapSerializer::Save(const string &filename, Map *pMap, const vector<KeyFrameDatabase *> &vpKeyFrameDB,
+                         MapStore *pMapStore, ThreadPool *pPool) {
+  PROFILE_SCOPE("MapSerializer::Save");
+  const int Ntype = pMap->Ntype;
+
+  // Only the membership is snapshotted under the map lock. Every object is
+  // encoded through its own mutexes after the lock is released, so the
+  // tracker does not wait for the pool.
+  vector<KeyFrame *> vpKFs;
+  vector<MapPoint *> vpMPs;
+  vector<uint64_t> vOrigins;
+  uint64_t nNextKeyFrameId, nNextMapPointId, nNextFrameId;
+  {
+    unique_lock<mutex> lockMap(pMap->mMutexMapUpdate);
+    for (KeyFrame *pKF : pMap->GetAllKeyFrames())
+      if (!pKF->isBad())
+        vpKFs.push_back(pKF);
+    for (MapPoint *pMP : pMap->GetAllMapPoints())
+      if (!pMP->isBad())
+        vpMPs.push_back(pMP);
+    for (KeyFrame *pKF : pMap->mvpKeyFrameOrigins)
+      if (!pKF->isBad())
+        vOrigins.push_back(pKF->mnId);
+    nNextKeyFrameId = KeyFrame::nNextId;
+    nNextMapPointId = MapPoint::nNextId;
+    nNextFrameId = Frame::nNextId;
+  }
+  sort(vpKFs.begin(), vpKFs.end(), KeyFrame::lId);
+  sort(vpMPs.begin(), vpMPs.end(), [](MapPoint *a, MapPoint *b) { return a->mnId < b->mnId; });
+
+  // Paged out features are read from the page file, they must not be
+  // evicted while their keyframe is encoded
+  shared_lock<shared_mutex> residency = pMapStore->ReadGuard();
+
+  vector<vector<uint8_t>> vKFPayloads(vpKFs.size());
+  vector<vector<uint8_t>> vMPPayloads(vpMPs.size());
+  atomic<bool> bFeaturesLost(false);
+
+  const size_t kChunk = 256;
+  TaskGroup group(pPool);
+  for (size_t begin = 0; begin < vpKFs.size(); begin += kChunk) {
+    group.Run(
+        [&, begin]() {
+          for (size_t i = begin; i < min(begin + kChunk, vpKFs.size()); i++) {
+            KeyFrame *pKF = vpKFs[i];
+            RecordWriter w;
+            w.Put<uint64_t>(pKF->mnId);
+            w.Put<uint64_t>(pKF->mnFrameId);
+            w.Put<double>(pKF->mTimeStamp);
+            w.Put<float>(pKF->fx);
+            w.Put<float>(pKF->fy);
+            w.Put<float>(pKF->cx);
+            w.Put<float>(pKF->cy);
+            w.Put<float>(pKF->mbf);
+            w.Put<float>(pKF->mb);
+            w.Put<float>(pKF->mThDepth);
+            w.PutMat(pKF->mK);
+            w.Put<float>(pKF->mfGridElementWidthInv);
+            w.Put<float>(pKF->mfGridElementHeightInv);
+            w.Put<int32_t>(pKF->mnMinX);
+            w.Put<int32_t>(pKF->mnMinY);
+            w.Put<int32_t>(pKF->mnMaxX);
+            w.Put<int32_t>(pKF->mnMaxY);
+            w.Put<int32_t>(pKF->mnScaleLevels);
+            w.Put<float>(pKF->mfScaleFactor);
+            w.PutVector(pKF->mvScaleFactors);
+            w.PutVector(pKF->mvLevelSigma2);
+            w.PutVector(pKF->mvInvLevelSigma2);
+            w.PutMat(pKF->GetPose());
+
+            map<KeyFrame *, int> mConnections;
+            bool bNotErase;
+            {
+              unique_lock<mutex> lock(pKF->mMutexConnections);
+              mConnections.insert(pKF->mConnectedKeyFrameWeights.begin(), pKF->mConnectedKeyFrameWeights.end());
+              bNotErase = pKF->mbNotErase;
+            }
+            w.Put<uint8_t>(bNotErase);
+
+            // Features evicted by the MapStore are read from its page file
+            // instead of being made resident again
+            vector<FeaturePoint> vPaged;
+            const bool bPaged = !pKF->IsResident();
+            if (bPaged && !pKF->mpMapStore->ReadChannels(pKF, vPaged)) {
+              bFeaturesLost = true;
+              continue;
+            }
+            for (int Ftype = 0; Ftype < Ntype; Ftype++)
+              EncodeChannel(w, bPaged ? vPaged[Ftype] : pKF->Channels[Ftype], pKF->GetMapPointMatches(Ftype));
+
+            vector<StoredEdge> vConnections;
+            for (const auto &conn : mConnections)
+              if (!conn.first->isBad())
+                vConnections.push_back({conn.first->mnId, conn.second, 0});
+            w.PutVector(vConnections);
+
+            KeyFrame *pParent = pKF->GetParent();
+            w.Put<int64_t>(pParent ? (int64_t)pParent->mnId : -1);
+
+            vector<uint64_t> vIds;
+            for (KeyFrame *pChild : pKF->GetChilds())
+              vIds.push_back(pChild->mnId);
+            w.PutVector(vIds);
+            vIds.clear();
+            for (KeyFrame *pLoop : pKF->GetLoopEdges())
+              vIds.push_back(pLoop->mnId);
+            w.PutVector(vIds);
+
+            vKFPayloads[i].swap(w.mvData);
+          }
+        },
+        "MapSerializer::EncodeKeyFrames");
+  }
+
+  for (size_t begin = 0; begin < vpMPs.size(); begin += kChunk) {
+    group.Run(
+        [&, begin]() {
+          for (size_t i = begin; i < min(begin + kChunk, vpMPs.size()); i++) {
+            MapPoint *pMP = vpMPs[i];
+            RecordWriter w;
+            w.Put<uint64_t>(pMP->mnId);
+            w.Put<int32_t>(pMP->mFtype);
+            w.Put<int64_t>(pMP->mnFirstKFid);
+            w.Put<int64_t>(pMP->mnFirstFrame);
+            w.PutMat(pMP->GetWorldPos());
+            w.PutMat(pMP->GetNormal());
+            w.PutMat(pMP->GetDescriptor());
+            KeyFrame *pRefKF = pMP->GetReferenceKeyFrame();
+            w.Put<int64_t>(pRefKF ? (int64_t)pRefKF->mnId : -1);
+
+            float minDistance, maxDistance;
+            {
+              unique_lock<mutex> lock(pMP->mMutexPos);
+              minDistance = pMP->mfMinDistance;
+              maxDistance = pMP->mfMaxDistance;
+            }
+            int32_t nVisible, nFound;
+            {
+              unique_lock<mutex> lock(pMP->mMutexFeatures);
+              nVisible = pMP->mnVisible;
+              nFound = pMP->mnFound;
+            }
+            w.Put<int32_t>(nVisible);
+            w.Put<int32_t>(nFound);
+            w.Put<float>(minDistance);
+            w.Put<float>(maxDistance);
+
+            vector<StoredObservation> vObservations;
+            for (const auto &obs : pMP->GetObservations())
+              if (!obs.first->isBad())
+                vObservations.push_back({obs.first->mnId, obs.second});
+            w.PutVector(vObservations);
+
+            vMPPayloads[i].swap(w.mvData);
+          }
+        },
+        "MapSerializer::EncodeMapPoints");
+  }
+
+  // Inverted files, restricted to the keyframes that are saved
+  vector<vector<uint8_t>> vDBPayloads(Ntype);
+  for (int Ftype = 0; Ftype < Ntype; Ftype++) {
+    KeyFrameDatabase *pDB = vpKeyFrameDB[Ftype];
+    RecordWriter w;
+    w.Put<int32_t>(Ftype);
+    vector<pair<uint32_t, vector<uint64_t>>> vPostings;
+    {
+      shared_lock<shared_mutex> lock(pDB->mMutex);
+      for (size_t word = 0; word < pDB->mvInvertedFile.size(); word++) {
+        vector<uint64_t> vIds;
+        for (uint32_t slot : pDB->mvInvertedFile[word].mvSlots) {
+          KeyFrame *pKF = pDB->mvpKeyFrames[slot];
+          // The database also indexes the keyframes of archived maps
+          if (!pKF->isBad() && pKF->GetMap() == pMap)
+            vIds.push_back(pKF->mnId);
+        }
+        if (!vIds.empty())
+          vPostings.emplace_back(word, move(vIds));
+      }
+    }
+    w.Put<uint64_t>(vPostings.size());
+    for (const auto &posting : vPostings) {
+      w.Put<uint32_t>(posting.first);
+      w.PutVector(posting.second);
+    }
+    vDBPayloads[Ftype].swap(w.mvData);
+  }
+
+  group.Wait();
+
+  if (bFeaturesLost) {
+    cerr << "Could not read back the evicted features of a keyframe, the map is not saved" << endl;
+    return false;
+  }
+
+  RecordWriter mapRecord;
+  for (int Ftype = 0; Ftype < Ntype; Ftype++)
+    mapRecord.Put<uint64_t>(vpKeyFrameDB[Ftype]->mpVoc->size());
+  mapRecord.PutVector(vOrigins);
+
+  ofstream f(filename, ios::out | ios::binary | ios::trunc);
+  if (!f.is_open()) {
+    cerr << "Could not open " << filename << " to save the map" << endl;
+    return false;
+  }
+
+  MapFileHeader h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, kMapMagic, sizeof(kMapMagic));
+  h.version = kMapVersion;
+  h.endianTag = kMapEndianTag;
+  h.Ntype = Ntype;
+  h.nKeyFrames = vpKFs.size();
+  h.nMapPoints = vpMPs.size();
+  h.nNextKeyFrameId = nNextKeyFrameId;
+  h.nNextMapPointId = nNextMapPointId;
+  h.nNextFrameId = nNextFrameId;
+  f.write(reinterpret_cast<const char *>(&h), sizeof(h));
+
+  auto writeRecord = [&f](uint32_t type, const vector<uint8_t> &payload) {
+    RecordHeader rh{type, 0, payload.size()};
+    f.write(reinterpret_cast<const char *>(&rh), sizeof(rh));
+    f.write(reinterpret_cast<const char *>(payload.data()), payload.size());
+  };
+
+  writeRecord(kRecordMap, mapRecord.mvData);
+  for (const vector<uint8_t> &payload : vKFPayloads)
+    writeRecord(kRecordKeyFrame, payload);
+  for (const vector<uint8_t> &payload : vMPPayloads)
+    writeRecord(kRecordMapPoint, payload);
+  for (const vector<uint8_t> &payload : vDBPayloads)
+    writeRecord(kRecordDatabase, payload);
+
+  if (!f.good()) {
+    cerr << "Failed writing the map to " << filename << endl;
+    return false;
+  }
+
+  cout << "Map saved to " << filename << ": " << vpKFs.size() << " keyframes, " << vpMPs.size() << " map points"
+       << endl;
+  return true;
+}
+
+bool MapSerializer::Load(const string &filename, Map *pMap, const vector<KeyFrameDatabase *> &vpKeyFrameDB,
+                         const vector<ORBVocabulary *> &vpVocabulary, ThreadPool *pPool) {
+  PROFILE_SCOPE("MapSerializer::Load");
+  const int Ntype = pMap->Ntype;
+
+  if (pMap->KeyFramesInMap() > 0) {
+    cerr << "Map loading failure: the map is not empty" << endl;
+    return false;
+  }
+
+  ifstream f(filename, ios::in | ios::binary | ios::ate);
+  if (!f.is_open()) {
+    cerr << "Map loading failure: could not open " << filename << endl;
+    return false;
+  }
+  const uint64_t nFileSize = f.tellg();
+  f.seekg(0);
+
+  MapFileHeader h;
+  if (!f.read(reinterpret_cast<char *>(&h), sizeof(h)) || memcmp(h.magic, kMapMagic, sizeof(kMapMagic)) != 0 ||
+      h.endianTag != kMapEndianTag) {
+    cerr << "Map loading failure: " << filename << " is not a map file" << endl;
+    return false;
+  }
+  if (h.version != kMapVersion) {
+    cerr << "Map loading failure: unsupported version " << h.version << " in " << filename << endl;
+    return false;
+  }
+  if (h.Ntype != Ntype) {
+    cerr << "Map loading failure: the map has " << h.Ntype << " channels, the system " << Ntype << endl;
+    return false;
+  }
+
+  // Nothing read from the file is trusted for an allocation before it is
+  // checked against what is left of the file. Every record has at least its
+  // header.
+  const uint64_t nMaxRecords = (nFileSize - sizeof(h)) / sizeof(RecordHeader);
+  if (h.nKeyFrames > nMaxRecords || h.nMapPoints > nMaxRecords - h.nKeyFrames) {
+    cerr << "Map loading failure: " << filename << " is truncated or corrupted" << endl;
+    return false;
+  }
+
+  // 1. Stream the records, each one is decoded on the pool while the next
+  // one is read. Records are appended as they come, a deque keeps the ones
+  // being decoded in place.
+  deque<KeyFrameRecord> vKFRecords;
+  deque<MapPointRecord> vMPRecords;
+  vector<DatabaseRecord> vDBRecords(Ntype);
+  vector<uint64_t> vOrigins;
+  bool bMapRecord = false;
+  atomic<bool> bDecodeOk(true);
+
+  {
+    TaskGroup group(pPool);
+    RecordHeader rh;
+    uint64_t nPos = sizeof(h);
+    while (f.read(reinterpret_cast<char *>(&rh), sizeof(rh))) {
+      nPos += sizeof(rh);
+      if (rh.size > nFileSize - nPos) {
+        bDecodeOk = false;
+        break;
+      }
+      nPos += rh.size;
+
+      shared_ptr<vector<uint8_t>> pPayload = make_shared<vector<uint8_t>>(rh.size);
+      if (!f.read(reinterpret_cast<char *>(pPayload->data()), rh.size)) {
+        bDecodeOk = false;
+        break;
+      }
+
+      if (rh.type == kRecordMap) {
+        RecordReader r(*pPayload);
+        for (int Ftype = 0; Ftype < Ntype; Ftype++) {
+          uint64_t nWords;
+          if (!r.Get(nWords) || nWords != vpVocabulary[Ftype]->size()) {
+            cerr << "Map loading failure: the map was built with a different vocabulary for channel " << Ftype
+                 << endl;
+            return false;
+          }
+        }
+        bMapRecord = r.GetVector(vOrigins);
+      } else if (rh.type == kRecordKeyFrame) {
+        if (vKFRecords.size() == h.nKeyFrames) {
+          bDecodeOk = false;
+          break;
+        }
+        vKFRecords.emplace_back();
+        KeyFrameRecord &rec = vKFRecords.back();
+        group.Run(
+            [pPayload, Ntype, &rec, &bDecodeOk]() {
+              if (!DecodeKeyFrame(*pPayload, Ntype, rec))
+                bDecodeOk = false;
+            },
+            "MapSerializer::DecodeKeyFrame");
+      } else if (rh.type == kRecordMapPoint) {
+        if (vMPRecords.size() == h.nMapPoints) {
+          bDecodeOk = false;
+          break;
+        }
+        vMPRecords.emplace_back();
+        MapPointRecord &rec = vMPRecords.back();
+        group.Run(
+            [pPayload, Ntype, &rec, &bDecodeOk]() {
+              if (!DecodeMapPoint(*pPayload, Ntype, rec))
+                bDecodeOk = false;
+            },
+            "MapSerializer::DecodeMapPoint");
+      } else if (rh.type == kRecordDatabase) {
+        DatabaseRecord rec;
+        if (!DecodeDatabase(*pPayload, Ntype, vpVocabulary, rec)) {
+          bDecodeOk = false;
+          break;
+        }
+        vDBRecords[rec.Ftype] = move(rec);
+      }
+    }
+    group.Wait();
+  }
+
+  if (!bDecodeOk || !bMapRecord || vKFRecords.size() != h.nKeyFrames || vMPRecords.size() != h.nMapPoints) {
+    cerr << "Map loading failure: " << filename << " is truncated or corrupted" << endl;
+    return false;
+  }
+
+  // 2. Create the objects. Constructors draw ids from shared counters, so
+  // this runs serially; the stored ids are restored afterwards.
+  unordered_map<uint64_t, KeyFrame *> mKFs;
+  mKFs.reserve(vKFRecords.size());
+  vector<KeyFrame *> vpKFs(vKFRecords.size());
+  uint64_t maxFrameId = 0;
+
+  // KeyFrames take the calibration from the Frame statics, keep the values
+  // of the running tracker
+  const float fx = Frame::fx, fy = Frame::fy, cx = Frame::cx, cy = Frame::cy;
+  const float invfx = Frame::invfx, invfy = Frame::invfy;
+  const float gridWidthInv = Frame::mfGridElementWidthInv, gridHeightInv = Frame::mfGridElementHeightInv;
+  const float minX = Frame::mnMinX, maxX = Frame::mnMaxX, minY = Frame::mnMinY, maxY = Frame::mnMaxY;
+
+  for (size_t i = 0; i < vKFRecords.size(); i++) {
+    const KeyFrameRecord &rec = vKFRecords[i];
+    Frame F(Ntype);
+    F.mnId = rec.frameId;
+    F.mTimeStamp = rec.timestamp;
+    F.mpVocabulary = vpVocabulary;
+    F.mK = rec.K;
+    F.mbf = rec.bf;
+    F.mb = rec.b;
+    F.mThDepth = rec.thDepth;
+    F.mnScaleLevels = rec.nScaleLevels;
+    F.mfScaleFactor = rec.scaleFactor;
+    F.mfLogScaleFactor = log(rec.scaleFactor);
+    F.mvScaleFactors = rec.vScaleFactors;
+    F.mvLevelSigma2 = rec.vLevelSigma2;
+    F.mvInvLevelSigma2 = rec.vInvLevelSigma2;
+    F.SetPose(rec.Tcw);
+    Frame::fx = rec.fx;
+    Frame::fy = rec.fy;
+    Frame::cx = rec.cx;
+    Frame::cy = rec.cy;
+    Frame::invfx = 1.0f / rec.fx;
+    Frame::invfy = 1.0f / rec.fy;
+    Frame::mfGridElementWidthInv = rec.gridWidthInv;
+    Frame::mfGridElementHeightInv = rec.gridHeightInv;
+    Frame::mnMinX = rec.minX;
+    Frame::mnMinY = rec.minY;
+    Frame::mnMaxX = rec.maxX;
+    Frame::mnMaxY = rec.maxY;
+
+    KeyFrame *pKF = new KeyFrame(F, pMap, vpKeyFrameDB, Ntype);
+    pKF->mnId = rec.id;
+    vpKFs[i] = pKF;
+    mKFs[rec.id] = pKF;
+    maxFrameId = max(maxFrameId, rec.frameId);
+  }
+
+  Frame::fx = fx;
+  Frame::fy = fy;
+  Frame::cx = cx;
+  Frame::cy = cy;
+  Frame::invfx = invfx;
+  Frame::invfy = invfy;
+  Frame::mfGridElementWidthInv = gridWidthInv;
+  Frame::mfGridElementHeightInv = gridHeightInv;
+  Frame::mnMinX = minX;
+  Frame::mnMaxX = maxX;
+  Frame::mnMinY = minY;
+  Frame::mnMaxY = maxY;
+
+  auto findKF = [&mKFs](int64_t id) -> KeyFrame * {
+    if (id < 0)
+      return nullptr;
+    unordered_map<uint64_t, KeyFrame *>::const_iterator it = mKFs.find(id);
+    return it == mKFs.end() ? nullptr : it->second;
+  };
+
+  // Points without a surviving observation are dropped
+  unordered_map<uint64_t, MapPoint *> mMPs;
+  mMPs.reserve(vMPRecords.size());
+  vector<MapPoint *> vpMPs(vMPRecords.size(), nullptr);
+  for (size_t i = 0; i < vMPRecords.size(); i++) {
+    const MapPointRecord &rec = vMPRecords[i];
+    KeyFrame *pRefKF = findKF(rec.refKF);
+    for (size_t j = 0; !pRefKF && j < rec.vObservations.size(); j++)
+      pRefKF = findKF(rec.vObservations[j].id);
+    if (!pRefKF)
+      continue;
+
+    MapPoint *pMP = new MapPoint(rec.pos, pRefKF, pMap, rec.Ftype);
+    pMP->mnId = rec.id;
+    pMP->mnFirstKFid = rec.firstKFid;
+    pMP->mnFirstFrame = rec.firstFrame;
+    vpMPs[i] = pMP;
+    mMPs[rec.id] = pMP;
+  }
+
+  // 3. Resolve the ids. Every task only writes its own object.
+  const size_t kChunk = 256;
+  {
+    TaskGroup group(pPool);
+    for (size_t begin = 0; begin < vpKFs.size(); begin += kChunk) {
+      group.Run(
+          [&, begin]() {
+            for (size_t i = begin; i < min(begin + kChunk, vpKFs.size()); i++) {
+              KeyFrameRecord &rec = vKFRecords[i];
+              KeyFrame *pKF = vpKFs[i];
+
+              for (int Ftype = 0; Ftype < Ntype; Ftype++) {
+                FeaturePoint &ch = rec.vChannels[Ftype];
+                const vector<int64_t> &vIds = rec.vMapPointIds[Ftype];
+                ch.mvpMapPoints.assign(ch.N, static_cast<MapPoint *>(NULL));
+                ch.mvbOutlier.assign(ch.N, false);
+                for (int idx = 0; idx < ch.N; idx++) {
+                  if (vIds[idx] < 0)
+                    continue;
+                  unordered_map<uint64_t, MapPoint *>::const_iterator it = mMPs.find(vIds[idx]);
+                  if (it != mMPs.end() && it->second->mFtype == Ftype)
+                    ch.mvpMapPoints[idx] = it->second;
+                }
+                pKF->Channels[Ftype] = move(ch);
+              }
+
+              {
+                unique_lock<mutex> lock(pKF->mMutexConnections);
+                for (const StoredEdge &conn : rec.vConnections) {
+                  KeyFrame *pOther = findKF(conn.id);
+                  if (pOther && pOther != pKF)
+                    pKF->mConnectedKeyFrameWeights[pOther] = conn.weight;
+                }
+                pKF->mbFirstConnection = false;
+                pKF->mpParent = findKF(rec.parent);
+                for (uint64_t id : rec.vChildren)
+                  if (KeyFrame *pChild = findKF(id))
+                    pKF->mspChildrens.insert(pChild);
+                for (uint64_t id : rec.vLoopEdges)
+                  if (KeyFrame *pLoop = findKF(id))
+                    pKF->mspLoopEdges.insert(pLoop);
+                pKF->mbNotErase = rec.bNotErase != 0;
+              }
+              pKF->UpdateBestCovisibles();
+            }
+          },
+          "MapSerializer::RestoreKeyFrames");
+    }
+    group.Wait();
+
+    // Observation counts depend on the keyframe channels restored above
+    for (size_t begin = 0; begin < vpMPs.size(); begin += kChunk) {
+      group.Run(
+          [&, begin]() {
+            for (size_t i = begin; i < min(begin + kChunk, vpMPs.size()); i++) {
+              MapPoint *pMP = vpMPs[i];
+              if (!pMP)
+                continue;
+              const MapPointRecord &rec = vMPRecords[i];
+
+              unique_lock<mutex> lock(pMP->mMutexFeatures);
+              pMP->mnVisible = rec.nVisible;
+              pMP->mnFound = rec.nFound;
+              pMP->mDescriptor = rec.descriptor;
+              pMP->nObs = 0;
+              for (const StoredObservation &obs : rec.vObservations) {
+                KeyFrame *pKF = findKF(obs.id);
+                if (!pKF || obs.idx >= (uint64_t)pKF->Channels[pMP->mFtype].N ||
+                    pKF->Channels[pMP->mFtype].mvpMapPoints[obs.idx] != pMP)
+                  continue;
+                pMP->mObservations.insert(pKF, obs.idx);
+                pMP->nObs += pKF->Channels[pMP->mFtype].mpFeatures->mvuRight[obs.idx] >= 0 ? 2 : 1;
+              }
+              MapPoint::UpdateCovisibility(pMP->mObservations, 1);
+
+              unique_lock<mutex> lock2(pMP->mMutexPos);
+              pMP->mNormalVector = rec.normal.empty() ? cv::Mat::zeros(3, 1, CV_32F) : rec.normal;
+              pMP->mfMinDistance = rec.minDistance;
+              pMP->mfMaxDistance = rec.maxDistance;
+              pMP->PublishState();
+            }
+          },
+          "MapSerializer::RestoreMapPoints");
+    }
+    group.Wait();
+  }
+
+  // 4. Publish
+  for (KeyFrame *pKF : vpKFs)
+    pMap->AddKeyFrame(pKF);
+  for (MapPoint *pMP : vpMPs)
+    if (pMP)
+      pMap->AddMapPoint(pMP);
+  for (uint64_t id : vOrigins)
+    if (KeyFrame *pKF = findKF(id)) {
+      pKF->mbOrigin = true;
+      pMap->mvpKeyFrameOrigins.push_back(pKF);
+    }
+
+  for (int Ftype = 0; Ftype < Ntype; Ftype++) {
+    KeyFrameDatabase *pDB = vpKeyFrameDB[Ftype];
+    if (vDBRecords[Ftype].Ftype < 0) {
+      // No stored inverted file, rebuild it from the keyframes
+      for (KeyFrame *pKF : vpKFs)
+        pDB->add(pKF, Ftype);
+      continue;
+    }
+    unique_lock<shared_mutex> lock(pDB->mMutex);
+    for (const auto &posting : vDBRecords[Ftype].vPostings) {
+      KeyFrameDatabase::Postings &postings = pDB->mvInvertedFile[posting.first];
+      for (uint64_t id : posting.second) {
+        KeyFrame *pKF = findKF(id);
+        if (!pKF)
+          continue;
+        // Weights are not stored, they come from the restored BoW vector
+        const DBoW2::BowVector &BowVec = pKF->Channels[Ftype].mBowVec;
+        DBoW2::BowVector::const_iterator wit = BowVec.find(posting.first);
+        postings.mvSlots.push_back(pDB->GetSlot(pKF));
+        postings.mvWeights.push_back(wit != BowVec.end() ? wit->second : 0);
+      }
+    }
+  }
+
+  uint64_t maxKFid = 0, maxMPid = 0;
+  for (KeyFrame *pKF : vpKFs)
+    maxKFid = max<uint64_t>(maxKFid, pKF->mnId);
+  for (MapPoint *pMP : vpMPs)
+    if (pMP)
+      maxMPid = max<uint64_t>(maxMPid, pMP->mnId);
+  {
+    unique_lock<mutex> lock(pMap->mMutexPointCreation);
+    MapPoint::nNextId = max<uint64_t>({MapPoint::nNextId, maxMPid + 1, h.nNextMapPointId});
+  }
+  KeyFrame::nNextId = max<uint64_t>({KeyFrame::nNextId, maxKFid + 1, h.nNextKeyFrameId});
+  Frame::nNextId = max<uint64_t>({Frame::nNextId, maxFrameId + 1, h.nNextFrameId});
+
+  pMap->InformNewBigChange();
+
+  cout << "Map loaded from " << filename << ": " << pMap->KeyFramesInMap() << " keyframes, "
+       << pMap->MapPointsInMap() << " map points" << endl;
+  return true;
+}
+
+vector<uint8_t> MapSerializer::EncodeChannels(const vector<FeaturePoint> &vChannels) {
+  RecordWriter w;
+  for (const FeaturePoint &ch : vChannels)
+    EncodeChannel(w, ch, vector<MapPoint *>(ch.N, static_cast<MapPoint *>(NULL)));
+  return move(w.mvData);
+}
+
+bool MapSerializer::DecodeChannels(const vector<uint8_t> &data, int Ntype, vector<FeaturePoint> &vChannels) {
+  RecordReader r(data);
+  vChannels.resize(Ntype);
+  vector<int64_t> vMapPointIds;
+  for (int Ftype = 0; Ftype < Ntype; Ftype++)
+    if (!DecodeChannel(r, vChannels[Ftype], vMapPointIds))
+      return false;
+  return true;
+}
+
+} // namespace ORB_SLAM2
@@ -0,0 +1,381 @@
+#include "MapStore.h"
+#include "Atlas.h"
+#include "KeyFrame.h"
+#include "Map.h"
+#include "MapSerializer.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <tuple>
+
+using namespace ::std;
+
+namespace ORB_SLAM2 {
+
+MapStore::MapStore(Atlas *pAtlas, const string &strPageFile, size_t nBudgetBytes, float fTileSize)
+    : mpAtlas(pAtlas), mStrPageFile(strPageFile), mnBudgetBytes(nBudgetBytes),
+      mfTileSize(fTileSize > 0 ? fTileSize : 10.f), mbEvictionWaiting(false), mnResidentKeyFrames(0),
+      mnResidentBytes(0), mnPageFileEnd(0) {}
+
+MapStore::~MapStore() { clear(); }
+
+shared_lock<shared_mutex> MapStore::ReadGuard(const bool bYield) {
+  if (bYield) {
+    unique_lock<mutex> lock(mMutexWaiting);
+    mcvWaiting.wait_for(lock, chrono::milliseconds(100), [this] { return !mbEvictionWaiting; });
+  }
+  return shared_lock<shared_mutex>(mMutexReaders);
+}
+
+void MapStore::AddKeyFrame(KeyFrame *pKF) {
+  if (!IsEnabled())
+    return;
+
+  const TileKey key = GetTileKey(pKF);
+  const size_t nBytes = PagedBytes(pKF);
+
+  unique_lock<mutex> lock(mMutexTiles);
+  if (mmTileEntries.count(pKF))
+    return;
+  TileEntry &entry = mmTileEntries[pKF];
+  entry.key = key;
+  entry.nResidentBytes = nBytes;
+
+  Tile &tile = mTiles[key];
+  tile.vpKFs.push_back(pKF);
+  tile.nResidentBytes += nBytes;
+  mnResidentKeyFrames++;
+  mnResidentBytes += nBytes;
+}
+
+void MapStore::UpdateKeyFrames(const vector<KeyFrame *> &vpKFs) {
+  if (!IsEnabled())
+    return;
+
+  // Poses are read before taking the tiles mutex, PageIn on the tracking
+  // thread takes it too
+  vector<TileKey> vKeys;
+  vKeys.reserve(vpKFs.size());
+  for (KeyFrame *pKF : vpKFs)
+    vKeys.push_back(GetTileKey(pKF));
+
+  unique_lock<mutex> lock(mMutexTiles);
+  for (size_t i = 0; i < vpKFs.size(); i++) {
+    unordered_map<KeyFrame *, TileEntry>::iterator eit = mmTileEntries.find(vpKFs[i]);
+    if (eit == mmTileEntries.end() || eit->second.key == vKeys[i])
+      continue;
+    TileEntry &entry = eit->second;
+
+    map<TileKey, Tile>::iterator tit = mTiles.find(entry.key);
+    vector<KeyFrame *> &vpOld = tit->second.vpKFs;
+    vpOld.erase(find(vpOld.begin(), vpOld.end(), vpKFs[i]));
+    tit->second.nResidentBytes -= entry.nResidentBytes;
+    if (vpOld.empty())
+      mTiles.erase(tit);
+
+    entry.key = vKeys[i];
+    Tile &tile = mTiles[entry.key];
+    tile.vpKFs.push_back(vpKFs[i]);
+    tile.nResidentBytes += entry.nResidentBytes;
+  }
+}
+
+MapStore::TileKey MapStore::GetTileKey(KeyFrame *pKF) {
+  const Eigen::Vector3f O = pKF->GetCameraCenterf();
+  return make_tuple(pKF->GetMap(), (int64_t)floor(O[0] / mfTileSize), (int64_t)floor(O[2] / mfTileSize));
+}
+
+int64_t MapStore::TileDistance(const TileKey &key, Map *pActiveMap, int64_t cx, int64_t cz) {
+  if (get<0>(key) != pActiveMap)
+    return numeric_limits<int64_t>::max();
+  return max(abs(get<1>(key) - cx), abs(get<2>(key) - cz));
+}
+
+bool MapStore::Evict(const cv::Mat &Ow) {
+  if (!IsEnabled())
+    return true;
+
+  unique_lock<shared_mutex> lock(mMutexReaders, try_to_lock);
+  if (!lock.owns_lock()) {
+    unique_lock<mutex> lockWaiting(mMutexWaiting);
+    mbEvictionWaiting = true;
+    return false;
+  }
+
+  PROFILE_SCOPE("MapStore::Evict");
+
+  // No reader holds a store replaced by PageIn anymore
+  {
+    unique_lock<mutex> lockRetired(mMutexRetired);
+    mvpRetired.clear();
+  }
+
+  uint64_t nEvictions = 0;
+  {
+    unique_lock<mutex> lockTiles(mMutexTiles);
+    if (mnResidentBytes > mnBudgetBytes) {
+      Map *pActiveMap = mpAtlas->GetActiveMap();
+      const int64_t cx = floor(Ow.at<float>(0) / mfTileSize);
+      const int64_t cz = floor(Ow.at<float>(2) / mfTileSize);
+
+      // Farthest tiles first. The tile of the camera and its neighbours are
+      // never evicted, tracking and local mapping work there.
+      vector<pair<int64_t, Tile *>> vTiles;
+      for (auto &tile : mTiles) {
+        if (tile.second.nResidentBytes == 0)
+          continue;
+        const int64_t distance = TileDistance(tile.first, pActiveMap, cx, cz);
+        if (distance > 1)
+          vTiles.push_back(make_pair(distance, &tile.second));
+      }
+      sort(vTiles.begin(), vTiles.end(),
+           [](const pair<int64_t, Tile *> &a, const pair<int64_t, Tile *> &b) { return a.first > b.first; });
+
+      for (const auto &tile : vTiles) {
+        if (mnResidentBytes <= mnBudgetBytes)
+          break;
+        for (KeyFrame *pKF : tile.second->vpKFs) {
+          TileEntry &entry = mmTileEntries.at(pKF);
+          if (entry.nResidentBytes == 0)
+            continue;
+          // A local optimization may have moved it next to the camera
+          if (TileDistance(GetTileKey(pKF), pActiveMap, cx, cz) <= 1)
+            continue;
+          if (!PageOut(pKF))
+            continue;
+          tile.second->nResidentBytes -= entry.nResidentBytes;
+          mnResidentBytes -= entry.nResidentBytes;
+          mnResidentKeyFrames--;
+          entry.nResidentBytes = 0;
+          nEvictions++;
+        }
+      }
+    }
+  }
+
+  {
+    unique_lock<mutex> lockWaiting(mMutexWaiting);
+    mbEvictionWaiting = false;
+  }
+  mcvWaiting.notify_all();
+
+  unique_lock<mutex> lockStats(mMutexStats);
+  mStats.nEvictions += nEvictions;
+  mStats.nPageFileBytes = mnPageFileEnd;
+  return true;
+}
+
+bool MapStore::PageOut(KeyFrame *pKF) {
+  // Features never change after the keyframe is created, so a keyframe is
+  // written once and later evictions only release the memory
+  if (pKF->mnPageOffset < 0) {
+    const vector<uint8_t> vData = MapSerializer::EncodeChannels(pKF->Channels);
+
+    unique_lock<mutex> lock(mMutexPageFile);
+    if (!mPageFile.is_open()) {
+      mPageFile.open(mStrPageFile, ios::in | ios::out | ios::binary | ios::trunc);
+      if (!mPageFile.is_open()) {
+        cerr << "MapStore: cannot open page file " << mStrPageFile << endl;
+        return false;
+      }
+    }
+    mPageFile.seekp(mnPageFileEnd);
+    mPageFile.write(reinterpret_cast<const char *>(vData.data()), vData.size());
+    mPageFile.flush();
+    if (!mPageFile) {
+      cerr << "MapStore: cannot write page file " << mStrPageFile << endl;
+      mPageFile.clear();
+      return false;
+    }
+    pKF->mnPageOffset = mnPageFileEnd;
+    pKF->mnPageSize = vData.size();
+    mnPageFileEnd += vData.size();
+  }
+
+  for (FeaturePoint &ch : pKF->Channels) {
+    if (ch.N == 0)
+      continue;
+
+    // Keep what the optimizations and the observations read
+    const FeatureStore &features = *ch.mpFeatures;
+    shared_ptr<FeatureStore> pResident = make_shared<FeatureStore>();
+    pResident->mvKeysUn = features.mvKeysUn;
+    pResident->mvOctave = features.mvOctave;
+    pResident->mvuRight = features.mvuRight;
+    pResident->mvDepth = features.mvDepth;
+    ch.mpFeatures = move(pResident);
+
+    DBoW2::BowVector().swap(ch.mBowVec);
+    DBoW2::FeatureVector().swap(ch.mFeatVec);
+  }
+
+  pKF->mpMapStore = this;
+  pKF->mbResident.store(false, memory_order_release);
+  return true;
+}
+
+bool MapStore::PageIn(KeyFrame *pKF) {
+  PROFILE_SCOPE("MapStore::PageIn");
+
+  // The decoded stores replace the resident ones, their keypoints must match
+  vector<FeaturePoint> vChannels;
+  bool bRead = ReadChannels(pKF, vChannels);
+  for (size_t Ftype = 0; bRead && Ftype < pKF->Channels.size(); Ftype++)
+    bRead = vChannels[Ftype].N == pKF->Channels[Ftype].N;
+  if (!bRead) {
+    cerr << "MapStore: cannot read back keyframe " << pKF->mnId << ", its features are lost" << endl;
+    unique_lock<mutex> lock(mMutexStats);
+    mStats.nLostKeyFrames++;
+    return false;
+  }
+
+  vector<shared_ptr<const FeatureStore>> vpRetired;
+  for (size_t Ftype = 0; Ftype < pKF->Channels.size(); Ftype++) {
+    FeaturePoint &ch = pKF->Channels[Ftype];
+    if (ch.N == 0)
+      continue;
+
+    // The resident store is never written: the decoded one holds its members
+    // and the evicted ones, and replaces it. Readers of the resident members
+    // may still use the old store, it is kept until no guard is held.
+    vpRetired.push_back(ch.mpFeatures);
+    ch.mpFeatures = vChannels[Ftype].mpFeatures;
+
+    ch.mBowVec.swap(vChannels[Ftype].mBowVec);
+    ch.mFeatVec.swap(vChannels[Ftype].mFeatVec);
+  }
+  const size_t nBytes = PagedBytes(pKF);
+
+  {
+    unique_lock<mutex> lock(mMutexRetired);
+    move(vpRetired.begin(), vpRetired.end(), back_inserter(mvpRetired));
+  }
+
+  pKF->mbResident.store(true, memory_order_release);
+
+  {
+    unique_lock<mutex> lock(mMutexTiles);
+    unordered_map<KeyFrame *, TileEntry>::iterator eit = mmTileEntries.find(pKF);
+    if (eit != mmTileEntries.end()) {
+      eit->second.nResidentBytes = nBytes;
+      mTiles[eit->second.key].nResidentBytes += nBytes;
+      mnResidentKeyFrames++;
+      mnResidentBytes += nBytes;
+    }
+  }
+
+  unique_lock<mutex> lock(mMutexStats);
+  mStats.nPageIns++;
+  return true;
+}
+
+bool MapStore::ReadChannels(KeyFrame *pKF, vector<FeaturePoint> &vChannels) {
+  vector<uint8_t> vData;
+  return pKF->mnPageOffset >= 0 && ReadPage(pKF, vData) &&
+         MapSerializer::DecodeChannels(vData, pKF->Ntype, vChannels);
+}
+
+bool MapStore::ReadPage(KeyFrame *pKF, vector<uint8_t> &vData) {
+  vData.resize(pKF->mnPageSize);
+
+  unique_lock<mutex> lock(mMutexPageFile);
+  mPageFile.seekg(pKF->mnPageOffset);
+  mPageFile.read(reinterpret_cast<char *>(vData.data()), vData.size());
+  if (!mPageFile) {
+    cerr << "MapStore: cannot read page file " << mStrPageFile << endl;
+    mPageFile.clear();
+    return false;
+  }
+  return true;
+}
+
+size_t MapStore::PagedBytes(KeyFrame *pKF) {
+  // Approximate size of a tree node of the BoW containers
+  const size_t kNodeBytes = 48;
+
+  size_t nBytes = 0;
+  for (const FeaturePoint &ch : pKF->Channels) {
+    const FeatureStore &features = *ch.mpFeatures;
+    nBytes += features.mvKeys.size() * sizeof(cv::KeyPoint);
+    nBytes += (features.mvX.size() + features.mvY.size() + features.mvAngle.size()) * sizeof(float);
+    nBytes += features.mDescriptors.total() * features.mDescriptors.elemSize();
+    nBytes += (features.mvGridStart.size() + features.mvGridIndices.size()) * sizeof(uint32_t);
+    nBytes += ch.mBowVec.size() * kNodeBytes;
+    for (const auto &node : ch.mFeatVec)
+      nBytes += kNodeBytes + node.second.size() * sizeof(unsigned int);
+  }
+  return nBytes;
+}
+
+void MapStore::clear() {
+  {
+    unique_lock<mutex> lock(mMutexTiles);
+    mTiles.clear();
+    mmTileEntries.clear();
+    mnResidentKeyFrames = 0;
+    mnResidentBytes = 0;
+  }
+
+  {
+    unique_lock<mutex> lock(mMutexRetired);
+    mvpRetired.clear();
+  }
+
+  {
+    unique_lock<mutex> lock(mMutexPageFile);
+    if (mPageFile.is_open()) {
+      mPageFile.close();
+      std::remove(mStrPageFile.c_str());
+    }
+    mnPageFileEnd = 0;
+  }
+
+  {
+    unique_lock<mutex> lock(mMutexWaiting);
+    mbEvictionWaiting = false;
+  }
+  mcvWaiting.notify_all();
+
+  unique_lock<mutex> lock(mMutexStats);
+  mStats = Stats();
+}
+
+MapStore::Stats MapStore::GetStats() {
+  Stats stats;
+  {
+    unique_lock<mutex> lock(mMutexStats);
+    stats = mStats;
+  }
+
+  unique_lock<mutex> lock(mMutexTiles);
+  stats.nKeyFrames = mmTileEntries.size();
+  stats.nResidentKeyFrames = mnResidentKeyFrames;
+  stats.nResidentBytes = mnResidentBytes;
+  stats.nTiles = mTiles.size();
+  for (const auto &tile : mTiles)
+    if (tile.second.nResidentBytes > 0)
+      stats.nResidentTiles++;
+  return stats;
+}
+
+void MapStore::PrintStats(ostream &os) {
+  const Stats stats = GetStats();
+  const double kMB = 1024.0 * 1024.0;
+  os << "MapStore: " << stats.nResidentKeyFrames << "/" << stats.nKeyFrames << " keyframes resident in "
+     << stats.nResidentTiles << "/" << stats.nTiles << " tiles, " << stats.nResidentBytes / kMB << " MB of "
+     << mnBudgetBytes / kMB << " MB" << endl;
+  os << "MapStore: " << stats.nEvictions << " evictions, " << stats.nPageIns << " page-ins, page file "
+     << stats.nPageFileBytes / kMB << " MB" << endl;
+  if (stats.nLostKeyFrames > 0)
+    os << "MapStore: " << stats.nLostKeyFrames << " keyframes lost their features" << endl;
+}
+
+} // namespace ORB_SLAM2
@@ -0,0 +1,75 @@
+#include "MappedFile.h"
+
+#include <fstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MAPPEDFILE_POSIX 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace ::std;
+
+namespace ORB_SLAM2 {
+
+bool MappedFile::Open(const string &filename) {
+  Close();
+
+#ifdef MAPPEDFILE_POSIX
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+    ::close(fd);
+    return false;
+  }
+
+  void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping keeps its own reference to the file
+  ::close(fd);
+  if (p == MAP_FAILED)
+    return false;
+
+  mpData = static_cast<const uint8_t *>(p);
+  mnSize = st.st_size;
+  mbMapped = true;
+#else
+  ifstream f(filename, ios::binary | ios::ate);
+  if (!f.is_open())
+    return false;
+
+  const streamsize size = f.tellg();
+  if (size <= 0)
+    return false;
+
+  mvBuffer.resize(size);
+  f.seekg(0);
+  if (!f.read(reinterpret_cast<char *>(mvBuffer.data()), size))
+    return false;
+
+  mpData = mvBuffer.data();
+  mnSize = size;
+#endif
+
+  mFilename = filename;
+  return true;
+}
+
+void MappedFile::Close() {
+#ifdef MAPPEDFILE_POSIX
+  if (mbMapped && mpData)
+    munmap(const_cast<uint8_t *>(mpData), mnSize);
+#endif
+  mvBuffer.clear();
+  mvBuffer.shrink_to_fit();
+  mpData = nullptr;
+  mnSize = 0;
+  mbMapped = false;
+  mFilename.clear();
+}
+
+} // namespace ORB_SLAM2
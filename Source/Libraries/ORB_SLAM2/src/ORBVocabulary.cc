@@ -1,12 +1,93 @@
 #include "ORBVocabulary.h"
 
+#include "HammingDistance.h"
+
+#include <climits>
+#include <cstring>
+#include <stdexcept>
+
 using namespace ::std;
 
 namespace ORB_SLAM2 {
 
+// Flat vocabulary format (little endian, every array 64B aligned):
+//
+//   FlatHeader
+//   uint8_t  descriptors[nNodes][descBytes]
+//   uint32_t childBegin[nNodes]
+//   uint32_t childCount[nNodes]
+//   uint32_t nodeId[nNodes]
+//   uint32_t wordId[nNodes]
+//   double   weight[nNodes]
+//
+// Nodes are stored breadth first, so the children of a node are contiguous.
+// indexChecksum covers the header (with both checksums zeroed) and the
+// childBegin, childCount, nodeId and wordId arrays, and is verified on every
+// load. checksum covers everything after the header and is only verified on
+// request, since it reads the whole file.
+namespace {
+
+const char kFlatMagic[8] = {'O', 'R', 'B', 'V', 'O', 'C', 'F', '\0'};
+const uint32_t kFlatVersion = 2;
+const uint32_t kFlatEndianTag = 0x01020304;
+const size_t kFlatAlign = 64;
+
+struct FlatHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t endianTag;
+  int32_t k;
+  int32_t L;
+  int32_t weighting;
+  int32_t scoring;
+  uint32_t descBytes;
+  uint32_t nNodes;
+  uint32_t nWords;
+  uint32_t reserved0;
+  uint64_t fileSize;
+  uint64_t checksum;
+  uint64_t offDescriptors;
+  uint64_t offChildBegin;
+  uint64_t offChildCount;
+  uint64_t offNodeId;
+  uint64_t offWordId;
+  uint64_t offWeight;
+  uint64_t indexChecksum;
+  uint64_t reserved1;
+};
+static_assert(sizeof(FlatHeader) == 128, "FlatHeader layout changed");
+
+inline size_t AlignUp(size_t n) { return (n + kFlatAlign - 1) & ~(kFlatAlign - 1); }
+
+// 64 bit FNV-1a over 8 byte words, h chains several ranges
+uint64_t FlatChecksum(const uint8_t *data, size_t size, uint64_t h = 0xcbf29ce484222325ull) {
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t w;
+    memcpy(&w, data + i, 8);
+    h = (h ^ w) * 0x100000001b3ull;
+  }
+  for (; i < size; i++)
+    h = (h ^ data[i]) * 0x100000001b3ull;
+  return h;
+}
+
+uint64_t FlatIndexChecksum(const uint8_t *pImage, FlatHeader h) {
+  h.checksum = 0;
+  h.indexChecksum = 0;
+  uint64_t sum = FlatChecksum(reinterpret_cast<const uint8_t *>(&h), sizeof(h));
+  const size_t nBytes = (size_t)h.nNodes * 4;
+  sum = FlatChecksum(pImage + h.offChildBegin, nBytes, sum);
+  sum = FlatChecksum(pImage + h.offChildCount, nBytes, sum);
+  sum = FlatChecksum(pImage + h.offNodeId, nBytes, sum);
+  return FlatChecksum(pImage + h.offWordId, nBytes, sum);
+}
+
+} // namespace
+
 ORBVocabulary::ORBVocabulary(int k, int L, DBoW2::WeightingType weighting,
                              DBoW2::ScoringType scoring)
-    : ::OrbVocabulary(k, L, weighting, scoring) {}
+    : ::OrbVocabulary(k, L, weighting, scoring), mpThreadPool(nullptr) {}
 
 bool ORBVocabulary::loadFromTextFile(const string &filename) {
   ifstream f;
@@ -15,6 +96,11 @@ bool ORBVocabulary::loadFromTextFile(const string &filename) {
   if (f.eof())
     return false;
 
+  mFlat = FlatTree();
+  mpFlatIndex.reset();
+  mpMappedFile.reset();
+  mvFlatImage.clear();
+
   m_words.clear();
   m_nodes.clear();
 
@@ -87,6 +173,8 @@ bool ORBVocabulary::loadFromTextFile(const string &filename) {
     }
   }
 
+  flattenTree();
+
   return true;
 }
 
@@ -98,6 +186,19 @@ void ORBVocabulary::saveToTextFile(const string &filename) const {
   f << m_k << " " << m_L << " "
     << " " << m_scoring << " " << m_weighting << endl;
 
+  if (mFlat.nNodes) {
+    // Same node order as m_nodes, so the word ids survive a reload
+    const FlatIndex &index = flatIndex();
+    for (uint32_t id = 1; id < mFlat.nNodes; id++) {
+      const uint32_t i = index.vById[id];
+      f << mFlat.nodeId[index.vParent[i]] << " ";
+      f << (mFlat.childCount[i] == 0 ? 1 : 0) << " ";
+      f << F::toString(flatDescriptor(i)) << " " << mFlat.weight[i] << endl;
+    }
+    f.close();
+    return;
+  }
+
   for (size_t i = 1; i < m_nodes.size(); i++) {
     const Node &node = m_nodes[i];
 
@@ -125,6 +226,11 @@ bool ORBVocabulary::loadFromBinaryFile(const std::string &filename) {
   f.read((char *)&m_weighting, sizeof(m_weighting));
   createScoringObject();
 
+  mFlat = FlatTree();
+  mpFlatIndex.reset();
+  mpMappedFile.reset();
+  mvFlatImage.clear();
+
   m_words.clear();
   m_words.reserve(pow((double)m_k, (double)m_L + 1));
   m_nodes.clear();
@@ -153,6 +259,9 @@ bool ORBVocabulary::loadFromBinaryFile(const std::string &filename) {
     nid += 1;
   }
   f.close();
+
+  flattenTree();
+
   return true;
 }
 
@@ -161,7 +270,7 @@ bool ORBVocabulary::loadFromBinaryFile(const std::string &filename) {
 void ORBVocabulary::saveToBinaryFile(const std::string &filename) const {
   fstream f;
   f.open(filename.c_str(), ios_base::out | ios::binary);
-  unsigned int nb_nodes = m_nodes.size();
+  unsigned int nb_nodes = mFlat.nNodes ? mFlat.nNodes : m_nodes.size();
   float _weight;
   unsigned int size_node = sizeof(m_nodes[0].parent) + F::L * sizeof(char) +
                            sizeof(_weight) + sizeof(bool);
@@ -171,6 +280,23 @@ void ORBVocabulary::saveToBinaryFile(const std::string &filename) const {
   f.write((char *)&m_L, sizeof(m_L));
   f.write((char *)&m_scoring, sizeof(m_scoring));
   f.write((char *)&m_weighting, sizeof(m_weighting));
+
+  if (mFlat.nNodes) {
+    const FlatIndex &index = flatIndex();
+    for (uint32_t id = 1; id < nb_nodes; id++) {
+      const uint32_t i = index.vById[id];
+      const DBoW2::NodeId parent = mFlat.nodeId[index.vParent[i]];
+      f.write((char *)&parent, sizeof(parent));
+      f.write((char *)(mFlat.descriptors + (size_t)i * mFlat.descBytes), F::L);
+      _weight = mFlat.weight[i];
+      f.write((char *)&_weight, sizeof(_weight));
+      bool is_leaf = mFlat.childCount[i] == 0;
+      f.write((char *)&is_leaf, sizeof(is_leaf));
+    }
+    f.close();
+    return;
+  }
+
   for (size_t i = 1; i < nb_nodes; i++) {
     const Node &node = m_nodes[i];
     f.write((char *)&node.parent, sizeof(node.parent));
@@ -186,4 +312,432 @@ void ORBVocabulary::saveToBinaryFile(const std::string &filename) const {
 
 // --------------------------------------------------------------------------
 
+void ORBVocabulary::SetThreadPool(ThreadPool *pThreadPool) {
+  mpThreadPool = pThreadPool;
+}
+
+bool ORBVocabulary::isFlatFile(const std::string &filename) {
+  ifstream f(filename, ios::binary);
+  char magic[sizeof(kFlatMagic)];
+  if (!f.read(magic, sizeof(magic)))
+    return false;
+  return memcmp(magic, kFlatMagic, sizeof(kFlatMagic)) == 0;
+}
+
+bool ORBVocabulary::loadFromFlatFile(const std::string &filename, bool bVerifyPayload) {
+  std::shared_ptr<MappedFile> pFile = std::make_shared<MappedFile>();
+  if (!pFile->Open(filename))
+    return false;
+
+  const uint8_t *base = pFile->Data();
+  const size_t size = pFile->Size();
+
+  if (size < sizeof(FlatHeader)) {
+    cerr << "Vocabulary loading failure: " << filename << " is too small" << endl;
+    return false;
+  }
+
+  FlatHeader h;
+  memcpy(&h, base, sizeof(h));
+
+  if (memcmp(h.magic, kFlatMagic, sizeof(kFlatMagic)) != 0 || h.endianTag != kFlatEndianTag) {
+    cerr << "Vocabulary loading failure: " << filename << " is not a flat vocabulary" << endl;
+    return false;
+  }
+  if (h.version != kFlatVersion) {
+    cerr << "Vocabulary loading failure: unsupported flat vocabulary version " << h.version
+         << ", convert it again with vocabulary_converter" << endl;
+    return false;
+  }
+  if (h.descBytes != (uint32_t)F::L || h.nNodes == 0 || h.nWords > h.nNodes || h.fileSize != size) {
+    cerr << "Vocabulary loading failure: " << filename << " is truncated or inconsistent" << endl;
+    return false;
+  }
+
+  const uint64_t n = h.nNodes;
+  const uint64_t offsets[] = {h.offDescriptors, h.offChildBegin, h.offChildCount, h.offNodeId, h.offWordId, h.offWeight};
+  const uint64_t sizes[] = {n * h.descBytes, n * 4, n * 4, n * 4, n * 4, n * 8};
+  for (int i = 0; i < 6; i++) {
+    if (offsets[i] % kFlatAlign != 0 || offsets[i] < sizeof(FlatHeader) || offsets[i] + sizes[i] > size) {
+      cerr << "Vocabulary loading failure: " << filename << " has invalid section offsets" << endl;
+      return false;
+    }
+  }
+
+  if (FlatIndexChecksum(base, h) != h.indexChecksum) {
+    cerr << "Vocabulary loading failure: index checksum mismatch in " << filename << endl;
+    return false;
+  }
+  if (bVerifyPayload && FlatChecksum(base + sizeof(FlatHeader), size - sizeof(FlatHeader)) != h.checksum) {
+    cerr << "Vocabulary loading failure: checksum mismatch in " << filename << endl;
+    return false;
+  }
+
+  // transformFlat follows the child ranges without checks. Children must come
+  // after their parent, which also rules out cycles, and leaves need a word.
+  const uint32_t *pChildBegin = reinterpret_cast<const uint32_t *>(base + h.offChildBegin);
+  const uint32_t *pChildCount = reinterpret_cast<const uint32_t *>(base + h.offChildCount);
+  const uint32_t *pNodeId = reinterpret_cast<const uint32_t *>(base + h.offNodeId);
+  const uint32_t *pWordId = reinterpret_cast<const uint32_t *>(base + h.offWordId);
+  for (uint64_t i = 0; i < n; i++) {
+    const bool bValid = pChildCount[i] > 0 ? pChildBegin[i] > i && (uint64_t)pChildBegin[i] + pChildCount[i] <= n
+                                           : pWordId[i] < h.nWords;
+    if (!bValid || pNodeId[i] >= n) {
+      cerr << "Vocabulary loading failure: " << filename << " has an invalid node " << i << endl;
+      return false;
+    }
+  }
+
+  m_k = h.k;
+  m_L = h.L;
+  m_weighting = (DBoW2::WeightingType)h.weighting;
+  m_scoring = (DBoW2::ScoringType)h.scoring;
+  createScoringObject();
+
+  // The tree is served from the mapping, release any parsed one
+  m_words.clear();
+  m_words.shrink_to_fit();
+  m_nodes.clear();
+  m_nodes.shrink_to_fit();
+
+  mvFlatImage.clear();
+  mvFlatImage.shrink_to_fit();
+
+  attachFlat(base);
+  mpMappedFile = pFile;
+
+  return true;
+}
+
+bool ORBVocabulary::buildFlatImage(vector<uint8_t> &vImage) const {
+  if (m_nodes.empty())
+    return false;
+
+  // Breadth first order, children appended together so they stay contiguous
+  const uint32_t nNodes = m_nodes.size();
+  vector<DBoW2::NodeId> vOrder;
+  vOrder.reserve(nNodes);
+  vector<uint32_t> vChildBegin(nNodes, 0), vChildCount(nNodes, 0);
+  vOrder.push_back(0);
+  for (size_t f = 0; f < vOrder.size(); f++) {
+    const Node &node = m_nodes[vOrder[f]];
+    vChildBegin[f] = node.children.empty() ? 0 : vOrder.size();
+    vChildCount[f] = node.children.size();
+    vOrder.insert(vOrder.end(), node.children.begin(), node.children.end());
+  }
+
+  if (vOrder.size() != nNodes) {
+    cerr << "Vocabulary tree is not connected" << endl;
+    return false;
+  }
+
+  FlatHeader h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, kFlatMagic, sizeof(kFlatMagic));
+  h.version = kFlatVersion;
+  h.endianTag = kFlatEndianTag;
+  h.k = m_k;
+  h.L = m_L;
+  h.weighting = m_weighting;
+  h.scoring = m_scoring;
+  h.descBytes = F::L;
+  h.nNodes = nNodes;
+  h.nWords = m_words.size();
+
+  size_t offset = AlignUp(sizeof(FlatHeader));
+  h.offDescriptors = offset;
+  offset = AlignUp(offset + (size_t)nNodes * h.descBytes);
+  h.offChildBegin = offset;
+  offset = AlignUp(offset + (size_t)nNodes * 4);
+  h.offChildCount = offset;
+  offset = AlignUp(offset + (size_t)nNodes * 4);
+  h.offNodeId = offset;
+  offset = AlignUp(offset + (size_t)nNodes * 4);
+  h.offWordId = offset;
+  offset = AlignUp(offset + (size_t)nNodes * 4);
+  h.offWeight = offset;
+  offset = AlignUp(offset + (size_t)nNodes * 8);
+  h.fileSize = offset;
+
+  vImage.assign(offset, 0);
+  uint8_t *pDesc = vImage.data() + h.offDescriptors;
+  uint32_t *pNodeId = reinterpret_cast<uint32_t *>(vImage.data() + h.offNodeId);
+  uint32_t *pWordId = reinterpret_cast<uint32_t *>(vImage.data() + h.offWordId);
+  double *pWeight = reinterpret_cast<double *>(vImage.data() + h.offWeight);
+
+  for (uint32_t f = 0; f < nNodes; f++) {
+    const Node &node = m_nodes[vOrder[f]];
+    // The root has no descriptor
+    if (!node.descriptor.empty())
+      memcpy(pDesc + (size_t)f * h.descBytes, node.descriptor.data, min<size_t>(h.descBytes, node.descriptor.total()));
+    pNodeId[f] = node.id;
+    pWordId[f] = node.isLeaf() ? node.word_id : UINT32_MAX;
+    pWeight[f] = node.weight;
+  }
+  memcpy(vImage.data() + h.offChildBegin, vChildBegin.data(), (size_t)nNodes * 4);
+  memcpy(vImage.data() + h.offChildCount, vChildCount.data(), (size_t)nNodes * 4);
+
+  h.checksum = FlatChecksum(vImage.data() + sizeof(FlatHeader), vImage.size() - sizeof(FlatHeader));
+  h.indexChecksum = FlatIndexChecksum(vImage.data(), h);
+  memcpy(vImage.data(), &h, sizeof(h));
+  return true;
+}
+
+bool ORBVocabulary::saveToFlatFile(const std::string &filename) const {
+  const uint8_t *pImage = mpMappedFile ? mpMappedFile->Data() : mvFlatImage.data();
+  const size_t nImageSize = mpMappedFile ? mpMappedFile->Size() : mvFlatImage.size();
+  if (mFlat.nNodes == 0 || nImageSize == 0) {
+    cerr << "No vocabulary loaded, cannot save " << filename << endl;
+    return false;
+  }
+
+  ofstream f(filename, ios::binary);
+  if (!f.write(reinterpret_cast<const char *>(pImage), nImageSize))
+    return false;
+  return true;
+}
+
+void ORBVocabulary::flattenTree() {
+  if (!buildFlatImage(mvFlatImage)) {
+    mvFlatImage.clear();
+    return;
+  }
+  attachFlat(mvFlatImage.data());
+
+  // Every query is served from the flat tree from here on, the parsed tree
+  // would only double the memory
+  m_words.clear();
+  m_words.shrink_to_fit();
+  m_nodes.clear();
+  m_nodes.shrink_to_fit();
+}
+
+void ORBVocabulary::attachFlat(const uint8_t *pImage) {
+  FlatHeader h;
+  memcpy(&h, pImage, sizeof(h));
+
+  mFlat.nNodes = h.nNodes;
+  mFlat.nWords = h.nWords;
+  mFlat.descBytes = h.descBytes;
+  mFlat.descriptors = pImage + h.offDescriptors;
+  mFlat.childBegin = reinterpret_cast<const uint32_t *>(pImage + h.offChildBegin);
+  mFlat.childCount = reinterpret_cast<const uint32_t *>(pImage + h.offChildCount);
+  mFlat.nodeId = reinterpret_cast<const uint32_t *>(pImage + h.offNodeId);
+  mFlat.wordId = reinterpret_cast<const uint32_t *>(pImage + h.offWordId);
+  mFlat.weight = reinterpret_cast<const double *>(pImage + h.offWeight);
+
+  mpFlatIndex.reset();
+}
+
+const ORBVocabulary::FlatIndex &ORBVocabulary::flatIndex() const {
+  unique_lock<mutex> lock(mMutexFlatIndex);
+  if (mpFlatIndex)
+    return *mpFlatIndex;
+
+  std::unique_ptr<FlatIndex> pIndex(new FlatIndex);
+  pIndex->vParent.assign(mFlat.nNodes, 0);
+  pIndex->vWordNode.assign(mFlat.nWords, 0);
+  pIndex->vById.assign(mFlat.nNodes, 0);
+  for (uint32_t i = 0; i < mFlat.nNodes; i++) {
+    const uint32_t first = mFlat.childBegin[i];
+    for (uint32_t c = 0; c < mFlat.childCount[i]; c++)
+      pIndex->vParent[first + c] = i;
+    if (mFlat.childCount[i] == 0)
+      pIndex->vWordNode[mFlat.wordId[i]] = i;
+    pIndex->vById[mFlat.nodeId[i]] = i;
+  }
+
+  mpFlatIndex = move(pIndex);
+  return *mpFlatIndex;
+}
+
+cv::Mat ORBVocabulary::flatDescriptor(uint32_t i) const {
+  return cv::Mat(1, mFlat.descBytes, CV_8U, const_cast<uint8_t *>(mFlat.descriptors + (size_t)i * mFlat.descBytes));
+}
+
+// --------------------------------------------------------------------------
+
+unsigned int ORBVocabulary::size() const {
+  return mFlat.nNodes ? mFlat.nWords : ::OrbVocabulary::size();
+}
+
+bool ORBVocabulary::empty() const {
+  return mFlat.nNodes ? mFlat.nWords == 0 : ::OrbVocabulary::empty();
+}
+
+DBoW2::NodeId ORBVocabulary::getParentNode(DBoW2::WordId wid, int levelsup) const {
+  if (mFlat.nNodes == 0)
+    return ::OrbVocabulary::getParentNode(wid, levelsup);
+
+  const FlatIndex &index = flatIndex();
+  uint32_t i = index.vWordNode[wid];
+  while (levelsup > 0 && i != 0) { // 0 --> root
+    --levelsup;
+    i = index.vParent[i];
+  }
+  return mFlat.nodeId[i];
+}
+
+cv::Mat ORBVocabulary::getWord(DBoW2::WordId wid) const {
+  if (mFlat.nNodes == 0)
+    return ::OrbVocabulary::getWord(wid);
+  return flatDescriptor(flatIndex().vWordNode[wid]).clone();
+}
+
+DBoW2::WordValue ORBVocabulary::getWordWeight(DBoW2::WordId wid) const {
+  if (mFlat.nNodes == 0)
+    return ::OrbVocabulary::getWordWeight(wid);
+  return mFlat.weight[flatIndex().vWordNode[wid]];
+}
+
+void ORBVocabulary::save(cv::FileStorage &fs, const std::string &name) const {
+  if (mFlat.nNodes != 0 && m_nodes.empty())
+    throw std::runtime_error("[ORBVocabulary] The flat tree cannot be saved to a FileStorage, "
+                             "use saveToTextFile or saveToBinaryFile");
+  ::OrbVocabulary::save(fs, name);
+}
+
+void ORBVocabulary::load(const cv::FileStorage &fs, const std::string &name) {
+  mFlat = FlatTree();
+  mpFlatIndex.reset();
+  mpMappedFile.reset();
+  mvFlatImage.clear();
+
+  ::OrbVocabulary::load(fs, name);
+
+  flattenTree();
+}
+
+int ORBVocabulary::stopWords(double minWeight) {
+  if (mFlat.nNodes != 0)
+    throw std::runtime_error("[ORBVocabulary] The flat tree is read only, stop words before converting it");
+  return ::OrbVocabulary::stopWords(minWeight);
+}
+
+void ORBVocabulary::transform(const std::vector<cv::Mat> &features, DBoW2::BowVector &v) const {
+  DBoW2::FeatureVector fv;
+  transform(features, v, fv, 0);
+}
+
+void ORBVocabulary::transform(const std::vector<cv::Mat> &features, DBoW2::BowVector &v,
+                              DBoW2::FeatureVector &fv, int levelsup) const {
+  if (mFlat.nNodes == 0) {
+    ::OrbVocabulary::transform(features, v, fv, levelsup);
+    return;
+  }
+
+  v.clear();
+  fv.clear();
+
+  if (empty())
+    return;
+
+  // Mirrors TemplatedVocabulary::transform
+  DBoW2::LNorm norm;
+  bool must = m_scoring_object->mustNormalize(norm);
+
+  const bool bAccumulate = m_weighting == DBoW2::TF || m_weighting == DBoW2::TF_IDF;
+
+  // Descend the tree for every feature, in parallel batches when a pool is set
+  const size_t N = features.size();
+  vector<DBoW2::WordId> vWordIds(N);
+  vector<DBoW2::WordValue> vWeights(N);
+  vector<DBoW2::NodeId> vNodeIds(N);
+
+  auto lookup = [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++)
+      transformFlat(features[i], vWordIds[i], vWeights[i], &vNodeIds[i], levelsup);
+  };
+
+  const size_t nBatch = 128;
+  if (mpThreadPool && N > nBatch) {
+    TaskGroup batches(mpThreadPool);
+    for (size_t begin = 0; begin < N; begin += nBatch) {
+      const size_t end = min(N, begin + nBatch);
+      batches.Run([&lookup, begin, end]() { lookup(begin, end); }, "Vocabulary::transform");
+    }
+    batches.Wait();
+  } else {
+    lookup(0, N);
+  }
+
+  // Accumulate in feature order so the sums match the serial DBoW2 result bit for bit
+  for (unsigned int i_feature = 0; i_feature < N; i_feature++) {
+    const DBoW2::WordValue w = vWeights[i_feature];
+    if (w > 0) { // not stopped
+      if (bAccumulate)
+        v.addWeight(vWordIds[i_feature], w);
+      else
+        v.addIfNotExist(vWordIds[i_feature], w);
+      fv.addFeature(vNodeIds[i_feature], i_feature);
+    }
+  }
+
+  if (bAccumulate && !v.empty() && !must) {
+    // unnecessary when normalizing
+    const double nd = v.size();
+    for (DBoW2::BowVector::iterator vit = v.begin(); vit != v.end(); vit++)
+      vit->second /= nd;
+  }
+
+  if (must)
+    v.normalize(norm);
+}
+
+void ORBVocabulary::transform(const cv::Mat &feature, DBoW2::WordId &id, DBoW2::WordValue &weight,
+                              DBoW2::NodeId *nid, int levelsup) const {
+  if (mFlat.nNodes == 0) {
+    ::OrbVocabulary::transform(feature, id, weight, nid, levelsup);
+    return;
+  }
+  transformFlat(feature, id, weight, nid, levelsup);
+}
+
+void ORBVocabulary::transformFlat(const cv::Mat &feature, DBoW2::WordId &word_id, DBoW2::WordValue &weight,
+                                  DBoW2::NodeId *nid, int levelsup) const {
+  // level at which the node must be stored in nid, if given
+  const int nid_level = m_L - levelsup;
+  if (nid != NULL)
+    *nid = 0; // root
+
+  // Only the first descBytes of wider descriptors are compared
+  const uint8_t *pFeature = feature.ptr<uint8_t>();
+  const int descBytes = mFlat.descBytes;
+
+  uint32_t final_id = 0; // root
+  int current_level = 0;
+
+  // Children are scored a chunk at a time against the contiguous descriptor rows
+  const uint32_t nChunk = 32;
+  int vDist[nChunk];
+
+  do {
+    ++current_level;
+    const uint32_t first = mFlat.childBegin[final_id];
+    const uint32_t nChildren = mFlat.childCount[final_id];
+
+    // Ties keep the first child, as in DBoW2
+    int best_d = INT_MAX;
+    for (uint32_t c0 = 0; c0 < nChildren; c0 += nChunk) {
+      const uint32_t n = min(nChunk, nChildren - c0);
+      HammingDistance::DistanceToRows(pFeature, mFlat.descriptors + (size_t)(first + c0) * descBytes, descBytes, n,
+                                      vDist);
+      for (uint32_t c = 0; c < n; c++) {
+        if (vDist[c] < best_d) {
+          best_d = vDist[c];
+          final_id = first + c0 + c;
+        }
+      }
+    }
+
+    if (nid != NULL && current_level == nid_level)
+      *nid = mFlat.nodeId[final_id];
+
+  } while (mFlat.childCount[final_id] > 0);
+
+  // turn node id into word id
+  word_id = mFlat.wordId[final_id];
+  weight = mFlat.weight[final_id];
+}
+
 } // namespace ORB_SLAM2
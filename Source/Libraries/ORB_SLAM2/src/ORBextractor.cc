@@ -78,6 +78,7 @@ void ORBextractor::InfoConfigs() {
   std::cout << "- Scale Factor: " << scaleFactor << std::endl;
   std::cout << "- Initial Fast Threshold: " << iniThFAST << std::endl;
   std::cout << "- Minimum Fast Threshold: " << minThFAST  << std::endl;
+  std::cout << "- Parallel Levels: " << (mbParallelLevels ? "on" : "off") << std::endl;
 }
 
 static float IC_Angle(const Mat &image, Point2f pt, const vector<int> &u_max) {
@@ -436,6 +437,8 @@ ORBextractor::ORBextractor(int _nfeatures, float _scaleFactor, int _nlevels,
 
   ORBextractor::ORBextractor(const cv::FileNode& config, bool init)
       : FeatureExtractor(config, init) {
+  mbParallelLevels = config["parallelLevels"].empty() ? true : (int)config["parallelLevels"] != 0;
+
   const int npoints = 512;
   const Point *pattern0 = (const Point *)bit_pattern_31_;
   std::copy(pattern0, pattern0 + npoints, std::back_inserter(pattern));
@@ -463,346 +466,352 @@ static void computeOrientation(const Mat &image, vector<KeyPoint> &keypoints,
   }
 }
 
-void ExtractorNode::DivideNode(ExtractorNode &n1, ExtractorNode &n2,
-                               ExtractorNode &n3, ExtractorNode &n4) {
-  const int halfX = ceil(static_cast<float>(UR.x - UL.x) / 2);
-  const int halfY = ceil(static_cast<float>(BR.y - UL.y) / 2);
+// Splits a node in four. The points of the parent are partitioned in place
+// by quadrant, keeping their order, and the children are appended to vNodes.
+static void DivideNode(const vector<cv::KeyPoint> &vKeys,
+                       vector<ExtractorNode> &vNodes, vector<int> &vIndices,
+                       vector<int> &vPartition, const int parent,
+                       int vChildren[4]) {
+  // Copied, vNodes may grow below
+  const ExtractorNode node = vNodes[parent];
+
+  const int halfX = ceil(static_cast<float>(node.UR.x - node.UL.x) / 2);
+  const int halfY = ceil(static_cast<float>(node.BR.y - node.UL.y) / 2);
 
   // Define boundaries of childs
-  n1.UL = UL;
-  n1.UR = cv::Point2i(UL.x + halfX, UL.y);
-  n1.BL = cv::Point2i(UL.x, UL.y + halfY);
-  n1.BR = cv::Point2i(UL.x + halfX, UL.y + halfY);
-  n1.vKeys.reserve(vKeys.size());
-
-  n2.UL = n1.UR;
-  n2.UR = UR;
-  n2.BL = n1.BR;
-  n2.BR = cv::Point2i(UR.x, UL.y + halfY);
-  n2.vKeys.reserve(vKeys.size());
-
-  n3.UL = n1.BL;
-  n3.UR = n1.BR;
-  n3.BL = BL;
-  n3.BR = cv::Point2i(n1.BR.x, BL.y);
-  n3.vKeys.reserve(vKeys.size());
-
-  n4.UL = n3.UR;
-  n4.UR = n2.BR;
-  n4.BL = n3.BR;
-  n4.BR = BR;
-  n4.vKeys.reserve(vKeys.size());
+  ExtractorNode n[4];
+  n[0].UL = node.UL;
+  n[0].UR = cv::Point2i(node.UL.x + halfX, node.UL.y);
+  n[0].BL = cv::Point2i(node.UL.x, node.UL.y + halfY);
+  n[0].BR = cv::Point2i(node.UL.x + halfX, node.UL.y + halfY);
+
+  n[1].UL = n[0].UR;
+  n[1].UR = node.UR;
+  n[1].BL = n[0].BR;
+  n[1].BR = cv::Point2i(node.UR.x, node.UL.y + halfY);
+
+  n[2].UL = n[0].BL;
+  n[2].UR = n[0].BR;
+  n[2].BL = node.BL;
+  n[2].BR = cv::Point2i(n[0].BR.x, node.BL.y);
+
+  n[3].UL = n[2].UR;
+  n[3].UR = n[1].BR;
+  n[3].BL = n[2].BR;
+  n[3].BR = node.BR;
+
+  auto quadrant = [&](const int idx) {
+    const cv::KeyPoint &kp = vKeys[idx];
+    if (kp.pt.x < n[0].UR.x)
+      return kp.pt.y < n[0].BR.y ? 0 : 2;
+    return kp.pt.y < n[0].BR.y ? 1 : 3;
+  };
 
   // Associate points to childs
-  for (size_t i = 0; i < vKeys.size(); i++) {
-    const cv::KeyPoint &kp = vKeys[i];
-    if (kp.pt.x < n1.UR.x) {
-      if (kp.pt.y < n1.BR.y)
-        n1.vKeys.push_back(kp);
-      else
-        n3.vKeys.push_back(kp);
-    } else if (kp.pt.y < n1.BR.y)
-      n2.vKeys.push_back(kp);
-    else
-      n4.vKeys.push_back(kp);
+  int vCount[4] = {0, 0, 0, 0};
+  for (int k = node.begin; k < node.end; k++)
+    vCount[quadrant(vIndices[k])]++;
+
+  int vOffset[4];
+  vOffset[0] = 0;
+  for (int q = 1; q < 4; q++)
+    vOffset[q] = vOffset[q - 1] + vCount[q - 1];
+
+  vPartition.resize(node.size());
+  for (int k = node.begin; k < node.end; k++)
+    vPartition[vOffset[quadrant(vIndices[k])]++] = vIndices[k];
+  copy(vPartition.begin(), vPartition.end(), vIndices.begin() + node.begin);
+
+  int begin = node.begin;
+  for (int q = 0; q < 4; q++) {
+    n[q].begin = begin;
+    n[q].end = begin + vCount[q];
+    n[q].bNoMore = vCount[q] == 1;
+    begin = n[q].end;
+
+    vChildren[q] = vNodes.size();
+    vNodes.push_back(n[q]);
   }
-
-  if (n1.vKeys.size() == 1)
-    n1.bNoMore = true;
-  if (n2.vKeys.size() == 1)
-    n2.bNoMore = true;
-  if (n3.vKeys.size() == 1)
-    n3.bNoMore = true;
-  if (n4.vKeys.size() == 1)
-    n4.bNoMore = true;
 }
 
-vector<cv::KeyPoint>
-ORBextractor::DistributeOctTree(const vector<cv::KeyPoint> &vToDistributeKeys,
-                                const int &minX, const int &maxX,
-                                const int &minY, const int &maxY, const int &N,
-                                const int &level) {
+void ORBextractor::DistributeOctTree(LevelBuffers &buffers,
+                                     const vector<cv::KeyPoint> &vToDistributeKeys,
+                                     const int &minX, const int &maxX,
+                                     const int &minY, const int &maxY,
+                                     const int &N,
+                                     vector<cv::KeyPoint> &vResultKeys) {
   // Compute how many initial nodes
   const int nIni = round(static_cast<float>(maxX - minX) / (maxY - minY));
 
   const float hX = static_cast<float>(maxX - minX) / nIni;
 
-  list<ExtractorNode> lNodes;
+  vector<ExtractorNode> &vNodes = buffers.vNodes;
+  vector<int> &vIndices = buffers.vIndices;
+  vNodes.clear();
+  vNodes.resize(nIni);
+
+  // Nodes in use form a list, new children are pushed at the front
+  int head = -1;
+  int nNodes = 0;
+  auto pushFront = [&](const int idx) {
+    vNodes[idx].prev = -1;
+    vNodes[idx].next = head;
+    if (head >= 0)
+      vNodes[head].prev = idx;
+    head = idx;
+    nNodes++;
+  };
+  auto erase = [&](const int idx) {
+    const ExtractorNode &node = vNodes[idx];
+    if (node.prev >= 0)
+      vNodes[node.prev].next = node.next;
+    else
+      head = node.next;
+    if (node.next >= 0)
+      vNodes[node.next].prev = node.prev;
+    nNodes--;
+  };
 
-  vector<ExtractorNode *> vpIniNodes;
-  vpIniNodes.resize(nIni);
+  // Associate points to childs, counting first so that every initial node
+  // gets a contiguous range of vIndices
+  for (size_t i = 0; i < vToDistributeKeys.size(); i++)
+    vNodes[vToDistributeKeys[i].pt.x / hX].end++;
 
+  int begin = 0;
   for (int i = 0; i < nIni; i++) {
-    ExtractorNode ni;
+    ExtractorNode &ni = vNodes[i];
     ni.UL = cv::Point2i(hX * static_cast<float>(i), 0);
     ni.UR = cv::Point2i(hX * static_cast<float>(i + 1), 0);
     ni.BL = cv::Point2i(ni.UL.x, maxY - minY);
     ni.BR = cv::Point2i(ni.UR.x, maxY - minY);
-    ni.vKeys.reserve(vToDistributeKeys.size());
-
-    lNodes.push_back(ni);
-    vpIniNodes[i] = &lNodes.back();
-  }
 
-  // Associate points to childs
-  for (size_t i = 0; i < vToDistributeKeys.size(); i++) {
-    const cv::KeyPoint &kp = vToDistributeKeys[i];
-    vpIniNodes[kp.pt.x / hX]->vKeys.push_back(kp);
+    const int count = ni.end;
+    ni.begin = ni.end = begin;
+    begin += count;
   }
 
-  list<ExtractorNode>::iterator lit = lNodes.begin();
+  vIndices.resize(vToDistributeKeys.size());
+  for (size_t i = 0; i < vToDistributeKeys.size(); i++)
+    vIndices[vNodes[vToDistributeKeys[i].pt.x / hX].end++] = i;
 
-  while (lit != lNodes.end()) {
-    if (lit->vKeys.size() == 1) {
-      lit->bNoMore = true;
-      lit++;
-    } else if (lit->vKeys.empty())
-      lit = lNodes.erase(lit);
-    else
-      lit++;
+  for (int i = nIni - 1; i >= 0; i--) {
+    if (vNodes[i].size() == 0)
+      continue;
+    vNodes[i].bNoMore = vNodes[i].size() == 1;
+    pushFront(i);
   }
 
+  // Adds the non empty children of a divided node, returns how many of them
+  // can be divided further
+  vector<pair<int, int>> &vSizeAndNode = buffers.vSizeAndNode;
+  vector<pair<int, int>> &vPrevSizeAndNode = buffers.vPrevSizeAndNode;
+  auto addChildren = [&](const int vChildren[4]) {
+    int nExpandable = 0;
+    for (int q = 0; q < 4; q++) {
+      const int size = vNodes[vChildren[q]].size();
+      if (size == 0)
+        continue;
+      pushFront(vChildren[q]);
+      if (size > 1) {
+        nExpandable++;
+        vSizeAndNode.push_back(make_pair(size, vChildren[q]));
+      }
+    }
+    return nExpandable;
+  };
+
   bool bFinish = false;
 
   int iteration = 0;
 
-  vector<pair<int, ExtractorNode *>> vSizeAndPointerToNode;
-  vSizeAndPointerToNode.reserve(lNodes.size() * 4);
-
   while (!bFinish) {
     iteration++;
 
-    int prevSize = lNodes.size();
+    int prevSize = nNodes;
 
-    lit = lNodes.begin();
+    int lit = head;
 
     int nToExpand = 0;
 
-    vSizeAndPointerToNode.clear();
+    vSizeAndNode.clear();
 
-    while (lit != lNodes.end()) {
-      if (lit->bNoMore) {
+    while (lit >= 0) {
+      const int next = vNodes[lit].next;
+      if (vNodes[lit].bNoMore) {
         // If node only contains one point do not subdivide and continue
-        lit++;
-        continue;
-      } else {
-        // If more than one point, subdivide
-        ExtractorNode n1, n2, n3, n4;
-        lit->DivideNode(n1, n2, n3, n4);
-
-        // Add childs if they contain points
-        if (n1.vKeys.size() > 0) {
-          lNodes.push_front(n1);
-          if (n1.vKeys.size() > 1) {
-            nToExpand++;
-            vSizeAndPointerToNode.push_back(
-                make_pair(n1.vKeys.size(), &lNodes.front()));
-            lNodes.front().lit = lNodes.begin();
-          }
-        }
-        if (n2.vKeys.size() > 0) {
-          lNodes.push_front(n2);
-          if (n2.vKeys.size() > 1) {
-            nToExpand++;
-            vSizeAndPointerToNode.push_back(
-                make_pair(n2.vKeys.size(), &lNodes.front()));
-            lNodes.front().lit = lNodes.begin();
-          }
-        }
-        if (n3.vKeys.size() > 0) {
-          lNodes.push_front(n3);
-          if (n3.vKeys.size() > 1) {
-            nToExpand++;
-            vSizeAndPointerToNode.push_back(
-                make_pair(n3.vKeys.size(), &lNodes.front()));
-            lNodes.front().lit = lNodes.begin();
-          }
-        }
-        if (n4.vKeys.size() > 0) {
-          lNodes.push_front(n4);
-          if (n4.vKeys.size() > 1) {
-            nToExpand++;
-            vSizeAndPointerToNode.push_back(
-                make_pair(n4.vKeys.size(), &lNodes.front()));
-            lNodes.front().lit = lNodes.begin();
-          }
-        }
-
-        lit = lNodes.erase(lit);
+        lit = next;
         continue;
       }
+
+      // If more than one point, subdivide
+      int vChildren[4];
+      DivideNode(vToDistributeKeys, vNodes, vIndices, buffers.vPartition, lit,
+                 vChildren);
+      nToExpand += addChildren(vChildren);
+
+      erase(lit);
+      lit = next;
     }
 
     // Finish if there are more nodes than required features
     // or all nodes contain just one point
-    if ((int)lNodes.size() >= N || (int)lNodes.size() == prevSize) {
+    if (nNodes >= N || nNodes == prevSize) {
       bFinish = true;
-    } else if (((int)lNodes.size() + nToExpand * 3) > N) {
+    } else if ((nNodes + nToExpand * 3) > N) {
 
       while (!bFinish) {
 
-        prevSize = lNodes.size();
-
-        vector<pair<int, ExtractorNode *>> vPrevSizeAndPointerToNode =
-            vSizeAndPointerToNode;
-        vSizeAndPointerToNode.clear();
-
-        sort(vPrevSizeAndPointerToNode.begin(),
-             vPrevSizeAndPointerToNode.end());
-        for (int j = vPrevSizeAndPointerToNode.size() - 1; j >= 0; j--) {
-          ExtractorNode n1, n2, n3, n4;
-          vPrevSizeAndPointerToNode[j].second->DivideNode(n1, n2, n3, n4);
-
-          // Add childs if they contain points
-          if (n1.vKeys.size() > 0) {
-            lNodes.push_front(n1);
-            if (n1.vKeys.size() > 1) {
-              vSizeAndPointerToNode.push_back(
-                  make_pair(n1.vKeys.size(), &lNodes.front()));
-              lNodes.front().lit = lNodes.begin();
-            }
-          }
-          if (n2.vKeys.size() > 0) {
-            lNodes.push_front(n2);
-            if (n2.vKeys.size() > 1) {
-              vSizeAndPointerToNode.push_back(
-                  make_pair(n2.vKeys.size(), &lNodes.front()));
-              lNodes.front().lit = lNodes.begin();
-            }
-          }
-          if (n3.vKeys.size() > 0) {
-            lNodes.push_front(n3);
-            if (n3.vKeys.size() > 1) {
-              vSizeAndPointerToNode.push_back(
-                  make_pair(n3.vKeys.size(), &lNodes.front()));
-              lNodes.front().lit = lNodes.begin();
-            }
-          }
-          if (n4.vKeys.size() > 0) {
-            lNodes.push_front(n4);
-            if (n4.vKeys.size() > 1) {
-              vSizeAndPointerToNode.push_back(
-                  make_pair(n4.vKeys.size(), &lNodes.front()));
-              lNodes.front().lit = lNodes.begin();
-            }
-          }
+        prevSize = nNodes;
+
+        vPrevSizeAndNode.swap(vSizeAndNode);
+        vSizeAndNode.clear();
 
-          lNodes.erase(vPrevSizeAndPointerToNode[j].second->lit);
+        sort(vPrevSizeAndNode.begin(), vPrevSizeAndNode.end());
+        for (int j = vPrevSizeAndNode.size() - 1; j >= 0; j--) {
+          const int parent = vPrevSizeAndNode[j].second;
+          int vChildren[4];
+          DivideNode(vToDistributeKeys, vNodes, vIndices, buffers.vPartition,
+                     parent, vChildren);
+          addChildren(vChildren);
 
-          if ((int)lNodes.size() >= N)
+          erase(parent);
+
+          if (nNodes >= N)
             break;
         }
 
-        if ((int)lNodes.size() >= N || (int)lNodes.size() == prevSize)
+        if (nNodes >= N || nNodes == prevSize)
           bFinish = true;
       }
     }
   }
 
   // Retain the best point in each node
-  vector<cv::KeyPoint> vResultKeys;
-  vResultKeys.reserve(nfeatures);
-  for (list<ExtractorNode>::iterator lit = lNodes.begin(); lit != lNodes.end();
-       lit++) {
-    vector<cv::KeyPoint> &vNodeKeys = lit->vKeys;
-    cv::KeyPoint *pKP = &vNodeKeys[0];
+  vResultKeys.clear();
+  for (int lit = head; lit >= 0; lit = vNodes[lit].next) {
+    const ExtractorNode &node = vNodes[lit];
+    const cv::KeyPoint *pKP = &vToDistributeKeys[vIndices[node.begin]];
     float maxResponse = pKP->response;
 
-    for (size_t k = 1; k < vNodeKeys.size(); k++) {
-      if (vNodeKeys[k].response > maxResponse) {
-        pKP = &vNodeKeys[k];
-        maxResponse = vNodeKeys[k].response;
+    for (int k = node.begin + 1; k < node.end; k++) {
+      const cv::KeyPoint &kp = vToDistributeKeys[vIndices[k]];
+      if (kp.response > maxResponse) {
+        pKP = &kp;
+        maxResponse = kp.response;
       }
     }
 
     vResultKeys.push_back(*pKP);
   }
-
-  return vResultKeys;
 }
 
 void ORBextractor::ComputeKeyPointsOctTree(
     vector<vector<KeyPoint>> &allKeypoints) {
   allKeypoints.resize(nlevels);
 
-  const float W = 30;
+  for (int level = 0; level < nlevels; ++level)
+    ComputeKeyPointsLevel(level, allKeypoints[level]);
+}
 
-  for (int level = 0; level < nlevels; ++level) {
-    const int minBorderX = EDGE_THRESHOLD - 3;
-    const int minBorderY = minBorderX;
-    const int maxBorderX = mvImagePyramid[level].cols - EDGE_THRESHOLD + 3;
-    const int maxBorderY = mvImagePyramid[level].rows - EDGE_THRESHOLD + 3;
+void ORBextractor::ComputeKeyPointsLevel(const int level,
+                                         vector<KeyPoint> &keypoints) {
+  const float W = 30;
 
-    vector<cv::KeyPoint> vToDistributeKeys;
-    vToDistributeKeys.reserve(nfeatures * 10);
+  const int minBorderX = EDGE_THRESHOLD - 3;
+  const int minBorderY = minBorderX;
+  const int maxBorderX = mvImagePyramid[level].cols - EDGE_THRESHOLD + 3;
+  const int maxBorderY = mvImagePyramid[level].rows - EDGE_THRESHOLD + 3;
+
+  const float width = (maxBorderX - minBorderX);
+  const float height = (maxBorderY - minBorderY);
+
+  const int nCols = width / W;
+  const int nRows = height / W;
+  const int wCell = ceil(width / nCols);
+  const int hCell = ceil(height / nRows);
+
+  // FAST per row of cells. Rows are independent and are concatenated in
+  // order afterwards, so the result does not depend on the scheduling.
+  LevelBuffers &buffers = mvLevelBuffers[level];
+  if ((int)buffers.vRowKeys.size() < nRows) {
+    buffers.vRowKeys.resize(nRows);
+    buffers.vCellKeys.resize(nRows);
+  }
 
-    const float width = (maxBorderX - minBorderX);
-    const float height = (maxBorderY - minBorderY);
+  auto detectRow = [&, level](const int i) {
+    vector<cv::KeyPoint> &vRowKeys = buffers.vRowKeys[i];
+    vector<cv::KeyPoint> &vKeysCell = buffers.vCellKeys[i];
+    vRowKeys.clear();
 
-    const int nCols = width / W;
-    const int nRows = height / W;
-    const int wCell = ceil(width / nCols);
-    const int hCell = ceil(height / nRows);
+    const float iniY = minBorderY + i * hCell;
+    float maxY = iniY + hCell + 6;
 
-    for (int i = 0; i < nRows; i++) {
-      const float iniY = minBorderY + i * hCell;
-      float maxY = iniY + hCell + 6;
+    if (iniY >= maxBorderY - 3)
+      return;
+    if (maxY > maxBorderY)
+      maxY = maxBorderY;
 
-      if (iniY >= maxBorderY - 3)
+    for (int j = 0; j < nCols; j++) {
+      const float iniX = minBorderX + j * wCell;
+      float maxX = iniX + wCell + 6;
+      if (iniX >= maxBorderX - 6)
         continue;
-      if (maxY > maxBorderY)
-        maxY = maxBorderY;
+      if (maxX > maxBorderX)
+        maxX = maxBorderX;
 
-      for (int j = 0; j < nCols; j++) {
-        const float iniX = minBorderX + j * wCell;
-        float maxX = iniX + wCell + 6;
-        if (iniX >= maxBorderX - 6)
-          continue;
-        if (maxX > maxBorderX)
-          maxX = maxBorderX;
+      FAST(mvImagePyramid[level].rowRange(iniY, maxY).colRange(iniX, maxX),
+           vKeysCell, iniThFAST, true);
 
-        vector<cv::KeyPoint> vKeysCell;
+      if (vKeysCell.empty()) {
         FAST(mvImagePyramid[level].rowRange(iniY, maxY).colRange(iniX, maxX),
-             vKeysCell, iniThFAST, true);
-
-        if (vKeysCell.empty()) {
-          FAST(mvImagePyramid[level].rowRange(iniY, maxY).colRange(iniX, maxX),
-               vKeysCell, minThFAST, true);
-        }
+             vKeysCell, minThFAST, true);
+      }
 
-        if (!vKeysCell.empty()) {
-          for (vector<cv::KeyPoint>::iterator vit = vKeysCell.begin();
-               vit != vKeysCell.end(); vit++) {
-            (*vit).pt.x += j * wCell;
-            (*vit).pt.y += i * hCell;
-            vToDistributeKeys.push_back(*vit);
-          }
+      if (!vKeysCell.empty()) {
+        for (vector<cv::KeyPoint>::iterator vit = vKeysCell.begin();
+             vit != vKeysCell.end(); vit++) {
+          (*vit).pt.x += j * wCell;
+          (*vit).pt.y += i * hCell;
+          vRowKeys.push_back(*vit);
         }
       }
     }
+  };
 
-    vector<KeyPoint> &keypoints = allKeypoints[level];
-    keypoints.reserve(nfeatures);
-
-    keypoints =
-        DistributeOctTree(vToDistributeKeys, minBorderX, maxBorderX, minBorderY,
-                          maxBorderY, mnFeaturesPerLevel[level], level);
-
-    const int scaledPatchSize = PATCH_SIZE * mvScaleFactor[level];
+  if (mbParallelLevels) {
+    TaskGroup rows(mpThreadPool);
+    for (int i = 0; i < nRows; i++)
+      rows.Run([&detectRow, i] { detectRow(i); }, "ORBextractor::FAST");
+    rows.Wait();
+  } else {
+    for (int i = 0; i < nRows; i++)
+      detectRow(i);
+  }
 
-    // Add border to coordinates and scale information
-    const int nkps = keypoints.size();
-    for (int i = 0; i < nkps; i++) {
-      keypoints[i].pt.x += minBorderX;
-      keypoints[i].pt.y += minBorderY;
-      keypoints[i].octave = level;
-      keypoints[i].size = scaledPatchSize;
-    }
+  vector<cv::KeyPoint> &vToDistributeKeys = buffers.vToDistributeKeys;
+  vToDistributeKeys.clear();
+  for (int i = 0; i < nRows; i++)
+    vToDistributeKeys.insert(vToDistributeKeys.end(),
+                             buffers.vRowKeys[i].begin(),
+                             buffers.vRowKeys[i].end());
+
+  DistributeOctTree(buffers, vToDistributeKeys, minBorderX, maxBorderX,
+                    minBorderY, maxBorderY, mnFeaturesPerLevel[level],
+                    keypoints);
+
+  const int scaledPatchSize = PATCH_SIZE * mvScaleFactor[level];
+
+  // Add border to coordinates and scale information
+  const int nkps = keypoints.size();
+  for (int i = 0; i < nkps; i++) {
+    keypoints[i].pt.x += minBorderX;
+    keypoints[i].pt.y += minBorderY;
+    keypoints[i].octave = level;
+    keypoints[i].size = scaledPatchSize;
   }
 
   // compute orientations
-  for (int level = 0; level < nlevels; ++level)
-    computeOrientation(mvImagePyramid[level], allKeypoints[level], umax);
+  computeOrientation(mvImagePyramid[level], keypoints, umax);
 }
 
 void ORBextractor::ComputeKeyPointsOld(
@@ -979,15 +988,27 @@ void ORBextractor::operator()(InputArray _image, InputArray _mask,
   // Pre-compute the scale pyramid
   ComputePyramid(image);
 
-  vector<vector<KeyPoint>> allKeypoints;
-  ComputeKeyPointsOctTree(allKeypoints);
+  vector<vector<KeyPoint>> &allKeypoints = mvLevelKeypoints;
+  if (mbParallelLevels) {
+    // Levels are independent once the pyramid is built
+    TaskGroup levels(mpThreadPool);
+    for (int level = 0; level < nlevels; ++level)
+      levels.Run([this, level] { ComputeKeyPointsLevel(level, mvLevelKeypoints[level]); },
+                 "ORBextractor::KeyPointsLevel");
+    levels.Wait();
+  } else {
+    ComputeKeyPointsOctTree(allKeypoints);
+  }
   // ComputeKeyPointsOld(allKeypoints);
 
   Mat descriptors;
 
-  int nkeypoints = 0;
+  // Each level owns the descriptor rows [vOffsets[level], vOffsets[level+1])
+  vector<int> &vOffsets = mvDescriptorOffsets;
   for (int level = 0; level < nlevels; ++level)
-    nkeypoints += (int)allKeypoints[level].size();
+    vOffsets[level + 1] = vOffsets[level] + (int)allKeypoints[level].size();
+
+  const int nkeypoints = vOffsets[nlevels];
   if (nkeypoints == 0)
     _descriptors.release();
   else {
@@ -995,26 +1016,21 @@ void ORBextractor::operator()(InputArray _image, InputArray _mask,
     descriptors = _descriptors.getMat();
   }
 
-  _keypoints.clear();
-  _keypoints.reserve(nkeypoints);
-
-  int offset = 0;
-  for (int level = 0; level < nlevels; ++level) {
+  auto describeLevel = [&](const int level) {
     vector<KeyPoint> &keypoints = allKeypoints[level];
     int nkeypointsLevel = (int)keypoints.size();
 
     if (nkeypointsLevel == 0)
-      continue;
-
-    // preprocess the resized image
-    Mat workingMat = mvImagePyramid[level].clone();
-    GaussianBlur(workingMat, workingMat, Size(7, 7), 2, 2, BORDER_REFLECT_101);
+      return;
 
-    // Compute the descriptors
-    Mat desc = descriptors.rowRange(offset, offset + nkeypointsLevel);
-    computeDescriptors(workingMat, keypoints, desc, pattern);
+    // Blur the level right before describing it, while it is still in cache.
+    // Isolated, so the result matches blurring a standalone copy of the level.
+    GaussianBlur(mvImagePyramid[level], mvBlurredPyramid[level], Size(7, 7), 2, 2,
+                 BORDER_REFLECT_101 + BORDER_ISOLATED);
 
-    offset += nkeypointsLevel;
+    // Compute the descriptors on the blurred level
+    Mat desc = descriptors.rowRange(vOffsets[level], vOffsets[level + 1]);
+    computeDescriptors(mvBlurredPyramid[level], keypoints, desc, pattern);
 
     // Scale keypoint coordinates
     if (level != 0) {
@@ -1025,29 +1041,85 @@ void ORBextractor::operator()(InputArray _image, InputArray _mask,
            keypoint != keypointEnd; ++keypoint)
         keypoint->pt *= scale;
     }
-    // And add the keypoints to the output
-    _keypoints.insert(_keypoints.end(), keypoints.begin(), keypoints.end());
+  };
+
+  if (mbParallelLevels) {
+    TaskGroup levels(mpThreadPool);
+    for (int level = 0; level < nlevels; ++level)
+      levels.Run([&describeLevel, level] { describeLevel(level); }, "ORBextractor::DescribeLevel");
+    levels.Wait();
+  } else {
+    for (int level = 0; level < nlevels; ++level)
+      describeLevel(level);
   }
 
+  // And add the keypoints to the output, in level order
+  _keypoints.clear();
+  _keypoints.reserve(nkeypoints);
+  for (int level = 0; level < nlevels; ++level)
+    _keypoints.insert(_keypoints.end(), allKeypoints[level].begin(), allKeypoints[level].end());
+
   // std::cout << "Using ORBextractor......" << std::endl;
   
 }
 
-void ORBextractor::ComputePyramid(cv::Mat image) {
+void ORBextractor::AllocatePyramid(const cv::Size &imageSize, const int type) {
+  // Lay every bordered level out back to back in a single arena, plus a
+  // second arena of the same layout for the blurred copies
+  vector<Size> vWholeSizes(nlevels);
+  vector<size_t> vOffsets(nlevels + 1, 0);
+  const size_t elemSize = CV_ELEM_SIZE(type);
   for (int level = 0; level < nlevels; ++level) {
     float scale = mvInvScaleFactor[level];
-    Size sz(cvRound((float)image.cols * scale),
-            cvRound((float)image.rows * scale));
-    Size wholeSize(sz.width + EDGE_THRESHOLD * 2,
-                   sz.height + EDGE_THRESHOLD * 2);
-    Mat temp(wholeSize, image.type()), masktemp;
-    mvImagePyramid[level] =
-        temp(Rect(EDGE_THRESHOLD, EDGE_THRESHOLD, sz.width, sz.height));
+    Size sz(cvRound((float)imageSize.width * scale),
+            cvRound((float)imageSize.height * scale));
+    vWholeSizes[level] = Size(sz.width + EDGE_THRESHOLD * 2,
+                              sz.height + EDGE_THRESHOLD * 2);
+    // Keep every level 64B aligned
+    const size_t bytes = vWholeSizes[level].area() * elemSize;
+    vOffsets[level + 1] = vOffsets[level] + ((bytes + 63) & ~size_t(63));
+  }
+
+  mPyramidArena.create(1, vOffsets[nlevels] + 64, CV_8U);
+  mBlurArena.create(1, vOffsets[nlevels] + 64, CV_8U);
+  uchar *pPyramid = alignPtr(mPyramidArena.ptr(), 64);
+  uchar *pBlur = alignPtr(mBlurArena.ptr(), 64);
+
+  mvPyramidBordered.resize(nlevels);
+  mvBlurredPyramid.resize(nlevels);
+  for (int level = 0; level < nlevels; ++level) {
+    const Size &whole = vWholeSizes[level];
+    const Rect inner(EDGE_THRESHOLD, EDGE_THRESHOLD,
+                     whole.width - EDGE_THRESHOLD * 2,
+                     whole.height - EDGE_THRESHOLD * 2);
+
+    mvPyramidBordered[level] = Mat(whole, type, pPyramid + vOffsets[level]);
+    mvImagePyramid[level] = mvPyramidBordered[level](inner);
+    mvBlurredPyramid[level] = Mat(whole, type, pBlur + vOffsets[level])(inner);
+  }
+
+  mvLevelBuffers.resize(nlevels);
+  mvLevelKeypoints.resize(nlevels);
+  mvDescriptorOffsets.assign(nlevels + 1, 0);
+
+  mPyramidSize = imageSize;
+  mPyramidType = type;
+}
+
+void ORBextractor::ComputePyramid(cv::Mat image) {
+  // Buffers are sized on the first frame and reused afterwards
+  if (image.size() != mPyramidSize || image.type() != mPyramidType)
+    AllocatePyramid(image.size(), image.type());
+
+  // Each level is resized and bordered in place. The blur for the descriptors
+  // is done in the describe pass of the level.
+  for (int level = 0; level < nlevels; ++level) {
+    Mat &temp = mvPyramidBordered[level];
 
     // Compute the resized image
     if (level != 0) {
-      resize(mvImagePyramid[level - 1], mvImagePyramid[level], sz, 0, 0,
-             INTER_LINEAR);
+      resize(mvImagePyramid[level - 1], mvImagePyramid[level],
+             mvImagePyramid[level].size(), 0, 0, INTER_LINEAR);
 
       copyMakeBorder(mvImagePyramid[level], temp, EDGE_THRESHOLD,
                      EDGE_THRESHOLD, EDGE_THRESHOLD, EDGE_THRESHOLD,
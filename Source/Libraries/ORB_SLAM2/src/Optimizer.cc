@@ -31,8 +31,11 @@
 #include <Eigen/StdVector>
 
 #include "Converter.h"
+#include "MapStore.h"
+#include "Profiler.h"
 
 #include <mutex>
+#include <shared_mutex>
 
 using namespace ::std;
 
@@ -44,14 +47,16 @@ void Optimizer::SetNtype(int n) {
   Ntype = n;
 }
 
-void Optimizer::GlobalBundleAdjustemnt(Map *pMap, int nIterations, bool *pbStopFlag, const unsigned long nLoopKF, const bool bRobust) {
+void Optimizer::GlobalBundleAdjustemnt(Map *pMap, int nIterations, bool *pbStopFlag, const unsigned long nLoopKF, const bool bRobust,
+                                       MapStore *pMapStore) {
+  PROFILE_SCOPE("Optimizer::GlobalBundleAdjustment");
   std::vector<KeyFrame *> vpKFs = pMap->GetAllKeyFrames();
   std::vector<MapPoint *> vpMP = pMap->GetAllMapPoints();
-  BundleAdjustment(vpKFs, vpMP, nIterations, pbStopFlag, nLoopKF, bRobust);
+  BundleAdjustment(vpKFs, vpMP, nIterations, pbStopFlag, nLoopKF, bRobust, pMapStore);
 }
 
 void Optimizer::BundleAdjustment(const std::vector<KeyFrame *> &vpKFs, const std::vector<MapPoint *> &vpMP, int nIterations, bool *pbStopFlag,
-                                              const unsigned long nLoopKF, const bool bRobust) {
+                                              const unsigned long nLoopKF, const bool bRobust, MapStore *pMapStore) {
   std::vector<bool> vbNotIncludedMP;
   vbNotIncludedMP.resize(vpMP.size());
 
@@ -75,9 +80,9 @@ void Optimizer::BundleAdjustment(const std::vector<KeyFrame *> &vpKFs, const std
     if (pKF->isBad())
       continue;
     g2o::VertexSE3Expmap *vSE3 = new g2o::VertexSE3Expmap();
-    vSE3->setEstimate(Converter::toSE3Quat(pKF->GetPose()));
+    vSE3->setEstimate(Converter::toSE3Quat(pKF->GetPosef()));
     vSE3->setId(pKF->mnId);
-    vSE3->setFixed(pKF->mnId == 0);
+    vSE3->setFixed(pKF->mbOrigin);
     optimizer.addVertex(vSE3);
     if (pKF->mnId > maxKFid)
       maxKFid = pKF->mnId;
@@ -86,8 +91,19 @@ void Optimizer::BundleAdjustment(const std::vector<KeyFrame *> &vpKFs, const std
   const float thHuber2D = sqrt(5.99);
   const float thHuber3D = sqrt(7.815);
 
+  // Only the edges read keyframe features. A waiting eviction runs between
+  // two batches instead of after the whole optimization.
+  const std::size_t kPointsPerGuard = 1000;
+  shared_lock<shared_mutex> residency;
+
   // Set MapPoint vertices
   for (std::size_t i = 0; i < vpMP.size(); i++) {
+    if (pMapStore && i % kPointsPerGuard == 0) {
+      if (residency.owns_lock())
+        residency.unlock();
+      residency = pMapStore->ReadGuard(true);
+    }
+
     MapPoint *pMP = vpMP[i];
     if (pMP->isBad())
       continue;
@@ -95,17 +111,17 @@ void Optimizer::BundleAdjustment(const std::vector<KeyFrame *> &vpKFs, const std
     int Ftype = pMP->GetFeatureType();
 
     g2o::VertexPointXYZ *vPoint = new g2o::VertexPointXYZ();
-    vPoint->setEstimate(Converter::toVector3d(pMP->GetWorldPos()));
+    vPoint->setEstimate(pMP->GetWorldPosf().cast<double>());
     const int id = pMP->mnId + maxKFid + 1;
     vPoint->setId(id);
     vPoint->setMarginalized(true);
     optimizer.addVertex(vPoint);
 
-    const map<KeyFrame *, std::size_t> observations = pMP->GetObservations();
+    const ObservationSet observations = pMP->GetObservations();
 
     int nEdges = 0;
     // SET EDGES
-    for (map<KeyFrame *, std::size_t>::const_iterator mit = observations.begin(); mit != observations.end(); mit++) {
+    for (ObservationSet::const_iterator mit = observations.begin(); mit != observations.end(); mit++) {
 
       KeyFrame *pKF = mit->first;
       if (pKF->isBad() || pKF->mnId > maxKFid)
@@ -113,9 +129,9 @@ void Optimizer::BundleAdjustment(const std::vector<KeyFrame *> &vpKFs, const std
 
       nEdges++;
 
-      const cv::KeyPoint &kpUn = pKF->Channels[Ftype].mvKeysUn[mit->second];
+      const cv::KeyPoint &kpUn = pKF->Channels[Ftype].mpFeatures->mvKeysUn[mit->second];
 
-      if (pKF->Channels[Ftype].mvuRight[mit->second] < 0) {
+      if (pKF->Channels[Ftype].mpFeatures->mvuRight[mit->second] < 0) {
         Eigen::Matrix<double, 2, 1> obs;
         obs << kpUn.pt.x, kpUn.pt.y;
 
@@ -141,7 +157,7 @@ void Optimizer::BundleAdjustment(const std::vector<KeyFrame *> &vpKFs, const std
         optimizer.addEdge(e);
       } else {
         Eigen::Matrix<double, 3, 1> obs;
-        const float kp_ur = pKF->Channels[Ftype].mvuRight[mit->second];
+        const float kp_ur = pKF->Channels[Ftype].mpFeatures->mvuRight[mit->second];
         obs << kpUn.pt.x, kpUn.pt.y, kp_ur;
 
         g2o::EdgeStereoSE3ProjectXYZ *e = new g2o::EdgeStereoSE3ProjectXYZ();
@@ -177,6 +193,9 @@ void Optimizer::BundleAdjustment(const std::vector<KeyFrame *> &vpKFs, const std
     }
   }
 
+  if (residency.owns_lock())
+    residency.unlock();
+
   // Optimize!
   optimizer.initializeOptimization();
   optimizer.optimize(nIterations);
@@ -223,6 +242,7 @@ void Optimizer::BundleAdjustment(const std::vector<KeyFrame *> &vpKFs, const std
 }
 
 void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool *pbStopFlag, Map *pMap) {
+  PROFILE_SCOPE("Optimizer::LocalBundleAdjustment");
   // Local KeyFrames: First Breath Search from Current Keyframe
   std::list<KeyFrame *> lLocalKeyFrames;
 
@@ -259,8 +279,8 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool *pbStopFlag, Map *pMap
   // Fixed Keyframes. Keyframes that see Local MapPoints but that are not Local Keyframes
   std::list<KeyFrame *> lFixedCameras;
   for (std::list<MapPoint *>::iterator lit = lLocalMapPoints.begin(), lend = lLocalMapPoints.end(); lit != lend; lit++) {
-    map<KeyFrame *, std::size_t> observations = (*lit)->GetObservations();
-    for (map<KeyFrame *, std::size_t>::iterator mit = observations.begin(), mend = observations.end(); mit != mend; mit++) {
+    const ObservationSet observations = (*lit)->GetObservations();
+    for (ObservationSet::const_iterator mit = observations.begin(), mend = observations.end(); mit != mend; mit++) {
       KeyFrame *pKFi = mit->first;
       if (pKFi->mnBALocalForKF != pKF->mnId && pKFi->mnBAFixedForKF != pKF->mnId) {
         pKFi->mnBAFixedForKF = pKF->mnId;
@@ -286,9 +306,9 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool *pbStopFlag, Map *pMap
   for (std::list<KeyFrame *>::iterator lit = lLocalKeyFrames.begin(), lend = lLocalKeyFrames.end(); lit != lend; lit++) {
     KeyFrame *pKFi = *lit;
     g2o::VertexSE3Expmap *vSE3 = new g2o::VertexSE3Expmap();
-    vSE3->setEstimate(Converter::toSE3Quat(pKFi->GetPose()));
+    vSE3->setEstimate(Converter::toSE3Quat(pKFi->GetPosef()));
     vSE3->setId(pKFi->mnId);
-    vSE3->setFixed(pKFi->mnId == 0);
+    vSE3->setFixed(pKFi->mbOrigin);
     optimizer.addVertex(vSE3);
     if (pKFi->mnId > maxKFid)
       maxKFid = pKFi->mnId;
@@ -298,7 +318,7 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool *pbStopFlag, Map *pMap
   for (std::list<KeyFrame *>::iterator lit = lFixedCameras.begin(), lend = lFixedCameras.end(); lit != lend; lit++) {
     KeyFrame *pKFi = *lit;
     g2o::VertexSE3Expmap *vSE3 = new g2o::VertexSE3Expmap();
-    vSE3->setEstimate(Converter::toSE3Quat(pKFi->GetPose()));
+    vSE3->setEstimate(Converter::toSE3Quat(pKFi->GetPosef()));
     vSE3->setId(pKFi->mnId);
     vSE3->setFixed(true);
     optimizer.addVertex(vSE3);
@@ -333,24 +353,24 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool *pbStopFlag, Map *pMap
   for (std::list<MapPoint *>::iterator lit = lLocalMapPoints.begin(), lend = lLocalMapPoints.end(); lit != lend; lit++) {
     MapPoint *pMP = *lit;
     g2o::VertexPointXYZ *vPoint = new g2o::VertexPointXYZ();
-    vPoint->setEstimate(Converter::toVector3d(pMP->GetWorldPos()));
+    vPoint->setEstimate(pMP->GetWorldPosf().cast<double>());
     int id = pMP->mnId + maxKFid + 1;
     vPoint->setId(id);
     vPoint->setMarginalized(true);
     optimizer.addVertex(vPoint);
 
-    const map<KeyFrame *, std::size_t> observations = pMP->GetObservations();
+    const ObservationSet observations = pMP->GetObservations();
     const int Ftype = pMP->GetFeatureType();
 
     // Set edges
-    for (map<KeyFrame *, std::size_t>::const_iterator mit = observations.begin(), mend = observations.end(); mit != mend; mit++) {
+    for (ObservationSet::const_iterator mit = observations.begin(), mend = observations.end(); mit != mend; mit++) {
       KeyFrame *pKFi = mit->first;
 
       if (!pKFi->isBad()) {
-        const cv::KeyPoint &kpUn = pKFi->Channels[Ftype].mvKeysUn[mit->second];
+        const cv::KeyPoint &kpUn = pKFi->Channels[Ftype].mpFeatures->mvKeysUn[mit->second];
 
         // Monocular observation
-        if (pKFi->Channels[Ftype].mvuRight[mit->second] < 0) {
+        if (pKFi->Channels[Ftype].mpFeatures->mvuRight[mit->second] < 0) {
           Eigen::Matrix<double, 2, 1> obs;
           obs << kpUn.pt.x, kpUn.pt.y;
 
@@ -378,7 +398,7 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool *pbStopFlag, Map *pMap
         } else // Stereo observation
         {
           Eigen::Matrix<double, 3, 1> obs;
-          const float kp_ur = pKFi->Channels[Ftype].mvuRight[mit->second];
+          const float kp_ur = pKFi->Channels[Ftype].mpFeatures->mvuRight[mit->second];
           obs << kpUn.pt.x, kpUn.pt.y, kp_ur;
 
           g2o::EdgeStereoSE3ProjectXYZ *e = new g2o::EdgeStereoSE3ProjectXYZ();
@@ -522,6 +542,7 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool *pbStopFlag, Map *pMap
 }
 
 int Optimizer::PoseOptimizationMultiChannels(Frame *pFrame) {
+  PROFILE_SCOPE("Optimizer::PoseOptimization");
   g2o::SparseOptimizer optimizer;
 
   std::unique_ptr<g2o::BlockSolver_6_3::LinearSolverType> linearSolver;
@@ -536,7 +557,7 @@ int Optimizer::PoseOptimizationMultiChannels(Frame *pFrame) {
 
   // Set Frame vertex
   g2o::VertexSE3Expmap *vSE3 = new g2o::VertexSE3Expmap();
-  vSE3->setEstimate(Converter::toSE3Quat(pFrame->mTcw));
+  vSE3->setEstimate(Converter::toSE3Quat(pFrame->GetPose()));
   vSE3->setId(0);
   vSE3->setFixed(false);
   optimizer.addVertex(vSE3);
@@ -569,12 +590,12 @@ int Optimizer::PoseOptimizationMultiChannels(Frame *pFrame) {
         MapPoint *pMP = pFrame->Channels[Ftype].mvpMapPoints[i];
         if (pMP) {
           // Monocular observation
-          if (pFrame->Channels[Ftype].mvuRight[i] < 0) {
+          if (pFrame->Channels[Ftype].mpFeatures->mvuRight[i] < 0) {
             nInitialCorrespondences++;
             pFrame->Channels[Ftype].mvbOutlier[i] = false;
 
             Eigen::Matrix<double, 2, 1> obs;
-            const cv::KeyPoint &kpUn = pFrame->Channels[Ftype].mvKeysUn[i];
+            const cv::KeyPoint &kpUn = pFrame->Channels[Ftype].mpFeatures->mvKeysUn[i];
             obs << kpUn.pt.x, kpUn.pt.y;
 
             g2o::EdgeSE3ProjectXYZOnlyPose *e = new g2o::EdgeSE3ProjectXYZOnlyPose();
@@ -592,10 +613,11 @@ int Optimizer::PoseOptimizationMultiChannels(Frame *pFrame) {
             e->fy = pFrame->fy;
             e->cx = pFrame->cx;
             e->cy = pFrame->cy;
-            cv::Mat Xw = pMP->GetWorldPos();
-            e->Xw[0] = Xw.at<float>(0);
-            e->Xw[1] = Xw.at<float>(1);
-            e->Xw[2] = Xw.at<float>(2);
+            MapPointState state;
+            pMP->GetState(state);
+            e->Xw[0] = state.mWorldPos[0];
+            e->Xw[1] = state.mWorldPos[1];
+            e->Xw[2] = state.mWorldPos[2];
 
             optimizer.addEdge(e);
 
@@ -608,8 +630,8 @@ int Optimizer::PoseOptimizationMultiChannels(Frame *pFrame) {
 
             // SET EDGE
             Eigen::Matrix<double, 3, 1> obs;
-            const cv::KeyPoint &kpUn = pFrame->Channels[Ftype].mvKeysUn[i];
-            const float &kp_ur = pFrame->Channels[Ftype].mvuRight[i];
+            const cv::KeyPoint &kpUn = pFrame->Channels[Ftype].mpFeatures->mvKeysUn[i];
+            const float &kp_ur = pFrame->Channels[Ftype].mpFeatures->mvuRight[i];
             obs << kpUn.pt.x, kpUn.pt.y, kp_ur;
 
             g2o::EdgeStereoSE3ProjectXYZOnlyPose *e = new g2o::EdgeStereoSE3ProjectXYZOnlyPose();
@@ -629,10 +651,11 @@ int Optimizer::PoseOptimizationMultiChannels(Frame *pFrame) {
             e->cx = pFrame->cx;
             e->cy = pFrame->cy;
             e->bf = pFrame->mbf;
-            cv::Mat Xw = pMP->GetWorldPos();
-            e->Xw[0] = Xw.at<float>(0);
-            e->Xw[1] = Xw.at<float>(1);
-            e->Xw[2] = Xw.at<float>(2);
+            MapPointState state;
+            pMP->GetState(state);
+            e->Xw[0] = state.mWorldPos[0];
+            e->Xw[1] = state.mWorldPos[1];
+            e->Xw[2] = state.mWorldPos[2];
 
             optimizer.addEdge(e);
 
@@ -656,7 +679,7 @@ int Optimizer::PoseOptimizationMultiChannels(Frame *pFrame) {
   int nBad = 0;
   for (std::size_t it = 0; it < 4; it++) {
 
-    vSE3->setEstimate(Converter::toSE3Quat(pFrame->mTcw));
+    vSE3->setEstimate(Converter::toSE3Quat(pFrame->GetPose()));
     optimizer.initializeOptimization(0);
     optimizer.optimize(its[it]);
 
@@ -726,6 +749,19 @@ int Optimizer::PoseOptimizationMultiChannels(Frame *pFrame) {
 }
 
 int Optimizer::PoseOptimization(Frame *pFrame, const int Ftype) {
+  PoseHypothesis hypothesis;
+  hypothesis.Tcw = pFrame->GetPose();
+  hypothesis.vpMapPoints.swap(pFrame->Channels[Ftype].mvpMapPoints);
+  hypothesis.vbOutlier.swap(pFrame->Channels[Ftype].mvbOutlier);
+  const int nGood = PoseOptimization(*pFrame, hypothesis, Ftype);
+  pFrame->Channels[Ftype].mvpMapPoints.swap(hypothesis.vpMapPoints);
+  pFrame->Channels[Ftype].mvbOutlier.swap(hypothesis.vbOutlier);
+  pFrame->SetPose(hypothesis.Tcw);
+  return nGood;
+}
+
+int Optimizer::PoseOptimization(const Frame &F, PoseHypothesis &hypothesis, const int Ftype) {
+  PROFILE_SCOPE_ARG("Optimizer::PoseOptimization", Ftype);
   g2o::SparseOptimizer optimizer;
 
   std::unique_ptr<g2o::BlockSolver_6_3::LinearSolverType> linearSolver;
@@ -740,13 +776,13 @@ int Optimizer::PoseOptimization(Frame *pFrame, const int Ftype) {
 
   // Set Frame vertex
   g2o::VertexSE3Expmap *vSE3 = new g2o::VertexSE3Expmap();
-  vSE3->setEstimate(Converter::toSE3Quat(pFrame->mTcw));
+  vSE3->setEstimate(Converter::toSE3Quat(hypothesis.Tcw));
   vSE3->setId(0);
   vSE3->setFixed(false);
   optimizer.addVertex(vSE3);
 
   // Set MapPoint vertices
-  const int N = pFrame->Channels[Ftype].N;
+  const int N = F.Channels[Ftype].N;
 
   std::vector<g2o::EdgeSE3ProjectXYZOnlyPose *> vpEdgesMono;
   std::vector<std::size_t> vnIndexEdgeMono;
@@ -765,36 +801,37 @@ int Optimizer::PoseOptimization(Frame *pFrame, const int Ftype) {
     unique_lock<mutex> lock(MapPoint::mGlobalMutex);
 
     for (int i = 0; i < N; i++) {
-      MapPoint *pMP = pFrame->Channels[Ftype].mvpMapPoints[i];
+      MapPoint *pMP = hypothesis.vpMapPoints[i];
       if (pMP) {
         // Monocular observation
-        if (pFrame->Channels[Ftype].mvuRight[i] < 0) {
+        if (F.Channels[Ftype].mpFeatures->mvuRight[i] < 0) {
           nInitialCorrespondences++;
-          pFrame->Channels[Ftype].mvbOutlier[i] = false;
+          hypothesis.vbOutlier[i] = false;
 
           Eigen::Matrix<double, 2, 1> obs;
-          const cv::KeyPoint &kpUn = pFrame->Channels[Ftype].mvKeysUn[i];
+          const cv::KeyPoint &kpUn = F.Channels[Ftype].mpFeatures->mvKeysUn[i];
           obs << kpUn.pt.x, kpUn.pt.y;
 
           g2o::EdgeSE3ProjectXYZOnlyPose *e = new g2o::EdgeSE3ProjectXYZOnlyPose();
 
           e->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex *>(optimizer.vertex(0)));
           e->setMeasurement(obs);
-          const float invSigma2 = pFrame->mvInvLevelSigma2[kpUn.octave];
+          const float invSigma2 = F.mvInvLevelSigma2[kpUn.octave];
           e->setInformation(Eigen::Matrix2d::Identity() * invSigma2);
 
           g2o::RobustKernelHuber *rk = new g2o::RobustKernelHuber;
           e->setRobustKernel(rk);
           rk->setDelta(deltaMono);
 
-          e->fx = pFrame->fx;
-          e->fy = pFrame->fy;
-          e->cx = pFrame->cx;
-          e->cy = pFrame->cy;
-          cv::Mat Xw = pMP->GetWorldPos();
-          e->Xw[0] = Xw.at<float>(0);
-          e->Xw[1] = Xw.at<float>(1);
-          e->Xw[2] = Xw.at<float>(2);
+          e->fx = F.fx;
+          e->fy = F.fy;
+          e->cx = F.cx;
+          e->cy = F.cy;
+          MapPointState state;
+          pMP->GetState(state);
+          e->Xw[0] = state.mWorldPos[0];
+          e->Xw[1] = state.mWorldPos[1];
+          e->Xw[2] = state.mWorldPos[2];
 
           optimizer.addEdge(e);
 
@@ -803,19 +840,19 @@ int Optimizer::PoseOptimization(Frame *pFrame, const int Ftype) {
         } else // Stereo observation
         {
           nInitialCorrespondences++;
-          pFrame->Channels[Ftype].mvbOutlier[i] = false;
+          hypothesis.vbOutlier[i] = false;
 
           // SET EDGE
           Eigen::Matrix<double, 3, 1> obs;
-          const cv::KeyPoint &kpUn = pFrame->Channels[Ftype].mvKeysUn[i];
-          const float &kp_ur = pFrame->Channels[Ftype].mvuRight[i];
+          const cv::KeyPoint &kpUn = F.Channels[Ftype].mpFeatures->mvKeysUn[i];
+          const float &kp_ur = F.Channels[Ftype].mpFeatures->mvuRight[i];
           obs << kpUn.pt.x, kpUn.pt.y, kp_ur;
 
           g2o::EdgeStereoSE3ProjectXYZOnlyPose *e = new g2o::EdgeStereoSE3ProjectXYZOnlyPose();
 
           e->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex *>(optimizer.vertex(0)));
           e->setMeasurement(obs);
-          const float invSigma2 = pFrame->mvInvLevelSigma2[kpUn.octave];
+          const float invSigma2 = F.mvInvLevelSigma2[kpUn.octave];
           Eigen::Matrix3d Info = Eigen::Matrix3d::Identity() * invSigma2;
           e->setInformation(Info);
 
@@ -823,15 +860,16 @@ int Optimizer::PoseOptimization(Frame *pFrame, const int Ftype) {
           e->setRobustKernel(rk);
           rk->setDelta(deltaStereo);
 
-          e->fx = pFrame->fx;
-          e->fy = pFrame->fy;
-          e->cx = pFrame->cx;
-          e->cy = pFrame->cy;
-          e->bf = pFrame->mbf;
-          cv::Mat Xw = pMP->GetWorldPos();
-          e->Xw[0] = Xw.at<float>(0);
-          e->Xw[1] = Xw.at<float>(1);
-          e->Xw[2] = Xw.at<float>(2);
+          e->fx = F.fx;
+          e->fy = F.fy;
+          e->cx = F.cx;
+          e->cy = F.cy;
+          e->bf = F.mbf;
+          MapPointState state;
+          pMP->GetState(state);
+          e->Xw[0] = state.mWorldPos[0];
+          e->Xw[1] = state.mWorldPos[1];
+          e->Xw[2] = state.mWorldPos[2];
 
           optimizer.addEdge(e);
 
@@ -854,7 +892,7 @@ int Optimizer::PoseOptimization(Frame *pFrame, const int Ftype) {
   int nBad = 0;
   for (std::size_t it = 0; it < 4; it++) {
 
-    vSE3->setEstimate(Converter::toSE3Quat(pFrame->mTcw));
+    vSE3->setEstimate(Converter::toSE3Quat(hypothesis.Tcw));
     optimizer.initializeOptimization(0);
     optimizer.optimize(its[it]);
 
@@ -864,18 +902,18 @@ int Optimizer::PoseOptimization(Frame *pFrame, const int Ftype) {
 
       const std::size_t idx = vnIndexEdgeMono[i];
 
-      if (pFrame->Channels[Ftype].mvbOutlier[idx]) {
+      if (hypothesis.vbOutlier[idx]) {
         e->computeError();
       }
 
       const float chi2 = e->chi2();
 
       if (chi2 > chi2Mono[it]) {
-        pFrame->Channels[Ftype].mvbOutlier[idx] = true;
+        hypothesis.vbOutlier[idx] = true;
         e->setLevel(1);
         nBad++;
       } else {
-        pFrame->Channels[Ftype].mvbOutlier[idx] = false;
+        hypothesis.vbOutlier[idx] = false;
         e->setLevel(0);
       }
 
@@ -888,19 +926,19 @@ int Optimizer::PoseOptimization(Frame *pFrame, const int Ftype) {
 
       const std::size_t idx = vnIndexEdgeStereo[i];
 
-      if (pFrame->Channels[Ftype].mvbOutlier[idx]) {
+      if (hypothesis.vbOutlier[idx]) {
         e->computeError();
       }
 
       const float chi2 = e->chi2();
 
       if (chi2 > chi2Stereo[it]) {
-        pFrame->Channels[Ftype].mvbOutlier[idx] = true;
+        hypothesis.vbOutlier[idx] = true;
         e->setLevel(1);
         nBad++;
       } else {
         e->setLevel(0);
-        pFrame->Channels[Ftype].mvbOutlier[idx] = false;
+        hypothesis.vbOutlier[idx] = false;
       }
 
       if (it == 2)
@@ -914,14 +952,23 @@ int Optimizer::PoseOptimization(Frame *pFrame, const int Ftype) {
   // Recover optimized pose and return number of inliers
   g2o::VertexSE3Expmap *vSE3_recov =static_cast<g2o::VertexSE3Expmap *>(optimizer.vertex(0));
   g2o::SE3Quat SE3quat_recov = vSE3_recov->estimate();
-  cv::Mat pose = Converter::toCvMat(SE3quat_recov);
-  pFrame->SetPose(pose);
+  hypothesis.Tcw = Converter::toCvMat(SE3quat_recov);
 
   return nInitialCorrespondences - nBad;
 }
 
 int Optimizer::OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, std::vector<MapPoint *> &vpMatches1, g2o::Sim3 &g2oS12, const float th2, 
                             const bool bFixScale, const int Ftype) {
+  std::vector<std::vector<MapPoint *>> vvpMatches1(Ftype + 1);
+  vvpMatches1[Ftype].swap(vpMatches1);
+  const int nIn = OptimizeSim3MultiChannels(pKF1, pKF2, vvpMatches1, g2oS12, th2, bFixScale);
+  vpMatches1.swap(vvpMatches1[Ftype]);
+  return nIn;
+}
+
+int Optimizer::OptimizeSim3MultiChannels(KeyFrame *pKF1, KeyFrame *pKF2, std::vector<std::vector<MapPoint *>> &vvpMatches1,
+                                         g2o::Sim3 &g2oS12, const float th2, const bool bFixScale) {
+  PROFILE_SCOPE("Optimizer::OptimizeSim3");
   g2o::SparseOptimizer optimizer;
   std::unique_ptr<g2o::BlockSolverX::LinearSolverType> linearSolver;
   linearSolver = std::make_unique<g2o::LinearSolverEigen<g2o::BlockSolverX::PoseMatrixType>>();
@@ -957,11 +1004,12 @@ int Optimizer::OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, std::vector<MapPoint
   optimizer.addVertex(vSim3);
 
   // Set MapPoint vertices
-  const int N = vpMatches1.size();
-  const std::vector<MapPoint *> vpMapPoints1 = pKF1->GetMapPointMatches(Ftype);
+  int N = 0;
+  for (std::size_t Ftype = 0; Ftype < vvpMatches1.size(); Ftype++)
+    N += vvpMatches1[Ftype].size();
   std::vector<g2o::EdgeSim3ProjectXYZ *> vpEdges12;
   std::vector<g2o::EdgeInverseSim3ProjectXYZ *> vpEdges21;
-  std::vector<std::size_t> vnIndexEdge;
+  std::vector<std::pair<int, std::size_t>> vnIndexEdge; // channel and keypoint of each edge
 
   vnIndexEdge.reserve(2 * N);
   vpEdges12.reserve(2 * N);
@@ -970,81 +1018,90 @@ int Optimizer::OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, std::vector<MapPoint
   const float deltaHuber = sqrt(th2);
 
   int nCorrespondences = 0;
+  int nVertexId = 1;
 
-  for (int i = 0; i < N; i++) {
-    if (!vpMatches1[i])
+  for (int Ftype = 0, nChannels = vvpMatches1.size(); Ftype < nChannels; Ftype++) {
+    const std::vector<MapPoint *> &vpMatches1 = vvpMatches1[Ftype];
+    if (vpMatches1.empty())
       continue;
+    const std::vector<MapPoint *> vpMapPoints1 = pKF1->GetMapPointMatches(Ftype);
+
+    for (int i = 0, iend = vpMatches1.size(); i < iend; i++) {
+      if (!vpMatches1[i])
+        continue;
 
-    MapPoint *pMP1 = vpMapPoints1[i];
-    MapPoint *pMP2 = vpMatches1[i];
-
-    const int id1 = 2 * i + 1;
-    const int id2 = 2 * (i + 1);
-
-    const int i2 = pMP2->GetIndexInKeyFrame(pKF2);
-
-    if (pMP1 && pMP2) {
-      if (!pMP1->isBad() && !pMP2->isBad() && i2 >= 0) {
-        g2o::VertexPointXYZ *vPoint1 = new g2o::VertexPointXYZ();
-        cv::Mat P3D1w = pMP1->GetWorldPos();
-        cv::Mat P3D1c = R1w * P3D1w + t1w;
-        vPoint1->setEstimate(Converter::toVector3d(P3D1c));
-        vPoint1->setId(id1);
-        vPoint1->setFixed(true);
-        optimizer.addVertex(vPoint1);
-
-        g2o::VertexPointXYZ *vPoint2 = new g2o::VertexPointXYZ();
-        cv::Mat P3D2w = pMP2->GetWorldPos();
-        cv::Mat P3D2c = R2w * P3D2w + t2w;
-        vPoint2->setEstimate(Converter::toVector3d(P3D2c));
-        vPoint2->setId(id2);
-        vPoint2->setFixed(true);
-        optimizer.addVertex(vPoint2);
+      MapPoint *pMP1 = vpMapPoints1[i];
+      MapPoint *pMP2 = vpMatches1[i];
+
+      const int id1 = nVertexId;
+      const int id2 = nVertexId + 1;
+
+      const int i2 = pMP2->GetIndexInKeyFrame(pKF2);
+
+      if (pMP1 && pMP2) {
+        if (!pMP1->isBad() && !pMP2->isBad() && i2 >= 0) {
+          g2o::VertexPointXYZ *vPoint1 = new g2o::VertexPointXYZ();
+          cv::Mat P3D1w = pMP1->GetWorldPos();
+          cv::Mat P3D1c = R1w * P3D1w + t1w;
+          vPoint1->setEstimate(Converter::toVector3d(P3D1c));
+          vPoint1->setId(id1);
+          vPoint1->setFixed(true);
+          optimizer.addVertex(vPoint1);
+
+          g2o::VertexPointXYZ *vPoint2 = new g2o::VertexPointXYZ();
+          cv::Mat P3D2w = pMP2->GetWorldPos();
+          cv::Mat P3D2c = R2w * P3D2w + t2w;
+          vPoint2->setEstimate(Converter::toVector3d(P3D2c));
+          vPoint2->setId(id2);
+          vPoint2->setFixed(true);
+          optimizer.addVertex(vPoint2);
+        } else
+          continue;
       } else
         continue;
-    } else
-      continue;
 
-    nCorrespondences++;
-
-    // Set edge x1 = S12*X2
-    Eigen::Matrix<double, 2, 1> obs1;
-    const cv::KeyPoint &kpUn1 = pKF1->Channels[Ftype].mvKeysUn[i];
-    obs1 << kpUn1.pt.x, kpUn1.pt.y;
-
-    g2o::EdgeSim3ProjectXYZ *e12 = new g2o::EdgeSim3ProjectXYZ();
-    e12->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex *>(optimizer.vertex(id2)));
-    e12->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex *>(optimizer.vertex(0)));
-    e12->setMeasurement(obs1);
-    const float &invSigmaSquare1 = pKF1->mvInvLevelSigma2[kpUn1.octave];
-    e12->setInformation(Eigen::Matrix2d::Identity() * invSigmaSquare1);
-
-    g2o::RobustKernelHuber *rk1 = new g2o::RobustKernelHuber;
-    e12->setRobustKernel(rk1);
-    rk1->setDelta(deltaHuber);
-    optimizer.addEdge(e12);
-
-    // Set edge x2 = S21*X1
-    Eigen::Matrix<double, 2, 1> obs2;
-    const cv::KeyPoint &kpUn2 = pKF2->Channels[Ftype].mvKeysUn[i2];
-    obs2 << kpUn2.pt.x, kpUn2.pt.y;
-
-    g2o::EdgeInverseSim3ProjectXYZ *e21 = new g2o::EdgeInverseSim3ProjectXYZ();
-
-    e21->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex *>(optimizer.vertex(id1)));
-    e21->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex *>(optimizer.vertex(0)));
-    e21->setMeasurement(obs2);
-    float invSigmaSquare2 = pKF2->mvInvLevelSigma2[kpUn2.octave];
-    e21->setInformation(Eigen::Matrix2d::Identity() * invSigmaSquare2);
-
-    g2o::RobustKernelHuber *rk2 = new g2o::RobustKernelHuber;
-    e21->setRobustKernel(rk2);
-    rk2->setDelta(deltaHuber);
-    optimizer.addEdge(e21);
-
-    vpEdges12.push_back(e12);
-    vpEdges21.push_back(e21);
-    vnIndexEdge.push_back(i);
+      nCorrespondences++;
+      nVertexId += 2;
+
+      // Set edge x1 = S12*X2
+      Eigen::Matrix<double, 2, 1> obs1;
+      const cv::KeyPoint &kpUn1 = pKF1->Channels[Ftype].mpFeatures->mvKeysUn[i];
+      obs1 << kpUn1.pt.x, kpUn1.pt.y;
+
+      g2o::EdgeSim3ProjectXYZ *e12 = new g2o::EdgeSim3ProjectXYZ();
+      e12->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex *>(optimizer.vertex(id2)));
+      e12->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex *>(optimizer.vertex(0)));
+      e12->setMeasurement(obs1);
+      const float &invSigmaSquare1 = pKF1->mvInvLevelSigma2[kpUn1.octave];
+      e12->setInformation(Eigen::Matrix2d::Identity() * invSigmaSquare1);
+
+      g2o::RobustKernelHuber *rk1 = new g2o::RobustKernelHuber;
+      e12->setRobustKernel(rk1);
+      rk1->setDelta(deltaHuber);
+      optimizer.addEdge(e12);
+
+      // Set edge x2 = S21*X1
+      Eigen::Matrix<double, 2, 1> obs2;
+      const cv::KeyPoint &kpUn2 = pKF2->Channels[Ftype].mpFeatures->mvKeysUn[i2];
+      obs2 << kpUn2.pt.x, kpUn2.pt.y;
+
+      g2o::EdgeInverseSim3ProjectXYZ *e21 = new g2o::EdgeInverseSim3ProjectXYZ();
+
+      e21->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex *>(optimizer.vertex(id1)));
+      e21->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex *>(optimizer.vertex(0)));
+      e21->setMeasurement(obs2);
+      float invSigmaSquare2 = pKF2->mvInvLevelSigma2[kpUn2.octave];
+      e21->setInformation(Eigen::Matrix2d::Identity() * invSigmaSquare2);
+
+      g2o::RobustKernelHuber *rk2 = new g2o::RobustKernelHuber;
+      e21->setRobustKernel(rk2);
+      rk2->setDelta(deltaHuber);
+      optimizer.addEdge(e21);
+
+      vpEdges12.push_back(e12);
+      vpEdges21.push_back(e21);
+      vnIndexEdge.push_back(std::make_pair(Ftype, i));
+    }
   }
 
   // Optimize!
@@ -1060,8 +1117,7 @@ int Optimizer::OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, std::vector<MapPoint
       continue;
 
     if (e12->chi2() > th2 || e21->chi2() > th2) {
-      std::size_t idx = vnIndexEdge[i];
-      vpMatches1[idx] = static_cast<MapPoint *>(NULL);
+      vvpMatches1[vnIndexEdge[i].first][vnIndexEdge[i].second] = static_cast<MapPoint *>(NULL);
       optimizer.removeEdge(e12);
       optimizer.removeEdge(e21);
       vpEdges12[i] = static_cast<g2o::EdgeSim3ProjectXYZ *>(NULL);
@@ -1092,8 +1148,7 @@ int Optimizer::OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, std::vector<MapPoint
       continue;
 
     if (e12->chi2() > th2 || e21->chi2() > th2) {
-      std::size_t idx = vnIndexEdge[i];
-      vpMatches1[idx] = static_cast<MapPoint *>(NULL);
+      vvpMatches1[vnIndexEdge[i].first][vnIndexEdge[i].second] = static_cast<MapPoint *>(NULL);
     } else
       nIn++;
   }
@@ -1109,6 +1164,7 @@ int Optimizer::OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, std::vector<MapPoint
 void Optimizer::OptimizeEssentialGraph(Map *pMap, KeyFrame *pLoopKF, KeyFrame *pCurKF, const LoopClosing::KeyFrameAndPose &NonCorrectedSim3,
                                        const LoopClosing::KeyFrameAndPose &CorrectedSim3, const map<KeyFrame *, set<KeyFrame *>> &LoopConnections,
                                        const bool &bFixScale) {
+  PROFILE_SCOPE("Optimizer::OptimizeEssentialGraph");
   // Setup optimizer
   g2o::SparseOptimizer optimizer;
   optimizer.setVerbose(false);
@@ -65,7 +65,7 @@ using namespace ::std;
 
 namespace ORB_SLAM2 {
 
-PnPsolver::PnPsolver(const Frame &F, const std::vector<MapPoint *> &vpMapPointMatches, const int Ftype)
+PnPsolver::PnPsolver()
     : pws(0), 
       us(0), 
       alphas(0), 
@@ -75,7 +75,25 @@ PnPsolver::PnPsolver(const Frame &F, const std::vector<MapPoint *> &vpMapPointMa
       mnInliersi(0), 
       mnIterations(0),
       mnBestInliers(0), 
-      N(0) {
+      N(0) {}
+
+PnPsolver::PnPsolver(const Frame &F, const std::vector<MapPoint *> &vpMapPointMatches, const int Ftype) : PnPsolver() {
+  Setup(F, vpMapPointMatches, Ftype);
+}
+
+void PnPsolver::Setup(const Frame &F, const std::vector<MapPoint *> &vpMapPointMatches, const int Ftype) {
+  // Buffers keep their capacity, a reused solver does not allocate for a similar problem
+  mvP2D.clear();
+  mvSigma2.clear();
+  mvP3Dw.clear();
+  mvKeyPointIndices.clear();
+  mvAllIndices.clear();
+  mnInliersi = 0;
+  mnIterations = 0;
+  mnBestInliers = 0;
+  mBestTcw.release();
+  mRefinedTcw.release();
+
   mvpMapPointMatches = vpMapPointMatches;
   mvP2D.reserve(F.Channels[Ftype].mvpMapPoints.size());
   mvSigma2.reserve(F.Channels[Ftype].mvpMapPoints.size());
@@ -89,13 +107,14 @@ PnPsolver::PnPsolver(const Frame &F, const std::vector<MapPoint *> &vpMapPointMa
 
     if (pMP) {
       if (!pMP->isBad()) {
-        const cv::KeyPoint &kp = F.Channels[Ftype].mvKeysUn[i];
+        const cv::KeyPoint &kp = F.Channels[Ftype].mpFeatures->mvKeysUn[i];
 
         mvP2D.push_back(kp.pt);
         mvSigma2.push_back(F.mvLevelSigma2[kp.octave]);
 
-        cv::Mat Pos = pMP->GetWorldPos();
-        mvP3Dw.push_back(cv::Point3f(Pos.at<float>(0), Pos.at<float>(1), Pos.at<float>(2)));
+        MapPointState state;
+        pMP->GetState(state);
+        mvP3Dw.push_back(cv::Point3f(state.mWorldPos[0], state.mWorldPos[1], state.mWorldPos[2]));
 
         mvKeyPointIndices.push_back(i);
         mvAllIndices.push_back(idx);
@@ -0,0 +1,215 @@
+#include "Profiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using namespace ::std;
+
+namespace ORB_SLAM2 {
+
+namespace {
+
+struct Event {
+  const char *label;
+  int arg;
+  int64_t tStart;
+  int64_t tEnd;
+};
+
+// Events kept per thread (power of two)
+const uint64_t kCapacity = 1 << 16;
+
+struct ThreadBuffer {
+  explicit ThreadBuffer(int tid) : mnTid(tid), mvEvents(kCapacity), mnHead(0), mnBase(0) {}
+
+  int mnTid;
+  string mName;
+  vector<Event> mvEvents;
+  // Total number of events written, only the owning thread stores to it
+  atomic<uint64_t> mnHead;
+  // Events before this count were discarded by Reset
+  atomic<uint64_t> mnBase;
+};
+
+// Buffers are never freed, so events of finished threads stay exportable
+struct Registry {
+  Registry() : mtEpoch(Profiler::Clock::now()) {}
+
+  mutex mMutex;
+  vector<unique_ptr<ThreadBuffer>> mvBuffers;
+  const Profiler::Clock::time_point mtEpoch;
+};
+
+Registry &GetRegistry() {
+  static Registry registry;
+  return registry;
+}
+
+thread_local ThreadBuffer *tlBuffer = nullptr;
+
+ThreadBuffer *LocalBuffer() {
+  if (!tlBuffer) {
+    Registry &r = GetRegistry();
+    unique_lock<mutex> lock(r.mMutex);
+    r.mvBuffers.emplace_back(new ThreadBuffer(r.mvBuffers.size()));
+    tlBuffer = r.mvBuffers.back().get();
+  }
+  return tlBuffer;
+}
+
+// Events recorded since the last Reset that were overwritten
+uint64_t Dropped(const ThreadBuffer &b) {
+  // Base first, it never passes a head loaded after it
+  const uint64_t base = b.mnBase.load(memory_order_acquire);
+  const uint64_t head = b.mnHead.load(memory_order_acquire);
+  return head - base > kCapacity ? head - base - kCapacity : 0;
+}
+
+// Oldest to newest events still held by a buffer
+vector<Event> Snapshot(const ThreadBuffer &b) {
+  const uint64_t base = b.mnBase.load(memory_order_acquire);
+  const uint64_t head = b.mnHead.load(memory_order_acquire);
+  const uint64_t n = min(head - base, kCapacity);
+  vector<Event> vEvents;
+  vEvents.reserve(n);
+  for (uint64_t i = head - n; i < head; i++)
+    vEvents.push_back(b.mvEvents[i & (kCapacity - 1)]);
+  return vEvents;
+}
+
+string StageName(const Event &e) {
+  if (e.arg < 0)
+    return e.label;
+  return string(e.label) + "[" + to_string(e.arg) + "]";
+}
+
+// JSON string contents
+string Escape(const string &s) {
+  string out;
+  out.reserve(s.size());
+  for (char c : s) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if ((unsigned char)c < 0x20) {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", (unsigned char)c);
+      out += buf;
+    } else {
+      out += c;
+    }
+  }
+  return out;
+}
+
+} // namespace
+
+int64_t Profiler::Now() {
+  return chrono::duration_cast<chrono::nanoseconds>(Clock::now() - GetRegistry().mtEpoch).count();
+}
+
+void Profiler::Record(const char *label, int arg, int64_t tStart, int64_t tEnd) {
+  ThreadBuffer *b = LocalBuffer();
+  const uint64_t head = b->mnHead.load(memory_order_relaxed);
+  b->mvEvents[head & (kCapacity - 1)] = Event{label, arg, tStart, tEnd};
+  b->mnHead.store(head + 1, memory_order_release);
+}
+
+void Profiler::SetThreadName(const string &name) {
+  ThreadBuffer *b = LocalBuffer();
+  unique_lock<mutex> lock(GetRegistry().mMutex);
+  b->mName = name;
+}
+
+bool Profiler::WriteChromeTrace(const string &filename) {
+  ofstream f(filename);
+  if (!f.is_open()) {
+    cerr << "[Profiler] Could not open " << filename << endl;
+    return false;
+  }
+
+  Registry &r = GetRegistry();
+  unique_lock<mutex> lock(r.mMutex);
+
+  f << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  bool bFirst = true;
+  f << fixed << setprecision(3);
+  for (const unique_ptr<ThreadBuffer> &pb : r.mvBuffers) {
+    if (!pb->mName.empty()) {
+      f << (bFirst ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << pb->mnTid
+        << ",\"args\":{\"name\":\"" << Escape(pb->mName) << "\"}}";
+      bFirst = false;
+    }
+
+    for (const Event &e : Snapshot(*pb)) {
+      // Complete events, timestamps in microseconds
+      f << (bFirst ? "" : ",") << "\n{\"name\":\"" << Escape(e.label) << "\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+        << pb->mnTid << ",\"ts\":" << e.tStart * 1e-3 << ",\"dur\":" << (e.tEnd - e.tStart) * 1e-3;
+      if (e.arg >= 0)
+        f << ",\"args\":{\"arg\":" << e.arg << "}";
+      f << "}";
+      bFirst = false;
+    }
+  }
+  f << "\n]}" << endl;
+
+  return f.good();
+}
+
+void Profiler::PrintSummary(ostream &os) {
+  map<string, vector<double>> mDurations;
+  uint64_t nDropped = 0;
+  {
+    Registry &r = GetRegistry();
+    unique_lock<mutex> lock(r.mMutex);
+    for (const unique_ptr<ThreadBuffer> &pb : r.mvBuffers) {
+      nDropped += Dropped(*pb);
+      for (const Event &e : Snapshot(*pb))
+        mDurations[StageName(e)].push_back((e.tEnd - e.tStart) * 1e-6);
+    }
+  }
+
+  if (mDurations.empty())
+    return;
+
+  // Nearest rank percentile of a sorted sample
+  auto percentile = [](const vector<double> &v, double p) {
+    const size_t idx = min(v.size() - 1, (size_t)(p * v.size()));
+    return v[idx];
+  };
+
+  os << endl << "Stage latencies [ms]:" << endl;
+  os << left << setw(40) << "stage" << right << setw(9) << "calls" << setw(10) << "mean" << setw(10) << "p50"
+     << setw(10) << "p90" << setw(10) << "p99" << setw(10) << "max" << endl;
+  for (auto &it : mDurations) {
+    vector<double> &v = it.second;
+    sort(v.begin(), v.end());
+    double total = 0;
+    for (double d : v)
+      total += d;
+    os << left << setw(40) << it.first << right << setw(9) << v.size() << fixed << setprecision(3) << setw(10)
+       << total / v.size() << setw(10) << percentile(v, 0.5) << setw(10) << percentile(v, 0.9) << setw(10)
+       << percentile(v, 0.99) << setw(10) << v.back() << endl;
+  }
+  if (nDropped > 0)
+    os << "(" << nDropped << " older events were overwritten and are not included)" << endl;
+}
+
+void Profiler::Reset() {
+  // mnHead belongs to the recording thread, so the events are discarded by
+  // moving the base up to it instead of rewinding it
+  Registry &r = GetRegistry();
+  unique_lock<mutex> lock(r.mMutex);
+  for (const unique_ptr<ThreadBuffer> &pb : r.mvBuffers)
+    pb->mnBase.store(pb->mnHead.load(memory_order_acquire), memory_order_release);
+}
+
+} // namespace ORB_SLAM2
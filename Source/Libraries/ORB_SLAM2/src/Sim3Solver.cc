@@ -34,30 +34,56 @@ using namespace ::std;
 namespace ORB_SLAM2 {
 
 Sim3Solver::Sim3Solver(const int Ftype, KeyFrame *pKF1, KeyFrame *pKF2, const std::vector<MapPoint *> &vpMatched12, const bool bFixScale)
-    : mnIterations(0), mnBestInliers(0), mbFixScale(bFixScale) {
-  mpKF1 = pKF1;
-  mpKF2 = pKF2;
+    : mpKF1(pKF1), mpKF2(pKF2), mN1(0), mnIterations(0), mnBestInliers(0), mbFixScale(bFixScale) {
+  AddMatches(Ftype, vpMatched12);
 
-  std::vector<MapPoint *> vpKeyFrameMP1 = pKF1->GetMapPointMatches(Ftype);
+  mK1 = pKF1->mK;
+  mK2 = pKF2->mK;
+
+  FromCameraToImage(mvX3Dc1, mvP1im1, mK1);
+  FromCameraToImage(mvX3Dc2, mvP2im2, mK2);
+
+  SetRansacParameters();
+}
+
+Sim3Solver::Sim3Solver(KeyFrame *pKF1, KeyFrame *pKF2, const std::vector<std::vector<MapPoint *>> &vvpMatched12,
+                       const bool bFixScale)
+    : mpKF1(pKF1), mpKF2(pKF2), mN1(0), mnIterations(0), mnBestInliers(0), mbFixScale(bFixScale) {
+  for (std::size_t Ftype = 0; Ftype < vvpMatched12.size(); Ftype++)
+    AddMatches(Ftype, vvpMatched12[Ftype]);
 
-  mN1 = vpMatched12.size();
+  mK1 = pKF1->mK;
+  mK2 = pKF2->mK;
+
+  FromCameraToImage(mvX3Dc1, mvP1im1, mK1);
+  FromCameraToImage(mvX3Dc2, mvP2im2, mK2);
+
+  SetRansacParameters();
+}
+
+void Sim3Solver::AddMatches(const int Ftype, const std::vector<MapPoint *> &vpMatched12) {
+  std::vector<MapPoint *> vpKeyFrameMP1 = mpKF1->GetMapPointMatches(Ftype);
+
+  const int nOffset = mN1;
+  const int nMatches = vpMatched12.size();
+  mN1 += nMatches;
 
   mvpMapPoints1.reserve(mN1);
   mvpMapPoints2.reserve(mN1);
-  mvpMatches12 = vpMatched12;
+  mvpMatches12.insert(mvpMatches12.end(), vpMatched12.begin(), vpMatched12.end());
   mvnIndices1.reserve(mN1);
   mvX3Dc1.reserve(mN1);
   mvX3Dc2.reserve(mN1);
 
-  cv::Mat Rcw1 = pKF1->GetRotation();
-  cv::Mat tcw1 = pKF1->GetTranslation();
-  cv::Mat Rcw2 = pKF2->GetRotation();
-  cv::Mat tcw2 = pKF2->GetTranslation();
+  cv::Mat Rcw1 = mpKF1->GetRotation();
+  cv::Mat tcw1 = mpKF1->GetTranslation();
+  cv::Mat Rcw2 = mpKF2->GetRotation();
+  cv::Mat tcw2 = mpKF2->GetTranslation();
 
   mvAllIndices.reserve(mN1);
 
-  std::size_t idx = 0;
-  for (int i1 = 0; i1 < mN1; i1++) {
+  std::size_t idx = mvAllIndices.size();
+  for (int i1 = 0; i1 < nMatches; i1++) {
     if (vpMatched12[i1]) {
       MapPoint *pMP1 = vpKeyFrameMP1[i1];
       MapPoint *pMP2 = vpMatched12[i1];
@@ -68,24 +94,24 @@ Sim3Solver::Sim3Solver(const int Ftype, KeyFrame *pKF1, KeyFrame *pKF2, const st
       if (pMP1->isBad() || pMP2->isBad())
         continue;
 
-      int indexKF1 = pMP1->GetIndexInKeyFrame(pKF1);
-      int indexKF2 = pMP2->GetIndexInKeyFrame(pKF2);
+      int indexKF1 = pMP1->GetIndexInKeyFrame(mpKF1);
+      int indexKF2 = pMP2->GetIndexInKeyFrame(mpKF2);
 
       if (indexKF1 < 0 || indexKF2 < 0)
         continue;
 
-      const cv::KeyPoint &kp1 = pKF1->Channels[Ftype].mvKeysUn[indexKF1];
-      const cv::KeyPoint &kp2 = pKF2->Channels[Ftype].mvKeysUn[indexKF2];
+      const cv::KeyPoint &kp1 = mpKF1->Channels[Ftype].mpFeatures->mvKeysUn[indexKF1];
+      const cv::KeyPoint &kp2 = mpKF2->Channels[Ftype].mpFeatures->mvKeysUn[indexKF2];
 
-      const float sigmaSquare1 = pKF1->mvLevelSigma2[kp1.octave];
-      const float sigmaSquare2 = pKF2->mvLevelSigma2[kp2.octave];
+      const float sigmaSquare1 = mpKF1->mvLevelSigma2[kp1.octave];
+      const float sigmaSquare2 = mpKF2->mvLevelSigma2[kp2.octave];
 
       mvnMaxError1.push_back(9.210 * sigmaSquare1);
       mvnMaxError2.push_back(9.210 * sigmaSquare2);
 
       mvpMapPoints1.push_back(pMP1);
       mvpMapPoints2.push_back(pMP2);
-      mvnIndices1.push_back(i1);
+      mvnIndices1.push_back(nOffset + i1);
 
       cv::Mat X3D1w = pMP1->GetWorldPos();
       mvX3Dc1.push_back(Rcw1 * X3D1w + tcw1);
@@ -97,14 +123,6 @@ Sim3Solver::Sim3Solver(const int Ftype, KeyFrame *pKF1, KeyFrame *pKF2, const st
       idx++;
     }
   }
-
-  mK1 = pKF1->mK;
-  mK2 = pKF2->mK;
-
-  FromCameraToImage(mvX3Dc1, mvP1im1, mK1);
-  FromCameraToImage(mvX3Dc2, mvP2im2, mK2);
-
-  SetRansacParameters();
 }
 
 void Sim3Solver::SetRansacParameters(double probability, int minInliers, int maxIterations) {
@@ -20,8 +20,12 @@
 
 #include "System.h"
 #include "Converter.h"
+#include "MapSerializer.h"
+#include "Profiler.h"
+#include <algorithm>
 #include <chrono>
 #include <iomanip>
+#include <map>
 #include <pangolin/pangolin.h>
 #include <thread>
 #include <time.h>
@@ -78,10 +82,21 @@ System::System(const string &strSettingsFile, const eSensor sensor, const bool b
   mpVocabulary.resize(Ntype);
   mpKeyFrameDatabase.resize(Ntype);
 
+  // Channels configured with the same file share one vocabulary instance
+  std::map<std::string, ORBVocabulary *> loadedVocabularies;
+
   cv::FileNode vocNode = fSettings["Vocabularies"];
   for (int i = 0; i < Ntype; i++)
   {
     std::string vocPath = DEFAULT_RESOURCE_BASE + (std::string)vocNode[ExtractorNames[i]];
+
+    if (loadedVocabularies.count(vocPath)) {
+      mpVocabulary[i] = loadedVocabularies[vocPath];
+      cout << endl << ExtractorNames[i] << " shares the already loaded vocabulary " << vocPath << endl;
+      mpKeyFrameDatabase[i] = new KeyFrameDatabase(*mpVocabulary[i]);
+      continue;
+    }
+
     // Load Vocabulary
     cout << endl
          << "Loading Vocabulary : " << vocPath << endl
@@ -97,6 +112,9 @@ System::System(const string &strSettingsFile, const eSensor sensor, const bool b
     if (has_suffix(vocPath, ".txt")) {
       bVocLoad = mpVocabulary[i]->loadFromTextFile(vocPath);
       cout << "Loading " << ExtractorNames[i] << " Vocabulary in txt mode." << endl;
+    } else if (ORBVocabulary::isFlatFile(vocPath)) {
+      bVocLoad = mpVocabulary[i]->loadFromFlatFile(vocPath);
+      cout << "Loading " << ExtractorNames[i] << " Vocabulary in flat (mapped) mode." << endl;
     } else {
       bVocLoad = mpVocabulary[i]->loadFromBinaryFile(vocPath);
       cout << "Loading " << ExtractorNames[i] << " Vocabulary in binary mode." << endl;
@@ -110,12 +128,51 @@ System::System(const string &strSettingsFile, const eSensor sensor, const bool b
     cout << ExtractorNames[i];
     printf(" Vocabulary loaded in %.2fs\n", (double)(clock() - tStart) / CLOCKS_PER_SEC);
     cout << endl;
+    loadedVocabularies[vocPath] = mpVocabulary[i];
+
     // Create KeyFrame Database
     mpKeyFrameDatabase[i] = new KeyFrameDatabase(*mpVocabulary[i]);
   }
     
+  // Create the shared thread pool. ThreadPool.nThreads <= 0 uses the cores left
+  // to Tracking, Local Mapping and Loop Closing, which work on their own threads,
+  // ThreadPool.Cores pins the workers and ThreadPool.Timing reports per-task timings at Shutdown.
+  cv::FileNode poolNode = fSettings["ThreadPool"];
+  int nPoolThreads = poolNode["nThreads"].empty() ? 0 : (int)poolNode["nThreads"];
+  if (nPoolThreads <= 0)
+    nPoolThreads = max(1, (int)thread::hardware_concurrency() - 3);
+  bool bPoolTiming = poolNode["Timing"].empty() ? false : (int)poolNode["Timing"] != 0;
+  std::vector<int> vPoolCores;
+  cv::FileNode coresNode = poolNode["Cores"];
+  for (auto it = coresNode.begin(); it != coresNode.end(); ++it)
+    vPoolCores.push_back((int)*it);
+
+  mpThreadPool = new ThreadPool(nPoolThreads, vPoolCores, bPoolTiming);
+  cout << "Thread pool started with " << mpThreadPool->NumThreads() << " workers" << endl;
+
+  for (ORBVocabulary *pVoc : mpVocabulary)
+    pVoc->SetThreadPool(mpThreadPool);
+
+  // Profiler.TraceFile: where Shutdown writes the Chrome trace of builds with ORB_SLAM2_PROFILING
+  cv::FileNode profilerNode = fSettings["Profiler"];
+  mStrTraceFile = profilerNode["TraceFile"].empty() ? string("ProfilerTrace.json") : (string)profilerNode["TraceFile"];
+  PROFILE_THREAD_NAME("Tracking");
+
   // Create the Map
   mpMap = new Map(Ntype);
+  mpAtlas = new Atlas(mpMap);
+
+  // MapStore.MemoryBudgetMB bounds the keyframe features kept in memory (0, the
+  // default, keeps everything), MapStore.TileSize is the side of the eviction
+  // tiles in map units (meters, or initial median depths for monocular) and
+  // MapStore.PageFile where evicted features are written.
+  cv::FileNode storeNode = fSettings["MapStore"];
+  const double budgetMB = storeNode["MemoryBudgetMB"].empty() ? 0.0 : (double)storeNode["MemoryBudgetMB"];
+  const float tileSize = storeNode["TileSize"].empty() ? 10.f : (float)storeNode["TileSize"];
+  const string strPageFile = storeNode["PageFile"].empty() ? string("keyframes.page") : (string)storeNode["PageFile"];
+  mpMapStore = new MapStore(mpAtlas, strPageFile, budgetMB > 0 ? (size_t)(budgetMB * 1024 * 1024) : 0, tileSize);
+  if (mpMapStore->IsEnabled())
+    cout << "Keyframe features bounded to " << budgetMB << " MB, evicted to " << strPageFile << endl;
 
   // Create Drawers. These are used by the Viewer
   
@@ -150,17 +207,38 @@ System::System(const string &strSettingsFile, const eSensor sensor, const bool b
   // Set pointers between threads
   mpTracker->SetLocalMapper(mpLocalMapper);
   mpTracker->SetLoopClosing(mpLoopCloser);
+  mpTracker->SetThreadPool(mpThreadPool);
+  mpTracker->SetAtlas(mpAtlas);
+  mpTracker->SetMapStore(mpMapStore);
 
   mpLocalMapper->SetTracker(mpTracker);
   mpLocalMapper->SetLoopCloser(mpLoopCloser);
+  mpLocalMapper->SetThreadPool(mpThreadPool);
+  mpLocalMapper->SetMapStore(mpMapStore);
 
   mpLoopCloser->SetTracker(mpTracker);
   mpLoopCloser->SetLocalMapper(mpLocalMapper);
+  mpLoopCloser->SetThreadPool(mpThreadPool);
+  mpLoopCloser->SetAtlas(mpAtlas);
+  mpLoopCloser->SetMapStore(mpMapStore);
 
   tempStop = false;
 
 }
 
+System::~System() {
+  if (!mpLocalMapper->isFinished() || !mpLoopCloser->isFinished())
+    Shutdown();
+
+  // Nothing may submit to the pool once it is gone
+  mpTracker->SetThreadPool(NULL);
+  mpLocalMapper->SetThreadPool(NULL);
+  mpLoopCloser->SetThreadPool(NULL);
+  for (ORBVocabulary *pVoc : mpVocabulary)
+    pVoc->SetThreadPool(NULL);
+  delete mpThreadPool;
+}
+
 cv::Mat System::TrackStereo(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timestamp) {
   if (mSensor != STEREO) {
     cerr << "ERROR: you called TrackStereo but input sensor was not set to "
@@ -204,7 +282,7 @@ cv::Mat System::TrackStereo(const cv::Mat &imLeft, const cv::Mat &imRight, const
   unique_lock<mutex> lock2(mMutexState);
   mTrackingState = mpTracker->mState;
   mTrackedMapPoints = mpTracker->mCurrentFrame.Channels[0].mvpMapPoints; //TO-DO Multi Channels
-  mTrackedKeyPointsUn = mpTracker->mCurrentFrame.Channels[0].mvKeysUn;
+  mTrackedKeyPointsUn = mpTracker->mCurrentFrame.Channels[0].mpFeatures->mvKeysUn;
   return Tcw;
 }
 
@@ -251,7 +329,7 @@ cv::Mat System::TrackRGBD(const cv::Mat &im, const cv::Mat &depthmap, const doub
   unique_lock<mutex> lock2(mMutexState);
   mTrackingState = mpTracker->mState;
   mTrackedMapPoints = mpTracker->mCurrentFrame.Channels[0].mvpMapPoints; //TO-DO Multi-Channels
-  mTrackedKeyPointsUn = mpTracker->mCurrentFrame.Channels[0].mvKeysUn;
+  mTrackedKeyPointsUn = mpTracker->mCurrentFrame.Channels[0].mpFeatures->mvKeysUn;
   return Tcw;
 }
 
@@ -298,7 +376,7 @@ cv::Mat System::TrackMonocular(const cv::Mat &im, const double &timestamp) {
   unique_lock<mutex> lock2(mMutexState);
   mTrackingState = mpTracker->mState;
   mTrackedMapPoints = mpTracker->mCurrentFrame.Channels[0].mvpMapPoints; //TO-DO Multi Channels
-  mTrackedKeyPointsUn = mpTracker->mCurrentFrame.Channels[0].mvKeysUn;
+  mTrackedKeyPointsUn = mpTracker->mCurrentFrame.Channels[0].mpFeatures->mvKeysUn;
 
   // if (mpTracker->mCurrentFrame.mnId == (mpTracker->mInitlizedID + 20)) {
   //   tempStop = true;
@@ -348,6 +426,18 @@ void System::Shutdown() {
     this_thread::sleep_for(chrono::milliseconds(1));
   }
 
+  if (mpThreadPool->TimingEnabled())
+    mpThreadPool->PrintTimings(cout);
+
+  if (mpMapStore->IsEnabled())
+    mpMapStore->PrintStats(cout);
+
+#ifdef ORB_SLAM2_PROFILING
+  Profiler::PrintSummary(cout);
+  if (Profiler::WriteChromeTrace(mStrTraceFile))
+    cout << "Profiler trace saved to " << mStrTraceFile << endl;
+#endif
+
   if (mpViewer)
     pangolin::BindToContext("ORB-SLAM2: Map Viewer");
 }
@@ -360,17 +450,62 @@ void System::SaveTrajectoryTUM(const string &filename) {
   //     endl; return;
   // }
 
+  vector<double> vTimestamps;
+  vector<cv::Mat> vTwc;
+  GetCameraTrajectory(vTimestamps, vTwc);
+
+  ofstream f;
+  f.open(filename.c_str());
+  f << fixed;
+
+  for (size_t i = 0; i < vTwc.size(); i++) {
+    cv::Mat Rwc = vTwc[i].rowRange(0, 3).colRange(0, 3);
+    cv::Mat twc = vTwc[i].rowRange(0, 3).col(3);
+
+    vector<float> q = Converter::toQuaternion(Rwc);
+
+    f << setprecision(6) << vTimestamps[i] << " " << setprecision(9) << twc.at<float>(0)
+      << " " << twc.at<float>(1) << " " << twc.at<float>(2) << " " << q[0]
+      << " " << q[1] << " " << q[2] << " " << q[3] << endl;
+  }
+  f.close();
+  cout << endl << "trajectory saved!" << endl;
+}
+
+bool System::SaveMap(const string &filename) {
+  cout << endl << "Saving map to " << filename << " ..." << endl;
+  if (mpAtlas->CountMaps() > 1)
+    cout << "Only the active map is saved, " << mpAtlas->CountMaps() - 1 << " archived maps are not" << endl;
+  return MapSerializer::Save(filename, mpMap, mpKeyFrameDatabase, mpMapStore, mpThreadPool);
+}
+
+bool System::LoadMap(const string &filename) {
+  cout << endl << "Loading map from " << filename << " ..." << endl;
+  if (mpMap->KeyFramesInMap() > 0) {
+    cerr << "LoadMap must be called before the first frame" << endl;
+    return false;
+  }
+
+  if (!MapSerializer::Load(filename, mpMap, mpKeyFrameDatabase, mpVocabulary, mpThreadPool))
+    return false;
+
+  mpTracker->InformMapLoaded();
+  return true;
+}
+
+void System::GetCameraTrajectory(vector<double> &vTimestamps, vector<cv::Mat> &vTwc) {
+  vTimestamps.clear();
+  vTwc.clear();
+
   vector<KeyFrame *> vpKFs = mpMap->GetAllKeyFrames();
+  if (vpKFs.empty())
+    return;
   sort(vpKFs.begin(), vpKFs.end(), KeyFrame::lId);
 
   // Transform all keyframes so that the first keyframe is at the origin.
   // After a loop closure the first keyframe might not be at the origin.
   cv::Mat Two = vpKFs[0]->GetPoseInverse();
 
-  ofstream f;
-  f.open(filename.c_str());
-  f << fixed;
-
   // Frame pose is stored relative to its reference keyframe (which is optimized
   // by BA and pose graph). We need to get first the keyframe pose and then
   // concatenate the relative transformation. Frames not localized (tracking
@@ -401,14 +536,27 @@ void System::SaveTrajectoryTUM(const string &filename) {
     cv::Mat Rwc = Tcw.rowRange(0, 3).colRange(0, 3).t();
     cv::Mat twc = -Rwc * Tcw.rowRange(0, 3).col(3);
 
-    vector<float> q = Converter::toQuaternion(Rwc);
+    cv::Mat Twc = cv::Mat::eye(4, 4, CV_32F);
+    Rwc.copyTo(Twc.rowRange(0, 3).colRange(0, 3));
+    twc.copyTo(Twc.rowRange(0, 3).col(3));
 
-    f << setprecision(6) << *lT << " " << setprecision(9) << twc.at<float>(0)
-      << " " << twc.at<float>(1) << " " << twc.at<float>(2) << " " << q[0]
-      << " " << q[1] << " " << q[2] << " " << q[3] << endl;
+    vTimestamps.push_back(*lT);
+    vTwc.push_back(Twc);
   }
-  f.close();
-  cout << endl << "trajectory saved!" << endl;
+}
+
+long unsigned int System::KeyFramesInMap() {
+  return mpMap->KeyFramesInMap();
+}
+
+long unsigned int System::MapPointsInMap() {
+  return mpMap->MapPointsInMap();
+}
+
+void System::WaitForLocalMapping() {
+  while ((mpLocalMapper->KeyframesInQueue() > 0 || !mpLocalMapper->AcceptKeyFrames()) &&
+         !mpLocalMapper->isStopped() && !mpLocalMapper->isFinished())
+    this_thread::sleep_for(chrono::microseconds(500));
 }
 
 void System::SaveKeyFrameTrajectoryTUM(const string &filename) {
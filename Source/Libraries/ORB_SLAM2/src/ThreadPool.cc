@@ -0,0 +1,300 @@
+#include "ThreadPool.h"
+#include "Profiler.h"
+
+#include <iomanip>
+#include <iostream>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using namespace ::std;
+
+namespace ORB_SLAM2 {
+
+namespace {
+// Index of the worker owning the current thread, -1 outside the pool
+thread_local int tlWorkerIdx = -1;
+thread_local const ThreadPool *tlOwner = nullptr;
+} // namespace
+
+ThreadPool::ThreadPool(int nThreads, const vector<int> &vCores, bool bTiming)
+    : mnQueued(0), mnNextQueue(0), mbFinish(false), mbTiming(bTiming) {
+  if (nThreads <= 0)
+    nThreads = max(1u, thread::hardware_concurrency());
+
+  mvQueues.reserve(nThreads);
+  for (int i = 0; i < nThreads; i++)
+    mvQueues.emplace_back(new WorkQueue());
+
+  mvThreads.reserve(nThreads);
+  for (int i = 0; i < nThreads; i++) {
+    mvThreads.emplace_back(&ThreadPool::WorkerLoop, this, i);
+    if (!vCores.empty())
+      PinThread(mvThreads.back(), vCores[i % vCores.size()]);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    unique_lock<mutex> lock(mMutexWake);
+    mbFinish = true;
+  }
+  mCondWake.notify_all();
+
+  for (thread &t : mvThreads)
+    t.join();
+}
+
+void ThreadPool::PinThread(thread &t, int core) {
+#ifdef __linux__
+  cpu_set_t cpuset;
+  CPU_ZERO(&cpuset);
+  CPU_SET(core, &cpuset);
+  if (pthread_setaffinity_np(t.native_handle(), sizeof(cpu_set_t), &cpuset) != 0)
+    cerr << "[ThreadPool] Could not pin worker to core " << core << endl;
+#else
+  (void)t;
+  (void)core;
+#endif
+}
+
+void ThreadPool::Submit(function<void()> task, const char *label, TaskGroup *pGroup) {
+  Task t{move(task), label, pGroup, mbTiming ? Clock::now() : Clock::time_point()};
+
+  // Workers keep their own children local, outside threads spread round robin
+  size_t q;
+  if (tlOwner == this && tlWorkerIdx >= 0)
+    q = tlWorkerIdx;
+  else
+    q = mnNextQueue.fetch_add(1, memory_order_relaxed) % mvQueues.size();
+
+  {
+    unique_lock<mutex> lock(mvQueues[q]->mMutex);
+    if (pGroup)
+      pGroup->mnQueued.fetch_add(1);
+    mvQueues[q]->mdTasks.push_back(move(t));
+  }
+  mnQueued.fetch_add(1, memory_order_release);
+
+  // Taking the lock orders this notify after a worker's predicate check
+  { unique_lock<mutex> lock(mMutexWake); }
+  mCondWake.notify_one();
+}
+
+bool ThreadPool::PopTask(int idx, Task &task) {
+  const int n = mvQueues.size();
+
+  // Own queue first, newest task (LIFO keeps the working set hot)
+  if (idx >= 0) {
+    WorkQueue &q = *mvQueues[idx];
+    unique_lock<mutex> lock(q.mMutex);
+    if (!q.mdTasks.empty()) {
+      task = move(q.mdTasks.back());
+      q.mdTasks.pop_back();
+      if (task.pGroup)
+        task.pGroup->mnQueued.fetch_sub(1);
+      return true;
+    }
+  }
+
+  // Steal the oldest task of another queue
+  const int start = idx >= 0 ? idx + 1 : 0;
+  for (int k = 0; k < n; k++) {
+    WorkQueue &q = *mvQueues[(start + k) % n];
+    unique_lock<mutex> lock(q.mMutex, try_to_lock);
+    if (!lock.owns_lock() || q.mdTasks.empty())
+      continue;
+    task = move(q.mdTasks.front());
+    q.mdTasks.pop_front();
+    if (task.pGroup)
+      task.pGroup->mnQueued.fetch_sub(1);
+    return true;
+  }
+
+  return false;
+}
+
+bool ThreadPool::PopGroupTask(int idx, const TaskGroup *pGroup, Task &task) {
+  const int n = mvQueues.size();
+  const int start = idx >= 0 ? idx : 0;
+
+  // Same order as PopTask: newest of the own queue, then oldest of the others
+  for (int k = 0; k < n; k++) {
+    WorkQueue &q = *mvQueues[(start + k) % n];
+    unique_lock<mutex> lock(q.mMutex);
+    if (k == 0 && idx >= 0) {
+      for (auto it = q.mdTasks.rbegin(); it != q.mdTasks.rend(); ++it)
+        if (it->pGroup == pGroup) {
+          task = move(*it);
+          q.mdTasks.erase(next(it).base());
+          task.pGroup->mnQueued.fetch_sub(1);
+          return true;
+        }
+    } else {
+      for (auto it = q.mdTasks.begin(); it != q.mdTasks.end(); ++it)
+        if (it->pGroup == pGroup) {
+          task = move(*it);
+          q.mdTasks.erase(it);
+          task.pGroup->mnQueued.fetch_sub(1);
+          return true;
+        }
+    }
+  }
+
+  return false;
+}
+
+void ThreadPool::Execute(Task &task) {
+  mnQueued.fetch_sub(1, memory_order_acq_rel);
+
+  const Clock::time_point tStart = mbTiming ? Clock::now() : Clock::time_point();
+
+  // Exceptions of group tasks are handed to the group, Wait rethrows them
+  exception_ptr exception;
+  try {
+    task.func();
+  } catch (...) {
+    if (!task.pGroup)
+      throw;
+    exception = current_exception();
+  }
+  task.func = nullptr;
+
+  if (mbTiming) {
+    const Clock::time_point tEnd = Clock::now();
+    const double runMs = chrono::duration<double, milli>(tEnd - tStart).count();
+    const double queueMs = chrono::duration<double, milli>(tStart - task.tSubmit).count();
+
+    unique_lock<mutex> lock(mMutexStats);
+    TaskStats &s = mStats[task.label ? task.label : "unnamed"];
+    s.nCalls++;
+    s.totalRunMs += runMs;
+    s.totalQueueMs += queueMs;
+    s.maxRunMs = max(s.maxRunMs, runMs);
+  }
+
+  // Last access to the group, its owner may return from Wait right after
+  if (task.pGroup)
+    task.pGroup->Finish(exception);
+}
+
+bool ThreadPool::RunPendingTask(const TaskGroup *pGroup) {
+  if (pGroup->mnQueued.load() <= 0)
+    return false;
+
+  Task task;
+  if (!PopGroupTask(tlOwner == this ? tlWorkerIdx : -1, pGroup, task))
+    return false;
+
+  Execute(task);
+  return true;
+}
+
+void ThreadPool::WorkerLoop(int idx) {
+  tlWorkerIdx = idx;
+  tlOwner = this;
+  PROFILE_THREAD_NAME("ThreadPool worker " + to_string(idx));
+
+  while (true) {
+    Task task;
+    if (PopTask(idx, task)) {
+      Execute(task);
+      continue;
+    }
+
+    unique_lock<mutex> lock(mMutexWake);
+    mCondWake.wait(lock, [this] { return mbFinish || mnQueued.load(memory_order_acquire) > 0; });
+    if (mbFinish && mnQueued.load() <= 0)
+      break;
+  }
+}
+
+void ThreadPool::PrintTimings(ostream &os) const {
+  unique_lock<mutex> lock(mMutexStats);
+  if (mStats.empty())
+    return;
+
+  os << endl << "Thread pool (" << mvThreads.size() << " workers) task timings [ms]:" << endl;
+  os << left << setw(28) << "task" << right << setw(10) << "calls" << setw(12) << "mean" << setw(12) << "max"
+     << setw(14) << "mean queue" << endl;
+  for (const auto &it : mStats) {
+    const TaskStats &s = it.second;
+    os << left << setw(28) << it.first << right << setw(10) << s.nCalls << fixed << setprecision(3) << setw(12)
+       << s.totalRunMs / s.nCalls << setw(12) << s.maxRunMs << setw(14) << s.totalQueueMs / s.nCalls << endl;
+  }
+}
+
+void ThreadPool::ResetTimings() {
+  unique_lock<mutex> lock(mMutexStats);
+  mStats.clear();
+}
+
+TaskGroup::TaskGroup(ThreadPool *pPool)
+    : mpPool(pPool), mnUncaught(uncaught_exceptions()), mnPending(0), mnQueued(0), mbWaiting(false) {}
+
+TaskGroup::~TaskGroup() noexcept(false) {
+  Join();
+  if (mException && uncaught_exceptions() == mnUncaught)
+    rethrow_exception(mException);
+}
+
+void TaskGroup::Run(function<void()> task, const char *label) {
+  if (!mpPool) {
+    task();
+    return;
+  }
+
+  // Passed on as is, small captures stay in the inline storage of the function
+  mnPending.fetch_add(1);
+  mpPool->Submit(move(task), label, this);
+
+  // A task of the group queued more work while the owner blocks in Wait
+  if (mbWaiting.load()) {
+    unique_lock<mutex> lock(mMutex);
+    mCond.notify_all();
+  }
+}
+
+void TaskGroup::Finish(exception_ptr exception) {
+  unique_lock<mutex> lock(mMutex);
+  if (exception && !mException)
+    mException = exception;
+  mnPending.fetch_sub(1);
+  mCond.notify_all();
+}
+
+void TaskGroup::Join() {
+  if (!mpPool)
+    return;
+
+  while (mnPending.load() > 0) {
+    if (mpPool->RunPendingTask(this))
+      continue;
+
+    // The remaining tasks run on other threads
+    unique_lock<mutex> lock(mMutex);
+    mbWaiting.store(true);
+    mCond.wait(lock, [this] { return mnPending.load() == 0 || mnQueued.load() > 0; });
+    mbWaiting.store(false);
+  }
+
+  // Finish notifies with the mutex held, taking it orders the return (and
+  // the destruction of the group) after the last one
+  unique_lock<mutex> lock(mMutex);
+}
+
+void TaskGroup::Wait() {
+  Join();
+
+  exception_ptr exception;
+  {
+    unique_lock<mutex> lock(mMutex);
+    swap(exception, mException);
+  }
+  if (exception)
+    rethrow_exception(exception);
+}
+
+} // namespace ORB_SLAM2
@@ -32,7 +32,9 @@
 #include "FeatureExtractorFactory.h"
 #include "Optimizer.h"
 #include "PnPsolver.h"
+#include "Profiler.h"
 
+#include <algorithm>
 #include <chrono>
 #include <iostream>
 #include <mutex>
@@ -53,11 +55,17 @@ Tracking::Tracking(System *pSys, std::vector<ORBVocabulary *> pVoc, std::vector<
       mbOnlyTracking(false),
       mbVO(false),
       mpSystem(pSys),
+      mpThreadPool(NULL),
       mpViewer(NULL),
       mpInitializer(static_cast<Initializer *>(NULL)), 
       mpFrameDrawer(pFrameDrawer), 
       mpMapDrawer(pMapDrawer),
       mpMap(pMap), 
+      mpAtlas(NULL),
+      mnLostFrames(0),
+      mbNewMapRequested(false),
+      mpMapStore(NULL),
+      mbEvictionPending(false),
       mnLastRelocFrameId(0),
       mpVocabulary(pVoc),
       mpKeyFrameDB(pKFDB),
@@ -112,6 +120,10 @@ Tracking::Tracking(System *pSys, std::vector<ORBVocabulary *> pVoc, std::vector<
   mMinFrames = 0;
   mMaxFrames = fps;
 
+  // Frames lost before the map is archived and a new one is started
+  int nLostFrames = fSettings["Atlas.LostFramesForNewMap"];
+  mnLostFramesForNewMap = nLostFrames > 0 ? nLostFrames : 30;
+
   // Initial pose is identity
   mLastPose = cv::Mat::eye(4, 4, CV_32F);
 
@@ -220,8 +232,27 @@ void Tracking::SetLoopClosing(LoopClosing *pLoopClosing) {
 
 void Tracking::SetViewer(Viewer *pViewer) { mpViewer = pViewer; }
 
+void Tracking::SetAtlas(Atlas *pAtlas) { mpAtlas = pAtlas; }
+
+void Tracking::SetMapStore(MapStore *pMapStore) { mpMapStore = pMapStore; }
+
+void Tracking::SetThreadPool(ThreadPool *pThreadPool) {
+  mpThreadPool = pThreadPool;
+  Frame::mpThreadPool = pThreadPool;
+
+  for (int Ftype = 0; Ftype < Ntype; Ftype++) {
+    if (mpFeatureExtractorLeft[Ftype])
+      mpFeatureExtractorLeft[Ftype]->SetThreadPool(pThreadPool);
+    if (mpFeatureExtractorRight[Ftype])
+      mpFeatureExtractorRight[Ftype]->SetThreadPool(pThreadPool);
+    if (mpIniFeatureExtractor[Ftype])
+      mpIniFeatureExtractor[Ftype]->SetThreadPool(pThreadPool);
+  }
+}
+
 // Stereo
 cv::Mat Tracking::GrabImageStereo(const cv::Mat &imRectLeft, const cv::Mat &imRectRight, const double &timestamp) {
+  PROFILE_SCOPE("Tracking::GrabImage");
   mImGray = imRectLeft;
   cv::Mat imGrayRight = imRectRight;
 
@@ -253,11 +284,12 @@ cv::Mat Tracking::GrabImageStereo(const cv::Mat &imRectLeft, const cv::Mat &imRe
 
   Track();
 
-  return mCurrentFrame.mTcw.clone();
+  return mCurrentFrame.GetPose().clone();
 }
 
 // RGBD
 cv::Mat Tracking::GrabImageRGBD(const cv::Mat &imRGB, const cv::Mat &imD, const double &timestamp) {
+  PROFILE_SCOPE("Tracking::GrabImage");
   mImGray = imRGB;
   cv::Mat imDepth = imD;
 
@@ -285,11 +317,12 @@ cv::Mat Tracking::GrabImageRGBD(const cv::Mat &imRGB, const cv::Mat &imD, const
 
   Track();
 
-  return mCurrentFrame.mTcw.clone();
+  return mCurrentFrame.GetPose().clone();
 }
 
 // MONO
 cv::Mat Tracking::GrabImageMonocular(const cv::Mat &im, const double &timestamp) {
+  PROFILE_SCOPE("Tracking::GrabImage");
   mImGray = im;
 
   if (mImGray.channels() == 3) {
@@ -315,10 +348,11 @@ cv::Mat Tracking::GrabImageMonocular(const cv::Mat &im, const double &timestamp)
 
   Track();
 
-  return mCurrentFrame.mTcw.clone();
+  return mCurrentFrame.GetPose().clone();
 }
 
 void Tracking::Track() {
+  PROFILE_SCOPE("Tracking::Track");
   if (mState == NO_IMAGES_YET) {
     mState = NOT_INITIALIZED;
   }
@@ -326,6 +360,40 @@ void Tracking::Track() {
   if (mState == LOST) 
     cout << "The lost frame ID: " << mCurrentFrame.mnId << endl;
 
+  // Lost for too long, keep the map for a later merge and start a new one.
+  // Lost right after initializing a map while others are archived, discard
+  // it, it is too small to be merged back. Loop Closing empties the active
+  // map between two loop corrections.
+  if (mState == LOST && !mbOnlyTracking && !mbNewMapRequested) {
+    const bool bDiscard = mpMap->KeyFramesInMap() <= 5;
+    if (bDiscard || mnLostFrames >= mnLostFramesForNewMap) {
+      cout << "Track lost for " << mnLostFrames << " frames, starting a new map" << endl;
+      mpLoopClosing->RequestNewMap(bDiscard);
+      mbNewMapRequested = true;
+    }
+  }
+  if (mbNewMapRequested) {
+    if (mpLoopClosing->isNewMapRequested()) {
+      // Keep one trajectory entry per frame, as for any lost frame
+      if (!mlRelativeFramePoses.empty()) {
+        mlRelativeFramePoses.push_back(mlRelativeFramePoses.back());
+        mlpReferences.push_back(mlpReferences.back());
+        mlFrameTimes.push_back(mlFrameTimes.back());
+        mlbLost.push_back(true);
+      }
+      return;
+    }
+    StartNewMap();
+  }
+
+  // Evict the tiles far from the last keyframe, retried on the next frames
+  // while LocalMapping or LoopClosing read keyframe features
+  if (mbEvictionPending && mpMapStore->Evict(mpLastKeyFrame->GetCameraCenter()))
+    mbEvictionPending = false;
+
+  // Keep the MapStore from evicting the features being matched
+  shared_lock<shared_mutex> residency = mpMapStore->ReadGuard();
+
   mLastProcessedState = mState;
 
   // Get Map Mutex -> Map cannot be changed
@@ -388,22 +456,12 @@ void Tracking::Track() {
           }
         }
       } else {
-        for (int Ftype = 0; Ftype < Ntype; Ftype++) {
-          bOK = Relocalization(Ftype);
-          if (bOK == true) {
-            break;
-          }
-        }
+        bOK = Relocalization();
       }
     } else {
       // Localization Mode: Local Mapping is deactivated
       if (mState == LOST) {
-        for (int Ftype = 0; Ftype < Ntype; Ftype++) {
-          bOK = Relocalization(Ftype);
-          if (bOK == true) {
-            break;
-          }
-        }
+        bOK = Relocalization();
       } else {
         if (!mbVO) {
           // In last frame we tracked enough MapPoints in the map
@@ -430,15 +488,10 @@ void Tracking::Track() {
               vpMPsMM[Ftype] = mCurrentFrame.Channels[Ftype].mvpMapPoints;
               vbOutMM[Ftype] = mCurrentFrame.Channels[Ftype].mvbOutlier;
             }
-            TcwMM = mCurrentFrame.mTcw.clone();
+            TcwMM = mCurrentFrame.GetPose().clone();
           }
 
-          for (int Ftype = 0; Ftype < Ntype; Ftype++) {
-            bOKReloc = Relocalization(Ftype);
-            if (bOKReloc == true) {
-              break;
-            }
-          }
+          bOKReloc = Relocalization();
             
           if (bOKMM && !bOKReloc) {
             mCurrentFrame.SetPose(TcwMM);
@@ -500,15 +553,15 @@ void Tracking::Track() {
     // If tracking were good, check if we insert a keyframe
     if (bOK) {
       // Update motion model
-      if (!mLastFrame.mTcw.empty()) {
+      if (!mLastFrame.GetPose().empty()) {
         cv::Mat LastTwc = cv::Mat::eye(4, 4, CV_32F);
         mLastFrame.GetRotationInverse().copyTo(LastTwc.rowRange(0, 3).colRange(0, 3));
         mLastFrame.GetCameraCenter().copyTo(LastTwc.rowRange(0, 3).col(3));
-        mVelocity = mCurrentFrame.mTcw * LastTwc;
+        mVelocity = mCurrentFrame.GetPose() * LastTwc;
       } else
         mVelocity = cv::Mat();
 
-      mpMapDrawer->SetCurrentCameraPose(mCurrentFrame.mTcw);
+      mpMapDrawer->SetCurrentCameraPose(mCurrentFrame.GetPose());
 
       // Clean VO matches
       for (int Ftype = 0; Ftype < Ntype; Ftype++) {
@@ -545,19 +598,19 @@ void Tracking::Track() {
         }
       }
 
-      mLastPose = mCurrentFrame.mTcw.clone();
+      mLastPose = mCurrentFrame.GetPose().clone();
     }
 
-    // Reset if the camera get lost soon after initialization
+    // Reset if the camera get lost soon after initialization of the only map
     if (mState == LOST) {
-      if (mpMap->KeyFramesInMap() <= 5) {
+      if (mpMap->KeyFramesInMap() <= 5 && mpAtlas->CountMaps() == 1) {
         cout << "Track lost soon after initialisation, reseting..." << endl;
         mpSystem->Reset();
         return;
       }
-      // Uncomment this if reseting is needed on the fly
-      // cout << "Track lost, reseting..." << endl;
-      // mpSystem->Reset();
+      mnLostFrames++;
+    } else {
+      mnLostFrames = 0;
     }
 
     if (!mCurrentFrame.mpReferenceKF)
@@ -567,14 +620,15 @@ void Tracking::Track() {
   }
 
   // Store frame pose information to retrieve the complete camera trajectory afterwards.
-  if (!mCurrentFrame.mTcw.empty()) {
-    cv::Mat Tcr = mCurrentFrame.mTcw * mCurrentFrame.mpReferenceKF->GetPoseInverse();
+  if (!mCurrentFrame.GetPose().empty()) {
+    cv::Mat Tcr = mCurrentFrame.GetPose() * mCurrentFrame.mpReferenceKF->GetPoseInverse();
     mlRelativeFramePoses.push_back(Tcr);
     mlpReferences.push_back(mpReferenceKF);
     mlFrameTimes.push_back(mCurrentFrame.mTimeStamp);
     mlbLost.push_back(mState == LOST);
-  } else {
-    // This can happen if tracking is lost
+  } else if (!mlRelativeFramePoses.empty()) {
+    // This can happen if tracking is lost. After a map load nothing was
+    // tracked yet to repeat.
     mlRelativeFramePoses.push_back(mlRelativeFramePoses.back());
     mlpReferences.push_back(mlpReferences.back());
     mlFrameTimes.push_back(mlFrameTimes.back());
@@ -589,7 +643,7 @@ void Tracking::StereoInitialization(const int Ftype) {
 
     int nGood = 0;
     for (int i = 0; i < mCurrentFrame.Channels[Ftype].N; i++) {
-      float z = mCurrentFrame.Channels[Ftype].mvDepth[i];
+      float z = mCurrentFrame.Channels[Ftype].mpFeatures->mvDepth[i];
       if (z > 0) {
         nGood++;
       }
@@ -602,13 +656,14 @@ void Tracking::StereoInitialization(const int Ftype) {
 
     // Create KeyFrame
     KeyFrame *pKFini = new KeyFrame(mCurrentFrame, mpMap, mpKeyFrameDB, Ntype);
+    pKFini->mbOrigin = true;
 
     // Insert KeyFrame in the map
     mpMap->AddKeyFrame(pKFini);
 
     // Create MapPoints and asscoiate to KeyFrame
     for (int i = 0; i < mCurrentFrame.Channels[Ftype].N; i++) {
-      float z = mCurrentFrame.Channels[Ftype].mvDepth[i];
+      float z = mCurrentFrame.Channels[Ftype].mpFeatures->mvDepth[i];
       if (z > 0) {
         cv::Mat x3D = mCurrentFrame.UnprojectStereo(i, Ftype);
         MapPoint *pNewMP = new MapPoint(x3D, pKFini, mpMap, Ftype);
@@ -640,7 +695,7 @@ void Tracking::StereoInitialization(const int Ftype) {
 
     mpMap->mvpKeyFrameOrigins.push_back(pKFini);
 
-    mpMapDrawer->SetCurrentCameraPose(mCurrentFrame.mTcw);
+    mpMapDrawer->SetCurrentCameraPose(mCurrentFrame.GetPose());
 
     mState = OK;
   }
@@ -651,15 +706,15 @@ void Tracking::StereoInitialization(const int Ftype) {
 //   if (!mpInitializer) {
 
 //     // Set Reference Frame
-//     if (mCurrentFrame.Channels[Ftype].mvKeys.size() > 100) {
+//     if (mCurrentFrame.Channels[Ftype].mpFeatures->mvKeys.size() > 100) {
       
 //       mInitialFrame = Frame(mCurrentFrame);
 //       mLastFrame = Frame(mCurrentFrame);
       
-//       mvbPrevMatched[Ftype].resize(mCurrentFrame.Channels[Ftype].mvKeysUn.size());
+//       mvbPrevMatched[Ftype].resize(mCurrentFrame.Channels[Ftype].mpFeatures->mvKeysUn.size());
       
-//       for (size_t i = 0; i < mCurrentFrame.Channels[Ftype].mvKeysUn.size(); i++)
-//         mvbPrevMatched[Ftype][i] = mCurrentFrame.Channels[Ftype].mvKeysUn[i].pt;
+//       for (size_t i = 0; i < mCurrentFrame.Channels[Ftype].mpFeatures->mvKeysUn.size(); i++)
+//         mvbPrevMatched[Ftype][i] = mCurrentFrame.Channels[Ftype].mpFeatures->mvKeysUn[i].pt;
 
 //       if (mpInitializer)
 //         delete mpInitializer;
@@ -672,7 +727,7 @@ void Tracking::StereoInitialization(const int Ftype) {
 //     }
 //   } else {
 //     // Try to initialize
-//     if ((int)mCurrentFrame.Channels[Ftype].mvKeys.size() <= 100) {
+//     if ((int)mCurrentFrame.Channels[Ftype].mpFeatures->mvKeys.size() <= 100) {
 //       delete mpInitializer;
 //       mpInitializer = static_cast<Initializer *>(NULL);
 //       fill(mvIniMatches[Ftype].begin(), mvIniMatches[Ftype].end(), -1);
@@ -841,10 +896,15 @@ void Tracking::Reset() {
 
   // Clear Map (this erase MapPoints and KeyFrames)
   mpMap->clear();
+  mpAtlas->clear();
+  mpMapStore->clear();
+  mbEvictionPending = false;
 
   KeyFrame::nNextId = 0;
   Frame::nNextId = 0;
   mState = NO_IMAGES_YET;
+  mnLostFrames = 0;
+  mbNewMapRequested = false;
 
 
   if (mpInitializer) {
@@ -895,6 +955,40 @@ void Tracking::ChangeCalibration(const string &strSettingPath) {
 
 void Tracking::InformOnlyTracking(const bool &flag) { mbOnlyTracking = flag; }
 
+void Tracking::InformMapLoaded() {
+  vector<KeyFrame *> vpKFs = mpMap->GetAllKeyFrames();
+  if (vpKFs.empty())
+    return;
+
+  for (KeyFrame *pKFi : vpKFs)
+    mpMapStore->AddKeyFrame(pKFi);
+
+  // Relocalization needs the last keyframe as reference, take the newest one
+  KeyFrame *pKF = *max_element(vpKFs.begin(), vpKFs.end(), KeyFrame::lId);
+  mpReferenceKF = pKF;
+  mpLastKeyFrame = pKF;
+  mnLastKeyFrameId = pKF->mnFrameId;
+  mnLastRelocFrameId = 0;
+  mnLostFrames = 0;
+  mbEvictionPending = mpMapStore->IsEnabled();
+  mState = LOST;
+}
+
+void Tracking::StartNewMap() {
+  mbNewMapRequested = false;
+
+  if (mpInitializer) {
+    delete mpInitializer;
+    mpInitializer = static_cast<Initializer *>(NULL);
+  }
+
+  mvpLocalKeyFrames.clear();
+  mvpLocalMapPoints.clear();
+  mVelocity = cv::Mat();
+  mnLostFrames = 0;
+  mState = NOT_INITIALIZED;
+}
+
 //////////////////////////////////Rewrite/////////////////////////////////
 
 void Tracking::StereoInitializationMultiChannels() {
@@ -911,7 +1005,7 @@ void Tracking::StereoInitializationMultiChannels() {
   for (int Ftype = 0; Ftype < Ntype; Ftype++) {
     int nGood = 0;
     for (int i = 0; i < mCurrentFrame.Channels[Ftype].N; i++) {
-      float z = mCurrentFrame.Channels[Ftype].mvDepth[i];
+      float z = mCurrentFrame.Channels[Ftype].mpFeatures->mvDepth[i];
       if (z > 0) {
         nGood++;
       }
@@ -925,6 +1019,7 @@ void Tracking::StereoInitializationMultiChannels() {
 
   // step 4 : Create KeyFrame
   KeyFrame *pKFini = new KeyFrame(mCurrentFrame, mpMap, mpKeyFrameDB, Ntype);
+  pKFini->mbOrigin = true;
 
   // step 5 : Insert KeyFrame in the map
   mpMap->AddKeyFrame(pKFini);
@@ -932,7 +1027,7 @@ void Tracking::StereoInitializationMultiChannels() {
   // step 6 : Create MapPoints and asscoiate to KeyFrame
   for (int Ftype = 0; Ftype < Ntype; Ftype++) {
     for (int i = 0; i < mCurrentFrame.Channels[Ftype].N; i++) {
-      float z = mCurrentFrame.Channels[Ftype].mvDepth[i];
+      float z = mCurrentFrame.Channels[Ftype].mpFeatures->mvDepth[i];
       if (z > 0) {
         cv::Mat x3D = mCurrentFrame.UnprojectStereo(i, Ftype);
         MapPoint *pNewMP = new MapPoint(x3D, pKFini, mpMap, Ftype);
@@ -965,7 +1060,7 @@ void Tracking::StereoInitializationMultiChannels() {
 
   mpMap->mvpKeyFrameOrigins.push_back(pKFini);
 
-  mpMapDrawer->SetCurrentCameraPose(mCurrentFrame.mTcw);
+  mpMapDrawer->SetCurrentCameraPose(mCurrentFrame.GetPose());
 
   mState = OK;
 }
@@ -977,7 +1072,7 @@ void Tracking::MonocularInitializationMultiChannels() {
     // Sum all mappoints
     int nKeysSum = 0;
     for (int Ftype = 0; Ftype < Ntype; Ftype++)
-      nKeysSum += mCurrentFrame.Channels[Ftype].mvKeys.size();
+      nKeysSum += mCurrentFrame.Channels[Ftype].mpFeatures->mvKeys.size();
 
     // Set Reference Frame
     if (nKeysSum > 100) {
@@ -985,11 +1080,11 @@ void Tracking::MonocularInitializationMultiChannels() {
       mLastFrame = Frame(mCurrentFrame);
 
       for (int Ftype = 0; Ftype < Ntype; Ftype++) 
-        mvbPrevMatched[Ftype].resize(mCurrentFrame.Channels[Ftype].mvKeysUn.size());
+        mvbPrevMatched[Ftype].resize(mCurrentFrame.Channels[Ftype].mpFeatures->mvKeysUn.size());
       
       for (int Ftype = 0; Ftype < Ntype; Ftype++)
-        for (size_t i = 0; i < mCurrentFrame.Channels[Ftype].mvKeysUn.size(); i++) 
-          mvbPrevMatched[Ftype][i] = mCurrentFrame.Channels[Ftype].mvKeysUn[i].pt;
+        for (size_t i = 0; i < mCurrentFrame.Channels[Ftype].mpFeatures->mvKeysUn.size(); i++) 
+          mvbPrevMatched[Ftype][i] = mCurrentFrame.Channels[Ftype].mpFeatures->mvKeysUn[i].pt;
   
 
       if (mpInitializer) 
@@ -1006,7 +1101,7 @@ void Tracking::MonocularInitializationMultiChannels() {
     // Sum numbers of keys
     int nKeysSum = 0;
     for (int Ftype = 0; Ftype < Ntype; Ftype++)
-      nKeysSum += mCurrentFrame.Channels[Ftype].mvKeys.size();
+      nKeysSum += mCurrentFrame.Channels[Ftype].mpFeatures->mvKeys.size();
 
     if (nKeysSum <= 100) {
         delete mpInitializer;
@@ -1072,6 +1167,7 @@ void Tracking::CreateInitialMapMonocularMultiChannels() {
   // Create KeyFrames
   KeyFrame *pKFini = new KeyFrame(mInitialFrame, mpMap, mpKeyFrameDB, Ntype);
   KeyFrame *pKFcur = new KeyFrame(mCurrentFrame, mpMap, mpKeyFrameDB, Ntype);
+  pKFini->mbOrigin = true;
 
   for (int Ftype = 0; Ftype < Ntype; Ftype++) {
     pKFini->ComputeBoW(Ftype);
@@ -1202,7 +1298,7 @@ void Tracking::UpdateLastFrame(const int Ftype) {
   vector<pair<float, int>> vDepthIdx;
   vDepthIdx.reserve(mLastFrame.Channels[Ftype].N);
   for (int i = 0; i < mLastFrame.Channels[Ftype].N; i++) {
-    float z = mLastFrame.Channels[Ftype].mvDepth[i];
+    float z = mLastFrame.Channels[Ftype].mpFeatures->mvDepth[i];
     if (z > 0) {
       vDepthIdx.push_back(make_pair(z, i));
     }
@@ -1245,6 +1341,7 @@ void Tracking::UpdateLastFrame(const int Ftype) {
 }
 
 bool Tracking::TrackWithMotionModelMultiChannels() {
+  PROFILE_SCOPE("Tracking::TrackWithMotionModel");
   Associater associater(0.9, true);
 
   // Update last frame pose according to its reference keyframe
@@ -1252,7 +1349,7 @@ bool Tracking::TrackWithMotionModelMultiChannels() {
   for (int Ftype = 0; Ftype < Ntype; Ftype++) 
     UpdateLastFrame(Ftype);
 
-  mCurrentFrame.SetPose(mVelocity * mLastFrame.mTcw);
+  mCurrentFrame.SetPose(mVelocity * mLastFrame.GetPose());
 
   for (int Ftype = 0; Ftype < Ntype; Ftype++)
     fill(mCurrentFrame.Channels[Ftype].mvpMapPoints.begin(), mCurrentFrame.Channels[Ftype].mvpMapPoints.end(), static_cast<MapPoint *>(NULL));
@@ -1325,6 +1422,7 @@ bool Tracking::TrackWithMotionModelMultiChannels() {
 }
 
 bool Tracking::TrackReferenceKeyFrameMultiChannels() {
+  PROFILE_SCOPE("Tracking::TrackReferenceKeyFrame");
   // Compute Bag of Words vector
   for (int Ftype = 0; Ftype < Ntype; Ftype++) 
     mCurrentFrame.ComputeBoW(Ftype);
@@ -1351,7 +1449,7 @@ bool Tracking::TrackReferenceKeyFrameMultiChannels() {
   for (int Ftype = 0; Ftype < Ntype; Ftype++) 
     mCurrentFrame.Channels[Ftype].mvpMapPoints = vvpMapPointMatches[Ftype];
   
-  mCurrentFrame.SetPose(mLastFrame.mTcw);
+  mCurrentFrame.SetPose(mLastFrame.GetPose());
 
   Optimizer::PoseOptimizationMultiChannels(&mCurrentFrame);
   //Optimizer::PoseOptimizationMultiChannels(&mCurrentFrame);
@@ -1378,140 +1476,157 @@ bool Tracking::TrackReferenceKeyFrameMultiChannels() {
   return nmatchesMap >= 10;
 }
 
-bool Tracking::Relocalization(const int Ftype) {
-  // Compute Bag of Words Vector
-  mCurrentFrame.ComputeBoW(Ftype);
-
+bool Tracking::Relocalization() {
+  PROFILE_SCOPE("Tracking::Relocalization");
   // Relocalization is performed when tracking is lost. Track Lost: Query KeyFrame Database for keyframe candidates for relocalisation
-  vector<KeyFrame *> vpCandidateKFs = mpKeyFrameDB[Ftype]->DetectRelocalizationCandidates(&mCurrentFrame, Ftype); // Multi Channels ??
+  vector<vector<KeyFrame *>> vvpCandidateKFs(Ntype);
+  {
+    TaskGroup channels(mpThreadPool);
+    for (int Ftype = 0; Ftype < Ntype; Ftype++)
+      channels.Run(
+          [this, Ftype, &vvpCandidateKFs] {
+            // Compute Bag of Words Vector
+            mCurrentFrame.ComputeBoW(Ftype);
+            vvpCandidateKFs[Ftype] = mpKeyFrameDB[Ftype]->DetectRelocalizationCandidates(&mCurrentFrame, Ftype);
+          },
+          "Tracking::DetectRelocalizationCandidates");
+  }
+
+  // Candidates of all channels are tried at once
+  vector<pair<int, KeyFrame *>> vCandidates;
+  for (int Ftype = 0; Ftype < Ntype; Ftype++)
+    for (KeyFrame *pKF : vvpCandidateKFs[Ftype])
+      if (pKF->GetMap() == mpMap)
+        vCandidates.push_back(make_pair(Ftype, pKF));
 
-  if (vpCandidateKFs.empty())
+  if (vCandidates.empty())
     return false;
 
-  const int nKFs = vpCandidateKFs.size();
+  while (mvpPnPsolvers.size() < vCandidates.size())
+    mvpPnPsolvers.emplace_back(new PnPsolver());
+
+  // Every candidate scores its hypotheses on its own PoseHypothesis against
+  // the shared current frame. The first one to find a pose supported by
+  // enough inliers publishes it and stops the others.
+  atomic<bool> bMatch(false);
+  int nMatchFtype = -1;
+  PoseHypothesis match;
+  {
+    TaskGroup candidates(mpThreadPool);
+    for (size_t i = 0; i < vCandidates.size(); i++)
+      candidates.Run(
+          [&, i] {
+            PoseHypothesis hypothesis;
+            const int Ftype = vCandidates[i].first;
+            if (!RelocalizeWithCandidate(vCandidates[i].second, Ftype, *mvpPnPsolvers[i], bMatch, hypothesis))
+              return;
+            if (bMatch.exchange(true))
+              return;
+            nMatchFtype = Ftype;
+            match = move(hypothesis);
+          },
+          "Tracking::RelocalizeWithCandidate");
+  }
 
-  // We perform first an ORB matching with each candidate. If enough matches are found we setup a PnP solver
-  Associater associater(0.75, true);
+  if (!bMatch)
+    return false;
 
-  vector<PnPsolver *> vpPnPsolvers;
-  vpPnPsolvers.resize(nKFs);
+  mCurrentFrame.SetPose(match.Tcw);
+  mCurrentFrame.Channels[nMatchFtype].mvpMapPoints.swap(match.vpMapPoints);
+  mCurrentFrame.Channels[nMatchFtype].mvbOutlier.swap(match.vbOutlier);
+  mnLastRelocFrameId = mCurrentFrame.mnId;
+  return true;
+}
 
-  vector<vector<MapPoint *>> vvpMapPointMatches;
-  vvpMapPointMatches.resize(nKFs);
+bool Tracking::RelocalizeWithCandidate(KeyFrame *pKF, const int Ftype, PnPsolver &solver, const atomic<bool> &bStop,
+                                       PoseHypothesis &hypothesis) {
+  if (pKF->isBad() || bStop)
+    return false;
 
-  vector<bool> vbDiscarded;
-  vbDiscarded.resize(nKFs);
+  // We perform first an ORB matching with the candidate. If enough matches are found we setup a PnP solver
+  Associater associater(0.75, true);
+  vector<MapPoint *> vpMapPointMatches;
+  const int nmatches = associater.SearchByBoW(pKF, mCurrentFrame, vpMapPointMatches, Ftype);
+  if (nmatches < 15)
+    return false;
 
-  int nCandidates = 0;
+  solver.Setup(mCurrentFrame, vpMapPointMatches, Ftype);
+  solver.SetRansacParameters(0.99, 10, 300, 4, 0.5, 5.991);
 
-  for (int i = 0; i < nKFs; i++) {
-    KeyFrame *pKF = vpCandidateKFs[i];
-    if (pKF->isBad())
-      vbDiscarded[i] = true;
-    else {
-      int nmatches = associater.SearchByBoW(pKF, mCurrentFrame, vvpMapPointMatches[i], Ftype);
-      if (nmatches < 15) {
-        vbDiscarded[i] = true;
-        continue;
-      } else {
-        PnPsolver *pSolver = new PnPsolver(mCurrentFrame, vvpMapPointMatches[i], Ftype);
-        pSolver->SetRansacParameters(0.99, 10, 300, 4, 0.5, 5.991);
-        vpPnPsolvers[i] = pSolver;
-        nCandidates++;
-      }
-    }
-  }
-
-  // Alternatively perform some iterations of P4P RANSAC Until we found a camera pose supported by enough inliers
-  bool bMatch = false;
+  // Perform P4P RANSAC 5 iterations at a time until we found a camera pose
+  // supported by enough inliers, another candidate did or the solver gives up
   Associater associater2(0.9, true);
+  const int N = mCurrentFrame.Channels[Ftype].N;
+  vector<MapPoint *> &vpMapPoints = hypothesis.vpMapPoints;
+  vector<bool> &vbOutlier = hypothesis.vbOutlier;
+  bool bNoMore = false;
+  while (!bNoMore && !bStop) {
+    vector<bool> vbInliers;
+    int nInliers;
+    cv::Mat Tcw = solver.iterate(5, bNoMore, vbInliers, nInliers);
+
+    // If a Camera Pose is computed, optimize
+    if (Tcw.empty())
+      continue;
 
-  while (nCandidates > 0 && !bMatch) {
-    for (int i = 0; i < nKFs; i++) {
-      if (vbDiscarded[i])
-        continue;
+    // Only the pose and the matches of the channel change per hypothesis
+    hypothesis.Tcw = Tcw;
+    vpMapPoints.assign(N, static_cast<MapPoint *>(NULL));
+    vbOutlier.assign(N, false);
 
-      // Perform 5 Ransac Iterations
-      vector<bool> vbInliers;
-      int nInliers;
-      bool bNoMore;
+    set<MapPoint *> sFound;
 
-      PnPsolver *pSolver = vpPnPsolvers[i];
-      cv::Mat Tcw = pSolver->iterate(5, bNoMore, vbInliers, nInliers);
+    const int np = vbInliers.size();
 
-      // If Ransac reachs max. iterations discard keyframe
-      if (bNoMore) {
-        vbDiscarded[i] = true;
-        nCandidates--;
+    for (int j = 0; j < np; j++) {
+      if (vbInliers[j]) {
+        vpMapPoints[j] = vpMapPointMatches[j];
+        sFound.insert(vpMapPointMatches[j]);
       }
+    }
 
-      // If a Camera Pose is computed, optimize
-      if (!Tcw.empty()) {
-        Tcw.copyTo(mCurrentFrame.mTcw);
-
-        set<MapPoint *> sFound;
-
-        const int np = vbInliers.size();
-
-        for (int j = 0; j < np; j++) {
-          if (vbInliers[j]) {
-            mCurrentFrame.Channels[Ftype].mvpMapPoints[j] = vvpMapPointMatches[i][j];
-            sFound.insert(vvpMapPointMatches[i][j]);
-          } else
-            mCurrentFrame.Channels[Ftype].mvpMapPoints[j] = NULL;
-        }
-
-        int nGood = Optimizer::PoseOptimization(&mCurrentFrame, Ftype);
-
-        if (nGood < 10)
-          continue;
-
-        for (int io = 0; io < mCurrentFrame.Channels[Ftype].N; io++)
-          if (mCurrentFrame.Channels[Ftype].mvbOutlier[io])
-            mCurrentFrame.Channels[Ftype].mvpMapPoints[io] = static_cast<MapPoint *>(NULL);
-
-        // If few inliers, search by projection in a coarse window and optimize again
-        if (nGood < 50) {
-          int nadditional = associater2.SearchByProjection(mCurrentFrame, vpCandidateKFs[i], sFound, 10, 100, Ftype);
-
-          if (nadditional + nGood >= 50) {
-            nGood = Optimizer::PoseOptimization(&mCurrentFrame, Ftype);
+    int nGood = Optimizer::PoseOptimization(mCurrentFrame, hypothesis, Ftype);
 
-            // If many inliers but still not enough, search by projection again in a narrower window the camera has been already optimized with many points
-            if (nGood > 30 && nGood < 50) {
-              sFound.clear();
-              for (int ip = 0; ip < mCurrentFrame.Channels[Ftype].N; ip++)
-                if (mCurrentFrame.Channels[Ftype].mvpMapPoints[ip])
-                  sFound.insert(mCurrentFrame.Channels[Ftype].mvpMapPoints[ip]);
-              nadditional = associater2.SearchByProjection(mCurrentFrame, vpCandidateKFs[i], sFound, 3, 64, Ftype);
+    if (nGood < 10)
+      continue;
 
-              // Final optimization
-              if (nGood + nadditional >= 50) {
-                nGood = Optimizer::PoseOptimization(&mCurrentFrame, Ftype);
+    for (int io = 0; io < N; io++)
+      if (vbOutlier[io])
+        vpMapPoints[io] = static_cast<MapPoint *>(NULL);
 
-                for (int io = 0; io < mCurrentFrame.Channels[Ftype].N; io++)
-                  if (mCurrentFrame.Channels[Ftype].mvbOutlier[io])
-                    mCurrentFrame.Channels[Ftype].mvpMapPoints[io] = NULL;
-              }
-            }
+    // If few inliers, search by projection in a coarse window and optimize again
+    if (nGood < 50) {
+      int nadditional = associater2.SearchByProjection(mCurrentFrame, hypothesis, pKF, sFound, 10, 100, Ftype);
+
+      if (nadditional + nGood >= 50) {
+        nGood = Optimizer::PoseOptimization(mCurrentFrame, hypothesis, Ftype);
+
+        // If many inliers but still not enough, search by projection again in a narrower window the camera has been already optimized with many points
+        if (nGood > 30 && nGood < 50) {
+          sFound.clear();
+          for (int ip = 0; ip < N; ip++)
+            if (vpMapPoints[ip])
+              sFound.insert(vpMapPoints[ip]);
+          nadditional = associater2.SearchByProjection(mCurrentFrame, hypothesis, pKF, sFound, 3, 64, Ftype);
+
+          // Final optimization
+          if (nGood + nadditional >= 50) {
+            nGood = Optimizer::PoseOptimization(mCurrentFrame, hypothesis, Ftype);
+
+            for (int io = 0; io < N; io++)
+              if (vbOutlier[io])
+                vpMapPoints[io] = NULL;
           }
         }
-
-        // If the pose is supported by enough inliers stop ransacs and continue
-        if (nGood >= 50) {
-          bMatch = true;
-          break;
-        }
       }
     }
-  }
 
-  if (!bMatch) {
-    return false;
-  } else {
-    mnLastRelocFrameId = mCurrentFrame.mnId;
-    return true;
+    // If the pose is supported by enough inliers stop ransacs and continue
+    if (nGood >= 50)
+      return true;
   }
+
+  return false;
 }
 
 void Tracking::UpdateLocalKeyFramesMultiChannels() {
@@ -1524,9 +1639,7 @@ void Tracking::UpdateLocalKeyFramesMultiChannels() {
       if (mCurrentFrame.Channels[Ftype].mvpMapPoints[i]) {
         MapPoint *pMP = mCurrentFrame.Channels[Ftype].mvpMapPoints[i];
         if (!pMP->isBad()) {
-          const map<KeyFrame *, size_t> observations = pMP->GetObservations();
-          for (map<KeyFrame *, size_t>::const_iterator it = observations.begin(), itend = observations.end(); it != itend; it++)
-            keyframeCounter[it->first]++;
+          pMP->ForEachObservation([&keyframeCounter](KeyFrame *pKF, size_t) { keyframeCounter[pKF]++; });
         } else {
           mCurrentFrame.Channels[Ftype].mvpMapPoints[i] = NULL;
         }
@@ -1634,6 +1747,7 @@ void Tracking::UpdateLocalPointsMultiChannels() {
 }
 
 void Tracking::SearchLocalPointsMultiChannels() {
+  PROFILE_SCOPE("Tracking::SearchLocalPoints");
   // Do not search map points already matched
   for (int Ftype = 0; Ftype < Ntype; Ftype++) {
     for (vector<MapPoint *>::iterator vit = mCurrentFrame.Channels[Ftype].mvpMapPoints.begin(), vend = mCurrentFrame.Channels[Ftype].mvpMapPoints.end(); vit != vend; vit++) {
@@ -1674,7 +1788,7 @@ void Tracking::SearchLocalPointsMultiChannels() {
     if(mCurrentFrame.mnId<mnLastRelocFrameId+2)
         th=5;
       
-    associater.SearchByProjection(mCurrentFrame, mvpLocalMapPoints, th);
+    associater.SearchByProjection(mCurrentFrame, mvpLocalMapPoints, th, mpThreadPool);
 
     // // NN only matching
     // associater.SearchByNN(mCurrentFrame, mvpLocalMapPoints);
@@ -1682,6 +1796,7 @@ void Tracking::SearchLocalPointsMultiChannels() {
 }
 
 void Tracking::UpdateLocalMapMultiChannels() {
+  PROFILE_SCOPE("Tracking::UpdateLocalMap");
   // This is for visualization
   mpMap->SetReferenceMapPoints(mvpLocalMapPoints);
 
@@ -1692,6 +1807,7 @@ void Tracking::UpdateLocalMapMultiChannels() {
 }
 
 bool Tracking::TrackLocalMapMultiChannels() {
+  PROFILE_SCOPE("Tracking::TrackLocalMap");
 
   UpdateLocalMapMultiChannels();
 
@@ -1765,7 +1881,7 @@ bool Tracking::NeedNewKeyFrameMultiChannels() {
   if (mSensor != System::MONOCULAR) {
     for (int Ftype = 0; Ftype < Ntype; Ftype++) {
       for (int i = 0; i < mCurrentFrame.Channels[Ftype].N; i++) {
-        if (mCurrentFrame.Channels[Ftype].mvDepth[i] > 0 && mCurrentFrame.Channels[Ftype].mvDepth[i] < mThDepth) {
+        if (mCurrentFrame.Channels[Ftype].mpFeatures->mvDepth[i] > 0 && mCurrentFrame.Channels[Ftype].mpFeatures->mvDepth[i] < mThDepth) {
           if (mCurrentFrame.Channels[Ftype].mvpMapPoints[i] && !mCurrentFrame.Channels[Ftype].mvbOutlier[i])
             nTrackedClose++;
           else
@@ -1824,6 +1940,7 @@ bool Tracking::NeedNewKeyFrameMultiChannels() {
 }
 
 void Tracking::CreateNewKeyFrameMultiChannels() {
+  PROFILE_SCOPE("Tracking::CreateNewKeyFrame");
   if (!mpLocalMapper->SetNotStop(true))
     return;
 
@@ -1851,7 +1968,7 @@ void Tracking::CreateNewKeyFrameMultiChannels() {
 
     for (int Ftype = 0; Ftype < Ntype; Ftype++) {
       for (int i = 0; i < mCurrentFrame.Channels[Ftype].N; i++) {
-        float z = mCurrentFrame.Channels[Ftype].mvDepth[i];
+        float z = mCurrentFrame.Channels[Ftype].mpFeatures->mvDepth[i];
         if (z > 0) {
           vDepthIdx[Ftype].push_back(make_pair(z, i));
         }
@@ -1904,6 +2021,7 @@ void Tracking::CreateNewKeyFrameMultiChannels() {
 
   mnLastKeyFrameId = mCurrentFrame.mnId;
   mpLastKeyFrame = pKF;
+  mbEvictionPending = mpMapStore->IsEnabled();
 }
 
 void Tracking::DiscardUnobservedMappoints(Frame &F, const int Ftype) {
@@ -0,0 +1,554 @@
+// Micro-benchmarks of the hot kernels (Google Benchmark).
+//
+// Every benchmark runs on a synthetic, deterministic stereo scene: a blurred
+// noise texture with random shapes, the right image shifted by a constant
+// disparity and a second frame translated by a few pixels. Scenes are
+// parameterised by feature count and image width (4:3), so kernel level
+// changes can be measured without running the full system.
+//
+// The vocabulary is read from $ORB_SLAM2_VOCABULARY, or the installed
+// default, in any of the supported formats.
+
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <set>
+
+#include <benchmark/benchmark.h>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "AKAZEextractor.h"
+#include "Associater.h"
+#include "Frame.h"
+#include "KeyFrame.h"
+#include "KeyFrameDatabase.h"
+#include "Map.h"
+#include "MapPoint.h"
+#include "ORBVocabulary.h"
+#include "ORBextractor.h"
+#include "Optimizer.h"
+#include "PnPsolver.h"
+#include "Sim3Solver.h"
+
+using namespace ::std;
+using namespace ORB_SLAM2;
+
+namespace {
+
+const float kDisparity = 20.0f;
+const float kBaseline = 0.1f;
+const int kDatabaseKeyFrames = 20;
+
+ORBVocabulary *GetVocabulary() {
+  static ORBVocabulary *pVoc = [] {
+    const char *env = getenv("ORB_SLAM2_VOCABULARY");
+    const string path = env ? env : DEFAULT_BINARY_ORB_VOCABULARY;
+    ORBVocabulary *voc = new ORBVocabulary();
+    bool bLoad;
+    if (path.size() > 4 && path.compare(path.size() - 4, 4, ".txt") == 0)
+      bLoad = voc->loadFromTextFile(path);
+    else if (ORBVocabulary::isFlatFile(path))
+      bLoad = voc->loadFromFlatFile(path);
+    else
+      bLoad = voc->loadFromBinaryFile(path);
+    if (!bLoad) {
+      cerr << "Could not load the vocabulary " << path << " (set ORB_SLAM2_VOCABULARY)" << endl;
+      exit(1);
+    }
+    return voc;
+  }();
+  return pVoc;
+}
+
+cv::Mat MakeTexture(int width, int height, uint64_t seed) {
+  cv::RNG rng(seed);
+  cv::Mat im(height, width, CV_8U);
+  rng.fill(im, cv::RNG::UNIFORM, 0, 256);
+  cv::GaussianBlur(im, im, cv::Size(0, 0), 2.0);
+  const int nShapes = width * height / 1500;
+  for (int i = 0; i < nShapes; i++) {
+    const cv::Point p(rng.uniform(0, width), rng.uniform(0, height));
+    const int r = rng.uniform(3, 20);
+    const cv::Scalar c(rng.uniform(0, 256));
+    if (i % 2)
+      cv::rectangle(im, p, p + cv::Point(r, rng.uniform(3, 20)), c, cv::FILLED);
+    else
+      cv::circle(im, p, r, c, cv::FILLED);
+  }
+  return im;
+}
+
+cv::Mat Shift(const cv::Mat &im, float dx) {
+  cv::Mat out;
+  const cv::Mat M = (cv::Mat_<double>(2, 3) << 1, 0, dx, 0, 1, 0);
+  cv::warpAffine(im, out, M, im.size(), cv::INTER_LINEAR, cv::BORDER_REFLECT);
+  return out;
+}
+
+// Stereo keyframe with a MapPoint for every keypoint with depth
+KeyFrame *CreateKeyFrame(Frame &F, Map *pMap, KeyFrameDatabase *pDB) {
+  KeyFrame *pKF = new KeyFrame(F, pMap, vector<KeyFrameDatabase *>(1, pDB), 1);
+  pMap->AddKeyFrame(pKF);
+  for (int i = 0; i < F.Channels[0].N; i++) {
+    if (F.Channels[0].mpFeatures->mvDepth[i] <= 0 || F.Channels[0].mvpMapPoints[i])
+      continue;
+    MapPoint *pMP = new MapPoint(F.UnprojectStereo(i, 0), pKF, pMap, 0);
+    pMP->AddObservation(pKF, i);
+    pKF->AddMapPoint(pMP, i, 0);
+    pMP->ComputeDistinctiveDescriptors();
+    pMP->UpdateNormalAndDepth();
+    pMap->AddMapPoint(pMP);
+    F.Channels[0].mvpMapPoints[i] = pMP;
+  }
+  pKF->ComputeBoW(0);
+  return pKF;
+}
+
+// Two overlapping stereo keyframes sharing map points, plus unrelated
+// keyframes in the database for the relocalization query
+struct Scene {
+  Scene(int nFeatures, int width) : map(1), db(*GetVocabulary()) {
+    const int height = width * 3 / 4;
+    Optimizer::SetNtype(1);
+
+    K = (cv::Mat_<float>(3, 3) << 0.9f * width, 0, width / 2.0f, 0, 0.9f * width, height / 2.0f, 0, 0, 1);
+    distCoef = cv::Mat::zeros(4, 1, CV_32F);
+    bf = K.at<float>(0, 0) * kBaseline;
+
+    orbLeft.reset(new ORBextractor(nFeatures, 1.2f, 8, 20, 7));
+    orbRight.reset(new ORBextractor(nFeatures, 1.2f, 8, 20, 7));
+    akaze.reset(new AKAZEextractor(nFeatures, 1.2f, 8, 20, 7));
+
+    imLeft = MakeTexture(width, height, 1);
+    imRight = Shift(imLeft, -kDisparity);
+    imLeft2 = Shift(imLeft, 4);
+    imRight2 = Shift(imRight, 4);
+
+    // Image bounds and grid are static in Frame, recompute them for this size
+    Frame::mbInitialComputations = true;
+    frame1 = MakeFrame(imLeft, imRight, 0);
+    frame1.SetPose(cv::Mat::eye(4, 4, CV_32F));
+    pKF1 = CreateKeyFrame(frame1, &map, &db);
+    db.add(pKF1, 0);
+
+    // Second frame tracked against the first, then promoted to a keyframe
+    frame2 = MakeFrame(imLeft2, imRight2, 1);
+    frame2.SetPose(cv::Mat::eye(4, 4, CV_32F));
+    Associater associater(0.9f, true);
+    associater.SearchByProjection(frame2, frame1, 15, false, 0);
+    frame2.ComputeBoW(0);
+    trackedFrame2 = Frame(frame2);
+
+    Frame kfFrame(frame2);
+    pKF2 = CreateKeyFrame(kfFrame, &map, &db);
+    for (int i = 0; i < kfFrame.Channels[0].N; i++) {
+      MapPoint *pMP = frame2.Channels[0].mvpMapPoints[i];
+      if (pMP)
+        pMP->AddObservation(pKF2, i);
+    }
+    pKF1->UpdateConnectionsMultiChannels();
+    pKF2->UpdateConnectionsMultiChannels();
+    db.add(pKF2, 0);
+
+    // Query frame for the keyframe based searches: no map points attached
+    for (MapPoint *&pMP : frame2.Channels[0].mvpMapPoints)
+      pMP = nullptr;
+
+    for (int i = 0; i < kDatabaseKeyFrames; i++) {
+      cv::Mat im = MakeTexture(width, height, 100 + i);
+      Frame F = MakeFrame(im, Shift(im, -kDisparity), 2 + i);
+      F.SetPose(cv::Mat::eye(4, 4, CV_32F));
+      db.add(CreateKeyFrame(F, &map, &db), 0);
+    }
+  }
+
+  Frame MakeFrame(const cv::Mat &left, const cv::Mat &right, double t) {
+    return Frame(left, right, t, vector<FeatureExtractor *>(1, orbLeft.get()),
+                 vector<FeatureExtractor *>(1, orbRight.get()), vector<ORBVocabulary *>(1, GetVocabulary()), K,
+                 distCoef, bf, kBaseline * 40, 1);
+  }
+
+  cv::Mat K, distCoef;
+  float bf;
+  unique_ptr<ORBextractor> orbLeft, orbRight;
+  unique_ptr<AKAZEextractor> akaze;
+  cv::Mat imLeft, imRight, imLeft2, imRight2;
+
+  Map map;
+  KeyFrameDatabase db;
+  Frame frame1{1};
+  Frame frame2{1};        // second view, no map points
+  Frame trackedFrame2{1}; // second view matched to frame1's points
+  KeyFrame *pKF1 = nullptr;
+  KeyFrame *pKF2 = nullptr;
+};
+
+// Scenes are built once per parameter set and kept for the whole run
+Scene &GetScene(const benchmark::State &state) {
+  static map<pair<int, int>, unique_ptr<Scene>> mScenes;
+  const pair<int, int> key(state.range(0), state.range(1));
+  unique_ptr<Scene> &pScene = mScenes[key];
+  if (!pScene)
+    pScene.reset(new Scene(key.first, key.second));
+  // Other scenes may have changed the static Frame geometry
+  Frame::mbInitialComputations = true;
+  pScene->MakeFrame(pScene->imLeft, pScene->imRight, 0);
+  return *pScene;
+}
+
+void SceneArgs(benchmark::internal::Benchmark *b) {
+  b->ArgNames({"features", "width"});
+  for (int nFeatures : {500, 1000, 2000})
+    for (int width : {640, 1280})
+      b->Args({nFeatures, width});
+  b->Unit(benchmark::kMicrosecond);
+}
+
+// Feature extraction
+
+void BM_ORBextractor(benchmark::State &state) {
+  Scene &s = GetScene(state);
+  vector<cv::KeyPoint> vKeys;
+  cv::Mat desc;
+  for (auto _ : state) {
+    (*s.orbLeft)(s.imLeft, cv::Mat(), vKeys, desc);
+    benchmark::DoNotOptimize(vKeys.data());
+  }
+  state.counters["keypoints"] = vKeys.size();
+}
+BENCHMARK(BM_ORBextractor)->Apply(SceneArgs);
+
+void BM_AKAZEextractor(benchmark::State &state) {
+  Scene &s = GetScene(state);
+  vector<cv::KeyPoint> vKeys;
+  cv::Mat desc;
+  for (auto _ : state) {
+    (*s.akaze)(s.imLeft, cv::Mat(), vKeys, desc);
+    benchmark::DoNotOptimize(vKeys.data());
+  }
+  state.counters["keypoints"] = vKeys.size();
+}
+BENCHMARK(BM_AKAZEextractor)->Apply(SceneArgs);
+
+// Descriptor distance, all pairs of the first 256 descriptors
+
+void BM_DescriptorDistance(benchmark::State &state) {
+  Scene &s = GetScene(state);
+  const cv::Mat &D = s.frame1.Channels[0].mpFeatures->mDescriptors;
+  const int n = min(D.rows, 256);
+  for (auto _ : state) {
+    int sum = 0;
+    for (int i = 0; i < n; i++)
+      for (int j = 0; j < n; j++)
+        sum += Associater::DescriptorDistance(D.row(i), D.row(j));
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * n * n);
+}
+BENCHMARK(BM_DescriptorDistance)->Apply(SceneArgs);
+
+// Matching
+
+void BM_SearchByProjection_LastFrame(benchmark::State &state) {
+  Scene &s = GetScene(state);
+  Associater associater(0.9f, true);
+  int nMatches = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    Frame F(s.frame2);
+    state.ResumeTiming();
+    nMatches = associater.SearchByProjection(F, s.frame1, 15, false, 0);
+  }
+  state.counters["matches"] = nMatches;
+}
+BENCHMARK(BM_SearchByProjection_LastFrame)->Apply(SceneArgs);
+
+void BM_SearchByProjection_LocalMap(benchmark::State &state) {
+  Scene &s = GetScene(state);
+  const vector<MapPoint *> vpLocalMapPoints = s.map.GetAllMapPoints();
+  Associater associater(0.8f);
+  int nMatches = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    Frame F(s.frame2);
+    for (MapPoint *pMP : vpLocalMapPoints)
+      F.isInFrustum(pMP, 0.5);
+    state.ResumeTiming();
+    nMatches = associater.SearchByProjection(F, vpLocalMapPoints, 3);
+  }
+  state.counters["matches"] = nMatches;
+}
+BENCHMARK(BM_SearchByProjection_LocalMap)->Apply(SceneArgs);
+
+void BM_SearchByProjection_LocalMapParallel(benchmark::State &state) {
+  Scene &s = GetScene(state);
+  static ThreadPool pool(0);
+  const vector<MapPoint *> vpLocalMapPoints = s.map.GetAllMapPoints();
+  Associater associater(0.8f);
+  int nMatches = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    Frame F(s.frame2);
+    for (MapPoint *pMP : vpLocalMapPoints)
+      F.isInFrustum(pMP, 0.5);
+    state.ResumeTiming();
+    nMatches = associater.SearchByProjection(F, vpLocalMapPoints, 3, &pool);
+  }
+  state.counters["matches"] = nMatches;
+}
+BENCHMARK(BM_SearchByProjection_LocalMapParallel)->Apply(SceneArgs);
+
+void BM_SearchByProjection_KeyFrame(benchmark::State &state) {
+  Scene &s = GetScene(state);
+  Associater associater(0.9f, true);
+  const set<MapPoint *> sAlreadyFound;
+  int nMatches = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    Frame F(s.frame2);
+    state.ResumeTiming();
+    nMatches = associater.SearchByProjection(F, s.pKF1, sAlreadyFound, 10, 100, 0);
+  }
+  state.counters["matches"] = nMatches;
+}
+BENCHMARK(BM_SearchByProjection_KeyFrame)->Apply(SceneArgs);
+
+void BM_SearchByProjection_Sim3(benchmark::State &state) {
+  Scene &s = GetScene(state);
+  const vector<MapPoint *> vpPoints = s.pKF1->GetMapPointMatches(0);
+  const cv::Mat Scw = s.pKF2->GetPose();
+  Associater associater(0.75f, true);
+  int nMatches = 0;
+  for (auto _ : state) {
+    vector<MapPoint *> vpMatched(s.pKF2->Channels[0].N, static_cast<MapPoint *>(NULL));
+    nMatches = associater.SearchByProjection(s.pKF2, Scw, vpPoints, vpMatched, 10, 0);
+  }
+  state.counters["matches"] = nMatches;
+}
+BENCHMARK(BM_SearchByProjection_Sim3)->Apply(SceneArgs);
+
+void BM_SearchByBoW_KeyFrameFrame(benchmark::State &state) {
+  Scene &s = GetScene(state);
+  Associater associater(0.7f, true);
+  vector<MapPoint *> vpMatches;
+  int nMatches = 0;
+  for (auto _ : state)
+    nMatches = associater.SearchByBoW(s.pKF1, s.frame2, vpMatches, 0);
+  state.counters["matches"] = nMatches;
+}
+BENCHMARK(BM_SearchByBoW_KeyFrameFrame)->Apply(SceneArgs);
+
+void BM_SearchByBoW_KeyFrames(benchmark::State &state) {
+  Scene &s = GetScene(state);
+  Associater associater(0.75f, true);
+  vector<MapPoint *> vpMatches12;
+  int nMatches = 0;
+  for (auto _ : state)
+    nMatches = associater.SearchByBoW(s.pKF1, s.pKF2, vpMatches12, 0);
+  state.counters["matches"] = nMatches;
+}
+BENCHMARK(BM_SearchByBoW_KeyFrames)->Apply(SceneArgs);
+
+// Frame
+
+void BM_ComputeStereoMatches(benchmark::State &state) {
+  Scene &s = GetScene(state);
+  Frame F(s.frame1);
+  FeatureStore features(*F.Channels[0].mpFeatures);
+  for (auto _ : state)
+    F.ComputeStereoMatches(features, 0);
+}
+BENCHMARK(BM_ComputeStereoMatches)->Apply(SceneArgs);
+
+void BM_GetFeaturesInArea(benchmark::State &state) {
+  Scene &s = GetScene(state);
+  const vector<cv::KeyPoint> &vKeys = s.frame2.Channels[0].mpFeatures->mvKeysUn;
+  size_t nFound = 0;
+  for (auto _ : state) {
+    for (const cv::KeyPoint &kp : vKeys)
+      nFound += s.frame2.GetFeaturesInArea(0, kp.pt.x, kp.pt.y, 15).size();
+  }
+  benchmark::DoNotOptimize(nFound);
+  state.SetItemsProcessed(state.iterations() * vKeys.size());
+}
+BENCHMARK(BM_GetFeaturesInArea)->Apply(SceneArgs);
+
+void BM_SearchArea(benchmark::State &state) {
+  Scene &s = GetScene(state);
+  const FeatureStore &query = *s.frame1.Channels[0].mpFeatures;
+  const FeatureStore &features = *s.frame2.Channels[0].mpFeatures;
+  int nMatched = 0;
+  for (auto _ : state) {
+    for (size_t i = 0; i < query.mvKeysUn.size(); i++) {
+      const AreaMatch match = features.SearchArea(query.mDescriptors.row(i), query.mvX[i], query.mvY[i], 15,
+                                                  query.mvOctave[i] - 1, query.mvOctave[i] + 1,
+                                                  [](size_t) { return true; });
+      nMatched += match.bestDist <= Associater::TH_HIGH;
+    }
+  }
+  benchmark::DoNotOptimize(nMatched);
+  state.SetItemsProcessed(state.iterations() * query.mvKeysUn.size());
+}
+BENCHMARK(BM_SearchArea)->Apply(SceneArgs);
+
+// Reads of every map point: lock-free snapshot against the locking getters
+void BM_MapPointGetState(benchmark::State &state) {
+  Scene &s = GetScene(state);
+  const vector<MapPoint *> vpMPs = s.map.GetAllMapPoints();
+  MapPointState mpState;
+  float sum = 0;
+  for (auto _ : state) {
+    for (MapPoint *pMP : vpMPs) {
+      pMP->GetState(mpState);
+      sum += mpState.mWorldPos[2] + mpState.mNormal[2] + mpState.mDescriptor[0];
+    }
+  }
+  benchmark::DoNotOptimize(sum);
+  state.SetItemsProcessed(state.iterations() * vpMPs.size());
+}
+BENCHMARK(BM_MapPointGetState)->Apply(SceneArgs);
+
+void BM_MapPointGetters(benchmark::State &state) {
+  Scene &s = GetScene(state);
+  const vector<MapPoint *> vpMPs = s.map.GetAllMapPoints();
+  float sum = 0;
+  for (auto _ : state) {
+    for (MapPoint *pMP : vpMPs)
+      sum += pMP->GetWorldPos().at<float>(2) + pMP->GetNormal().at<float>(2) + pMP->GetDescriptor().data[0];
+  }
+  benchmark::DoNotOptimize(sum);
+  state.SetItemsProcessed(state.iterations() * vpMPs.size());
+}
+BENCHMARK(BM_MapPointGetters)->Apply(SceneArgs);
+
+// Covisibility update of the second keyframe and the ordered view read after it
+void BM_UpdateConnections(benchmark::State &state) {
+  Scene &s = GetScene(state);
+  size_t nConnected = 0;
+  for (auto _ : state) {
+    s.pKF2->UpdateConnectionsMultiChannels();
+    nConnected += s.pKF2->GetBestCovisibilityKeyFrames(10).size();
+  }
+  benchmark::DoNotOptimize(nConnected);
+}
+BENCHMARK(BM_UpdateConnections)->Apply(SceneArgs);
+
+// Place recognition
+
+void BM_VocabularyTransform(benchmark::State &state) {
+  Scene &s = GetScene(state);
+  const cv::Mat &D = s.frame1.Channels[0].mpFeatures->mDescriptors;
+  vector<cv::Mat> vDesc;
+  for (int i = 0; i < D.rows; i++)
+    vDesc.push_back(D.row(i));
+  DBoW2::BowVector bow;
+  DBoW2::FeatureVector fv;
+  for (auto _ : state)
+    GetVocabulary()->transform(vDesc, bow, fv, 4);
+  state.SetItemsProcessed(state.iterations() * vDesc.size());
+}
+BENCHMARK(BM_VocabularyTransform)->Apply(SceneArgs);
+
+void BM_DetectRelocalizationCandidates(benchmark::State &state) {
+  Scene &s = GetScene(state);
+  size_t nCandidates = 0;
+  for (auto _ : state)
+    nCandidates = s.db.DetectRelocalizationCandidates(&s.frame2, 0).size();
+  state.counters["candidates"] = nCandidates;
+}
+BENCHMARK(BM_DetectRelocalizationCandidates)->Apply(SceneArgs);
+
+void BM_DetectLoopCandidates(benchmark::State &state) {
+  Scene &s = GetScene(state);
+  size_t nCandidates = 0;
+  for (auto _ : state)
+    nCandidates = s.db.DetectLoopCandidates(s.pKF2, 0, 0).size();
+  state.counters["candidates"] = nCandidates;
+}
+BENCHMARK(BM_DetectLoopCandidates)->Apply(SceneArgs);
+
+// Geometric solvers
+
+void BM_PnPsolver(benchmark::State &state) {
+  Scene &s = GetScene(state);
+  Associater associater(0.75f, true);
+  vector<MapPoint *> vpMatches;
+  associater.SearchByBoW(s.pKF1, s.frame2, vpMatches, 0);
+  for (auto _ : state) {
+    PnPsolver solver(s.frame2, vpMatches, 0);
+    solver.SetRansacParameters(0.99, 10, 300, 4, 0.5, 5.991);
+    bool bNoMore;
+    vector<bool> vbInliers;
+    int nInliers;
+    cv::Mat Tcw = solver.iterate(5, bNoMore, vbInliers, nInliers);
+    benchmark::DoNotOptimize(Tcw.data);
+  }
+}
+BENCHMARK(BM_PnPsolver)->Apply(SceneArgs);
+
+// Same problem on a solver reused as in relocalization
+void BM_PnPsolverReused(benchmark::State &state) {
+  Scene &s = GetScene(state);
+  Associater associater(0.75f, true);
+  vector<MapPoint *> vpMatches;
+  associater.SearchByBoW(s.pKF1, s.frame2, vpMatches, 0);
+  PnPsolver solver;
+  for (auto _ : state) {
+    solver.Setup(s.frame2, vpMatches, 0);
+    solver.SetRansacParameters(0.99, 10, 300, 4, 0.5, 5.991);
+    bool bNoMore;
+    vector<bool> vbInliers;
+    int nInliers;
+    cv::Mat Tcw = solver.iterate(5, bNoMore, vbInliers, nInliers);
+    benchmark::DoNotOptimize(Tcw.data);
+  }
+}
+BENCHMARK(BM_PnPsolverReused)->Apply(SceneArgs);
+
+void BM_Sim3Solver(benchmark::State &state) {
+  Scene &s = GetScene(state);
+  Associater associater(0.75f, true);
+  vector<MapPoint *> vpMatches12;
+  associater.SearchByBoW(s.pKF1, s.pKF2, vpMatches12, 0);
+  for (auto _ : state) {
+    Sim3Solver solver(0, s.pKF1, s.pKF2, vpMatches12, true);
+    solver.SetRansacParameters(0.99, 20, 300);
+    bool bNoMore;
+    vector<bool> vbInliers;
+    int nInliers;
+    cv::Mat S12 = solver.iterate(5, bNoMore, vbInliers, nInliers);
+    benchmark::DoNotOptimize(S12.data);
+  }
+}
+BENCHMARK(BM_Sim3Solver)->Apply(SceneArgs);
+
+// Optimization
+
+void BM_PoseOptimization(benchmark::State &state) {
+  Scene &s = GetScene(state);
+  int nInliers = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    Frame F(s.trackedFrame2);
+    F.SetPose(cv::Mat::eye(4, 4, CV_32F));
+    state.ResumeTiming();
+    nInliers = Optimizer::PoseOptimization(&F, 0);
+  }
+  state.counters["inliers"] = nInliers;
+}
+BENCHMARK(BM_PoseOptimization)->Apply(SceneArgs);
+
+void BM_LocalBundleAdjustment(benchmark::State &state) {
+  Scene &s = GetScene(state);
+  for (auto _ : state) {
+    bool bAbort = false;
+    Optimizer::LocalBundleAdjustment(s.pKF2, &bAbort, &s.map);
+  }
+}
+BENCHMARK(BM_LocalBundleAdjustment)->Apply(SceneArgs);
+
+} // namespace
+
+BENCHMARK_MAIN();
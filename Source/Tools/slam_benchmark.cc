@@ -0,0 +1,408 @@
+// Headless, deterministic benchmark of the full pipeline.
+//
+// Runs System without the viewer over a KITTI, TUM or EuRoC sequence, either
+// as fast as possible or at a fixed rate, and writes a JSON report (frames
+// per second, per-frame latency percentiles, map size, peak RSS and ATE
+// against ground truth) so results can be compared across commits.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+#include <sys/resource.h>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+#include <opencv2/core/core.hpp>
+
+#include <ImageSource.h>
+#include <System.h>
+
+using namespace ::std;
+
+namespace {
+
+struct Options {
+  string settings;
+  string dataset; // kitti | tum | euroc
+  string sequence;
+  string sensor; // mono | stereo | rgbd
+  string association;
+  string groundtruth;
+  string gtFormat; // tum | kitti | euroc, defaults to the dataset's
+  string output;
+  string saveMap;
+  string loadMap; // localization only in the loaded map
+  double rate = 0;        // frames per second, 0 = as fast as possible
+  bool syncMapping = false; // wait for LocalMapping before each frame
+  bool preload = false;     // decode every image before the timed run
+  int maxFrames = 0;
+};
+
+void Usage() {
+  cerr << "Usage: slam_benchmark --settings file.yaml --dataset kitti|tum|euroc --sequence path" << endl
+       << "         [--sensor mono|stereo|rgbd] [--association file] [--groundtruth file]" << endl
+       << "         [--gt-format tum|kitti|euroc] [--rate fps] [--sync-mapping] [--preload]" << endl
+       << "         [--max-frames n] [--save-map file] [--load-map file] [--output report.json]" << endl;
+}
+
+bool ParseArgs(int argc, char **argv, Options &opt) {
+  for (int i = 1; i < argc; i++) {
+    const string arg = argv[i];
+    auto value = [&](string &out) {
+      if (i + 1 >= argc)
+        return false;
+      out = argv[++i];
+      return true;
+    };
+    string v;
+    if (arg == "--settings" && value(opt.settings)) {
+    } else if (arg == "--dataset" && value(opt.dataset)) {
+    } else if (arg == "--sequence" && value(opt.sequence)) {
+    } else if (arg == "--sensor" && value(opt.sensor)) {
+    } else if (arg == "--association" && value(opt.association)) {
+    } else if (arg == "--groundtruth" && value(opt.groundtruth)) {
+    } else if (arg == "--gt-format" && value(opt.gtFormat)) {
+    } else if (arg == "--output" && value(opt.output)) {
+    } else if (arg == "--save-map" && value(opt.saveMap)) {
+    } else if (arg == "--load-map" && value(opt.loadMap)) {
+    } else if (arg == "--rate" && value(v)) {
+      opt.rate = stod(v);
+    } else if (arg == "--max-frames" && value(v)) {
+      opt.maxFrames = stoi(v);
+    } else if (arg == "--sync-mapping") {
+      opt.syncMapping = true;
+    } else if (arg == "--preload") {
+      opt.preload = true;
+    } else {
+      cerr << "Unknown or incomplete argument " << arg << endl;
+      return false;
+    }
+  }
+
+  if (opt.settings.empty() || opt.dataset.empty() || opt.sequence.empty())
+    return false;
+  if (opt.sensor.empty())
+    opt.sensor = opt.dataset == "tum" ? "rgbd" : "stereo";
+  if (opt.gtFormat.empty())
+    opt.gtFormat = opt.dataset;
+  return true;
+}
+
+// Ground truth positions, keyed by timestamp
+
+bool LoadGroundTruth(const string &filename, const string &format, const ORB_SLAM2::ImageSequence &seq, vector<double> &vT,
+                     vector<Eigen::Vector3d> &vP) {
+  ifstream f(filename);
+  if (!f.is_open())
+    return false;
+  string line;
+  size_t idx = 0;
+  while (getline(f, line)) {
+    if (line.empty() || line[0] == '#')
+      continue;
+    replace(line.begin(), line.end(), ',', ' ');
+    stringstream ss(line);
+    if (format == "kitti") {
+      // 3x4 row major Twc per frame, matched to the frame timestamps
+      double m[12];
+      for (double &x : m)
+        ss >> x;
+      if (idx >= seq.size())
+        break;
+      vT.push_back(seq.mvTimestamps[idx++]);
+      vP.emplace_back(m[3], m[7], m[11]);
+    } else {
+      double t, x, y, z;
+      ss >> t >> x >> y >> z;
+      vT.push_back(format == "euroc" ? t / 1e9 : t);
+      vP.emplace_back(x, y, z);
+    }
+  }
+  return !vT.empty();
+}
+
+struct AteResult {
+  size_t nMatched = 0;
+  double rmse = 0, mean = 0, median = 0, max = 0;
+};
+
+// Absolute trajectory error after aligning the estimate to the ground truth
+// (SE3, or Sim3 for monocular where the scale is unobservable)
+bool ComputeATE(const vector<double> &vTEst, const vector<cv::Mat> &vTwc, const vector<double> &vTGt,
+                const vector<Eigen::Vector3d> &vPGt, bool bScale, AteResult &res) {
+  const double maxDt = 0.02;
+  vector<Eigen::Vector3d> vEst, vGt;
+  for (size_t i = 0; i < vTEst.size(); i++) {
+    auto it = lower_bound(vTGt.begin(), vTGt.end(), vTEst[i]);
+    size_t best = vTGt.size();
+    double bestDt = maxDt;
+    if (it != vTGt.end() && *it - vTEst[i] <= bestDt) {
+      best = it - vTGt.begin();
+      bestDt = *it - vTEst[i];
+    }
+    if (it != vTGt.begin() && vTEst[i] - *(it - 1) <= bestDt)
+      best = (it - 1) - vTGt.begin();
+    if (best == vTGt.size())
+      continue;
+    const cv::Mat &T = vTwc[i];
+    vEst.emplace_back(T.at<float>(0, 3), T.at<float>(1, 3), T.at<float>(2, 3));
+    vGt.push_back(vPGt[best]);
+  }
+
+  if (vEst.size() < 3)
+    return false;
+
+  Eigen::Matrix3Xd src(3, vEst.size()), dst(3, vGt.size());
+  for (size_t i = 0; i < vEst.size(); i++) {
+    src.col(i) = vEst[i];
+    dst.col(i) = vGt[i];
+  }
+  const Eigen::Matrix4d S = Eigen::umeyama(src, dst, bScale);
+
+  vector<double> vErr(vEst.size());
+  double sumSq = 0, sum = 0;
+  for (size_t i = 0; i < vEst.size(); i++) {
+    const Eigen::Vector3d p = S.topLeftCorner<3, 3>() * src.col(i) + S.topRightCorner<3, 1>();
+    vErr[i] = (p - dst.col(i)).norm();
+    sumSq += vErr[i] * vErr[i];
+    sum += vErr[i];
+  }
+  sort(vErr.begin(), vErr.end());
+
+  res.nMatched = vErr.size();
+  res.rmse = sqrt(sumSq / vErr.size());
+  res.mean = sum / vErr.size();
+  res.median = vErr[vErr.size() / 2];
+  res.max = vErr.back();
+  return true;
+}
+
+double Percentile(const vector<double> &vSorted, double p) {
+  if (vSorted.empty())
+    return 0;
+  return vSorted[min(vSorted.size() - 1, (size_t)(p * vSorted.size()))];
+}
+
+// Quoted JSON string, paths may hold quotes, backslashes or control characters
+string JsonString(const string &s) {
+  ostringstream os;
+  os << '"';
+  for (char c : s) {
+    if (c == '"' || c == '\\')
+      os << '\\' << c;
+    else if ((unsigned char)c < 0x20)
+      os << "\\u" << hex << setw(4) << setfill('0') << (int)(unsigned char)c << dec << setfill(' ');
+    else
+      os << c;
+  }
+  os << '"';
+  return os.str();
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Options opt;
+  if (!ParseArgs(argc, argv, opt)) {
+    Usage();
+    return 1;
+  }
+
+  ORB_SLAM2::System::eSensor sensor;
+  if (opt.sensor == "mono")
+    sensor = ORB_SLAM2::System::MONOCULAR;
+  else if (opt.sensor == "stereo")
+    sensor = ORB_SLAM2::System::STEREO;
+  else if (opt.sensor == "rgbd")
+    sensor = ORB_SLAM2::System::RGBD;
+  else {
+    cerr << "Unknown sensor " << opt.sensor << endl;
+    return 1;
+  }
+
+  ORB_SLAM2::ImageSequence seq;
+  bool bLoaded = false;
+  if (opt.dataset == "kitti")
+    bLoaded = sensor != ORB_SLAM2::System::RGBD && seq.LoadKITTI(opt.sequence, sensor == ORB_SLAM2::System::STEREO);
+  else if (opt.dataset == "tum")
+    bLoaded = sensor != ORB_SLAM2::System::STEREO &&
+              (sensor == ORB_SLAM2::System::MONOCULAR || !opt.association.empty()) &&
+              seq.LoadTUM(opt.sequence, sensor == ORB_SLAM2::System::RGBD ? opt.association : string());
+  else if (opt.dataset == "euroc")
+    bLoaded = sensor != ORB_SLAM2::System::RGBD && seq.LoadEuRoC(opt.sequence, sensor == ORB_SLAM2::System::STEREO);
+
+  if (!bLoaded) {
+    cerr << "Could not read a " << opt.sensor << " " << opt.dataset << " sequence from " << opt.sequence << endl;
+    return 1;
+  }
+
+  if (opt.maxFrames > 0)
+    seq.Truncate(opt.maxFrames);
+  const size_t nFrames = seq.size();
+
+  // Rectification maps are only present in the settings of raw stereo
+  // datasets (EuRoC)
+  ORB_SLAM2::ImageSource source(seq);
+  if (sensor == ORB_SLAM2::System::STEREO)
+    source.SetRectification(opt.settings);
+
+  vector<ORB_SLAM2::ImageFrame> vPreloaded;
+  if (opt.preload) {
+    cout << "Preloading " << nFrames << " frames ..." << endl;
+    vPreloaded.reserve(nFrames);
+    for (size_t i = 0; i < nFrames; i++)
+      vPreloaded.push_back(source.Load(i));
+  }
+
+  ORB_SLAM2::System SLAM(opt.settings, sensor, false);
+
+  double mapLoadS = 0;
+  if (!opt.loadMap.empty()) {
+    const chrono::steady_clock::time_point t1 = chrono::steady_clock::now();
+    if (!SLAM.LoadMap(opt.loadMap)) {
+      SLAM.Shutdown();
+      return 1;
+    }
+    mapLoadS = chrono::duration<double>(chrono::steady_clock::now() - t1).count();
+    SLAM.ActivateLocalizationMode();
+  }
+
+  vector<double> vLatencyMs;
+  vLatencyMs.reserve(nFrames);
+  size_t nLost = 0;
+  long firstTracked = -1;
+  bool bFailed = false;
+
+  {
+    if (!opt.preload)
+      source.Start();
+
+    const chrono::steady_clock::time_point tStart = chrono::steady_clock::now();
+    chrono::steady_clock::time_point tNext = tStart;
+    for (size_t i = 0; i < nFrames; i++) {
+      ORB_SLAM2::ImageFrame fd;
+      if (opt.preload)
+        fd = vPreloaded[i];
+      else
+        source.Next(fd);
+      if (!fd.valid) {
+        cerr << "Failed to load frame " << i << " (" << seq.mvImage0[i] << ")" << endl;
+        bFailed = true;
+        break;
+      }
+
+      if (opt.syncMapping)
+        SLAM.WaitForLocalMapping();
+
+      if (opt.rate > 0) {
+        this_thread::sleep_until(tNext);
+        tNext += chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(1.0 / opt.rate));
+      }
+
+      const chrono::steady_clock::time_point t1 = chrono::steady_clock::now();
+      if (sensor == ORB_SLAM2::System::STEREO)
+        SLAM.TrackStereo(fd.im0, fd.im1, fd.timestamp);
+      else if (sensor == ORB_SLAM2::System::RGBD)
+        SLAM.TrackRGBD(fd.im0, fd.im1, fd.timestamp);
+      else
+        SLAM.TrackMonocular(fd.im0, fd.timestamp);
+      const chrono::steady_clock::time_point t2 = chrono::steady_clock::now();
+
+      vLatencyMs.push_back(chrono::duration<double, milli>(t2 - t1).count());
+      if (SLAM.GetTrackingState() == ORB_SLAM2::Tracking::LOST)
+        nLost++;
+      else if (firstTracked < 0 && SLAM.GetTrackingState() == ORB_SLAM2::Tracking::OK)
+        firstTracked = i;
+
+      if (opt.preload)
+        vPreloaded[i] = ORB_SLAM2::ImageFrame();
+    }
+
+    if (opt.syncMapping)
+      SLAM.WaitForLocalMapping();
+
+    const double wallS = chrono::duration<double>(chrono::steady_clock::now() - tStart).count();
+    source.Stop();
+
+    SLAM.Shutdown();
+
+    if (!opt.saveMap.empty() && !SLAM.SaveMap(opt.saveMap))
+      cerr << "Could not save the map to " << opt.saveMap << endl;
+
+    vector<double> vTEst;
+    vector<cv::Mat> vTwc;
+    SLAM.GetCameraTrajectory(vTEst, vTwc);
+
+    AteResult ate;
+    bool bAte = false;
+    if (!opt.groundtruth.empty()) {
+      vector<double> vTGt;
+      vector<Eigen::Vector3d> vPGt;
+      if (LoadGroundTruth(opt.groundtruth, opt.gtFormat, seq, vTGt, vPGt))
+        bAte = ComputeATE(vTEst, vTwc, vTGt, vPGt, sensor == ORB_SLAM2::System::MONOCULAR, ate);
+      else
+        cerr << "Could not read ground truth " << opt.groundtruth << endl;
+    }
+
+    vector<double> vSorted = vLatencyMs;
+    sort(vSorted.begin(), vSorted.end());
+    double totalMs = 0;
+    for (double d : vSorted)
+      totalMs += d;
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    const double peakRssMb = usage.ru_maxrss / 1024.0; // ru_maxrss is in KB on Linux
+
+    ostringstream js;
+    js << fixed << setprecision(4);
+    js << "{\n"
+       << "  \"dataset\": " << JsonString(opt.dataset) << ",\n"
+       << "  \"sequence\": " << JsonString(opt.sequence) << ",\n"
+       << "  \"sensor\": " << JsonString(opt.sensor) << ",\n"
+       << "  \"settings\": " << JsonString(opt.settings) << ",\n"
+       << "  \"rate\": " << opt.rate << ",\n"
+       << "  \"sync_mapping\": " << (opt.syncMapping ? "true" : "false") << ",\n"
+       << "  \"preload\": " << (opt.preload ? "true" : "false") << ",\n"
+       << "  \"completed\": " << (bFailed ? "false" : "true") << ",\n"
+       << "  \"frames\": " << vLatencyMs.size() << ",\n"
+       << "  \"frames_lost\": " << nLost << ",\n"
+       << "  \"first_tracked_frame\": " << firstTracked << ",\n"
+       << "  \"frames_in_trajectory\": " << vTwc.size() << ",\n"
+       << "  \"wall_time_s\": " << wallS << ",\n"
+       << "  \"fps\": " << (wallS > 0 ? vLatencyMs.size() / wallS : 0.0) << ",\n"
+       << "  \"latency_ms\": {\"mean\": " << (vSorted.empty() ? 0.0 : totalMs / vSorted.size())
+       << ", \"p50\": " << Percentile(vSorted, 0.5) << ", \"p90\": " << Percentile(vSorted, 0.9)
+       << ", \"p99\": " << Percentile(vSorted, 0.99) << ", \"max\": " << (vSorted.empty() ? 0.0 : vSorted.back())
+       << "},\n"
+       << "  \"keyframes\": " << SLAM.KeyFramesInMap() << ",\n"
+       << "  \"map_points\": " << SLAM.MapPointsInMap() << ",\n"
+       << "  \"peak_rss_mb\": " << peakRssMb << ",\n";
+    if (!opt.loadMap.empty())
+      js << "  \"map_load_s\": " << mapLoadS << ",\n";
+    if (bAte)
+      js << "  \"ate\": {\"matched\": " << ate.nMatched << ", \"rmse\": " << ate.rmse << ", \"mean\": " << ate.mean
+         << ", \"median\": " << ate.median << ", \"max\": " << ate.max << ", \"scale_aligned\": "
+         << (sensor == ORB_SLAM2::System::MONOCULAR ? "true" : "false") << "}\n";
+    else
+      js << "  \"ate\": null\n";
+    js << "}\n";
+
+    if (opt.output.empty()) {
+      cout << js.str();
+    } else {
+      ofstream f(opt.output);
+      f << js.str();
+      cout << "Benchmark report saved to " << opt.output << endl;
+    }
+  }
+
+  return bFailed ? 2 : 0;
+}
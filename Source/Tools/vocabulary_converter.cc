@@ -0,0 +1,64 @@
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include "ORBVocabulary.h"
+
+using namespace ::std;
+
+static bool has_suffix(const string &str, const string &suffix) {
+  return str.size() >= suffix.size() && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+int main(int argc, char **argv) {
+  if (argc != 3) {
+    cerr << endl
+         << "Usage: " << argv[0] << " input_vocabulary(.txt|.bin) output_vocabulary" << endl
+         << "Converts an ORB vocabulary to the flat, memory-mapped format." << endl;
+    return 1;
+  }
+
+  const string strInput = argv[1];
+  const string strOutput = argv[2];
+
+  ORB_SLAM2::ORBVocabulary voc;
+
+  auto t0 = chrono::steady_clock::now();
+  bool bLoad = false;
+  if (has_suffix(strInput, ".txt"))
+    bLoad = voc.loadFromTextFile(strInput);
+  else
+    bLoad = voc.loadFromBinaryFile(strInput);
+
+  if (!bLoad) {
+    cerr << "Failed to load vocabulary from " << strInput << endl;
+    return 1;
+  }
+  auto t1 = chrono::steady_clock::now();
+  cout << "Loaded " << strInput << " (" << voc.size() << " words) in "
+       << chrono::duration<double>(t1 - t0).count() << "s" << endl;
+
+  if (!voc.saveToFlatFile(strOutput)) {
+    cerr << "Failed to write " << strOutput << endl;
+    return 1;
+  }
+
+  // Reload and check the result, including the payload checksum
+  ORB_SLAM2::ORBVocabulary flat;
+  auto t2 = chrono::steady_clock::now();
+  if (!flat.loadFromFlatFile(strOutput, true)) {
+    cerr << "Written file " << strOutput << " does not load back" << endl;
+    return 1;
+  }
+  auto t3 = chrono::steady_clock::now();
+
+  if (flat.size() != voc.size()) {
+    cerr << "Word count mismatch after conversion" << endl;
+    return 1;
+  }
+
+  cout << "Saved " << strOutput << ", mapped back in "
+       << chrono::duration<double, milli>(t3 - t2).count() << "ms" << endl;
+
+  return 0;
+}